@@ -0,0 +1,169 @@
+//Benchmark of batched compiles ([build] batch) on a project of many tiny modules.
+//
+//  make && make bench && ./bin/bench_batch [files] [batch]
+//
+//A synthetic project is generated in bench_batch_project/ (files modules that
+//use nothing plus a main program using all of them, the worst case for the
+//startup cost of the compiler), then built from scratch with `fortuna build -j`
+//once without batching and once with the given batch size (default 16).
+//fortuna and bin/maketopologicf90 are taken from the repository root, so run
+//it from there.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#define MKDIR(p) _mkdir(p)
+#define SCANNER_SRC "bin\\maketopologicf90.exe"
+#define FORTUNA_EXE "..\\fortuna.exe"
+static double now_seconds(void) {
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+}
+#else
+#include <sys/stat.h>
+#include <time.h>
+#define MKDIR(p) mkdir(p, 0755)
+#define SCANNER_SRC "bin/maketopologicf90"
+#define FORTUNA_EXE "../fortuna"
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+#endif
+
+#define PROJECT "bench_batch_project"
+
+static int write_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return -1;
+    }
+    fputs(text, f);
+    fclose(f);
+    return 0;
+}
+
+static int copy_file(const char *src, const char *dst) {
+    FILE *in  = fopen(src, "rb");
+    FILE *out = in ? fopen(dst, "wb") : NULL;
+    if (!in || !out) {
+        fprintf(stderr, "Could not copy %s to %s (run make first)\n", src, dst);
+        if (in) fclose(in);
+        return -1;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+#ifndef _WIN32
+    chmod(dst, 0755);
+#endif
+    return 0;
+}
+
+static int generate(int files) {
+    MKDIR(PROJECT);
+    MKDIR(PROJECT "/src");
+    MKDIR(PROJECT "/bin");
+    MKDIR(PROJECT "/obj");
+    MKDIR(PROJECT "/mod");
+    MKDIR(PROJECT "/.cache");
+    if (copy_file(SCANNER_SRC, PROJECT "/bin/maketopologicf90.exe")) return -1;
+
+    char path[256], text[512];
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), PROJECT "/src/m%d.f90", i);
+        snprintf(text, sizeof(text),
+                 "module m%d\n"
+                 "  implicit none\n"
+                 "contains\n"
+                 "  integer function f%d(x)\n"
+                 "    integer, intent(in) :: x\n"
+                 "    f%d = x + %d\n"
+                 "  end function f%d\n"
+                 "end module m%d\n", i, i, i, i, i, i);
+        if (write_file(path, text)) return -1;
+    }
+
+    FILE *f = fopen(PROJECT "/src/main.f90", "w");
+    if (!f) return -1;
+    fprintf(f, "program main\n");
+    for (int i = 0; i < files; i++) fprintf(f, "  use m%d\n", i);
+    fprintf(f, "  implicit none\n  print *, f0(1)\nend program main\n");
+    fclose(f);
+    return 0;
+}
+
+static int write_config(int batch) {
+    char text[512];
+    snprintf(text, sizeof(text),
+             "[build]\n"
+             "target = \"bench\"\n"
+             "compiler = \"gfortran\"\n"
+             "batch = %d\n"
+             "flags = [\"-O0\"]\n"
+             "obj_dir = \"obj\"\n"
+             "mod_dir = \"mod\"\n\n"
+             "[search]\n"
+             "deep = [\"src\"]\n\n"
+             "[cache]\n"
+             "local = false\n", batch);
+    return write_file(PROJECT "/Fortuna.toml", text);
+}
+
+static double timed_build(int files, int batch) {
+    if (write_config(batch)) return -1.0;
+#ifdef _WIN32
+    const char *cmd = "cd " PROJECT " && " FORTUNA_EXE " build -j -r > NUL 2>&1";
+#else
+    const char *cmd = "cd " PROJECT " && " FORTUNA_EXE " build -j -r > /dev/null 2>&1";
+#endif
+    double t0 = now_seconds();
+    system(cmd);
+    double t1 = now_seconds();
+
+    //Only the compiles matter here, so check the objects rather than the
+    //exit code, which also covers linking.
+    for (int i = 0; i <= files; i++) {
+        char obj[256];
+        if (i < files) snprintf(obj, sizeof(obj), PROJECT "/obj/m%d.o", i);
+        else           snprintf(obj, sizeof(obj), PROJECT "/obj/main.o");
+        FILE *f = fopen(obj, "rb");
+        if (!f) {
+            fprintf(stderr, "Build with batch = %d failed, %s is missing\n", batch, obj);
+            return -1.0;
+        }
+        fclose(f);
+    }
+    return t1 - t0;
+}
+
+int main(int argc, char **argv) {
+    int files = argc > 1 ? atoi(argv[1]) : 5000;
+    int batch = argc > 2 ? atoi(argv[2]) : 16;
+    if (files < 1 || batch < 2) {
+        fprintf(stderr, "usage: bench_batch [files] [batch >= 2]\n");
+        return 1;
+    }
+
+    printf("Generating %d modules in %s\n", files, PROJECT);
+    if (generate(files)) return 1;
+
+    double single  = timed_build(files, 1);
+    double batched = timed_build(files, batch);
+    if (single < 0.0 || batched < 0.0) return 1;
+
+    printf("%-12s %10s\n", "batch", "seconds");
+    printf("%-12s %10.2f\n", "off", single);
+    printf("%-12d %10.2f\n", batch, batched);
+    printf("speedup      %9.2fx\n", single / batched);
+    return 0;
+}
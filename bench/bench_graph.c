@@ -0,0 +1,254 @@
+//Benchmark of the dependency graph core against the chained hash table it replaced.
+//
+//  make bench && ./bin/bench_graph [nodes ...]
+//
+//A layered synthetic project is generated in memory (each file uses 3 modules
+//from the layer below it, like a real module hierarchy), parsed into both
+//implementations from the same "target: deps" lines, and then a handful of
+//files are marked as changed and the rebuild set is computed.
+//
+//The legacy code is a verbatim copy of the old fortuna_hash.c graph routines
+//minus the blake3 call in new_file_node, so only the graph work is timed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "../src/fortuna_hash.h"
+#include "../src/fortuna_helper_fn.h"
+
+#define LAYERS       20
+#define USES         3
+#define CHANGED      10
+
+//=============================================================================
+// Legacy implementation
+//=============================================================================
+#define LEGACY_TABLE_SIZE 1024
+
+typedef struct LegacyDependent {
+    char *dependent;
+    struct LegacyDependent *next;
+} LegacyDependent;
+
+typedef struct LegacyNode {
+    char *filename;
+    unsigned int file_hash;
+    LegacyDependent *dependents;
+    struct LegacyNode *next;
+} LegacyNode;
+
+static unsigned int legacy_str_hash(const char *str) {
+    unsigned int hash = 5381;
+    int c;
+    while ((c = *str++))
+        hash = ((hash << 5) + hash) + c;
+    return hash & (LEGACY_TABLE_SIZE-1);
+}
+
+static LegacyNode *legacy_new_file_node(const char *filename) {
+    LegacyNode *node = malloc(sizeof(LegacyNode));
+    node->filename = strdup(filename);
+    node->file_hash = 0;
+    node->dependents = NULL;
+    node->next = NULL;
+    return node;
+}
+
+static LegacyNode *legacy_find(const char *filename, LegacyNode *table[]) {
+    for (LegacyNode *curr = table[legacy_str_hash(filename)]; curr; curr = curr->next) {
+        if (strcmp(curr->filename, filename) == 0) return curr;
+    }
+    return NULL;
+}
+
+static LegacyNode *legacy_get_or_create(const char *filename, LegacyNode *table[]) {
+    LegacyNode *node = legacy_find(filename, table);
+    if (node) return node;
+    node = legacy_new_file_node(filename);
+    unsigned int index = legacy_str_hash(filename);
+    node->next = table[index];
+    table[index] = node;
+    return node;
+}
+
+static void legacy_add_dependent(LegacyNode *file, const char *dependent) {
+    for (LegacyDependent *curr = file->dependents; curr; curr = curr->next) {
+        if (strcmp(curr->dependent, dependent) == 0) return;
+    }
+    LegacyDependent *d = malloc(sizeof(LegacyDependent));
+    d->dependent = strdup(dependent);
+    d->next = file->dependents;
+    file->dependents = d;
+}
+
+static void legacy_parse_line(char *line, LegacyNode *table[]) {
+    char *colon = strchr(line, ':');
+    if (!colon) return;
+    *colon = 0;
+    char *target = line;
+    legacy_get_or_create(target, table);
+    char *dep = strtok(colon + 1, " \t");
+    while (dep) {
+        legacy_add_dependent(legacy_get_or_create(dep, table), target);
+        dep = strtok(NULL, " \t");
+    }
+}
+
+static bool legacy_is_in_rebuild_list(const char *filename, LegacyNode *list) {
+    for (LegacyNode *curr = list; curr; curr = curr->next) {
+        if (strcmp(curr->filename, filename) == 0) return true;
+    }
+    return false;
+}
+
+static void legacy_append_to_rebuild_list(LegacyNode **list, const char *filename) {
+    if (legacy_is_in_rebuild_list(filename, *list)) return;
+    LegacyNode *node = legacy_new_file_node(filename);
+    if (*list == NULL) {
+        *list = node;
+    } else {
+        LegacyNode *curr = *list;
+        while (curr->next != NULL) curr = curr->next;
+        curr->next = node;
+    }
+}
+
+static void legacy_mark(const char *filename, LegacyNode *table[], LegacyNode **list, int *cnt) {
+    unsigned int idx = legacy_str_hash(filename);
+    LegacyNode **pprev = &table[idx];
+    LegacyNode *node   = table[idx];
+    while (node) {
+        if (strcmp(node->filename, filename) == 0) {
+            LegacyNode *next_bucket = node->next;
+            legacy_append_to_rebuild_list(list, node->filename);
+            (*cnt)++;
+            for (LegacyDependent *d = node->dependents; d; d = d->next) {
+                if (!legacy_is_in_rebuild_list(d->dependent, *list)) {
+                    legacy_mark(d->dependent, table, list, cnt);
+                }
+            }
+            *pprev = next_bucket;
+            node   = next_bucket;
+        } else {
+            pprev = &node->next;
+            node = node->next;
+        }
+    }
+}
+
+//The legacy marking unlinks nodes, so they are leaked here rather than
+//tracked down again. The benchmark process exits right after.
+static void legacy_free_list(LegacyNode *list) {
+    while (list) {
+        LegacyNode *next = list->next;
+        free(list->filename);
+        free(list);
+        list = next;
+    }
+}
+
+//=============================================================================
+// Synthetic project
+//=============================================================================
+static char **make_lines(int nodes) {
+    char **lines = malloc(sizeof(char *) * nodes);
+    int width = nodes / LAYERS;
+    if (width < 1) width = 1;
+
+    srand(1234);
+    for (int i = 0; i < nodes; i++) {
+        int layer = i / width;
+        char buf[512];
+        int pos = snprintf(buf, sizeof(buf), "src/layer%d/file%d.f90:", layer, i);
+        if (layer > 0) {
+            for (int u = 0; u < USES; u++) {
+                int dep = (layer - 1) * width + rand() % width;
+                pos += snprintf(buf + pos, sizeof(buf) - pos, " src/layer%d/file%d.f90", layer - 1, dep);
+            }
+        }
+        lines[i] = strdup(buf);
+    }
+    return lines;
+}
+
+//Changed files come from the middle of the hierarchy so the rebuild set
+//is a realistic fraction of the project.
+static int changed_file(int k, int nodes) {
+    int width = nodes / LAYERS;
+    if (width < 1) width = 1;
+    return (LAYERS / 2) * width + (k * 7919) % width;
+}
+
+static void run(int nodes) {
+    char **lines = make_lines(nodes);
+    char name[512];
+
+    //Legacy
+    LegacyNode *table[LEGACY_TABLE_SIZE] = {NULL};
+    double t0 = now_seconds();
+    for (int i = 0; i < nodes; i++) {
+        char *line = strdup(lines[i]);
+        legacy_parse_line(line, table);
+        free(line);
+    }
+    double t1 = now_seconds();
+    LegacyNode *list = NULL;
+    int legacy_cnt = 0;
+    for (int k = 0; k < CHANGED; k++) {
+        int i = changed_file(k, nodes) % nodes;
+        snprintf(name, sizeof(name), "src/layer%d/file%d.f90", i / (nodes / LAYERS > 0 ? nodes / LAYERS : 1), i);
+        if (!legacy_is_in_rebuild_list(name, list)) legacy_mark(name, table, &list, &legacy_cnt);
+    }
+    int legacy_rebuild = 0;
+    for (LegacyNode *c = list; c; c = c->next) legacy_rebuild++;
+    double t2 = now_seconds();
+    legacy_free_list(list);
+
+    //Current
+    DepGraph graph;
+    graph_init(&graph);
+    double t3 = now_seconds();
+    for (int i = 0; i < nodes; i++) {
+        char *line = strdup(lines[i]);
+        parse_line(line, &graph);
+        free(line);
+    }
+    double t4 = now_seconds();
+    Bitset dirty;
+    bitset_init(&dirty, graph.files.count);
+    for (int k = 0; k < CHANGED; k++) {
+        int i = changed_file(k, nodes) % nodes;
+        snprintf(name, sizeof(name), "src/layer%d/file%d.f90", i / (nodes / LAYERS > 0 ? nodes / LAYERS : 1), i);
+        int id = file_table_find(&graph.files, name);
+        if (id >= 0) bitset_set(&dirty, id);
+    }
+    graph_propagate_dirty(&graph, &dirty);
+    int *order = malloc(sizeof(int) * graph.files.count);
+    int rebuild = graph_collect_in_topo_order(&graph, &dirty, order);
+    double t5 = now_seconds();
+
+    printf("%8d nodes | rebuild %7d | legacy parse %9.4f s  mark %9.4f s | graph parse %9.4f s  mark %9.4f s | speedup %7.1fx\n",
+           nodes, rebuild, t1 - t0, t2 - t1, t4 - t3, t5 - t4,
+           ((t2 - t0) / ((t5 - t3) > 1e-9 ? (t5 - t3) : 1e-9)));
+    if (legacy_rebuild != rebuild) {
+        printf("         rebuild set mismatch: legacy %d, graph %d\n", legacy_rebuild, rebuild);
+    }
+
+    free(order);
+    bitset_free(&dirty);
+    graph_free(&graph);
+    for (int i = 0; i < nodes; i++) free(lines[i]);
+    free(lines);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) run(atoi(argv[i]));
+    } else {
+        run(1000);
+        run(10000);
+        run(100000);
+    }
+    return 0;
+}
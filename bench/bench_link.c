@@ -0,0 +1,185 @@
+//Benchmark of partial links ([link] partial) against one flat link.
+//
+//  make && make bench && ./bin/bench_link [files] [dirs] [rounds]
+//
+//A synthetic project is generated in bench_link_project/ (files modules spread
+//over dirs subdirectories plus a main program), built once, and then one
+//module is edited and the project built again, rounds times, first with a flat
+//link of every object and then with one ld -r group per subdirectory. The time
+//of these incremental builds is what the partial links are for. fortuna and
+//bin/maketopologicf90 are taken from the repository root, so run it from there.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#define MKDIR(p) _mkdir(p)
+#define SCANNER_SRC "bin\\maketopologicf90.exe"
+#define FORTUNA_EXE "..\\fortuna.exe"
+#define QUIET " > NUL 2>&1"
+static double now_seconds(void) {
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+}
+#else
+#include <sys/stat.h>
+#include <time.h>
+#define MKDIR(p) mkdir(p, 0755)
+#define SCANNER_SRC "bin/maketopologicf90"
+#define FORTUNA_EXE "../fortuna"
+#define QUIET " > /dev/null 2>&1"
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+#endif
+
+#define PROJECT "bench_link_project"
+
+static int write_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return -1;
+    }
+    fputs(text, f);
+    fclose(f);
+    return 0;
+}
+
+static int copy_file(const char *src, const char *dst) {
+    FILE *in  = fopen(src, "rb");
+    FILE *out = in ? fopen(dst, "wb") : NULL;
+    if (!in || !out) {
+        fprintf(stderr, "Could not copy %s to %s (run make first)\n", src, dst);
+        if (in) fclose(in);
+        return -1;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+#ifndef _WIN32
+    chmod(dst, 0755);
+#endif
+    return 0;
+}
+
+//Module i, with a constant that changes from one round to the next so the
+//object really is different.
+static int write_module(int i, int dirs, int round) {
+    char path[256], text[512];
+    snprintf(path, sizeof(path), PROJECT "/src/d%d/m%d.f90", i % dirs, i);
+    snprintf(text, sizeof(text),
+             "module m%d\n"
+             "  implicit none\n"
+             "contains\n"
+             "  integer function f%d(x)\n"
+             "    integer, intent(in) :: x\n"
+             "    f%d = x + %d\n"
+             "  end function f%d\n"
+             "end module m%d\n", i, i, i, i + round, i, i);
+    return write_file(path, text);
+}
+
+static int generate(int files, int dirs) {
+    MKDIR(PROJECT);
+    MKDIR(PROJECT "/src");
+    MKDIR(PROJECT "/bin");
+    MKDIR(PROJECT "/obj");
+    MKDIR(PROJECT "/mod");
+    MKDIR(PROJECT "/.cache");
+    if (copy_file(SCANNER_SRC, PROJECT "/bin/maketopologicf90.exe")) return -1;
+
+    char path[256];
+    for (int d = 0; d < dirs; d++) {
+        snprintf(path, sizeof(path), PROJECT "/src/d%d", d);
+        MKDIR(path);
+    }
+    for (int i = 0; i < files; i++) {
+        if (write_module(i, dirs, 0)) return -1;
+    }
+
+    //Every object is linked whether main uses it or not.
+    return write_file(PROJECT "/src/main.f90",
+                      "program main\n"
+                      "  use m0\n"
+                      "  implicit none\n"
+                      "  print *, f0(1)\n"
+                      "end program main\n");
+}
+
+static int write_config(int partial) {
+    char text[512];
+    snprintf(text, sizeof(text),
+             "[build]\n"
+             "target = \"bench\"\n"
+             "compiler = \"gfortran\"\n"
+             "flags = [\"-O0\"]\n"
+             "obj_dir = \"obj\"\n"
+             "mod_dir = \"mod\"\n\n"
+             "[search]\n"
+             "deep = [\"src\"]\n\n"
+             "[link]\n"
+             "partial = %s\n\n"
+             "[cache]\n"
+             "local = false\n", partial ? "true" : "false");
+    return write_file(PROJECT "/Fortuna.toml", text);
+}
+
+static int build(void) {
+    return system("cd " PROJECT " && " FORTUNA_EXE " build -j" QUIET);
+}
+
+//Mean time of a build after editing one module, over rounds edits.
+static double timed_rebuilds(int files, int dirs, int rounds, int partial, int *round) {
+    if (write_config(partial)) return -1.0;
+    if (build() != 0) {
+        fprintf(stderr, "Build with partial = %d failed\n", partial);
+        return -1.0;
+    }
+
+    double total = 0.0;
+    for (int r = 0; r < rounds; r++) {
+        (*round)++;
+        if (write_module((*round * 7919) % files, dirs, *round)) return -1.0;
+        double t0 = now_seconds();
+        int ret = build();
+        total += now_seconds() - t0;
+        if (ret != 0) {
+            fprintf(stderr, "Rebuild with partial = %d failed\n", partial);
+            return -1.0;
+        }
+    }
+    return total / rounds;
+}
+
+int main(int argc, char **argv) {
+    int files  = argc > 1 ? atoi(argv[1]) : 2000;
+    int dirs   = argc > 2 ? atoi(argv[2]) : 20;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    if (files < 1 || dirs < 1 || rounds < 1) {
+        fprintf(stderr, "usage: bench_link [files] [dirs] [rounds]\n");
+        return 1;
+    }
+
+    printf("Generating %d modules in %d directories in %s\n", files, dirs, PROJECT);
+    if (generate(files, dirs)) return 1;
+
+    int round = 0;
+    double flat    = timed_rebuilds(files, dirs, rounds, 0, &round);
+    double partial = flat < 0.0 ? -1.0 : timed_rebuilds(files, dirs, rounds, 1, &round);
+    if (flat < 0.0 || partial < 0.0) return 1;
+
+    printf("%-12s %10s\n", "link", "seconds");
+    printf("%-12s %10.3f\n", "flat", flat);
+    printf("%-12s %10.3f\n", "partial", partial);
+    printf("speedup      %9.2fx\n", flat / partial);
+    return 0;
+}
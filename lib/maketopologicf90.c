@@ -20,9 +20,9 @@
 #endif
 
 #define INITIAL_FILE_CAPACITY 1024
-#define MAX_FILE_CAPACITY 4096
+#define MAX_FILE_CAPACITY 65536
 #define INITIAL_USES_CAPACITY 16
-#define MAX_USES_CAPACITY 1024
+#define MAX_USES_CAPACITY 65536
 #define MAX_LINE 1024
 #define MAX_MODULE_LEN 128
 #define HASH_SIZE 16384
@@ -34,6 +34,10 @@ typedef struct ProjectFile {
     int *uses;       // store indices of modules used (indices in files[])
     int uses_count;
     int uses_capacity;
+    char **pending;  // -s only: used modules nobody defined so far
+    int pending_count;
+    int pending_capacity;
+    int emitted;     // -s only: line already printed
 } ProjectFile;
 
 static ProjectFile *files = NULL;
@@ -124,6 +128,10 @@ void ensure_file_capacity(void) {
             new_files[i].uses = NULL;
             new_files[i].uses_capacity = 0;
             new_files[i].uses_count = 0;
+            new_files[i].pending = NULL;
+            new_files[i].pending_count = 0;
+            new_files[i].pending_capacity = 0;
+            new_files[i].emitted = 0;
             new_files[i].module_name[0] = 0;
             new_files[i].filename[0] = 0;
         }
@@ -170,7 +178,32 @@ void parse_module_definition(char *line, int idx) {
     }
 }
 
-void parse_use_statement(char *line, int idx) {
+//Remember a used module that can't be resolved yet (-s). It is looked up
+//again whenever another file was scanned.
+void add_pending_module(int idx, const char *modname) {
+    ProjectFile *f = &files[idx];
+    for (int i = 0; i < f->pending_count; i++) {
+        if (strcmp(f->pending[i], modname) == 0) return;
+    }
+    if (f->pending_count >= f->pending_capacity) {
+        int new_capacity = f->pending_capacity == 0 ? 4 : f->pending_capacity * 2;
+        char **new_pending = realloc(f->pending, new_capacity * sizeof(char *));
+        if (!new_pending) {
+            fprintf(stderr, "realloc failed for pending modules\n");
+            exit(1);
+        }
+        f->pending = new_pending;
+        f->pending_capacity = new_capacity;
+    }
+    f->pending[f->pending_count] = strdup(modname);
+    if (!f->pending[f->pending_count]) {
+        fprintf(stderr, "strdup failed for pending modules\n");
+        exit(1);
+    }
+    f->pending_count++;
+}
+
+void parse_use_statement(char *line, int idx, int defer) {
     char *p = trim(line);
     if (strncasecmp(p, "use", 3) != 0) return;
     p += 3;
@@ -185,6 +218,10 @@ void parse_use_statement(char *line, int idx) {
         modname[i++] = (char)tolower((unsigned char)*p++);
     }
     modname[i] = '\0';
+    if (defer) {
+        add_pending_module(idx, modname);
+        return;
+    }
     int dep_idx = hash_lookup(modname);
     if (dep_idx != -1) add_used_module(idx, dep_idx);
 }
@@ -207,16 +244,22 @@ void parse_include_statement(char *line, int idx) {
     }
 }
 
+//mode 0 finds definitions, mode 1 uses. Mode 2 (-s) does both in one read,
+//keeping the used modules by name until the whole file was read.
 void parse_line_for_dep(char *line, const char *filename, int file_idx, int mode) {
     // Fortran
     if (strstr(filename, ".f") || strstr(filename, ".F") ) {
         if (mode == 0) parse_module_definition(line, file_idx);
-        else parse_use_statement(line, file_idx);
+        else if (mode == 1) parse_use_statement(line, file_idx, 0);
+        else {
+            parse_module_definition(line, file_idx);
+            parse_use_statement(line, file_idx, 1);
+        }
     }
 
     // C
     if (strstr(filename, ".c") || strstr(filename, ".cu") ) {
-        if (mode == 1) parse_include_statement(line, file_idx);
+        if (mode >= 1) parse_include_statement(line, file_idx);
     }
 }
 
@@ -342,6 +385,77 @@ void process_directories(){
     }
 }
 
+//Print one line of the Makefile dependency list.
+void print_dep_line(int idx) {
+    ProjectFile *f = &files[idx];
+    printf("%s:", f->filename);
+    for (int u = 0; u < f->uses_count; u++) {
+        printf(" %s", files[f->uses[u]].filename);
+    }
+    printf("\n");
+    f->emitted = 1;
+}
+
+//Look up the pending modules of every file still waiting, after new
+//definitions came in.
+void resolve_pending(int scanned) {
+    for (int i = 0; i < scanned; i++) {
+        ProjectFile *f = &files[i];
+        if (f->emitted) continue;
+        for (int k = 0; k < f->pending_count; ) {
+            int dep_idx = hash_lookup(f->pending[k]);
+            if (dep_idx == -1) {
+                k++;
+                continue;
+            }
+            add_used_module(i, dep_idx);
+            free(f->pending[k]);
+            f->pending[k] = f->pending[--f->pending_count];
+        }
+    }
+}
+
+//Print every scanned file whose modules are all resolved and printed, until
+//none is left. The lines come out in topological order.
+void emit_ready(int scanned) {
+    int progress = 1;
+    while (progress) {
+        progress = 0;
+        for (int i = 0; i < scanned; i++) {
+            ProjectFile *f = &files[i];
+            if (f->emitted || f->pending_count > 0) continue;
+            int ready = 1;
+            for (int u = 0; u < f->uses_count && ready; u++) {
+                ready = files[f->uses[u]].emitted;
+            }
+            if (!ready) continue;
+            print_dep_line(i);
+            progress = 1;
+        }
+    }
+    fflush(stdout);
+}
+
+//Streaming scan (-s). Every file is read once. A module it uses that no file
+//read so far defines may still be defined by a file read later, so the file
+//waits until it is defined, or to the end of the scan. Everything still
+//waiting then (e.g. users of intrinsic modules) is printed last.
+void stream_directories(void) {
+    for (int i = 0; i < file_count; i++) {
+        process_modules_in_file(files[i].filename, i, 2);
+        if (files[i].module_name[0] || files[i].pending_count > 0) resolve_pending(i + 1);
+        emit_ready(i + 1);
+    }
+
+    //Whatever is still unresolved is not part of the project.
+    for (int i = 0; i < file_count; i++) {
+        for (int k = 0; k < files[i].pending_count; k++) free(files[i].pending[k]);
+        free(files[i].pending);
+        files[i].pending = NULL;
+        files[i].pending_count = 0;
+    }
+}
+
 typedef struct {
     int *edges;
     int count;
@@ -471,7 +585,7 @@ void free_dirs(char **dirs, int count) {
  */
 void print_help(const char *progname) {
     printf(
-        "Usage: %s [-d dirs] [-D dirs] [-m] [-h]\n"
+        "Usage: %s [-d dirs] [-D dirs] [-m] [-s] [-h]\n"
         "\n"
         "Scans Fortran .f90 source files to determine module dependencies,\n"
         "then outputs the topologic build order of modules.\n"
@@ -482,6 +596,8 @@ void print_help(const char *progname) {
         "  -D DIRS    Comma-separated list of directories to scan recursively.\n"
         "             Only one -D flag allowed.\n"
         "  -m         Print a Makefile dependency list instead of build order.\n"
+        "  -s         Like -m, but print each file as soon as its dependencies\n"
+        "             are known, while the scan is still running.\n"
         "  -h         Show this help message.\n"
         "\n"
         "If neither -d nor -D is specified, defaults to scanning 'src' non-recursively.\n"
@@ -498,6 +614,8 @@ int main(int argc, char **argv) {
       -D DIRS   Comma-separated list of directories to scan recursively.
                 Only one -D flag allowed.
       -m        Print a Makefile dependency list instead of build order.
+      -s        Same list, streamed: a file is printed as soon as every module
+                it uses was found, the rest when the scan is done.
       -h        Show this help message.
 
     Description:
@@ -520,6 +638,7 @@ int main(int argc, char **argv) {
     char *d_dirs_str = NULL;
     char *D_dirs_str = NULL;
     int print_make_deps = 0;
+    int stream_make_deps = 0;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-d") == 0) {
@@ -544,6 +663,9 @@ int main(int argc, char **argv) {
             D_dirs_str = argv[++i];
         } else if (strcmp(argv[i], "-m") == 0) {
             print_make_deps = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            print_make_deps = 1;
+            stream_make_deps = 1;
         } else if (strcmp(argv[i], "-h") == 0) {
             print_help(argv[0]);
             return 0;
@@ -605,7 +727,8 @@ int main(int argc, char **argv) {
     }
 
     //Process the files
-    process_directories();
+    if (stream_make_deps) stream_directories();
+    else process_directories();
 
     //Build the adjacency graph by the files the module name appears in.
     //This is the entire graph of dependencies when that list is topologically sorted. 
@@ -631,15 +754,9 @@ int main(int argc, char **argv) {
 
     if (print_make_deps) {
         // Print Makefile dependency list: filename: dependencies filenames...
+        // With -s, only what wasn't streamed yet.
         for (int i = 0; i < file_count; i++) {
-            int idx = sorted[i];
-            printf("%s:", files[idx].filename);
-            ProjectFile *f = &files[idx];
-            for (int u = 0; u < f->uses_count; u++) {
-                int dep_idx = f->uses[u];
-                printf(" %s", files[dep_idx].filename);
-            }
-            printf("\n");
+            if (!files[sorted[i]].emitted) print_dep_line(sorted[i]);
         }
     } else {
         // Print build order (filenames only)
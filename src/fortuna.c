@@ -10,6 +10,14 @@
 #include "fortuna_cli_args.h"
 #include "fortuna_helper_fn.h"
 #include "fortuna_toml.h"
+#include "fortuna_cache.h"
+#include "fortuna_worker.h"
+#include "fortuna_daemon.h"
+#include "fortuna_sched.h"
+#include "fortuna_hot.h"
+#include "fortuna_trace.h"
+#include "fortuna_stats.h"
+#include "fortuna_history.h"
 
 #ifdef _WIN32
     #define MKDIR(path) _mkdir(path)
@@ -263,6 +271,28 @@ int file_exists_generic(char *filename) {
   return (stat(filename, &buffer) == 0);
 }
 
+//Value given after a flag ("--port 8080"), or NULL.
+static const char *flag_value(hashmap_t *map, const char *flag) {
+    if (!hashmap_contains(map, flag)) return NULL;
+    return return_key_for_index(map, return_index_for_key(map, flag) + 1);
+}
+
+//--stats prints where the build spent its time, --stats=json writes it to a file.
+static int stats_option(hashmap_t *map) {
+    if (!hashmap_contains(map, "--stats")) return STATS_OFF;
+    const char *format = flag_value(map, "--stats");
+    return (format && strcmp(format, "json") == 0) ? STATS_JSON : STATS_TEXT;
+}
+
+//Builds go to the project's daemon when one is running, except for --pgo,
+//which runs the training as well, and --explain, --trace and --dry-run, which
+//look at the build itself.
+static int build_project(const fortuna_build_opts_t *opts) {
+    int result;
+    if (!opts->pgo && !opts->explain && !opts->trace && !opts->dry_run && fortuna_daemon_build(opts, &result) == 0) return result;
+    return fortuna_build_project_incremental(opts);
+}
+
 int generate_project_toml(const char *project_name) {
 
     // Path to the project.toml file
@@ -302,7 +332,15 @@ int generate_project_toml(const char *project_name) {
         "#Placed in the lib folder and only supports static linking with ar\n"
         "#target = \"%s.lib\"\n\n"
         "[args]\n"
-        "#cmds = [\"cmd_line_argument\"] \n\n",
+        "#cmds = [\"cmd_line_argument\"] \n\n"
+        "[cache]\n"
+        "#Shared build cache, see the README\n"
+        "#local = true\n"
+        "#max_size = \"5G\"\n"
+        "#remote = \"http://localhost:8080\"\n\n"
+        "[distributed]\n"
+        "#Hosts running fortuna worker, see the README\n"
+        "#workers = [\"build1:9000\", \"build2:9000\"]\n\n",
         project_name,project_name
     );
 
@@ -451,17 +489,9 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    //Parallel build flag.
-    int parallel_build = 0;
-
-    //Incremental build flag
-    int incremental_build = 1;
-
-    //Build only a library flag
-    int lib_only = 0;
-
-    //Check if this is a run or not
-    int run_flag = 0;
+    //Build options: serial, incremental, full target, not a run.
+    fortuna_build_opts_t opts = {0};
+    opts.incremental = 1;
 
     //Project dir
     const char *project_dir;
@@ -511,29 +541,58 @@ int main(int argc, char *argv[]) {
     if (hashmap_contains_key_and_index(&args.args_map, "build", 1)) {
 
         //Check if we are doing a parallel build.
-        if(hashmap_contains(&args.args_map, "-j")) parallel_build = 1;
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
 
         //Check if we are allowing an incremental build.
         if(hashmap_contains(&args.args_map, "-r") || hashmap_contains(&args.args_map, "--rebuild") ){
-            incremental_build = 0;
+            opts.incremental = 0;
         }
 
         //Check if we are building a lib only
-        if(hashmap_contains(&args.args_map, "--lib")) lib_only = 1;
+        if(hashmap_contains(&args.args_map, "--lib")) opts.lib_only = 1;
+
+        //Report the phase times and counters of the build.
+        opts.stats = stats_option(&args.args_map);
+
+        //Build with the flags and directories of a [profile.<name>].
+        opts.profile = flag_value(&args.args_map, "--profile");
+
+        //Profile guided optimization: instrument, train, build again.
+        if(hashmap_contains(&args.args_map, "--pgo")) opts.pgo = 1;
+
+        //Print why each file is compiled, and with which flags.
+        if(hashmap_contains(&args.args_map, "--explain")) opts.explain = 1;
+
+        //Print the plan and its estimate from the compile history, build nothing.
+        if(hashmap_contains(&args.args_map, "--dry-run")) opts.dry_run = 1;
+        if(opts.dry_run && opts.pgo) {
+            print_error("--pgo runs the targets between its builds, so it doesn't go with --dry-run.");
+            return -1;
+        }
 
+        //Write the timeline of the build (--trace=build.json), see fortuna_trace.h.
+        if(hashmap_contains(&args.args_map, "--trace")) {
+            const char *trace_path = flag_value(&args.args_map, "--trace");
+            if (!trace_path) {
+                print_error("Syntax is \"fortuna build --trace=<file>\"");
+                return -1;
+            }
+            opts.trace = trace_open(trace_path);
+        }
 
         //Run the build
-        fortuna_build_project_incremental(parallel_build,incremental_build,lib_only,run_flag);
+        int result = build_project(&opts);
+        trace_close(opts.trace);
 
         //Safely exit
-        return 0;
+        return result == 0 ? 0 : -1;
     }
 
     //Run command
     if (hashmap_contains_key_and_index(&args.args_map, "run", 1)) {
 
         //Set the run flag
-        run_flag = 1;
+        opts.run_flag = 1;
 
         //Load the toml file.
         const char* toml_path = FORTUNA_NAME;
@@ -551,17 +610,18 @@ int main(int argc, char *argv[]) {
         }
 
         //Check if we are doing a parallel build.
-        if(hashmap_contains(&args.args_map, "-j")) parallel_build = 1;
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
 
         //Check if we are allowing an incremental build or forcing a full rebuild.
         if(hashmap_contains(&args.args_map, "-r") || hashmap_contains(&args.args_map, "--rebuild") ){
-            incremental_build = 0;
+            opts.incremental = 0;
         }
+        opts.profile = flag_value(&args.args_map, "--profile");
 
         if(!hashmap_contains(&args.args_map, "--bin")){
 
             //Then we may need a rebuild so we have to check. 
-            if(fortuna_build_project_incremental(parallel_build,incremental_build,lib_only,run_flag) < 0){
+            if(build_project(&opts) < 0){
                 //print_error("Build Error");
                 return -1;
             }
@@ -591,10 +651,10 @@ int main(int argc, char *argv[]) {
         }else{
 
             //Rebuild the project from scratch.
-            run_flag          = 0;
-            incremental_build = 0;
-            parallel_build    = 1;
-            fortuna_build_project_incremental(parallel_build,incremental_build,lib_only,run_flag);
+            opts.run_flag       = 0;
+            opts.incremental    = 0;
+            opts.parallel_build = 1;
+            build_project(&opts);
 
             //Then check if the executable exists. If it does not, then print an error message. 
             if(file_exists_generic(exe)){
@@ -609,6 +669,116 @@ int main(int argc, char *argv[]) {
     }
 
 
+    //Serve a build cache for other machines (or other builds on this one).
+    if (hashmap_contains_key_and_index(&args.args_map, "cache-serve", 1)) {
+        const char *port_str = flag_value(&args.args_map, "--port");
+        int port = port_str ? atoi(port_str) : 8080;
+        if (port <= 0 || port > 65535) {
+            print_error("Invalid port for cache-serve");
+            return -1;
+        }
+
+        //Default to a folder next to the local cache, not the local cache itself.
+        char dir[1024];
+        const char *dir_arg = flag_value(&args.args_map, "--dir");
+        if (dir_arg) {
+            snprintf(dir, sizeof(dir), "%s", dir_arg);
+        } else if (action_cache_default_dir(dir, sizeof(dir) - 8) == 0) {
+            strcat(dir, "-server");
+        } else {
+            print_error("No cache directory given, use --dir");
+            return -1;
+        }
+
+        int local_only = !hashmap_contains(&args.args_map, "--public");
+        return action_cache_serve(dir, port, local_only) == 0 ? 0 : -1;
+    }
+
+    //Keep the build state of this project in memory between builds.
+    if (hashmap_contains_key_and_index(&args.args_map, "daemon", 1)) {
+        if (!file_exists_generic(FORTUNA_NAME)) {
+            print_error("No Fortuna.toml in the current directory");
+            return -1;
+        }
+        return fortuna_daemon_serve() == 0 ? 0 : -1;
+    }
+
+    //Rebuild (and rerun) on every save.
+    if (hashmap_contains_key_and_index(&args.args_map, "watch", 1)) {
+        if (!file_exists_generic(FORTUNA_NAME)) {
+            print_error("No Fortuna.toml in the current directory");
+            return -1;
+        }
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
+        opts.stats = stats_option(&args.args_map);
+        opts.profile = flag_value(&args.args_map, "--profile");
+        return fortuna_watch(&opts, hashmap_contains(&args.args_map, "--run")) == 0 ? 0 : -1;
+    }
+
+    //Compile jobs sent by other machines' builds.
+    if (hashmap_contains_key_and_index(&args.args_map, "worker", 1)) {
+        const char *port_str    = flag_value(&args.args_map, "--port");
+        const char *jobs_str    = flag_value(&args.args_map, "--jobs");
+        const char *latency_str = flag_value(&args.args_map, "--latency");
+        int port    = port_str ? atoi(port_str) : WORKER_DEFAULT_PORT;
+        int jobs    = jobs_str ? atoi(jobs_str) : cpu_count();
+        int latency = latency_str ? atoi(latency_str) : 0;
+        if (port <= 0 || port > 65535 || jobs <= 0 || latency < 0) {
+            print_error("Invalid --port, --jobs or --latency for worker");
+            return -1;
+        }
+
+        int local_only = !hashmap_contains(&args.args_map, "--public");
+        return fortuna_worker_serve(port, jobs, latency, local_only) == 0 ? 0 : -1;
+    }
+
+    //What a change to one file costs: its dependents in the last build and
+    //the time to compile them again.
+    if (hashmap_contains_key_and_index(&args.args_map, "impact", 1)) {
+        opts.impact = flag_value(&args.args_map, "impact");
+        if (!opts.impact) {
+            print_error("Syntax is \"fortuna impact <file>\"");
+            return -1;
+        }
+        if(hashmap_contains(&args.args_map, "-j")) opts.parallel_build = 1;
+        opts.profile = flag_value(&args.args_map, "--profile");
+        return fortuna_build_project_incremental(&opts) == 0 ? 0 : -1;
+    }
+
+    //Reports on the builds so far.
+    if (hashmap_contains_key_and_index(&args.args_map, "report", 1)) {
+        int report_index = return_index_for_key(&args.args_map, "report");
+        const char *kind = return_key_for_index(&args.args_map, report_index+1);
+        if (kind && strcmp(kind, "hot") == 0) return fortuna_report_hot() == 0 ? 0 : -1;
+        if (kind && strcmp(kind, "compile-times") == 0) {
+            const char *threshold_str = flag_value(&args.args_map, "--threshold");
+            char *end = NULL;
+            double threshold = threshold_str ? strtod(threshold_str, &end) : HISTORY_THRESHOLD;
+            if ((threshold_str && (end == threshold_str || *end != '\0')) || threshold < 0.0) {
+                print_error("Invalid --threshold for report compile-times, a percent of 0 or more");
+                return -1;
+            }
+
+            //The object tree of the profile the build would use.
+            fortuna_toml_t cfg = {0};
+            if (fortuna_toml_load(FORTUNA_NAME, &cfg) != 0) {
+                print_error("Failed to load Fortuna.toml.");
+                return -1;
+            }
+            const char *profile = flag_value(&args.args_map, "--profile");
+            if (!profile) profile = fortuna_toml_get_string(&cfg, "build.profile");
+            const char *obj_dir = fortuna_toml_get_string(&cfg, "build.obj_dir");
+            char tree[600];
+            if (profile) snprintf(tree, sizeof(tree), ".cache%c%s%cobj", PATH_SEP, profile, PATH_SEP);
+            else snprintf(tree, sizeof(tree), "%s", obj_dir ? obj_dir : "obj");
+            int result = fortuna_report_compile_times(tree, threshold);
+            fortuna_toml_free(&cfg);
+            return result == 0 ? 0 : -1;
+        }
+        print_error("Syntax is \"fortuna report hot|compile-times\"");
+        return -1;
+    }
+
     //Clean 
     if (hashmap_contains_key_and_index(&args.args_map, "clean", 1)){
        
@@ -1,12 +1,19 @@
 #include "fortuna_build.h"
 #include "fortuna_toml.h"
 #include "fortuna_hash.h"
-#include "fortuna_threads.h"
+#include "fortuna_sched.h"
+#include "fortuna_cache.h"
+#include "fortuna_worker.h"
+#include "fortuna_hot.h"
+#include "fortuna_trace.h"
+#include "fortuna_stats.h"
+#include "fortuna_history.h"
 #include "fortuna_helper_fn.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <errno.h>
 
@@ -17,6 +24,7 @@
 #else
 #include <unistd.h>
 #include <limits.h>
+#include <dirent.h>
 #endif
 
 static int dir_exists(const char *path) {
@@ -29,21 +37,29 @@ static int dir_exists(const char *path) {
 #endif
 }
 
-//Figure out the path options.
+//Figure out the path options. The cache files live in the cache directory of
+//each object pool: .cache, or .cache/<target> for a [bin] target with flags of
+//its own.
 #ifdef _WIN32
     #define PATH_SEP '\\'
     //Generate the hash file cache. 
-    const char* hash_cache_file = ".cache/hash.dep";
+    const char* hash_cache_file = "hash.dep";
 
     //Depenency list 
-    const char* deps_file = ".cache/topo.dep";
+    const char* deps_file = "topo.dep";
+
+    //Objects committed by a build that has not finished yet.
+    const char* journal_file = "hash.journal";
 #else
     #define PATH_SEP '/'
     //Generate the hash file cache. 
-    const char* hash_cache_file = ".cache/hash.dep";
+    const char* hash_cache_file = "hash.dep";
 
     //Depenency list 
-    const char* deps_file = ".cache/topo.dep";
+    const char* deps_file = "topo.dep";
+
+    //Objects committed by a build that has not finished yet.
+    const char* journal_file = "hash.journal";
 #endif
 
 int make_dir(const char *path) {
@@ -138,51 +154,6 @@ int remove_folder(const char *path) {
 #endif
 }
 
-int count_files_in_directory(const char *path) {
-    int count = 0;
-
-#ifdef _WIN32
-    WIN32_FIND_DATA fd;
-    char search_path[MAX_PATH];
-    snprintf(search_path, MAX_PATH, "%s\\*", path);
-
-    HANDLE hFind = FindFirstFile(search_path, &fd);
-    if (hFind == INVALID_HANDLE_VALUE) {
-        return -1;  // error
-    }
-
-    do {
-        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-            count++;
-        }
-    } while (FindNextFile(hFind, &fd));
-
-    FindClose(hFind);
-
-#else
-    DIR *dir;
-    struct dirent *entry;
-    struct stat st;
-    char fullpath[1024];
-
-    dir = opendir(path);
-    if (dir == NULL) {
-        return -1;  // error
-    }
-
-    while ((entry = readdir(dir)) != NULL) {
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
-        if (stat(fullpath, &st) == 0 && S_ISREG(st.st_mode)) {
-            count++;
-        }
-    }
-
-    closedir(dir);
-#endif
-
-    return count;
-}
-
 #define CHUNK_SIZE 4096
 
 // Trim leading/trailing spaces
@@ -236,6 +207,77 @@ char *parse_line_for_dep(char *line, const char *filename) {
     return NULL;
 }
 
+//Copy a lower case Fortran name from p into out. Returns the end of the name.
+static const char *read_fortran_name(const char *p, char *out, size_t size) {
+    size_t i = 0;
+    while (*p && (isalnum((unsigned char)*p) || *p == '_') && i + 1 < size) {
+        out[i++] = (char)tolower((unsigned char)*p++);
+    }
+    out[i] = '\0';
+    return p;
+}
+
+static void push_output(char ***list, int *count, const char *name) {
+    char **tmp = realloc(*list, sizeof(char *) * (*count + 2));
+    if (!tmp) return;
+    *list = tmp;
+    (*list)[(*count)++] = strdup(name);
+    (*list)[*count] = NULL;
+}
+
+//Every module file a source can write: name.mod and name.smod for each module,
+//and ancestor@name.smod for each submodule. NULL terminated, or NULL if none.
+//"module function foo(x)" and friends are told apart from a module statement by
+//the tokens that follow the name.
+char **list_module_outputs(const char *filename) {
+    if (!strstr(filename, ".f") && !strstr(filename, ".F")) return NULL;
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return NULL;
+
+    char **outputs = NULL;
+    int count = 0;
+    char line[4096];
+    char name[256];
+    char parent[256];
+    char out[600];
+    while (fgets(line, sizeof(line), fp)) {
+        const char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+
+        if (strncasecmp(p, "module", 6) == 0 && isspace((unsigned char)p[6])) {
+            p = read_fortran_name(p + 7 + strspn(p + 7, " \t"), name, sizeof(name));
+            while (*p == ' ' || *p == '\t') p++;
+            if (!name[0] || (*p && *p != '!' && *p != ';' && *p != '\r' && *p != '\n')) continue;
+            snprintf(out, sizeof(out), "%s.mod", name);
+            push_output(&outputs, &count, out);
+            snprintf(out, sizeof(out), "%s.smod", name);
+            push_output(&outputs, &count, out);
+        } else if (strncasecmp(p, "submodule", 9) == 0) {
+            p += 9;
+            while (*p == ' ' || *p == '\t') p++;
+            if (*p++ != '(') continue;
+            while (*p == ' ' || *p == '\t') p++;
+            p = read_fortran_name(p, parent, sizeof(parent));
+            p = strchr(p, ')');
+            if (!p || !parent[0]) continue;
+            p++;
+            while (*p == ' ' || *p == '\t') p++;
+            read_fortran_name(p, name, sizeof(name));
+            if (!name[0]) continue;
+            snprintf(out, sizeof(out), "%s@%s.smod", parent, name);
+            push_output(&outputs, &count, out);
+        }
+    }
+    fclose(fp);
+    return outputs;
+}
+
+static void free_string_list(char **list) {
+    if (!list) return;
+    for (int i = 0; list[i]; i++) free(list[i]);
+    free(list);
+}
+
 // Buffered file reader that returns module .mod name
 char *get_module_filename(const char *filename) {
     FILE *fp = fopen(filename, "rb");
@@ -298,18 +340,8 @@ char *get_last_path_segment(const char *path) {
     return strdup(p); 
 }
 
-// Worker thread: launches a process per thread
-void compile_system_worker(void *arg) {
-    char *cmd = (char *)arg;
-    int ret = launch_process(cmd,NULL);
-    if (ret != 0) {
-        print_error("Compilation failed: %s\n");
-        return;
-    }
-    return;
-}
-
 int file_exists(const char *filename) {
+    stats_count(STAT_FILES_STATED, 1);
     FILE *file = fopen(filename, "r");
     if (file) {
         fclose(file);
@@ -319,6 +351,7 @@ int file_exists(const char *filename) {
 }
 
 static char *run_command_capture(const char *cmd) {
+    stats_count(STAT_PROCESSES, 1);
     FILE *pipe = popen(cmd, "r");
     if (!pipe) {
         print_error("Failed to run command.");
@@ -346,6 +379,95 @@ static char *run_command_capture(const char *cmd) {
     return buffer;
 }
 
+//One cached run of the scanner.
+typedef struct SessionScan {
+    char *cmd;
+    char *output;
+} SessionScan;
+
+struct BuildSession {
+    DigestCache digests;
+    SessionScan scans[2];       // source list and dependency list (-m)
+};
+
+BuildSession *build_session_create(void) {
+    BuildSession *session = calloc(1, sizeof(BuildSession));
+    if (session) digest_cache_init(&session->digests);
+    return session;
+}
+
+void build_session_invalidate_scan(BuildSession *session) {
+    for (int i = 0; i < 2; i++) {
+        free(session->scans[i].cmd);
+        free(session->scans[i].output);
+        session->scans[i].cmd    = NULL;
+        session->scans[i].output = NULL;
+    }
+}
+
+void build_session_free(BuildSession *session) {
+    if (!session) return;
+    build_session_invalidate_scan(session);
+    digest_cache_free(&session->digests);
+    free(session);
+}
+
+int build_session_file_changed(BuildSession *session, const char *path) {
+    int changed = digest_cache_invalidate(&session->digests, path);
+    if (changed > 0) build_session_invalidate_scan(session);
+    return changed >= 0;
+}
+
+//Run the scanner and count the run and its time for --stats.
+static char *run_scanner(const char *cmd) {
+    double start = now_seconds();
+    char *output = run_command_capture(cmd);
+    stats_count(STAT_SCANS, 1);
+    stats_count(STAT_SCAN_US, (long long)((now_seconds() - start) * 1e6));
+    return output;
+}
+
+//Run the scanner, or hand out its last output when the session knows nothing
+//it reads has changed since.
+static char *scan_sources(BuildSession *session, const char *cmd, int which) {
+    if (!session) return run_scanner(cmd);
+
+    SessionScan *scan = &session->scans[which];
+    if (!scan->output || strcmp(scan->cmd, cmd) != 0) {
+        free(scan->cmd);
+        free(scan->output);
+        scan->output = run_scanner(cmd);
+        scan->cmd    = scan->output ? strdup(cmd) : NULL;
+        if (!scan->cmd) {
+            free(scan->output);
+            scan->output = NULL;
+            return NULL;
+        }
+    }
+    return strdup(scan->output);
+}
+
+//Whether the session can hand out the output of cmd without running it.
+static int session_has_scan(const BuildSession *session, const char *cmd, int which) {
+    const SessionScan *scan = &session->scans[which];
+    return scan->output && strcmp(scan->cmd, cmd) == 0;
+}
+
+//Keep the output of a scan that ran outside scan_sources (a streamed one).
+static void session_store_scan(BuildSession *session, const char *cmd, int which, const char *output) {
+    SessionScan *scan = &session->scans[which];
+    free(scan->cmd);
+    free(scan->output);
+    scan->cmd    = strdup(cmd);
+    scan->output = strdup(output);
+    if (!scan->cmd || !scan->output) {
+        free(scan->cmd);
+        free(scan->output);
+        scan->cmd    = NULL;
+        scan->output = NULL;
+    }
+}
+
 // Add flag to unique list if not already there
 int add_unique_flag(char ***list, int *count, const char *flag) {
     for (int i = 0; i < *count; i++) {
@@ -418,441 +540,2958 @@ char *join_flags_array(char **flags_array) {
     return joined;
 }
 
+//Check whether a file name ends in .o
+static int is_object_file(const char *name) {
+    size_t len = strlen(name);
+    return len > 2 && strcmp(name + len - 2, ".o") == 0;
+}
 
-//Libary build
-int build_library(char** sources, int src_count, const char* obj_dir, const char* lib_name){
-    char ar_cmd[4096] = {0};
-    size_t ar_pos = 0;
-
-    ar_pos += snprintf(ar_cmd + ar_pos, sizeof(ar_cmd) - ar_pos, "ar rcs %s%c%s ","lib",PATH_SEP,lib_name);
+//Left behind by a compile that was killed before it could rename its output.
+static int is_temp_object_file(const char *name) {
+    size_t len = strlen(name);
+    return len > 6 && strcmp(name + len - 6, ".o.tmp") == 0;
+}
 
+//Remove objects in obj_dir that no source maps to anymore (deleted or renamed
+//sources, stray files), and any temporary object of an interrupted compile. Only
+//.o and .o.tmp files are touched, everything else is left alone. keep_temps
+//spares the temporary objects, for when compiles are already running.
+//dry_run only names the orphans. Returns the number of objects removed.
+static int remove_orphan_objects(const char *obj_dir, char **sources, int src_count, int keep_temps, int dry_run) {
+    FileTable expected;
+    file_table_init(&expected);
+    char obj_name[1024];
     for (int i = 0; i < src_count; i++) {
-        const char *src      = sources[i];
-        const char *rel_path = get_last_path_segment(src);
-        if(truncate_file_name_at_file_extension(rel_path)) continue;
-
-        //Write the "object" to the obj directory. For simplified building, 
-        //we eliminate the relative path to the src in the obj dir and link against
-        //just a list of all .o files we need in one place. This is much cleaner. 
-        char obj_path[512];
-        snprintf(obj_path, sizeof(obj_path), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
-        ar_pos += snprintf(ar_cmd + ar_pos, sizeof(ar_cmd) - ar_pos, " %s", obj_path);
-    }
-    print_info(ar_cmd);
-    int ret = launch_process(ar_cmd,NULL);
-    if (ret != 0) {
-        print_error("Linking failed.");
-        return -1;
+        char *rel_path = get_last_path_segment(sources[i]);
+        if(!truncate_file_name_at_file_extension(rel_path)) {
+            snprintf(obj_name, sizeof(obj_name), "%s.o", rel_path);
+            file_table_intern(&expected, obj_name);
+        }
+        free(rel_path);
     }
-    return 0;
-}
 
+    int removed = 0;
+    char full_path[1024];
+    char msg[1200];
+#ifdef _WIN32
+    WIN32_FIND_DATA fd;
+    char search_path[MAX_PATH];
+    snprintf(search_path, MAX_PATH, "%s\\*.o*", obj_dir);
 
-int build_target_incremental_core(fortuna_toml_t *cfg,
-                                   char *maketop_cmd,
-                                   const char *compiler,
-                                   const char *flags_str,
-                                   const char *obj_dir,
-                                   const char *mod_dir,
-                                   const char *target_name,
-                                   char **exclude_files,
-                                   int parallel_build,
-                                   int incremental_build,
-                                   const int lib_only,
-                                   const int run_flag,
-                                   const int is_c) {
+    HANDLE hFind = FindFirstFile(search_path, &fd);
+    if (hFind != INVALID_HANDLE_VALUE) {
+        do {
+            if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+            if (is_temp_object_file(fd.cFileName)) {
+                if (keep_temps) continue;
+                snprintf(full_path, sizeof(full_path), "%s%c%s", obj_dir, PATH_SEP, fd.cFileName);
+                DeleteFile(full_path);
+                continue;
+            }
+            if (!is_object_file(fd.cFileName) || file_table_find(&expected, fd.cFileName) >= 0) continue;
+            snprintf(full_path, sizeof(full_path), "%s%c%s", obj_dir, PATH_SEP, fd.cFileName);
+            if (dry_run || DeleteFile(full_path)) {
+                snprintf(msg, sizeof(msg), dry_run ? "Remove orphan object %s" : "Removed orphan object %s", full_path);
+                print_info(msg);
+                removed++;
+            }
+        } while (FindNextFile(hFind, &fd));
+        FindClose(hFind);
+    }
+#else
+    DIR *dir = opendir(obj_dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (is_temp_object_file(entry->d_name)) {
+                if (keep_temps) continue;
+                snprintf(full_path, sizeof(full_path), "%s%c%s", obj_dir, PATH_SEP, entry->d_name);
+                unlink(full_path);
+                continue;
+            }
+            if (!is_object_file(entry->d_name) || file_table_find(&expected, entry->d_name) >= 0) continue;
+            snprintf(full_path, sizeof(full_path), "%s%c%s", obj_dir, PATH_SEP, entry->d_name);
+            if (dry_run || unlink(full_path) == 0) {
+                snprintf(msg, sizeof(msg), dry_run ? "Remove orphan object %s" : "Removed orphan object %s", full_path);
+                print_info(msg);
+                removed++;
+            }
+        }
+        closedir(dir);
+    }
+#endif
 
+    file_table_free(&expected);
+    return removed;
+}
 
-    //Set the return code
-    int return_code = 0;
+//With --pgo every object keeps its profile data in <pgo_data>/<name>.gcda, the
+//name of the object without .o, instead of next to wherever it was compiled.
+//That way the instrumented and the optimized objects can live in different
+//trees and still find the same data.
+static void format_pgo_args(char *buf, size_t size, const char *pgo_data, const char *obj_file) {
+    const char *name = obj_file;
+    for (const char *c = obj_file; *c; c++) {
+        if (*c == '/' || *c == '\\') name = c + 1;
+    }
+    size_t len = strlen(name);
+    if (len > 6 && strcmp(name + len - 6, ".o.tmp") == 0) len -= 6;
+    else if (len > 2 && strcmp(name + len - 2, ".o") == 0) len -= 2;
+    snprintf(buf, size, " -dumpdir %s%c -dumpbase %.*s", pgo_data, PATH_SEP, (int)len, name);
+}
 
-    //Still need the list of source files to link against.
-    char *topo_src= run_command_capture(maketop_cmd);
+//Single place the compile command is generated. The incremental cache fingerprints
+//this exact string, so building and fingerprinting must never format it differently.
+//pgo_data is the profile data directory of --pgo, NULL otherwise. The command is
+//allocated to its full length, flags of any length are never cut off.
+static char *format_compile_cmd(const char *compiler,
+                                const char *flags_str,
+                                const char *mod_dir,
+                                const char *src,
+                                const char *obj_file,
+                                const char *pgo_data,
+                                const int is_c) {
+    char pgo_args[1200] = "";
+    if (pgo_data) format_pgo_args(pgo_args, sizeof(pgo_args), pgo_data, obj_file);
+    size_t len = strlen(compiler) + strlen(flags_str) + strlen(pgo_args) + strlen(mod_dir) +
+                 strlen(src) + strlen(obj_file) + 16;
+    char *cmd = malloc(len);
+    if (!cmd) return NULL;
+    if(!is_c){
+        snprintf(cmd, len, "%s %s%s -J%s -c %s -o %s", compiler, flags_str, pgo_args, mod_dir, src, obj_file);
+    }else{
+        snprintf(cmd, len, "%s %s%s -c %s -o %s", compiler, flags_str, pgo_args, src, obj_file);
+    }
+    return cmd;
+}
 
-    //Allocate the hashmaps.
-    FileNode*  cur_map[HASH_TABLE_SIZE]  = {NULL};
-    HashEntry* prev_map[HASH_TABLE_SIZE] = {NULL};
-    
-    //Now we get the exclusion list (if it exists)
-    int exclusion_cnt = 0;
-    FileNode*  exclusion_map[HASH_TABLE_SIZE]  = {NULL};
-    if(exclude_files){
-        for(int i = 0; exclude_files[i]; i++){
-            insert_node(exclude_files[i],exclusion_map);
-            exclusion_cnt++;
-        }
+//The profile data file of a source, see format_pgo_args.
+static void pgo_data_file(char *buf, size_t size, const char *pgo_data, const char *src) {
+    char *rel_path = get_last_path_segment(src);
+    if (rel_path && !truncate_file_name_at_file_extension(rel_path)) {
+        snprintf(buf, size, "%s%c%s.gcda", pgo_data, PATH_SEP, rel_path);
+    } else {
+        buf[0] = '\0';
     }
+    free(rel_path);
+}
 
-    //Count the object files
-    int obj_cnt = count_files_in_directory(obj_dir);
+//One [[override]] of Fortuna.toml: the sources matching one of its globs are
+//compiled with its flags.
+typedef struct FlagOverride {
+    char **files;             // globs, relative to the project like the sources
+    char  *flags;             // joined for the pool, like its own flags
+} FlagOverride;
+
+//Flags of single sources instead of the ones of their pool: the sources of an
+//[[override]], and the cold sources of [hot], which are compiled with
+//[profile.cold] flags (see fortuna_hot.h). An override wins over [hot], and a
+//later override over an earlier one.
+typedef struct SourceFlags {
+    const HotSet       *hot;        // NULL without [hot]
+    const char         *cold;       // flags of the cold sources
+    const FlagOverride *overrides;
+    int                 noverrides;
+} SourceFlags;
+
+static int is_path_sep(char c) {
+    return c == '/' || c == '\\';
+}
 
-    //From the list of topologically sorted files, we need to parse them
-    //properly as they are a single string. 
-    char *line           = strtok(topo_src, "\n");
-    char **sources       = NULL;
-    int src_count        = 0;
-    char **tmp           = NULL;
-    while (line) {
-        tmp = realloc(sources, sizeof(char *)*(src_count + 1));
-        if (!tmp) {
-            print_error("Memory allocation error in parsing sources");
-            free(topo_src);
-            return_code = -1;
-            goto defer_hashmaps;
+//Glob match of a whole path. * and ? stay within a directory, ** matches any
+//number of them, and "**/" none as well. Both slashes are the same. A literal
+//part that differs rejects the path right there, so the usual "src/gen/**"
+//costs a prefix compare for the sources outside it.
+static int glob_match(const char *pat, const char *path) {
+    while (*pat) {
+        if (pat[0] == '*' && pat[1] == '*') {
+            pat += 2;
+            int whole_dirs = is_path_sep(*pat);
+            if (whole_dirs) pat++;
+            for (const char *p = path; ; p++) {
+                if ((!whole_dirs || p == path || is_path_sep(p[-1])) && glob_match(pat, p)) return 1;
+                if (!*p) return 0;
+            }
         }
-                
-        //Skip if this file is in the exclusion list
-        if(node_is_in_the_hashmap(line,exclusion_map)){
-            line = strtok(NULL, "\n");
-            continue;
+        if (*pat == '*') {
+            pat++;
+            for (const char *p = path; ; p++) {
+                if (glob_match(pat, p)) return 1;
+                if (!*p || is_path_sep(*p)) return 0;
+            }
         }
-
-        //Otherwise, add to the list of sources!
-        sources = tmp;
-        sources[src_count] = strdup(line);
-        src_count++;
-        line = strtok(NULL, "\n");
-
+        if (!*path) return 0;
+        if (*pat == '?') {
+            if (is_path_sep(*path)) return 0;
+        } else if (*pat != *path && !(is_path_sep(*pat) && is_path_sep(*path))) {
+            return 0;
+        }
+        pat++;
+        path++;
     }
+    return !*path;
+}
 
-    //Trigger a full rebuild because we don't have a match for the number of
-    //object files and the number of src files. We can't just rebuild some obj
-    //files and not others because this case would be weird enough that maybe a file
-    //was renamed to a different one and now we have a problem. 
-    if((src_count-exclusion_cnt) != (obj_cnt-exclusion_cnt)){
-        incremental_build = 0;
-        parallel_build    = 0;
-
-        //Need to remove the old object folder and then make a new one.
-        //No choice really, as the re-naming could cause problems and we
-        //need a fresh build to do this. 
-        if(mod_dir) {
-            remove_folder(mod_dir);
-            make_dir(mod_dir);
-        }
-        if(obj_dir){
-            remove_folder(obj_dir);
-            make_dir(obj_dir);
+//The [[override]] src falls under, -1 for none.
+static int match_override(const SourceFlags *sf, const char *src) {
+    if (src[0] == '.' && is_path_sep(src[1])) src += 2;
+    for (int o = sf ? sf->noverrides - 1 : -1; o >= 0; o--) {
+        for (int g = 0; sf->overrides[o].files[g]; g++) {
+            if (glob_match(sf->overrides[o].files[g], src)) return o;
         }
     }
+    return -1;
+}
 
-    //Define the rebuild count
-    int rebuild_cnt = 0;
+//The flags src is compiled with, flags_str unless it has its own. cold is set
+//for a cold source.
+static const char *source_flags(const SourceFlags *sf, const char *flags_str, const char *src, int *cold) {
+    if (cold) *cold = 0;
+    int o = match_override(sf, src);
+    if (o >= 0) return sf->overrides[o].flags;
+    if (!sf || !sf->hot) return flags_str;
+    char *rel_path = get_last_path_segment(src);
+    int is_cold = rel_path && !truncate_file_name_at_file_extension(rel_path) && hot_set_is_cold(sf->hot, rel_path);
+    free(rel_path);
+    if (cold) *cold = is_cold;
+    return is_cold ? sf->cold : flags_str;
+}
 
-    // Compile each source in parallel if asked.
-    thread_t *threads;
+//The working directory of fortuna, the project.
+static int current_dir(char *out, size_t size) {
+#ifdef _WIN32
+    DWORD n = GetCurrentDirectoryA((DWORD)size, out);
+    return (n > 0 && n < size) ? 0 : -1;
+#else
+    return getcwd(out, size) ? 0 : -1;
+#endif
+}
 
-    //The most threads we can have is all of them so this is a safe allocation. 
-    if(parallel_build) threads = (thread_t*)malloc(src_count*sizeof(thread_t));
+//Whether a path is relative to the working directory.
+static int is_relative_path(const char *path) {
+    if (path[0] == '/' || path[0] == '\\') return 0;
+    return !(isalpha((unsigned char)path[0]) && path[1] == ':');
+}
 
-    //Allocate the character buffers
-    char compile_cmd[2048];
-    char obj_file[1024];
-    char mod_file[1024];
+//path below root when it is relative, for a process that runs elsewhere.
+static char *rooted_path(const char *path, const char *root) {
+    if (!is_relative_path(path)) return strdup(path);
+    size_t len = strlen(root) + strlen(path) + 2;
+    char *out = malloc(len);
+    if (out) snprintf(out, len, "%s%c%s", root, PATH_SEP, path);
+    return out;
+}
 
-    //For the incremental build, we parse the dependency chain and rebuild. 
-    if(incremental_build){
-        strcat(maketop_cmd," -m");
-        char *topo_make = run_command_capture(maketop_cmd);
+//Compiler options that name a path, as "-Ipath" or "-I path".
+static const char *const path_options[] = {"-I", "-J", "-isystem", "-iquote", "-idirafter", "-include",
+                                           "-fprofile-use=", "-fprofile-generate=", "-fprofile-dir=", NULL};
 
-        //Write the new list to a file and then reload it. 
-        FILE* depedency_chain = fopen(deps_file ,"w+");
-        fprintf(depedency_chain,"%s",topo_make);
-        fclose(depedency_chain);
+//flags with the relative paths of path_options below root.
+static char *rooted_flags(const char *flags, const char *root) {
+    size_t len = strlen(flags) + strlen(root) + 2;
+    for (const char *p = flags; *p; p++) {
+        if (*p == ' ') len += strlen(root) + 1;
+    }
+    char *out  = malloc(len);
+    char *copy = strdup(flags);
+    if (!out || !copy) {
+        free(out);
+        free(copy);
+        return NULL;
+    }
 
-        //Parse the dependency file first
-        int res = parse_dependency_file(deps_file,cur_map);
-        if(!res){
-            print_error("Failed to make hash table of dependency graph\n");
-            return_code = -1;
-            goto defer_core;
+    size_t pos = 0;
+    int path_next = 0;
+    out[0] = '\0';
+    for (char *tok = strtok(copy, " "); tok; tok = strtok(NULL, " ")) {
+        const char *path = path_next ? tok : NULL;
+        path_next = 0;
+        for (int i = 0; !path && path_options[i]; i++) {
+            size_t n = strlen(path_options[i]);
+            if (strncmp(tok, path_options[i], n) != 0) continue;
+            if (tok[n]) path = tok + n;
+            else path_next = path_options[i][n - 1] != '=';
+            break;
         }
-            
-        //If hash file exists, load it and compare
-        if (file_exists(hash_cache_file)) {
-            load_prev_hashes(hash_cache_file,prev_map);
-            save_hashes(hash_cache_file,cur_map);
-            prune_obsolete_cached_entries(prev_map,cur_map);
-        }else{
-            print_error("Cannot do an incremental build with no history!");
-            print_error("Check that the .cache/hash.dep file exists.\n");
-            return_code = -1;
-            goto defer_core;
+        const char *sep = pos ? " " : "";
+        if (path && is_relative_path(path)) {
+            pos += (size_t)snprintf(out + pos, len - pos, "%s%.*s%s%c%s", sep, (int)(path - tok), tok, root, PATH_SEP, path);
+        } else {
+            pos += (size_t)snprintf(out + pos, len - pos, "%s%s", sep, tok);
         }
+    }
+    free(copy);
+    return out;
+}
 
-        //Check the hash table for what we need to build.
-        FileNode *rebuild_list = NULL;
-        for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-            FileNode *node = cur_map[i];
-            while (node) {
-                // Check if this node has changed
-                if (!file_is_unchanged(node->filename, node->file_hash, prev_map)) {
-                    // It changed — mark its dependents
-                    mark_dependents_for_rebuild(node->filename, cur_map, &rebuild_list, &rebuild_cnt);
-                }
+//Start of a compile command for several sources at once. Same as above up to
+//the sources, minus -o, which the compiler refuses with more than one source.
+//The objects are written to the directory the compiler runs in, so a batch
+//runs in a scratch directory and every path in it is below root, the project.
+static char *format_batch_prefix(const char *compiler,
+                                 const char *flags_str,
+                                 const char *mod_dir,
+                                 const char *root,
+                                 const int is_c) {
+    char *exe    = strpbrk(compiler, "/\\") ? rooted_path(compiler, root) : strdup(compiler);
+    char *flags  = rooted_flags(flags_str, root);
+    char *mod    = rooted_path(mod_dir, root);
+    char *prefix = NULL;
+    if (exe && flags && mod) {
+        size_t len = strlen(exe) + strlen(flags) + strlen(mod) + 16;
+        prefix = malloc(len);
+        if (prefix && !is_c) snprintf(prefix, len, "%s %s -J%s -c", exe, flags, mod);
+        else if (prefix)     snprintf(prefix, len, "%s %s -c", exe, flags);
+    }
+    free(exe);
+    free(flags);
+    free(mod);
+    return prefix;
+}
 
-                //Check the whether we built the mod file successfully on a previous run. 
-                const char* module_name = get_module_filename(node->filename);
-                if(module_name) {
-
-                    //If the mod files does not exist, we need to rebuild it.
-                    //This is because either the previous compilation failed
-                    //or the files were deleted/moved. Either way, we need it! 
-                    snprintf(mod_file, sizeof(mod_file), "%s%c%s", mod_dir, PATH_SEP, module_name);
-                    if(!file_exists(mod_file)) {
-                        append_to_rebuild_list(&rebuild_list, node->filename);
-                        rebuild_cnt++;
-                    }
-                }
-                node = node->next;
-            }
+//Attach the compile fingerprint to every node in the graph. A change of flags
+//or toolchain then looks exactly like a source change for that object. Objects
+//optimized with profile data (pgo_use) also change with their data file.
+static unsigned int assign_compile_fingerprints(DepGraph *graph,
+                                                const char *compiler,
+                                                const char *flags_str,
+                                                const SourceFlags *sf,
+                                                const char *obj_dir,
+                                                const char *mod_dir,
+                                                const char *pgo_data,
+                                                const int pgo_use,
+                                                const int is_c) {
+    unsigned int toolchain = toolchain_fingerprint(compiler);
+    char obj_file[1024];
+    for (int id = 0; id < graph->files.count; id++) {
+        const char *src = graph->files.names[id];
+        char *rel_path  = get_last_path_segment(src);
+        if(truncate_file_name_at_file_extension(rel_path)) {
+            free(rel_path);
+            continue;
         }
-
-        //Rebuild required if the rebuild list is not empty.
-        //Otherwise, we jump to our memory cleanup.
-        if(rebuild_list == NULL && lib_only == 0) {
-            if(!run_flag) print_info("Nothing to build");
-            return_code = 0;
-            goto defer_core;
+        snprintf(obj_file, sizeof(obj_file), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
+        char *compile_cmd = format_compile_cmd(compiler, source_flags(sf, flags_str, src, NULL), mod_dir, src,
+                                               obj_file, pgo_data, is_c);
+        if (!compile_cmd) {
+            print_error("Memory allocation error in fingerprinting the compile commands");
+            continue;
         }
+        graph->records[id].fingerprint = compile_fingerprint(toolchain, compile_cmd);
+        free(compile_cmd);
+        if (pgo_use) {
+            char gcda[1100], digest[CACHE_KEY_HEX];
+            ActionKey ak;
+            pgo_data_file(gcda, sizeof(gcda), pgo_data, src);
+            action_key_init(&ak);
+            if (file_exists(gcda)) action_key_add_file(&ak, gcda);
+            action_key_final(&ak, digest);
+            graph->records[id].fingerprint = compile_fingerprint(graph->records[id].fingerprint, digest);
+        }
+        free(rel_path);
+    }
+    return toolchain;
+}
 
-        //Compile each source only if it changed and needs to be rebuilt. 
-        int node_cnt   = 0;
-        FileNode *curr = rebuild_list;
-        while(curr && node_cnt != rebuild_cnt){
-            const char *src = curr->filename;
-
-            //Check the exclusion list here. This can break a build,
-            //but that is the correct behavior if asked. 
-            if(node_is_in_the_hashmap(src,exclusion_map)) {
-                curr = curr->next;
-                continue;
-            }
-
-            //Otherwise continue on 
-            const char *rel_path = get_last_path_segment(src);
-            if(truncate_file_name_at_file_extension(rel_path)) continue;
-
-            //Write the object file name to a string
-            snprintf(obj_file, sizeof(obj_file), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
-
-            //Generate the compile command
-            if(!is_c){
-                snprintf(compile_cmd, sizeof(compile_cmd), "%s %s -J%s -c %s -o %s",
-                         compiler, flags_str, mod_dir, src, obj_file);
-            }else{
-                snprintf(compile_cmd, sizeof(compile_cmd), "%s %s -c %s -o %s",
-                         compiler, flags_str, src, obj_file);
-            }
-
-            //Print the info
-            print_info(compile_cmd);
 
-            //Parallel build logic.
-            if(!parallel_build){
-                int ret = launch_process(compile_cmd,NULL);
-                if (ret != 0) {
-                    print_error("Compilation failed.");
-                    free(topo_make);
-                    free(rebuild_list); 
-                    return_code = -1;
-                    goto defer_core;
-                }
-            }else{
-                //Copy the command to a per thread buffer to avoid conflicts. 
-                char *compile_cmd_ts = strdup(compile_cmd);
-                if (thread_create(&threads[rebuild_cnt++], compile_system_worker, compile_cmd_ts) != 0) {
-                    print_error("Failed to create thread");
-                    free(topo_make);
-                    free(rebuild_list); 
-                    return_code = -1;
-                    goto defer_core;
-                }
-            }
+//Libary build
+//Link and ar commands longer than this get their objects from a response file
+//(@file) instead. The command line is limited to 8191 characters on Windows,
+//and big links are easier to read this way anyway.
+#define COMMAND_LINE_MAX 8191
+
+//Where the response file of a target goes: in the cache directory of its
+//build, named after the target.
+static void response_file_path(char *out, size_t size, const char *cache_dir, const char *name, const char *suffix) {
+    int len = snprintf(out, size, "%s/", cache_dir);
+    for (const char *c = name; *c && len + 1 < (int)size; c++) {
+        out[len++] = (*c == '/' || *c == '\\' || *c == ':') ? '_' : *c;
+    }
+    out[len] = '\0';
+    snprintf(out + len, size - len, "%s", suffix);
+}
 
-            //Next node
-            curr = curr->next;
-            node_cnt++;
+//One argument per line, with a backslash in front of every character gcc, ld
+//and ar would otherwise split on or unquote (Windows paths included).
+static char *format_response_file(char **args, int nargs) {
+    size_t len = 1;
+    for (int i = 0; i < nargs; i++) len += 2 * strlen(args[i]) + 1;
+    char *text = malloc(len);
+    if (!text) return NULL;
+    size_t pos = 0;
+    for (int i = 0; i < nargs; i++) {
+        for (const char *c = args[i]; *c; c++) {
+            if (isspace((unsigned char)*c) || *c == '\\' || *c == '"' || *c == '\'') text[pos++] = '\\';
+            text[pos++] = *c;
         }
+        text[pos++] = '\n';
+    }
+    text[pos] = '\0';
+    return text;
+}
 
-        //Free the topo_make here and then free the rebuild list. 
-        free(topo_make);
-        free(rebuild_list);
-    }else{
-        for (int i = 0; i < src_count; i++) {
+static int write_response_file(const char *path, char **args, int nargs) {
+    char *text = format_response_file(args, nargs);
+    FILE *f = text ? fopen(path, "w") : NULL;
+    if (!f) {
+        free(text);
+        return -1;
+    }
+    fputs(text, f);
+    free(text);
+    return fclose(f) == 0 ? 0 : -1;
+}
 
-            const char *src      = sources[i];
-            const char *rel_path = get_last_path_segment(src);
-            if(truncate_file_name_at_file_extension(rel_path)) continue;
+//Whether the response file at path holds exactly these arguments.
+static int response_file_matches(const char *path, char **args, int nargs) {
+    char *text = format_response_file(args, nargs);
+    FILE *f = text ? fopen(path, "r") : NULL;
+    if (!f) {
+        free(text);
+        return 0;
+    }
+    size_t len = strlen(text), pos = 0;
+    int c, same = 1;
+    while (same && (c = fgetc(f)) != EOF) same = pos < len && text[pos++] == (char)c;
+    fclose(f);
+    same = same && pos == len;
+    free(text);
+    return same;
+}
 
-            //Skip files if requested. 
-            if(node_is_in_the_hashmap(src,exclusion_map)) {
-                continue;
-            }
+//The objects of a link or an archive as arguments, each one with a leading
+//space: inline, or as @rsp_path when the command would not fit
+//COMMAND_LINE_MAX. rest is the length of the command without them.
+static char *format_object_args(char **objs, int nobjs, size_t rest, const char *rsp_path) {
+    size_t len = 1;
+    for (int i = 0; i < nobjs; i++) len += strlen(objs[i]) + 1;
+
+    if (rest + len > COMMAND_LINE_MAX) {
+        if (write_response_file(rsp_path, objs, nobjs) != 0) {
+            char msg[1200];
+            snprintf(msg, sizeof(msg), "Failed to write the response file %s", rsp_path);
+            print_error(msg);
+            return NULL;
+        }
+        char *arg = malloc(strlen(rsp_path) + 3);
+        if (arg) sprintf(arg, " @%s", rsp_path);
+        return arg;
+    }
 
-            snprintf(obj_file, sizeof(obj_file), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
+    char *args = malloc(len);
+    if (!args) return NULL;
+    size_t pos = 0;
+    args[0] = '\0';
+    for (int i = 0; i < nobjs; i++) pos += snprintf(args + pos, len - pos, " %s", objs[i]);
+    return args;
+}
 
-            if(!is_c){
-                snprintf(compile_cmd, sizeof(compile_cmd), "%s %s -J%s -c %s -o %s",
-                         compiler, flags_str, mod_dir, src, obj_file);
-            }else{
-                snprintf(compile_cmd, sizeof(compile_cmd), "%s %s -c %s -o %s",
-                         compiler, flags_str, src, obj_file);
-            }
+//What went into the archive at the last ar run: the first line says how it
+//was built, then one member per line as "<mtime> <size> <object>". A member
+//is replaced when its object changed since, or was compiled by this build
+//(mtime only has seconds), and deleted when its source is gone.
+#define AR_MEMBERS_HEADER "fortuna-ar 1"
+
+typedef struct ArMembers {
+    FileTable  objs;
+    long long *mtime;
+    long long *size;
+} ArMembers;
+
+static void ar_members_free(ArMembers *m) {
+    file_table_free(&m->objs);
+    free(m->mtime);
+    free(m->size);
+}
 
-            //Print the info
-            print_info(compile_cmd);
+static int ar_members_add(ArMembers *m, const char *obj, long long mtime, long long size) {
+    int id = file_table_intern(&m->objs, obj);
+    if (id < 0) return -1;
+    long long *t = realloc(m->mtime, sizeof(long long) * m->objs.count);
+    if (!t) return -1;
+    m->mtime = t;
+    long long *s = realloc(m->size, sizeof(long long) * m->objs.count);
+    if (!s) return -1;
+    m->size = s;
+    m->mtime[id] = mtime;
+    m->size[id]  = size;
+    return 0;
+}
 
-            //Check if we issue a sys call or spawn a thread to do it.
-            if(!parallel_build){
-                int ret = launch_process(compile_cmd,NULL);
-                if (ret != 0) {
-                    print_error("Compilation failed.");
-                    return_code = -1;
-                    goto defer_core;
-                }
-            }else{
-                //Copy the command to a per thread buffer to avoid conflicts. 
-                char *compile_cmd_ts = strdup(compile_cmd);
-                if (thread_create(&threads[i], compile_system_worker, compile_cmd_ts) != 0) {
-                    print_error("Failed to create thread");
-                    return_code = -1;
-                    goto defer_core;
-                }
-            }
+//Returns 0 when the file was there and built the same way (thin or not).
+static int ar_members_load(ArMembers *m, const char *path, int thin) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[1200];
+    int mode = -1;
+    if (!fgets(line, sizeof(line), f) || sscanf(line, AR_MEMBERS_HEADER " %d", &mode) != 1 || mode != thin) {
+        fclose(f);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        long long mtime, size;
+        int off = 0;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (sscanf(line, "%lld %lld %n", &mtime, &size, &off) != 2 || !line[off]) continue;
+        if (ar_members_add(m, line + off, mtime, size) != 0) {
+            fclose(f);
+            return -1;
         }
     }
+    fclose(f);
+    return 0;
+}
 
-    
-    //If waiting on a parallel build, we finish up here by joining all the threads.
-    if(parallel_build){
-        int num_threads_spawned = (incremental_build) ? rebuild_cnt : src_count;
-        for (int i = 0; i < num_threads_spawned; i++) {
-            thread_join(threads[i]);
-        }
+static int ar_members_save(const ArMembers *m, const char *path, int thin) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, AR_MEMBERS_HEADER " %d\n", thin);
+    for (int i = 0; i < m->objs.count; i++) {
+        fprintf(f, "%lld %lld %s\n", m->mtime[i], m->size[i], m->objs.names[i]);
     }
+    return fclose(f) == 0 ? 0 : -1;
+}
 
-    //Check if we are building a library or not.
-    const char* lib = fortuna_toml_get_string(cfg, "lib.target");
-    if(lib != NULL && lib_only == 0) {
-        if(build_library(sources,src_count,obj_dir,lib) == -1){
-            print_error("Failed to link library. Check if ar is installed and if the paths are correct.");
-            return_code = -1;
-            goto defer_core;
-        }
-    }else if(lib != NULL && lib_only == 1){
-        //If lib only, we skip linking the executable.
-        goto skip_linking;
-    }else if(lib == NULL && lib_only == 1){
-        //If lib == NULL but we requested a lib only run, error out. 
-        print_error("No target lib found in Fortuna.toml");
-        return_code = -1;
-        goto defer_core;
+//Whether lib/<lib_name> has to be written although no object changed: it is
+//missing, was built the other way (thin or not), or the last ar run failed.
+static int library_outdated(const char *lib_name, const char *cache_dir, int thin) {
+    char lib_path[1024], members_path[1024];
+    snprintf(lib_path, sizeof(lib_path), "lib%c%s", PATH_SEP, lib_name);
+    response_file_path(members_path, sizeof(members_path), cache_dir, lib_name, ".ar.members");
+    if (!file_exists(lib_path)) return 1;
+
+    ArMembers last = {0};
+    file_table_init(&last.objs);
+    int outdated = ar_members_load(&last, members_path, thin) != 0;
+    ar_members_free(&last);
+    return outdated;
+}
+
+//Run "<ar> <op> lib/<lib_name> <objs>" through the shell like the compiles, the
+//objects in a response file when there are many of them. Returns the exit code
+//of ar.
+static int run_ar(const char *ar, const char *op, const char *lib_name, char **objs, int nobjs, const char *rsp_path) {
+    size_t len = strlen(ar) + strlen(op) + strlen(lib_name) + 32;
+    char *obj_args = format_object_args(objs, nobjs, len, rsp_path);
+    if (!obj_args) return -1;
+
+    len += strlen(obj_args);
+    char *ar_cmd = malloc(len);
+    if (!ar_cmd) {
+        free(obj_args);
+        return -1;
     }
+    snprintf(ar_cmd, len, "%s %s %s%c%s%s", ar, op, "lib", PATH_SEP, lib_name, obj_args);
+    free(obj_args);
+
+    print_info(ar_cmd);
+    stats_count(STAT_PROCESSES, 1);
+    ProcessStats st = {0};
+    int ret = launch_process_stats(ar_cmd, NULL, &st);
+    free(ar_cmd);
+    return ret;
+}
 
-    // Link
-    char link_cmd[4096] = {0};
-    size_t link_pos = 0;
-    link_pos += snprintf(link_cmd + link_pos, sizeof(link_cmd) - link_pos, "%s %s", compiler, flags_str);
+//Brings lib/<lib_name> up to date with the objects of sources. With full (or
+//without a member list from the last run) the archive is written from scratch,
+//otherwise only the members whose objects changed are replaced (ar r) and the
+//ones whose sources are gone deleted (ar d). rebuilt holds the sources this
+//build compiled. A thin archive (ar T) only holds the paths of the objects in
+//obj_dir and their symbols, so it is written again whenever anything changed.
+//ar is the archiver, one that knows LTO objects with [build] lto.
+int build_library(char** sources, int src_count, const char* obj_dir, const char *cache_dir,
+                  const char* lib_name, const FileTable *rebuilt, int thin, int full, const char *ar){
+    char lib_path[1024], members_path[1024], rsp_path[1024];
+    snprintf(lib_path, sizeof(lib_path), "lib%c%s", PATH_SEP, lib_name);
+    response_file_path(members_path, sizeof(members_path), cache_dir, lib_name, ".ar.members");
+    response_file_path(rsp_path, sizeof(rsp_path), cache_dir, lib_name, ".ar.rsp");
+
+    ArMembers now  = {0};
+    ArMembers last = {0};
+    file_table_init(&now.objs);
+    file_table_init(&last.objs);
+    char **changed     = malloc(sizeof(char *) * (src_count ? src_count : 1));
+    const char **owner = malloc(sizeof(char *) * (src_count ? src_count : 1));
+    char **removed     = NULL;
+    int nchanged = 0, nremoved = 0;
+    int ret = -1;
+    if (!changed || !owner) goto defer_lib;
 
-    //Link all the objects files. We check if the file exists to prevent issues.
-    char obj_path[512];
     for (int i = 0; i < src_count; i++) {
-        const char *src      = sources[i];
-        const char *rel_path = get_last_path_segment(src);
-        if(truncate_file_name_at_file_extension(rel_path)) continue;
+        const char *src = sources[i];
+        char *rel_path  = get_last_path_segment(src);
+        if(truncate_file_name_at_file_extension(rel_path)) {
+            free(rel_path);
+            continue;
+        }
 
         //Write the "object" to the obj directory. For simplified building, 
         //we eliminate the relative path to the src in the obj dir and link against
-        //just the object in the specified folder.
+        //just a list of all .o files we need in one place. This is much cleaner. 
+        char obj_path[1024];
         snprintf(obj_path, sizeof(obj_path), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
+        free(rel_path);
 
-        //Check if the obj file actually built and/or still exists.
-        if(!file_exists(obj_path)){
-            char msg[256];
+        struct stat st;
+        if (stat(obj_path, &st) != 0) {
+            char msg[1100];
             snprintf(msg, sizeof(msg), "Object file %s does not exist.", obj_path);
             print_error(msg);
-            return_code = -1;
-            goto defer_core;
+            goto defer_lib;
         }
-
-        //Add to the command string.
-        link_pos += snprintf(link_cmd + link_pos, sizeof(link_cmd) - link_pos, " %s", obj_path);
+        if (ar_members_add(&now, obj_path, (long long)st.st_mtime, (long long)st.st_size) != 0) goto defer_lib;
+        owner[file_table_find(&now.objs, obj_path)] = src;
     }
 
-    //Link with the libraries (if they exist).
-    char **source_libs = fortuna_toml_get_array(cfg, "library.source-libs");
-    if (!source_libs) source_libs = NULL;
-    if (source_libs ) {
-        for (int i = 0; source_libs[i]; i++) {
-            link_pos += snprintf(link_cmd + link_pos, sizeof(link_cmd) - link_pos, " %s", source_libs[i]);
+    int rewrite = full || !file_exists(lib_path) || ar_members_load(&last, members_path, thin) != 0;
+    if (!rewrite) {
+        for (int i = 0; i < now.objs.count; i++) {
+            const char *obj = now.objs.names[i];
+            int id = file_table_find(&last.objs, obj);
+            if (id < 0 || last.mtime[id] != now.mtime[i] || last.size[id] != now.size[i] ||
+                file_table_find(rebuilt, owner[i]) >= 0) {
+                changed[nchanged++] = now.objs.names[i];
+            }
         }
-    }
 
-    //Build the final link command
-    link_pos += snprintf(link_cmd + link_pos, sizeof(link_cmd) - link_pos, " -o %s", target_name);
+        //Members are named after the object without its directory.
+        removed = malloc(sizeof(char *) * (last.objs.count ? last.objs.count : 1));
+        if (!removed) goto defer_lib;
+        for (int i = 0; i < last.objs.count; i++) {
+            if (file_table_find(&now.objs, last.objs.names[i]) >= 0) continue;
+            char *name = get_last_path_segment(last.objs.names[i]);
+            if (name) removed[nremoved++] = name;
+        }
 
-    //Execute the link command
-    print_info(link_cmd);
-    int ret = launch_process(link_cmd,NULL);
-    if (ret != 0) {
-        print_error("Linking failed.");
-        return_code = -1;
-        goto defer_core;
+        if (nchanged == 0 && nremoved == 0) {
+            ret = 0;
+            goto defer_lib;
+        }
+        rewrite = thin;
     }
 
+    //From here on the member list is stale until it is written again.
+    remove(members_path);
+    if (rewrite) {
+        //Written from scratch, so members of sources that are gone don't linger.
+        remove(lib_path);
+        nchanged = 0;
+        for (int i = 0; i < now.objs.count; i++) changed[nchanged++] = now.objs.names[i];
+        if (run_ar(ar, thin ? "rcsT" : "rcs", lib_name, changed, nchanged, rsp_path) != 0) goto defer_lib;
+    } else {
+        if (nremoved > 0 && run_ar(ar, nchanged > 0 ? "d" : "ds", lib_name, removed, nremoved, rsp_path) != 0) goto defer_lib;
+        if (nchanged > 0 && run_ar(ar, "rs", lib_name, changed, nchanged, rsp_path) != 0) goto defer_lib;
+    }
 
-    //Skip linking jump if we don't want to link.
-    skip_linking:
-    print_ok("Built Successfully");
+    if (ar_members_save(&now, members_path, thin) != 0) print_info("Could not save the member list of the library, the next build writes it again.");
+    ret = 0;
+
+defer_lib:
+    if (ret != 0) print_error("Linking failed.");
+    for (int i = 0; i < nremoved; i++) free(removed[i]);
+    free(removed);
+    free(changed);
+    free(owner);
+    ar_members_free(&now);
+    ar_members_free(&last);
+    return ret;
+}
 
 
-    //If we aren't on an incremental build, we need to dump everything
-    //to the .cache files here for the first run. 
-    if(!incremental_build){
-         //For the incremental build, we parse the files!
-        strcat(maketop_cmd," -m");
-        char *topo_make = run_command_capture(maketop_cmd);
+//One object being compiled by the scheduler.
+typedef struct CompileUnit {
+    int   id;               // graph id of the source
+    int   built;            // obj_tmp holds a good object
+    char *cmd;              // compile command of this file on its own
+    char *iface_cmd;        // -fsyntax-only pass writing its modules, or NULL
+    char *src;              // streamed compiles only, they have no graph id
+    char **deps;            // streamed compiles only, the sources it uses
+    int   ndeps;
+    char  obj_file[1024];
+    char  obj_tmp[1040];    // the compiler writes here, renamed on success
+    char  obj_batch[512];   // object name of a batched compile (no -o)
+    char  key[CACHE_KEY_HEX];
+    int   own_flags;        // compiled with flags of its own, never batched
+    int   cold;             // a cold source of [hot]
+    double seconds;         // compile time, 0 when it came from a cache
+    double cpu_seconds;     // CPU time of the compiler, 0 on a remote worker
+    long   peak_rss_kb;
+} CompileUnit;
+
+//One program linked from the object pool of a build, see
+//fortuna_build_project_incremental. Its link is a job of the build that waits
+//on the compiles of its objects, so every target links as soon as they are done.
+typedef struct LinkTarget {
+    const char *name;          // output file
+    const char *main;          // source of its main program, NULL for [build] target
+    int         needs_program; // [build] target next to [bin] ones, see link_plan
+    int         skip;          // not linked, no program left for it
+    char       *sources;       // per source of the build, whether it is linked in
+    char       *cmd;           // link command, once the objects are known
+} LinkTarget;
+
+//What one scheduler job compiles: a single file, or with [build] batch a group
+//of independent files from the same level of the graph in one invocation.
+//With [build] two_phase a file others use also gets an interface job, which
+//only writes its module files. The link of a target is a job too.
+typedef struct CompileBatch {
+    CompileUnit **units;
+    int           count;
+    int           interface;  // run units[0]->iface_cmd, no object
+    int           streamed;   // started from the scanner output, see ScanStream
+    LinkTarget   *link;       // run link->cmd, there are no units
+} CompileBatch;
+
+typedef struct BuildContext {
+    DepGraph     *graph;
+    FILE         *journal;
+    ActionCache  *cache;          // NULL when the build cache is off
+    char       ***module_outputs; // id -> list_module_outputs, with a cache or workers
+    const char   *obj_dir;
+    const char   *mod_dir;
+    unsigned int  toolchain;
+    WorkerPool   *workers;        // NULL without [distributed] workers
+    int           local_lanes;    // lanes past these are remote slots
+    const char   *batch_prefix;   // compile command up to the sources, for batches
+    const char   *root;           // the project directory, batches run elsewhere
+    const char   *pgo_use_data;   // --pgo, the profile data the compiles read
+    Trace        *trace;          // --trace, NULL without
+} BuildContext;
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
 
-        //Build the dependency table and save to file.
-        FILE* depedency_chain = fopen(deps_file ,"w+");
-        fprintf(depedency_chain,"%s",topo_make);
-        fclose(depedency_chain);
+//Action key of one compile: the source, the exact command, the toolchain, and
+//the interface of everything it uses. A used module counts through its .mod and
+//.smod files, so changing only the body of a module still hits for its users.
+//Anything used without module files (an include) counts through its contents.
+//names are the sources it uses. Their module files come from the graph, or
+//with from_graph = 0 (a streamed compile, the graph doesn't exist yet) from
+//reading them.
+static void hash_action(BuildContext *build, const char *src, const char *cmd,
+                        char **names, int n, int from_graph, char key[CACHE_KEY_HEX]) {
+    ActionKey ak;
+    action_key_init(&ak);
+    action_key_add_file(&ak, src);
+    action_key_add_str(&ak, cmd);
+    action_key_add(&ak, &build->toolchain, sizeof(build->toolchain));
+    if (build->pgo_use_data) {
+        char gcda[1100];
+        pgo_data_file(gcda, sizeof(gcda), build->pgo_use_data, src);
+        if (gcda[0] && file_exists(gcda)) action_key_add_file(&ak, gcda);
+    }
 
-        //Load it into memory or the hashmap is empty on save. 
-        parse_dependency_file(deps_file,cur_map);
+    //Paths differ between checkouts, so dependencies go in by content in a
+    //fixed order.
+    qsort(names, n, sizeof(char *), compare_names);
 
-        //Save hashes for the current state of the project. 
-        save_hashes(hash_cache_file,cur_map);
+    char mod_file[1024];
+    for (int i = 0; i < n; i++) {
+        char **outputs = from_graph ? build->module_outputs[file_table_find(&build->graph->files, names[i])]
+                                    : list_module_outputs(names[i]);
+        int found = 0;
+        for (int k = 0; outputs && outputs[k]; k++) {
+            snprintf(mod_file, sizeof(mod_file), "%s%c%s", build->mod_dir, PATH_SEP, outputs[k]);
+            if (!file_exists(mod_file)) continue;
+            action_key_add_str(&ak, outputs[k]);
+            action_key_add_file(&ak, mod_file);
+            found = 1;
+        }
+        if (!found) action_key_add_file(&ak, names[i]);
+        if (!from_graph) free_string_list(outputs);
     }
+    action_key_final(&ak, key);
+}
 
-defer_core:
-    if(parallel_build) free(threads);
-
-defer_hashmaps:
-    free_prev_hash_table(prev_map);
-    free_all(cur_map);
-    free_all(exclusion_map);
+static void compute_action_key(BuildContext *build, int id, const char *cmd, char key[CACHE_KEY_HEX]) {
+    DepGraph *graph = build->graph;
+    const IdList *uses = &graph->dependencies[id];
+    char **names = malloc(sizeof(char *) * (uses->count ? uses->count : 1));
+    int n = 0;
+    for (int i = 0; names && i < uses->count; i++) names[n++] = graph->files.names[uses->ids[i]];
+    hash_action(build, graph->files.names[id], cmd, names, n, 1, key);
+    free(names);
+}
 
-    return return_code;
+//Only paths inside the project can be recreated on a worker.
+static int is_project_path(const char *path) {
+    if (!*path || path[0] == '/' || path[0] == '\\' || strchr(path, ':')) return 0;
+    return strstr(path, "..") == NULL;
 }
 
+//Ships a compile to the worker behind a remote lane: the source plus everything
+//it uses, directly or through other files, as module files when it has them and
+//as source otherwise. Returns -1 when the job has to run locally.
+static int remote_compile(BuildContext *build, const CompileUnit *unit, int lane, int *exit_code) {
+    DepGraph *graph = build->graph;
+    const char *src = graph->files.names[unit->id];
+    if (!is_project_path(src) || !is_project_path(build->obj_dir) || !is_project_path(build->mod_dir)) return -1;
+
+    char  *seen  = calloc(graph->files.count, 1);
+    int   *stack = malloc(sizeof(int) * graph->files.count);
+    char **files = NULL;
+    int    nfiles = 0;
+    int    ok = seen && stack;
+    if (ok) push_output(&files, &nfiles, src);
+
+    int top = 0;
+    if (ok) {
+        seen[unit->id] = 1;
+        stack[top++]   = unit->id;
+    }
+    char mod_file[1024];
+    while (ok && top > 0) {
+        const IdList *uses = &graph->dependencies[stack[--top]];
+        for (int i = 0; ok && i < uses->count; i++) {
+            int dep = uses->ids[i];
+            if (seen[dep]) continue;
+            seen[dep]     = 1;
+            stack[top++]  = dep;
+
+            char **outputs = build->module_outputs[dep];
+            int found = 0;
+            for (int k = 0; outputs && outputs[k]; k++) {
+                snprintf(mod_file, sizeof(mod_file), "%s%c%s", build->mod_dir, PATH_SEP, outputs[k]);
+                if (!file_exists(mod_file)) continue;
+                push_output(&files, &nfiles, mod_file);
+                found = 1;
+            }
+            if (!found) {
+                ok = is_project_path(graph->files.names[dep]);
+                push_output(&files, &nfiles, graph->files.names[dep]);
+            }
+        }
+    }
+    free(seen);
+    free(stack);
+
+    int ret = -1;
+    if (ok) {
+        char *dirs[] = { (char *)build->obj_dir, (char *)build->mod_dir, NULL };
+        RemoteJob remote = { unit->cmd, unit->obj_tmp, unit->obj_tmp, build->mod_dir, dirs, files };
+        int slot = lane - build->local_lanes;
+
+        char msg[2400];
+        snprintf(msg, sizeof(msg), "%s (on %s)", unit->cmd, worker_pool_slot_name(build->workers, slot));
+        print_info(msg);
+        ret = worker_pool_compile(build->workers, slot, &remote, exit_code);
+    }
+    free_string_list(files);
+    return ret;
+}
+
+//With a cache, restore the outputs of a compile the cache has seen before.
+static int restore_from_cache(BuildContext *build, CompileUnit *unit) {
+    if (!build->cache) return 0;
+    compute_action_key(build, unit->id, unit->cmd, unit->key);
+    if (!action_cache_fetch(build->cache, unit->key, unit->obj_tmp, build->mod_dir)) return 0;
+
+    char msg[1200];
+    snprintf(msg, sizeof(msg), "Restored %s from the build cache", build->graph->files.names[unit->id]);
+    print_info(msg);
+    unit->built = 1;
+    return 1;
+}
+
+//Runs a compiler or linker in dir (NULL for the project) and measures it into
+//one, for the compile history and --trace. The CPU time adds to the job's, and
+//the peak RSS is the job's when it is the largest.
+static int run_tool(const char *cmd, const char *dir, ProcessStats *one, ProcessStats *st) {
+    stats_count(STAT_PROCESSES, 1);
+    int ret = launch_process_stats(cmd, dir, one);
+    st->cpu_seconds += one->cpu_seconds;
+    if (one->peak_rss_kb > st->peak_rss_kb) st->peak_rss_kb = one->peak_rss_kb;
+    return ret;
+}
+
+//Compile one file, on the worker behind the lane when it is a remote one.
+static int compile_single(BuildContext *build, CompileUnit *unit, int lane, ProcessStats *st) {
+    int ret;
+    ProcessStats one = {0};
+    double start = now_seconds();
+    if (lane < build->local_lanes || remote_compile(build, unit, lane, &ret) != 0) {
+        print_info(unit->cmd);
+        ret = run_tool(unit->cmd, NULL, &one, st);
+    }
+    unit->built       = ret == 0;
+    unit->seconds     = now_seconds() - start;
+    unit->cpu_seconds = one.cpu_seconds;
+    unit->peak_rss_kb = one.peak_rss_kb;
+    return ret;
+}
+
+//One compiler invocation for several files. Without -o the objects land in the
+//working directory, so the batch runs in <obj_dir>/.batch-<lane>, a scratch
+//directory of its lane, and the objects are moved to their temporary names
+//from there. A failed batch is split in halves until the files that fail are
+//found on their own.
+static int compile_batch(BuildContext *build, CompileUnit **units, int count, int lane, ProcessStats *st) {
+    if (count == 0) return 0;
+    if (count == 1) return compile_single(build, units[0], 0, st);
+
+    char scratch[1100];
+    snprintf(scratch, sizeof(scratch), "%s%c.batch-%d", build->obj_dir, PATH_SEP, lane);
+    if (make_path(scratch) != 0) {
+        char msg[1200];
+        snprintf(msg, sizeof(msg), "Failed to create the batch directory %s", scratch);
+        print_error(msg);
+        return -1;
+    }
+
+    size_t len = strlen(build->batch_prefix) + 1;
+    for (int i = 0; i < count; i++) len += strlen(build->root) + strlen(build->graph->files.names[units[i]->id]) + 2;
+    char *cmd = malloc(len);
+    if (!cmd) return -1;
+    size_t pos = (size_t)snprintf(cmd, len, "%s", build->batch_prefix);
+    for (int i = 0; i < count; i++) {
+        const char *src = build->graph->files.names[units[i]->id];
+        if (is_relative_path(src)) pos += (size_t)snprintf(cmd + pos, len - pos, " %s%c%s", build->root, PATH_SEP, src);
+        else                       pos += (size_t)snprintf(cmd + pos, len - pos, " %s", src);
+    }
+
+    //The files of a batch share its time, and its peak RSS is theirs.
+    print_info(cmd);
+    ProcessStats one = {0};
+    double start = now_seconds();
+    int ret = run_tool(cmd, scratch, &one, st);
+    double share = (now_seconds() - start) / count;
+    free(cmd);
+
+    char obj[sizeof(scratch) + sizeof(units[0]->obj_batch)];
+    if (ret == 0) {
+        for (int i = 0; i < count; i++) {
+            snprintf(obj, sizeof(obj), "%s%c%s", scratch, PATH_SEP, units[i]->obj_batch);
+            if (replace_file(obj, units[i]->obj_tmp) == 0) units[i]->built = 1;
+            else ret = -1;
+            units[i]->seconds     = share;
+            units[i]->cpu_seconds = one.cpu_seconds / count;
+            units[i]->peak_rss_kb = one.peak_rss_kb;
+        }
+        return ret;
+    }
+
+    for (int i = 0; i < count; i++) {
+        snprintf(obj, sizeof(obj), "%s%c%s", scratch, PATH_SEP, units[i]->obj_batch);
+        remove(obj);
+    }
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Batch of %d files failed, splitting it to find the culprit", count);
+    print_info(msg);
+    int half   = count / 2;
+    int first  = compile_batch(build, units, half, lane, st);
+    int second = compile_batch(build, units + half, count - half, lane, st);
+    return first ? first : second;
+}
+
+//A compile started from the scanner output while the graph doesn't exist yet
+//(see ScanStream). Compiles locally, through the build cache like any other.
+static int compile_streamed(BuildContext *build, CompileUnit *unit, ProcessStats *st) {
+    if (build->cache) {
+        hash_action(build, unit->src, unit->cmd, unit->deps, unit->ndeps, 0, unit->key);
+        if (action_cache_fetch(build->cache, unit->key, unit->obj_tmp, build->mod_dir)) {
+            char msg[1200];
+            snprintf(msg, sizeof(msg), "Restored %s from the build cache", unit->src);
+            print_info(msg);
+            unit->built = 1;
+            return 0;
+        }
+    }
+
+    print_info(unit->cmd);
+    ProcessStats one = {0};
+    double start = now_seconds();
+    int ret = run_tool(unit->cmd, NULL, &one, st);
+    unit->built       = ret == 0;
+    unit->seconds     = now_seconds() - start;
+    unit->cpu_seconds = one.cpu_seconds;
+    unit->peak_rss_kb = one.peak_rss_kb;
+    if (unit->built && build->cache) {
+        char **outputs = list_module_outputs(unit->src);
+        action_cache_store(build->cache, unit->key, unit->obj_tmp, build->mod_dir, outputs);
+        free_string_list(outputs);
+    }
+    return ret;
+}
+
+//Runs a job on a scheduler worker. With a cache the outputs of every file are
+//restored when the action is known, and stored after a successful compile
+//otherwise. A single file on a remote lane is sent to its worker.
+static int run_job(BuildContext *build, const SchedJob *job, ProcessStats *st) {
+    CompileBatch *batch = (CompileBatch *)job->user;
+    ProcessStats one = {0};
+
+    if (batch->link) {
+        print_info(batch->link->cmd);
+        return run_tool(batch->link->cmd, NULL, &one, st);
+    }
+    if (batch->interface) {
+        print_info(batch->units[0]->iface_cmd);
+        return run_tool(batch->units[0]->iface_cmd, NULL, &one, st);
+    }
+    if (batch->streamed) return compile_streamed(build, batch->units[0], st);
+
+    CompileUnit **todo = malloc(sizeof(CompileUnit *) * batch->count);
+    if (!todo) return -1;
+    int n = 0;
+    for (int i = 0; i < batch->count; i++) {
+        if (!restore_from_cache(build, batch->units[i])) todo[n++] = batch->units[i];
+    }
+
+    int ret = (n == 1) ? compile_single(build, todo[0], job->worker, st) : compile_batch(build, todo, n, job->worker, st);
+    for (int i = 0; build->cache && i < n; i++) {
+        CompileUnit *unit = todo[i];
+        if (unit->built) action_cache_store(build->cache, unit->key, unit->obj_tmp, build->mod_dir, build->module_outputs[unit->id]);
+    }
+    free(todo);
+    return ret;
+}
+
+//The span of a finished job in the --trace timeline, on the row of its lane.
+static void trace_build_job(BuildContext *build, const SchedJob *job, int exit_code,
+                            const ProcessStats *st, double start, double end) {
+    CompileBatch *batch = (CompileBatch *)job->user;
+    TraceJob tj = { NULL, "compile", NULL, exit_code, st->cpu_seconds, st->peak_rss_kb, 0, NULL };
+    char files[4096] = "", name[1100];
+    if (job->worker >= build->local_lanes) tj.worker = worker_pool_slot_name(build->workers, job->worker - build->local_lanes);
+
+    if (batch->link) {
+        tj.kind = "link";
+        tj.name = tj.file = batch->link->name;
+        trace_job(build->trace, job->worker, &tj, start, end);
+        return;
+    }
+    if (batch->interface) tj.kind = "interface";
+    else if (batch->count > 1) tj.kind = "batch";
+
+    size_t pos = 0;
+    for (int i = 0; i < batch->count; i++) {
+        const CompileUnit *unit = batch->units[i];
+        const char *src = batch->streamed ? unit->src : build->graph->files.names[unit->id];
+        if (pos < sizeof(files)) pos += (size_t)snprintf(files + pos, sizeof(files) - pos, "%s%s", i ? " " : "", src);
+        if (!batch->interface && unit->built && unit->seconds <= 0.0) tj.cached++;
+        if (i == 0 && batch->count > 1) snprintf(name, sizeof(name), "%s (+%d)", src, batch->count - 1);
+        else if (i == 0)                snprintf(name, sizeof(name), "%s", src);
+    }
+    tj.name = name;
+    tj.file = files;
+    trace_job(build->trace, job->worker, &tj, start, end);
+}
+
+static int exec_compile(const SchedJob *job, void *ctx) {
+    BuildContext *build = (BuildContext *)ctx;
+    ProcessStats st = {0};
+    double start = now_seconds();
+    int ret = run_job(build, job, &st);
+    double end = now_seconds();
+    stats_count(((CompileBatch *)job->user)->link ? STAT_LINK_US : STAT_COMPILE_US, (long long)((end - start) * 1e6));
+    if (build->trace) trace_build_job(build, job, ret, &st, start, end);
+    return ret;
+}
+
+//Runs for every finished job, under the scheduler lock. A good object is
+//renamed into place and its cache entry committed to the journal right away, so
+//a later failure or Ctrl-C can't lose it. A failed one leaves nothing behind.
+//In a failed batch the files that did compile are kept. Streamed compiles are
+//committed to the journal once the build is over, when their hashes are known.
+static int on_compile_done(SchedJob *job, void *ctx) {
+    BuildContext *build = (BuildContext *)ctx;
+    CompileBatch *batch = (CompileBatch *)job->user;
+    int ret = 0;
+
+    if (batch->link) {
+        if (job->exit_code != 0) {
+            char msg[1200];
+            snprintf(msg, sizeof(msg), "Linking failed: %s", batch->link->name);
+            print_error(msg);
+        }
+        return 0;
+    }
+    if (batch->interface) {
+        if (job->exit_code != 0) {
+            char msg[1200];
+            snprintf(msg, sizeof(msg), "Interface pass failed: %s", build->graph->files.names[batch->units[0]->id]);
+            print_error(msg);
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < batch->count; i++) {
+        CompileUnit *unit = batch->units[i];
+        const char  *src  = batch->streamed ? unit->src : build->graph->files.names[unit->id];
+        char msg[1200];
+
+        if (!unit->built) {
+            remove(unit->obj_tmp);
+            snprintf(msg, sizeof(msg), "Compilation failed: %s", src);
+            print_error(msg);
+            continue;
+        }
+
+        if (replace_file(unit->obj_tmp, unit->obj_file) != 0) {
+            snprintf(msg, sizeof(msg), "Failed to move %s into place", unit->obj_file);
+            print_error(msg);
+            ret = -1;
+            continue;
+        }
+
+        if (!batch->streamed) journal_commit(build->journal, src, &build->graph->records[unit->id]);
+    }
+    return ret;
+}
+
+//Cold builds compile while the scanner is still running. With -s it prints the
+//dependency line of a file as soon as everything the file uses is known, in
+//topological order, and each line becomes a compile job right away on a
+//scheduler that is already running. Every job waits only on the compiles of the
+//files it uses, so the leaves compile while the rest of the tree is scanned.
+typedef struct StreamedCompile {
+    CompileBatch  batch;
+    CompileUnit   unit;
+    CompileUnit  *member;          // batch.units points here
+} StreamedCompile;
+
+typedef struct ScanStream {
+    Scheduler        *sched;
+    const FileTable  *exclude;
+    const char       *compiler;
+    const char       *flags_str;
+    const SourceFlags *source_flags;
+    const char       *obj_dir;
+    const char       *mod_dir;
+    const char       *pgo_data;
+    int               is_c;
+    FILE             *journal;
+    FileTable         files;       // every file the scanner printed so far
+    int              *job_of;      // files id -> compile job, -1 if none
+    StreamedCompile **compiles;    // files id -> its compile, NULL if none
+    int               capacity;
+} ScanStream;
+
+static void scan_stream_free(ScanStream *st) {
+    for (int f = 0; f < st->files.count; f++) {
+        StreamedCompile *sc = st->compiles[f];
+        if (!sc) continue;
+        free(sc->unit.cmd);
+        free(sc->unit.src);
+        for (int i = 0; i < sc->unit.ndeps; i++) free(sc->unit.deps[i]);
+        free(sc->unit.deps);
+        free(sc);
+    }
+    free(st->job_of);
+    free(st->compiles);
+    file_table_free(&st->files);
+}
+
+//Queue the compile for one "file: deps" line. Returns -1 on allocation failure.
+static int scan_stream_add(ScanStream *st, char *line) {
+    char *colon = strchr(line, ':');
+    if (!colon) return 0;
+    *colon = 0;
+    char *target = line;
+    while (*target == ' ' || *target == '\t') target++;
+    if (!*target) return 0;
+
+    int fid = file_table_intern(&st->files, target);
+    if (fid < 0) return -1;
+    if (fid >= st->capacity) {
+        int new_cap = st->capacity ? st->capacity * 2 : 256;
+        int *job_of = realloc(st->job_of, sizeof(int) * new_cap);
+        if (job_of) st->job_of = job_of;
+        StreamedCompile **compiles = realloc(st->compiles, sizeof(StreamedCompile *) * new_cap);
+        if (compiles) st->compiles = compiles;
+        if (!job_of || !compiles) return -1;
+        for (int i = st->capacity; i < new_cap; i++) {
+            st->job_of[i]   = -1;
+            st->compiles[i] = NULL;
+        }
+        st->capacity = new_cap;
+    }
+
+    //Excluded files and headers are in the list, but not compiled.
+    if (file_table_find(st->exclude, target) >= 0) return 0;
+    char *rel_path = get_last_path_segment(target);
+    if (truncate_file_name_at_file_extension(rel_path)) {
+        free(rel_path);
+        return 0;
+    }
+
+    StreamedCompile *sc = calloc(1, sizeof(StreamedCompile));
+    if (!sc) {
+        free(rel_path);
+        return -1;
+    }
+    CompileUnit *unit = &sc->unit;
+    unit->id  = -1;
+    unit->src = strdup(target);
+    snprintf(unit->obj_file, sizeof(unit->obj_file), "%s%c%s.o", st->obj_dir, PATH_SEP, rel_path);
+    snprintf(unit->obj_tmp, sizeof(unit->obj_tmp), "%s.tmp", unit->obj_file);
+    free(rel_path);
+
+    const char *flags = source_flags(st->source_flags, st->flags_str, target, &unit->cold);
+    unit->cmd = format_compile_cmd(st->compiler, flags, st->mod_dir, target, unit->obj_tmp, st->pgo_data, st->is_c);
+
+    //Owned by the stream from here on, so it is freed with it.
+    st->compiles[fid] = sc;
+
+    //The files it uses were all printed before it.
+    char *list   = colon + 1;
+    int max_deps = 1;
+    for (const char *c = list; *c; c++) max_deps += (*c == ' ' || *c == '\t');
+    int *deps  = malloc(sizeof(int) * max_deps);
+    unit->deps = malloc(sizeof(char *) * max_deps);
+    if (!unit->src || !unit->cmd || !deps || !unit->deps) {
+        free(deps);
+        return -1;
+    }
+    int ndeps = 0;
+    for (char *dep = strtok(list, " \t\r\n"); dep; dep = strtok(NULL, " \t\r\n")) {
+        char *name = strdup(dep);
+        if (!name) {
+            free(deps);
+            return -1;
+        }
+        unit->deps[unit->ndeps++] = name;
+        int dep_id = file_table_find(&st->files, dep);
+        if (dep_id >= 0 && st->job_of[dep_id] >= 0) deps[ndeps++] = st->job_of[dep_id];
+    }
+
+    sc->member          = unit;
+    sc->batch.units     = &sc->member;
+    sc->batch.count     = 1;
+    sc->batch.streamed  = 1;
+    journal_mark_dirty(st->journal, target);
+    st->job_of[fid] = sched_add_job(st->sched, unit->cmd, deps, ndeps, &sc->batch);
+    free(deps);
+    return st->job_of[fid] < 0 ? -1 : 0;
+}
+
+//Run the scanner with -s and queue every line. Returns its whole output (the
+//usual -m dependency list), or NULL when it failed.
+static char *scan_stream_run(ScanStream *st, const char *cmd) {
+    double began = now_seconds();
+    stats_count(STAT_PROCESSES, 1);
+    stats_count(STAT_SCANS, 1);
+    FILE *pipe = popen(cmd, "r");
+    if (!pipe) {
+        print_error("Failed to run command.");
+        return NULL;
+    }
+
+    char  *output = NULL;
+    size_t size   = 0;
+    size_t start  = 0;     // start of the line being read
+    char   chunk[4096];
+    int    failed = 0;
+    while (!failed && fgets(chunk, sizeof(chunk), pipe)) {
+        size_t len = strlen(chunk);
+        char *grown = realloc(output, size + len + 1);
+        if (!grown) {
+            failed = 1;
+            break;
+        }
+        output = grown;
+        memcpy(output + size, chunk, len + 1);
+        size += len;
+        if (output[size - 1] != '\n') continue;
+
+        char *line = malloc(size - start + 1);
+        if (!line) {
+            failed = 1;
+            break;
+        }
+        memcpy(line, output + start, size - start);
+        line[size - start] = 0;
+        if (scan_stream_add(st, line) != 0) failed = 1;
+        free(line);
+        start = size;
+    }
+
+    int status = pclose(pipe);
+    stats_count(STAT_SCAN_US, (long long)((now_seconds() - began) * 1e6));
+    if (failed) print_error("Memory allocation error in scheduling the build");
+    if (failed || status != 0 || !output) {
+        free(output);
+        return NULL;
+    }
+    return output;
+}
+
+//Whether the scanner knows -s. Copies of it in older projects don't.
+static int scanner_can_stream(const char *maketop_cmd) {
+    char probe[1100];
+    snprintf(probe, sizeof(probe), "%s -h", maketop_cmd);
+    char *help = run_command_capture(probe);
+    int ok = help && strstr(help, "  -s ") != NULL;
+    free(help);
+    return ok;
+}
+
+//The source list (the targets of a dependency list), one per line.
+static char *dep_list_targets(const char *make) {
+    char *out = malloc(strlen(make) + 1);
+    if (!out) return NULL;
+    size_t pos = 0;
+    for (const char *line = make; *line; ) {
+        const char *eol   = strchr(line, '\n');
+        const char *colon = strchr(line, ':');
+        size_t len = eol ? (size_t)(eol - line) : strlen(line);
+        if (colon && (!eol || colon < eol)) {
+            memcpy(out + pos, line, colon - line);
+            pos += colon - line;
+            out[pos++] = '\n';
+        }
+        line += len + (eol ? 1 : 0);
+    }
+    out[pos] = 0;
+    return out;
+}
+
+//Whether a source defines a main program: a Fortran program statement or a C
+//main function. Each of those can only be linked into one target.
+static int defines_program(const char *path, int is_c) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    char line[1024];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        const char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (!is_c) {
+            found = strncasecmp(p, "program", 7) == 0 && isspace((unsigned char)p[7]);
+            continue;
+        }
+        if (strncmp(p, "int", 3) != 0 || !isspace((unsigned char)p[3])) continue;
+        p += 3;
+        while (*p == ' ' || *p == '\t') p++;
+        if (strncmp(p, "main", 4) != 0) continue;
+        p += 4;
+        while (*p == ' ' || *p == '\t') p++;
+        found = *p == '(';
+    }
+    fclose(f);
+    return found;
+}
+
+//Whether the linked target is there. The compiler adds .exe on Windows.
+static int target_exists(const char *name) {
+#ifdef _WIN32
+    char exe[1024];
+    snprintf(exe, sizeof(exe), "%s.exe", name);
+    if (file_exists(exe)) return 1;
+#endif
+    return file_exists(name);
+}
+
+//Decide which sources go into which target. Without [bin] targets that is
+//every source, as it always was. With them, the sources are read for main
+//programs: the main of a [bin] target only goes into that target, and the
+//[build] target gets the programs no [bin] target claims. When there are none
+//left it isn't linked at all.
+static int link_plan(char **sources, int src_count, LinkTarget *targets, int ntargets, int is_c) {
+    int separate = 0;
+    for (int t = 0; t < ntargets; t++) separate |= targets[t].main != NULL || targets[t].needs_program;
+
+    //-1 for everything else, -2 for an unclaimed program, or the target of a main.
+    int *owner = malloc(sizeof(int) * (src_count ? src_count : 1));
+    if (!owner) return -1;
+    int unclaimed = 0;
+    for (int i = 0; i < src_count; i++) {
+        owner[i] = -1;
+        for (int t = 0; separate && t < ntargets && owner[i] == -1; t++) {
+            if (targets[t].main && strcmp(targets[t].main, sources[i]) == 0) owner[i] = t;
+        }
+        if (separate && owner[i] == -1 && defines_program(sources[i], is_c)) {
+            owner[i] = -2;
+            unclaimed++;
+        }
+    }
+
+    int ret = 0;
+    for (int t = 0; t < ntargets && ret == 0; t++) {
+        LinkTarget *target = &targets[t];
+        target->sources = calloc(src_count ? src_count : 1, 1);
+        if (!target->sources) {
+            ret = -1;
+            break;
+        }
+
+        for (int i = 0; i < src_count; i++) {
+            target->sources[i] = owner[i] == -1 || owner[i] == t || (!target->main && owner[i] == -2);
+        }
+        if (target->needs_program && !unclaimed) {
+            char msg[1200];
+            target->skip = 1;
+            snprintf(msg, sizeof(msg), "No main program left for %s, only the [bin] targets are linked", target->name);
+            print_info(msg);
+        }
+    }
+    free(owner);
+    return ret;
+}
+
+//Whether path is inside the directory dir (both relative to the project).
+static int path_in_dir(const char *path, const char *dir) {
+    if (strncmp(path, "./", 2) == 0) path += 2;
+    if (strncmp(dir, "./", 2) == 0) dir += 2;
+    size_t len = strlen(dir);
+    while (len > 0 && (dir[len - 1] == '/' || dir[len - 1] == '\\')) len--;
+    return len > 0 && strncmp(path, dir, len) == 0 && (path[len] == '/' || path[len] == '\\');
+}
+
+//Partial links. The objects of a group are linked into one relocatable object
+//(-r) in the cache directory, which the targets link instead, so a link
+//reads a few dozen inputs instead of thousands of objects. A group is one of
+//[link.group] (a name and the directories it takes) or, with [link] partial,
+//the directory of the source. Only objects every target links go into one;
+//mains stay out. Sets group_of (-1 for none) and returns the names.
+static char **plan_link_groups(fortuna_toml_t *cfg, char **sources, int src_count,
+                               const LinkTarget *targets, int ntargets, int *group_of, int *ngroups) {
+    *ngroups = 0;
+    char **named = fortuna_toml_get_table_keys_list(cfg, "link.group");
+    int by_dir   = fortuna_toml_get_bool(cfg, "link.partial", 0);
+    if (!by_dir && (!named || !named[0])) {
+        free_string_list(named);
+        return NULL;
+    }
+
+    int nnamed = 0;
+    while (named && named[nnamed]) nnamed++;
+    char ***dirs = calloc(nnamed ? nnamed : 1, sizeof(char **));
+    FileTable names;
+    file_table_init(&names);
+    for (int g = 0; dirs && g < nnamed; g++) {
+        char key[512];
+        snprintf(key, sizeof(key), "link.group.%s", named[g]);
+        dirs[g] = fortuna_toml_get_array(cfg, key);
+    }
+
+    for (int i = 0; dirs && i < src_count; i++) {
+        group_of[i] = -1;
+        int shared = 0;
+        for (int t = 0; t < ntargets; t++) {
+            if (targets[t].skip) continue;
+            if (!targets[t].sources[i]) {
+                shared = 0;
+                break;
+            }
+            shared = 1;
+        }
+        if (!shared) continue;
+
+        const char *group = NULL;
+        for (int g = 0; g < nnamed && !group; g++) {
+            for (int d = 0; dirs[g] && dirs[g][d] && !group; d++) {
+                if (path_in_dir(sources[i], dirs[g][d])) group = named[g];
+            }
+        }
+
+        char dir[1024];
+        if (!group && by_dir) {
+            snprintf(dir, sizeof(dir), "%s", sources[i]);
+            char *slash = strrchr(dir, '/');
+            char *back  = strrchr(dir, '\\');
+            if (back > slash) slash = back;
+            if (slash) *slash = '\0';
+            else snprintf(dir, sizeof(dir), ".");
+            group = dir;
+        }
+        if (group) group_of[i] = file_table_intern(&names, group);
+    }
+
+    for (int g = 0; dirs && g < nnamed; g++) free_string_list(dirs[g]);
+    free(dirs);
+    free_string_list(named);
+
+    char **list = calloc(names.count + 1, sizeof(char *));
+    for (int g = 0; list && g < names.count; g++) {
+        list[g] = strdup(names.names[g]);
+        if (!list[g]) {
+            free_string_list(list);
+            list = NULL;
+        }
+    }
+    if (list) *ngroups = names.count;
+    file_table_free(&names);
+    return list;
+}
+
+//Link command of a target. The objects go inline or through the response file
+//rsp_path, see format_object_args. linker is [build] linker (gcc's -fuse-ld) or NULL for the default one, lto the link
+//flag of [build] lto or NULL.
+static char *format_link_cmd(const char *compiler, const char *flags_str, const char *linker, const char *lto,
+                             char **objs, int nobjs, const char *rsp_path, char **libs, const char *target_name) {
+    size_t len = strlen(compiler) + strlen(flags_str) + strlen(target_name) + 16;
+    if (linker) len += strlen(linker) + 11;
+    if (lto) len += strlen(lto) + 1;
+    for (int i = 0; libs && libs[i]; i++) len += strlen(libs[i]) + 1;
+
+    char *obj_args = format_object_args(objs, nobjs, len, rsp_path);
+    if (!obj_args) return NULL;
+    len += strlen(obj_args);
+    char *cmd = malloc(len);
+    if (!cmd) {
+        free(obj_args);
+        return NULL;
+    }
+    size_t pos = snprintf(cmd, len, "%s %s", compiler, flags_str);
+    if (linker) pos += snprintf(cmd + pos, len - pos, " -fuse-ld=%s", linker);
+    if (lto) pos += snprintf(cmd + pos, len - pos, " %s", lto);
+    pos += snprintf(cmd + pos, len - pos, "%s", obj_args);
+    free(obj_args);
+    for (int i = 0; libs && libs[i]; i++) pos += snprintf(cmd + pos, len - pos, " %s", libs[i]);
+    snprintf(cmd + pos, len - pos, " -o %s", target_name);
+    return cmd;
+}
+
+//Partial link of a group: its objects, listed in rsp_path, into one relocatable
+//object. It goes through the compiler driver like the final link, so both use
+//the same toolchain and [build] linker.
+static char *format_partial_link_cmd(const char *compiler, const char *linker, const char *rsp_path, const char *part_path) {
+    size_t len = strlen(compiler) + strlen(rsp_path) + strlen(part_path) + 32;
+    if (linker) len += strlen(linker) + 11;
+    char *cmd = malloc(len);
+    if (!cmd) return NULL;
+    size_t pos = snprintf(cmd, len, "%s -r -nostdlib", compiler);
+    if (linker) pos += snprintf(cmd + pos, len - pos, " -fuse-ld=%s", linker);
+    snprintf(cmd + pos, len - pos, " -o %s @%s", part_path, rsp_path);
+    return cmd;
+}
+
+//The build cache is shared by every project of the user, see fortuna_cache.h.
+static ActionCache *open_build_cache(fortuna_toml_t *cfg) {
+    ActionCache *cache = action_cache_open(fortuna_toml_get_string(cfg, "cache.dir"),
+                                           fortuna_toml_get_string(cfg, "cache.max_size"));
+    if (!cache) print_info("Build cache unavailable, compiling without it");
+
+    //Shared remote cache, e.g. for a CI farm. Misses fall through to it.
+    const char *remote = fortuna_toml_get_string(cfg, "cache.remote");
+    if (cache && remote && action_cache_set_remote(cache, remote, fortuna_toml_get_bool(cfg, "cache.upload", 1)) != 0) {
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Ignoring remote cache \"%s\", expected http://host:port", remote);
+        print_error(msg);
+    }
+    return cache;
+}
+
+//Join the flags with every -I<from> pointed at to. Profiles and pools keep
+//their module files apart, but gfortran searches the -I directories before the
+//-J one, so an -Imod in the flags would find the module files of another build.
+static char *join_flags_retargeted(char **flags_array, const char *from, const char *to) {
+    if (!flags_array || !from || !to || strcmp(from, to) == 0) return join_flags_array(flags_array);
+
+    int n = 0;
+    while (flags_array[n]) n++;
+    char **flags = calloc(n + 1, sizeof(char *));
+    if (!flags) return NULL;
+    for (int i = 0; i < n; i++) {
+        const char *flag = flags_array[i];
+        if (strncmp(flag, "-I", 2) == 0 && strcmp(flag + 2, from) == 0) {
+            flags[i] = malloc(strlen(to) + 3);
+            if (flags[i]) sprintf(flags[i], "-I%s", to);
+        } else if (i > 0 && strcmp(flags_array[i - 1], "-I") == 0 && strcmp(flag, from) == 0) {
+            flags[i] = strdup(to);
+        } else {
+            flags[i] = strdup(flag);
+        }
+        if (!flags[i]) {
+            free_string_list(flags);
+            return NULL;
+        }
+    }
+    char *joined = join_flags_array(flags);
+    free_string_list(flags);
+    return joined;
+}
+
+//Add one more flag to a joined string. Returns -1 on allocation failure, the
+//string is left as it was then.
+static int append_flag(char **flags_str, const char *flag) {
+    char *grown = realloc(*flags_str, strlen(*flags_str) + strlen(flag) + 2);
+    if (!grown) return -1;
+    strcat(grown, " ");
+    strcat(grown, flag);
+    *flags_str = grown;
+    return 0;
+}
+
+//[build] lto. auto only uses it for optimized builds (-O2 and up), so a debug
+//profile keeps its quick links.
+enum { LTO_OFF, LTO_FULL, LTO_AUTO };
+
+//Whether the last -O of the flags optimizes enough for lto = "auto".
+static int flags_optimize(const char *flags_str) {
+    int optimize = 0;
+    for (const char *p = flags_str; (p = strstr(p, "-O")) != NULL; p += 2) {
+        if (p != flags_str && !isspace((unsigned char)p[-1])) continue;
+        char level = p[2];
+        optimize = level == 's' || level == 'z' || level == 'f' || (level >= '2' && level <= '9');
+    }
+    return optimize;
+}
+
+//The LTO flags of a compiler. gcc and gfortran compile slim objects that hold
+//only the IR (-flto), which keeps the cache small, and spread the partitions
+//of the link over the cores, or over the jobs of a make jobserver
+//(-flto=auto). LLVM compilers use ThinLTO. An archive of IR objects needs an
+//ar that loads the LTO plugin for its symbol index.
+typedef struct LtoFlags {
+    const char *compile;
+    const char *link;
+    const char *ar;
+} LtoFlags;
+
+static LtoFlags lto_flags(const char *compiler) {
+    LtoFlags lto = {"-flto", "-flto=auto", "gcc-ar"};
+    if (strstr(compiler, "clang") || strstr(compiler, "flang")) {
+        lto.compile = "-flto=thin";
+        lto.link    = "-flto=thin";
+        lto.ar      = "llvm-ar";
+    }
+    return lto;
+}
+
+//What the targets were linked with last (the profile, the partial link
+//groups), "" for nothing.
+static void read_link_stamp(const char *path, char *line, size_t size) {
+    line[0] = '\0';
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    if (fgets(line, (int)size, f)) line[strcspn(line, "\r\n")] = '\0';
+    fclose(f);
+}
+
+static void write_link_stamp(const char *path, const char *line) {
+    FILE *stamp = fopen(path, "w");
+    if (stamp) {
+        fprintf(stamp, "%s\n", line);
+        fclose(stamp);
+    }
+}
+
+//[link] and [build] linker on one line, so a change to the partial link groups
+//or the linker links again.
+static void link_layout(fortuna_toml_t *cfg, char *out, size_t size) {
+    size_t pos = snprintf(out, size, "partial=%d", fortuna_toml_get_bool(cfg, "link.partial", 0));
+    const char *linker = fortuna_toml_get_string(cfg, "build.linker");
+    if (linker) pos += snprintf(out + pos, size - pos, " linker=%s", linker);
+    char **named = fortuna_toml_get_table_keys_list(cfg, "link.group");
+    for (int g = 0; named && named[g] && pos < size; g++) {
+        char key[512];
+        snprintf(key, sizeof(key), "link.group.%s", named[g]);
+        char **dirs = fortuna_toml_get_array(cfg, key);
+        pos += snprintf(out + pos, size - pos, " %s=", named[g]);
+        for (int d = 0; dirs && dirs[d] && pos < size; d++) {
+            pos += snprintf(out + pos, size - pos, d ? ",%s" : "%s", dirs[d]);
+        }
+        free_string_list(dirs);
+    }
+    free_string_list(named);
+}
+
+//The targets built from one set of flags, and where their objects go.
+typedef struct TargetPool {
+    char       *flags_key;       // the flags as written, which tell pools apart
+    char       *flags_str;
+    char        obj_dir[512];
+    char        mod_dir[512];
+    char        cache_dir[512];  // hash.dep, topo.dep and the journal
+    const char *lib;             // [lib] target, only built from the first pool
+    int         lto;             // [build] lto applies, the flags have its compile flag
+    char        pgo_data[640];   // --pgo, where the profile data goes, "" otherwise
+    int         pgo_use;         // --pgo, the objects are optimized with the data
+    char       *cold_flags;      // [hot], the flags of its cold sources
+    FlagOverride *overrides;     // [[override]], with the flags joined for the pool
+    SourceFlags source_flags;    // the sources with flags of their own
+    LinkTarget *targets;
+    int         ntargets;
+    char      **exclude;         // [exclude] files and the mains of other pools
+    int         relink;          // the targets were linked by another profile
+} TargetPool;
+
+//Closes the current phase of the build and starts the next one. The phases
+//go to --stats and the --trace timeline.
+static void phase_end(const fortuna_build_opts_t *opts, const char *name, double *phase_start) {
+    double now = now_seconds();
+    stats_phase(name, now - *phase_start);
+    trace_phase(opts->trace, name, *phase_start, now);
+    *phase_start = now;
+}
+
+//--explain: why each file is compiled. The first reason found is the one kept.
+static void explain(char **why, int id, const char *fmt, const char *arg) {
+    if (!why || why[id]) return;
+    size_t len = strlen(fmt) + (arg ? strlen(arg) : 0) + 1;
+    why[id] = malloc(len);
+    if (why[id]) snprintf(why[id], len, fmt, arg ? arg : "");
+}
+
+//The rest of a rebuild set is there because of what it uses. Dependencies
+//come first in topological order, so theirs are known.
+static void explain_dependents(DepGraph *graph, const Bitset *dirty, char **why) {
+    const int *topo = why ? graph_topo_order(graph) : NULL;
+    for (int k = 0; topo && k < graph->files.count; k++) {
+        int id = topo[k];
+        const IdList *uses = &graph->dependencies[id];
+        for (int i = 0; bitset_test(dirty, id) && !why[id] && i < uses->count; i++) {
+            if (bitset_test(dirty, uses->ids[i])) explain(why, id, "uses %s", graph->files.names[uses->ids[i]]);
+        }
+    }
+}
+
+//The compiles of --explain, --dry-run and fortuna impact, each with its reason,
+//and where its flags come from when they aren't the ones of the build. With
+//seconds, the expected time of each too (-1 for a file without a history).
+static void print_compiles(const DepGraph *graph, const int *list, int cnt, char **why,
+                           const TargetPool *pool, const double *seconds) {
+    for (int k = 0; k < cnt; k++) {
+        int id = list[k];
+        const char *src = graph->files.names[id];
+        char msg[2400], origin[600] = "", estimate[64] = "";
+        int o = match_override(&pool->source_flags, src), cold = 0;
+        source_flags(&pool->source_flags, pool->flags_str, src, &cold);
+        if (o >= 0) {
+            snprintf(origin, sizeof(origin), ", flags of [[override]] %d", o + 1);
+        } else if (cold) {
+            snprintf(origin, sizeof(origin), ", cold flags of [hot]");
+        }
+        if (seconds && seconds[k] >= 0.0) snprintf(estimate, sizeof(estimate), ", ~%.2f s", seconds[k]);
+        else if (seconds)                 snprintf(estimate, sizeof(estimate), ", no history");
+        snprintf(msg, sizeof(msg), "Compile %s: %s%s%s", src, why && why[id] ? why[id] : "", origin, estimate);
+        print_info(msg);
+    }
+}
+
+//Expected compile time of each file of list from the compile history, -1 for
+//those without one. NULL when out of memory.
+static double *estimate_compiles(const DepGraph *graph, const int *list, int cnt, const char *obj_dir) {
+    double *seconds = malloc(sizeof(double) * (cnt ? cnt : 1));
+    char **objs     = calloc(cnt ? cnt : 1, sizeof(char *));
+    for (int k = 0; seconds && objs && k < cnt; k++) {
+        char *rel_path = get_last_path_segment(graph->files.names[list[k]]);
+        objs[k] = malloc(1100);
+        if (objs[k] && rel_path && !truncate_file_name_at_file_extension(rel_path)) {
+            snprintf(objs[k], 1100, "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
+        } else if (objs[k]) {
+            objs[k][0] = '\0';
+        }
+        free(rel_path);
+        if (!objs[k]) {
+            free(seconds);
+            seconds = NULL;
+        }
+    }
+    if (seconds && objs) history_estimate(objs, cnt, seconds);
+    for (int k = 0; objs && k < cnt; k++) free(objs[k]);
+    free(objs);
+    return seconds;
+}
+
+static int compare_seconds(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//How long the compiles of list take on lanes lanes. Like in the scheduler, a
+//compile starts once a lane is free and the files it uses are compiled (all
+//at once with two_phase). Files without a history count as the median of
+//the others. Links are not in the history, so not in the estimate.
+static void print_estimate(const DepGraph *graph, const int *list, int cnt, const double *seconds,
+                           const char *obj_dir, int lanes, int two_phase) {
+    if (!seconds || cnt == 0) return;
+    double *known     = malloc(sizeof(double) * cnt);
+    double *finish    = calloc(graph->files.count ? graph->files.count : 1, sizeof(double));
+    double *lane_free = calloc(lanes, sizeof(double));
+    int nknown = 0;
+    for (int k = 0; known && k < cnt; k++) {
+        if (seconds[k] >= 0.0) known[nknown++] = seconds[k];
+    }
+    if (!known || !finish || !lane_free || nknown == 0) {
+        if (known && finish && lane_free) print_info("No compile history for these files yet, build once for an estimate");
+        free(known);
+        free(finish);
+        free(lane_free);
+        return;
+    }
+    qsort(known, nknown, sizeof(double), compare_seconds);
+    double fill = (nknown % 2) ? known[nknown / 2] : 0.5 * (known[nknown / 2 - 1] + known[nknown / 2]);
+
+    double eta = 0.0;
+    for (int k = 0; k < cnt; k++) {
+        int id = list[k];
+        double ready = 0.0;
+        const IdList *uses = &graph->dependencies[id];
+        for (int i = 0; !two_phase && i < uses->count; i++) {
+            if (finish[uses->ids[i]] > ready) ready = finish[uses->ids[i]];
+        }
+        int lane = 0;
+        for (int l = 1; l < lanes; l++) {
+            if (lane_free[l] < lane_free[lane]) lane = l;
+        }
+        double start = lane_free[lane] > ready ? lane_free[lane] : ready;
+        finish[id] = start + (seconds[k] >= 0.0 ? seconds[k] : fill);
+        lane_free[lane] = finish[id];
+        if (finish[id] > eta) eta = finish[id];
+    }
+
+    char msg[1400], unknown[128] = "";
+    if (nknown < cnt) snprintf(unknown, sizeof(unknown), ", %d without a history counted as %.2f s", cnt - nknown, fill);
+    snprintf(msg, sizeof(msg), "%d compile%s into %s, about %.1f s on %d lane%s%s", cnt, cnt == 1 ? "" : "s", obj_dir,
+             eta, lanes, lanes == 1 ? "" : "s", unknown);
+    print_info(msg);
+    free(known);
+    free(finish);
+    free(lane_free);
+}
+
+//The compile jobs of a build, see schedule_compiles.
+typedef struct CompileJobs {
+    CompileUnit   *units;        // one per file to compile, in topological order
+    int            count;
+    CompileBatch  *batches;
+    CompileUnit  **members;      // the units of each batch, one after the other
+    int           *job_of_id;    // graph id -> job of its compile, -1 for none
+    int           *iface_of_id;  // graph id -> job of its interface pass, -1 for none
+} CompileJobs;
+
+static void compile_jobs_free(CompileJobs *jobs) {
+    for (int u = 0; u < jobs->count; u++) {
+        free(jobs->units[u].cmd);
+        free(jobs->units[u].iface_cmd);
+    }
+    free(jobs->units);
+    free(jobs->batches);
+    free(jobs->members);
+    free(jobs->job_of_id);
+    free(jobs->iface_of_id);
+}
+
+//The link jobs of a build, see schedule_link_groups and schedule_target_links.
+typedef struct LinkJobs {
+    CompileBatch *targets;       // per target
+    char        **group_names;   // the partial link groups
+    int           ngroups;
+    int          *group_of;      // per source, its group or -1
+    int          *group_job;     // per group, its job or -1 when it is up to date
+    LinkTarget   *group_links;
+    CompileBatch *group_jobs;
+} LinkJobs;
+
+static void link_jobs_free(LinkJobs *links) {
+    free(links->targets);
+    for (int g = 0; g < links->ngroups; g++) {
+        free(links->group_names[g]);
+        if (links->group_links) free(links->group_links[g].cmd);
+    }
+    free(links->group_names);
+    free(links->group_of);
+    free(links->group_job);
+    free(links->group_links);
+    free(links->group_jobs);
+}
+
+//The sources of the pool from the topologically sorted scanner output, without
+//the excluded ones. The main program of every target has to be one of them.
+static int collect_sources(char *topo_src, const FileTable *exclude, const TargetPool *pool,
+                           char ***sources, int *src_count) {
+    char *line = strtok(topo_src, "\n");
+    while (line) {
+        char **tmp = realloc(*sources, sizeof(char *) * (*src_count + 1));
+        if (!tmp) {
+            print_error("Memory allocation error in parsing sources");
+            return -1;
+        }
+        *sources = tmp;
+
+        //Skip if this file is in the exclusion list
+        if (file_table_find(exclude, line) < 0) (*sources)[(*src_count)++] = strdup(line);
+        line = strtok(NULL, "\n");
+    }
+
+    for (int t = 0; t < pool->ntargets; t++) {
+        const LinkTarget *target = &pool->targets[t];
+        int found = target->main == NULL;
+        for (int i = 0; i < *src_count && !found; i++) found = strcmp((*sources)[i], target->main) == 0;
+        if (!found) {
+            char msg[1200];
+            snprintf(msg, sizeof(msg), "Main program %s of target %s is not in the search directories.", target->main, target->name);
+            print_error(msg);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//What has to be compiled, in topological order: everything that changed
+//(source, flags or toolchain), was left over by an unfinished build, used a
+//file that is gone or lost its module or object file, and everything that
+//uses those. Excluded files are never compiled. Sets relink when a file is
+//gone. Returns the list, NULL when out of memory.
+static int *plan_rebuild(DepGraph *graph, const DepGraph *prev_graph, const HashCache *prev_hashes,
+                         const FileTable *pending, const FileTable *exclude, const TargetPool *pool,
+                         int incremental_build, char **why, int *relink, int *rebuild_cnt) {
+    Bitset dirty;
+    if (bitset_init(&dirty, graph->files.count) != 0) {
+        print_error("Memory allocation error in marking the rebuild set");
+        return NULL;
+    }
+    for (int id = 0; id < graph->files.count; id++) {
+        if (!incremental_build || !file_is_unchanged(graph, id, prev_hashes)) {
+            bitset_set(&dirty, id);
+            const FileRecord *last = incremental_build ? hash_cache_lookup(prev_hashes, graph->files.names[id]) : NULL;
+            if (!incremental_build) explain(why, id, "full build", NULL);
+            else if (!last)         explain(why, id, "new file", NULL);
+            else if (last->file_hash != graph->records[id].file_hash) explain(why, id, "source changed", NULL);
+            else                    explain(why, id, "compile command or compiler changed", NULL);
+        }
+
+        //Planned by an earlier build that never got to it.
+        if (file_table_find(pending, graph->files.names[id]) >= 0) {
+            bitset_set(&dirty, id);
+            explain(why, id, "left over by an unfinished build", NULL);
+        }
+    }
+
+    //A deleted or renamed file changes everything that used it, even
+    //though none of those files changed themselves.
+    for (int old_id = 0; old_id < prev_graph->files.count; old_id++) {
+        if (file_table_find(&graph->files, prev_graph->files.names[old_id]) >= 0) continue;
+        *relink = 1;
+        const IdList *users = &prev_graph->dependents[old_id];
+        for (int i = 0; i < users->count; i++) {
+            int id = file_table_find(&graph->files, prev_graph->files.names[users->ids[i]]);
+            if (id < 0) continue;
+            bitset_set(&dirty, id);
+            explain(why, id, "used %s, which is gone", prev_graph->files.names[old_id]);
+        }
+    }
+    graph_propagate_dirty(graph, &dirty);
+
+    explain_dependents(graph, &dirty, why);
+
+    //Check the whether we built the mod file successfully on a previous run.
+    for (int id = 0; incremental_build && id < graph->files.count; id++) {
+        char *module_name = get_module_filename(graph->files.names[id]);
+        if(module_name) {
+
+            //If the mod files does not exist, we need to rebuild it.
+            //This is because either the previous compilation failed
+            //or the files were deleted/moved. Either way, we need it!
+            char mod_file[1024];
+            snprintf(mod_file, sizeof(mod_file), "%s%c%s", pool->mod_dir, PATH_SEP, module_name);
+            if(!file_exists(mod_file)) {
+                bitset_set(&dirty, id);
+                explain(why, id, "module file %s is missing", mod_file);
+            }
+            free(module_name);
+        }
+
+        //A missing object only costs that one compile.
+        char *rel_path = get_last_path_segment(graph->files.names[id]);
+        if(!truncate_file_name_at_file_extension(rel_path)) {
+            char obj_file[1024];
+            snprintf(obj_file, sizeof(obj_file), "%s%c%s.o", pool->obj_dir, PATH_SEP, rel_path);
+            if(!file_exists(obj_file)) {
+                bitset_set(&dirty, id);
+                explain(why, id, "object %s is missing", obj_file);
+            }
+        }
+        free(rel_path);
+    }
+
+    //Rebuild list in topological order.
+    int *rebuild_list = malloc(sizeof(int) * (graph->files.count ? graph->files.count : 1));
+    if (!rebuild_list) {
+        print_error("Memory allocation error in marking the rebuild set");
+        bitset_free(&dirty);
+        return NULL;
+    }
+    int count = graph_collect_in_topo_order(graph, &dirty, rebuild_list);
+    bitset_free(&dirty);
+
+    //Excluded files are in the graph (and have no object), but never compiled.
+    int kept = 0;
+    for (int k = 0; k < count; k++) {
+        if (file_table_find(exclude, graph->files.names[rebuild_list[k]]) < 0) rebuild_list[kept++] = rebuild_list[k];
+    }
+    *rebuild_cnt = kept;
+    return rebuild_list;
+}
+
+//--dry-run: what the build would compile, link and archive and how long its
+//compiles take. Nothing is written.
+static void print_dry_run(const DepGraph *graph, const int *rebuild_list, int rebuild_cnt, char **why,
+                          const TargetPool *pool, const fortuna_build_opts_t *opts, char **sources, int src_count,
+                          int relink, int archive, int lanes, int two_phase, int is_c) {
+    double *seconds = estimate_compiles(graph, rebuild_list, rebuild_cnt, pool->obj_dir);
+    print_compiles(graph, rebuild_list, rebuild_cnt, why, pool, seconds);
+
+    //A target links again when one of its objects is compiled, see
+    //schedule_target_links.
+    LinkTarget *targets = pool->targets;
+    if (opts->lib_only == 0 && link_plan(sources, src_count, targets, pool->ntargets, is_c) == 0) {
+        char *compiled = calloc(graph->files.count ? graph->files.count : 1, 1);
+        for (int k = 0; compiled && k < rebuild_cnt; k++) compiled[rebuild_list[k]] = 1;
+        for (int t = 0; compiled && t < pool->ntargets; t++) {
+            const char *reason = NULL;
+            for (int i = 0; !targets[t].skip && i < src_count && !reason; i++) {
+                int id = file_table_find(&graph->files, sources[i]);
+                if (targets[t].sources[i] && id >= 0 && compiled[id]) reason = "objects are compiled";
+            }
+            if (targets[t].skip) continue;
+            if (!reason && !target_exists(targets[t].name)) reason = "it is missing";
+            if (!reason && relink) reason = "objects were removed, or it was linked by another profile";
+            if (!reason) continue;
+            char msg[1200];
+            snprintf(msg, sizeof(msg), "Link %s: %s", targets[t].name, reason);
+            print_info(msg);
+        }
+        free(compiled);
+    }
+    if (pool->lib && opts->lib_only == 0 && (rebuild_cnt > 0 || archive)) {
+        char msg[1200];
+        snprintf(msg, sizeof(msg), "Archive %s: %s", pool->lib, rebuild_cnt > 0 ? "objects are compiled" : "it is missing or out of date");
+        print_info(msg);
+    }
+    print_estimate(graph, rebuild_list, rebuild_cnt, seconds, pool->obj_dir, lanes, two_phase);
+    free(seconds);
+}
+
+//Compile each source only if it changed and needs to be rebuilt.
+//Every compile is a job that waits for the compiles of the files it uses.
+//With [build] batch = N, up to N independent files share one compiler
+//invocation, which pays off for many small files.
+//With [build] two_phase = true, every Fortran file that others use first
+//gets a quick -fsyntax-only pass that only writes its .mod files. The real
+//compiles then wait on those passes instead of each other's full compiles,
+//so a long module chain costs the sum of the quick passes, not of the -O3
+//compiles.
+//The files a streamed build queued already only get their job looked up.
+static int schedule_compiles(Scheduler *sched, DepGraph *graph, const int *rebuild_list, int rebuild_cnt,
+                             const TargetPool *pool, const char *compiler, const ScanStream *stream, FILE *journal,
+                             int batch_max, int lanes, int two_phase, int is_c, CompileJobs *jobs) {
+    const char *flags_str = pool->flags_str;
+    const char *obj_dir   = pool->obj_dir;
+    const char *mod_dir   = pool->mod_dir;
+    const char *pgo_data  = pool->pgo_data[0] ? pool->pgo_data : NULL;
+
+    int nfiles = graph->files.count ? graph->files.count : 1;
+    jobs->units       = calloc(rebuild_cnt ? rebuild_cnt : 1, sizeof(CompileUnit));
+    jobs->batches     = calloc(rebuild_cnt ? 2 * rebuild_cnt : 1, sizeof(CompileBatch));
+    jobs->members     = malloc(sizeof(CompileUnit *) * (rebuild_cnt ? 2 * rebuild_cnt : 1));
+    jobs->job_of_id   = malloc(sizeof(int) * nfiles);
+    jobs->iface_of_id = malloc(sizeof(int) * nfiles);
+    int *unit_level   = malloc(sizeof(int) * nfiles);
+    if (!jobs->units || !jobs->batches || !jobs->members || !jobs->job_of_id || !jobs->iface_of_id || !unit_level) {
+        print_error("Memory allocation error in scheduling the build");
+        free(unit_level);
+        return -1;
+    }
+    CompileUnit *units   = jobs->units;
+    CompileBatch *batches = jobs->batches;
+    CompileUnit **members = jobs->members;
+    int *job_of_id       = jobs->job_of_id;
+    int *iface_of_id     = jobs->iface_of_id;
+    for (int id = 0; id < graph->files.count; id++) {
+        job_of_id[id]   = -1;
+        iface_of_id[id] = -1;
+        unit_level[id]  = -1;
+    }
+
+    //One unit per file to compile, in topological order.
+    int max_level = 0;
+    for (int k = 0; k < rebuild_cnt; k++) {
+        int id = rebuild_list[k];
+        const char *src = graph->files.names[id];
+
+        //Already queued by the stream.
+        int streamed = file_table_find(&stream->files, src);
+        if (streamed >= 0 && stream->compiles[streamed]) {
+            job_of_id[id] = stream->job_of[streamed];
+            continue;
+        }
+
+        //Otherwise continue on
+        char *rel_path = get_last_path_segment(src);
+        if(truncate_file_name_at_file_extension(rel_path)) {
+            free(rel_path);
+            continue;
+        }
+
+        //The compiler writes a temporary object that is only renamed over the
+        //real one once it succeeded, so an interrupted compile can't leave a
+        //truncated object behind. gfortran already does the same for .mod files.
+        CompileUnit *unit = &units[jobs->count++];
+        unit->id = id;
+        snprintf(unit->obj_file, sizeof(unit->obj_file), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
+        snprintf(unit->obj_tmp, sizeof(unit->obj_tmp), "%s.tmp", unit->obj_file);
+        snprintf(unit->obj_batch, sizeof(unit->obj_batch), "%s.o", rel_path);
+        free(rel_path);
+
+        //Generate the compile command
+        const char *flags = source_flags(&pool->source_flags, flags_str, src, &unit->cold);
+        unit->own_flags   = flags != flags_str;
+        unit->cmd = format_compile_cmd(compiler, flags, mod_dir, src, unit->obj_tmp, pgo_data, is_c);
+        int iface = two_phase && graph->dependents[id].count > 0;
+        if (iface) {
+            size_t len = strlen(compiler) + strlen(flags) + strlen(mod_dir) + strlen(src) + 32;
+            unit->iface_cmd = malloc(len);
+            if (unit->iface_cmd) snprintf(unit->iface_cmd, len, "%s %s -J%s -fsyntax-only %s", compiler, flags, mod_dir, src);
+        }
+        if (!unit->cmd || (iface && !unit->iface_cmd)) {
+            print_error("Memory allocation error in generating the compile commands");
+            free(unit_level);
+            return -1;
+        }
+
+        //Level among the files being compiled: one above the highest one it uses.
+        //With two phases no compile waits on another, so all are on one level.
+        const IdList *uses = &graph->dependencies[id];
+        unit_level[id] = 0;
+        for (int i = 0; !two_phase && i < uses->count; i++) {
+            int dep_level = unit_level[uses->ids[i]];
+            if (dep_level >= unit_level[id]) unit_level[id] = dep_level + 1;
+        }
+        if (unit_level[id] > max_level) max_level = unit_level[id];
+
+        journal_mark_dirty(journal, src);
+    }
+    int unit_count = jobs->count;
+
+    //The interface passes chain like the full compiles would, in topological
+    //order. They go in first, so the compiles can depend on them.
+    int batch_count = 0;
+    int member      = 0;
+    for (int u = 0; u < unit_count; u++) {
+        if (!units[u].iface_cmd) continue;
+        const IdList *uses = &graph->dependencies[units[u].id];
+        int *deps_iface = malloc(sizeof(int) * (uses->count ? uses->count : 1));
+        if (!deps_iface) {
+            print_error("Memory allocation error in scheduling the build");
+            free(unit_level);
+            return -1;
+        }
+        int ndeps = 0;
+        for (int i = 0; i < uses->count; i++) {
+            if (iface_of_id[uses->ids[i]] >= 0) deps_iface[ndeps++] = iface_of_id[uses->ids[i]];
+        }
+        members[member] = &units[u];
+        batches[batch_count].units     = &members[member++];
+        batches[batch_count].count     = 1;
+        batches[batch_count].interface = 1;
+        iface_of_id[units[u].id] = sched_add_job(sched, units[u].iface_cmd, deps_iface, ndeps, &batches[batch_count++]);
+        free(deps_iface);
+    }
+
+    //Group the units into jobs. Files on the same level never use each other,
+    //so each level is cut into batches of at most batch_max, and smaller ones
+    //when that is needed to give every lane some work.
+    //Without batching every file is its own job, in topological order.
+    //Files with flags of their own can't share the command of a batch.
+    int first_compile = batch_count;
+    if (batch_max <= 1) max_level = 0;
+    for (int level = 0; level <= max_level; level++) {
+        for (int u = 0; batch_max > 1 && u < unit_count; u++) {
+            if (unit_level[units[u].id] != level || !units[u].own_flags) continue;
+            members[member] = &units[u];
+            batches[batch_count].units = &members[member++];
+            batches[batch_count].count = 1;
+            batch_count++;
+        }
+        int first = member;
+        for (int u = 0; u < unit_count; u++) {
+            if (batch_max <= 1 || (unit_level[units[u].id] == level && !units[u].own_flags)) members[member++] = &units[u];
+        }
+        int count = member - first;
+        int chunk = 1;
+        if (batch_max > 1) {
+            chunk = (count + lanes - 1) / lanes;
+            if (chunk > batch_max) chunk = batch_max;
+            if (chunk < 1) chunk = 1;
+        }
+        for (int start = 0; start < count; start += chunk) {
+            batches[batch_count].units = &members[first + start];
+            batches[batch_count].count = (count - start < chunk) ? count - start : chunk;
+            batch_count++;
+        }
+    }
+    free(unit_level);
+
+    //Each job waits on the jobs of everything its files use, or on their
+    //interface passes. Those come earlier: batches go level by level, single
+    //files in topological order.
+    const int *dep_job_of = two_phase ? iface_of_id : job_of_id;
+    int deps_buf_cap = 16;
+    int *deps_buf = malloc(sizeof(int) * deps_buf_cap);
+    for (int b = first_compile; deps_buf && b < batch_count; b++) {
+        CompileBatch *batch = &batches[b];
+        int ndeps = 0;
+        for (int m = 0; deps_buf && m < batch->count; m++) {
+            const IdList *uses = &graph->dependencies[batch->units[m]->id];
+            for (int i = 0; i < uses->count; i++) {
+                int dep_job = dep_job_of[uses->ids[i]];
+                if (dep_job < 0) continue;
+                int seen = 0;
+                for (int j = 0; j < ndeps && !seen; j++) seen = deps_buf[j] == dep_job;
+                if (seen) continue;
+                if (ndeps == deps_buf_cap) {
+                    deps_buf_cap *= 2;
+                    int *grown = realloc(deps_buf, sizeof(int) * deps_buf_cap);
+                    if (!grown) {
+                        free(deps_buf);
+                        deps_buf = NULL;
+                        break;
+                    }
+                    deps_buf = grown;
+                }
+                deps_buf[ndeps++] = dep_job;
+            }
+        }
+        if (!deps_buf) break;
+
+        int job = sched_add_job(sched, batch->units[0]->cmd, deps_buf, ndeps, batch);
+        for (int m = 0; m < batch->count; m++) job_of_id[batch->units[m]->id] = job;
+    }
+    if (!deps_buf) {
+        print_error("Memory allocation error in scheduling the build");
+        return -1;
+    }
+    free(deps_buf);
+    return 0;
+}
+
+//The object of sources[i] for a link. Adds the job compiling it to deps (once),
+//or checks that it is there when it isn't compiled. Returns its path, or NULL
+//for a source without an object (rc is left alone) or one that is missing (rc
+//is set to -1).
+static char *link_object(const DepGraph *graph, const char *obj_dir, const char *src, const int *job_of_id,
+                         int *deps, int *ndeps, int *rc) {
+    char *rel_path = get_last_path_segment(src);
+    if(truncate_file_name_at_file_extension(rel_path)) {
+        free(rel_path);
+        return NULL;
+    }
+
+    //For simplified building, we eliminate the relative path to the src
+    //in the obj dir and link against just the object in the specified folder.
+    char obj_path[1024];
+    snprintf(obj_path, sizeof(obj_path), "%s%c%s.o", obj_dir, PATH_SEP, rel_path);
+    free(rel_path);
+
+    int id  = file_table_find(&graph->files, src);
+    int job = id >= 0 ? job_of_id[id] : -1;
+    if (job >= 0) {
+        int seen = 0;
+        for (int j = 0; j < *ndeps && !seen; j++) seen = deps[j] == job;
+        if (!seen) deps[(*ndeps)++] = job;
+    } else if (!file_exists(obj_path)) {
+        //Check if the obj file actually built and/or still exists.
+        char msg[1200];
+        snprintf(msg, sizeof(msg), "Object file %s does not exist.", obj_path);
+        print_error(msg);
+        *rc = -1;
+    }
+    return strdup(obj_path);
+}
+
+//The partial link groups of [link], each a job that waits on the compiles of
+//its members. A group is linked again when one of its members was compiled,
+//the members are not the ones of its response file any more, it is gone, or
+//[link] or the linker changed.
+static int schedule_link_groups(fortuna_toml_t *cfg, Scheduler *sched, const DepGraph *graph, const TargetPool *pool,
+                                const char *compiler, char **sources, int src_count, const int *job_of_id,
+                                LinkJobs *links) {
+    links->group_of = malloc(sizeof(int) * (src_count ? src_count : 1));
+    if (links->group_of) {
+        links->group_names = plan_link_groups(cfg, sources, src_count, pool->targets, pool->ntargets,
+                                              links->group_of, &links->ngroups);
+    }
+    if (pool->lto && links->ngroups > 0) {
+        //A partial link doesn't know IR objects, and the link optimizes all of them together anyway.
+        print_info("Partial links are off with [build] lto, the objects are linked as they are");
+        for (int g = 0; g < links->ngroups; g++) free(links->group_names[g]);
+        free(links->group_names);
+        links->group_names = NULL;
+        links->ngroups     = 0;
+    }
+    int ngroups = links->ngroups;
+    links->group_job   = malloc(sizeof(int) * (ngroups ? ngroups : 1));
+    links->group_links = calloc(ngroups ? ngroups : 1, sizeof(LinkTarget));
+    links->group_jobs  = calloc(ngroups ? ngroups : 1, sizeof(CompileBatch));
+    char **link_objs = malloc(sizeof(char *) * (src_count ? src_count : 1));
+    int *link_deps   = malloc(sizeof(int) * (src_count ? src_count : 1));
+    const char *linker = fortuna_toml_get_string(cfg, "build.linker");
+    int return_code = 0;
+    for (int g = 0; g < ngroups && return_code == 0; g++) {
+        if (!link_objs || !link_deps || !links->group_job || !links->group_links || !links->group_jobs) {
+            print_error("Memory allocation error in scheduling the links");
+            return_code = -1;
+            break;
+        }
+        int nobjs = 0, ndeps = 0;
+        for (int i = 0; i < src_count && return_code == 0; i++) {
+            if (links->group_of[i] != g) continue;
+            char *obj = link_object(graph, pool->obj_dir, sources[i], job_of_id, link_deps, &ndeps, &return_code);
+            if (obj) link_objs[nobjs++] = obj;
+        }
+
+        char part_path[1024], rsp_path[1024];
+        response_file_path(part_path, sizeof(part_path), pool->cache_dir, links->group_names[g], ".part.o");
+        response_file_path(rsp_path, sizeof(rsp_path), pool->cache_dir, links->group_names[g], ".part.rsp");
+        links->group_job[g] = -1;
+        if (return_code == 0 && (ndeps > 0 || pool->relink || !file_exists(part_path) ||
+                                 !response_file_matches(rsp_path, link_objs, nobjs))) {
+            //Gone until it is linked again, so a failed build can't leave a stale one.
+            remove(part_path);
+            if (write_response_file(rsp_path, link_objs, nobjs) != 0) {
+                char msg[1200];
+                snprintf(msg, sizeof(msg), "Failed to write the response file %s", rsp_path);
+                print_error(msg);
+                return_code = -1;
+            } else {
+                LinkTarget *group = &links->group_links[g];
+                group->name = links->group_names[g];
+                group->cmd  = format_partial_link_cmd(compiler, linker, rsp_path, part_path);
+                links->group_jobs[g].link = group;
+                if (!group->cmd || (links->group_job[g] = sched_add_job(sched, group->cmd, link_deps, ndeps, &links->group_jobs[g])) < 0) {
+                    print_error("Memory allocation error in scheduling the links");
+                    return_code = -1;
+                }
+            }
+        }
+        for (int i = 0; i < nobjs; i++) free(link_objs[i]);
+    }
+    free(link_objs);
+    free(link_deps);
+    return return_code;
+}
+
+//Every target is linked by a job that waits on the compiles of its objects
+//and its partial link groups, so a target links as soon as they are done, next
+//to the other compiles and links. It is only linked again when one of its
+//objects was compiled, relink is set or it doesn't exist.
+static int schedule_target_links(fortuna_toml_t *cfg, Scheduler *sched, const DepGraph *graph, const TargetPool *pool,
+                                 const char *compiler, char **sources, int src_count, const int *job_of_id,
+                                 int relink, LinkJobs *links) {
+    LtoFlags lto     = lto_flags(compiler);
+    links->targets   = calloc(pool->ntargets ? pool->ntargets : 1, sizeof(CompileBatch));
+    int nlink        = src_count + links->ngroups;
+    char **link_objs = malloc(sizeof(char *) * (nlink ? nlink : 1));
+    int *link_deps   = malloc(sizeof(int) * (nlink ? nlink : 1));
+    char **source_libs = fortuna_toml_get_array(cfg, "library.source-libs");
+    const char *linker = fortuna_toml_get_string(cfg, "build.linker");
+    int return_code = 0;
+    for (int t = 0; return_code == 0 && t < pool->ntargets; t++) {
+        if (!links->targets || !link_objs || !link_deps) {
+            print_error("Memory allocation error in scheduling the links");
+            return_code = -1;
+            break;
+        }
+        LinkTarget *target = &pool->targets[t];
+        if (target->skip) continue;
+
+        int nobjs = 0, ndeps = 0;
+        for (int g = 0; g < links->ngroups; g++) {
+            char part_path[1024];
+            response_file_path(part_path, sizeof(part_path), pool->cache_dir, links->group_names[g], ".part.o");
+            if (links->group_job[g] >= 0) link_deps[ndeps++] = links->group_job[g];
+            link_objs[nobjs] = strdup(part_path);
+            if (link_objs[nobjs]) nobjs++;
+        }
+        for (int i = 0; i < src_count && return_code == 0; i++) {
+            if (!target->sources[i] || (links->ngroups > 0 && links->group_of[i] >= 0)) continue;
+            char *obj = link_object(graph, pool->obj_dir, sources[i], job_of_id, link_deps, &ndeps, &return_code);
+            if (obj) link_objs[nobjs++] = obj;
+        }
+
+        if (return_code == 0 && (ndeps > 0 || relink || !target_exists(target->name))) {
+            char rsp_path[1024];
+            response_file_path(rsp_path, sizeof(rsp_path), pool->cache_dir, target->name, ".link.rsp");
+            target->cmd = format_link_cmd(compiler, pool->flags_str, linker, pool->lto ? lto.link : NULL,
+                                          link_objs, nobjs, rsp_path, source_libs, target->name);
+            links->targets[t].link = target;
+            if (!target->cmd || sched_add_job(sched, target->cmd, link_deps, ndeps, &links->targets[t]) < 0) {
+                print_error("Memory allocation error in scheduling the links");
+                return_code = -1;
+            }
+        }
+        for (int i = 0; i < nobjs; i++) free(link_objs[i]);
+    }
+    free(link_objs);
+    free(link_deps);
+    free_string_list(source_libs);
+    return return_code;
+}
+
+//The [lib] target of the pool, from every object of the build. Only the
+//objects compiled by this build are put into an existing archive again, see
+//build_library.
+static int archive_library(const TargetPool *pool, const DepGraph *graph, const int *rebuild_list, int rebuild_cnt,
+                           char **sources, int src_count, int thin, int full, const char *compiler) {
+    FileTable rebuilt;
+    file_table_init(&rebuilt);
+    for (int k = 0; k < rebuild_cnt; k++) file_table_intern(&rebuilt, graph->files.names[rebuild_list[k]]);
+    int ar_ret = build_library(sources, src_count, pool->obj_dir, pool->cache_dir, pool->lib, &rebuilt, thin, full,
+                               pool->lto ? lto_flags(compiler).ar : "ar");
+    file_table_free(&rebuilt);
+    if(ar_ret != 0){
+        print_error("Failed to link library. Check if ar is installed and if the paths are correct.");
+        return -1;
+    }
+    return 0;
+}
+
+//The compile times of the build: per class for fortuna report hot, and what
+//every compile cost for fortuna report compile-times. Objects restored from a
+//cache took no time to compile.
+static void record_compile_times(const TargetPool *pool, const DepGraph *graph, const CompileJobs *jobs,
+                                 const ScanStream *stream) {
+    const CompileUnit *units = jobs->units;
+    int unit_count = jobs->count;
+    if (pool->source_flags.hot) {
+        int ntimes = unit_count + stream->files.count;
+        char **time_srcs     = malloc(sizeof(char *) * (ntimes ? ntimes : 1));
+        double *seconds      = malloc(sizeof(double) * (ntimes ? ntimes : 1));
+        unsigned char *colds = malloc(ntimes ? ntimes : 1);
+        int n = 0;
+        for (int u = 0; time_srcs && seconds && colds && u < unit_count; u++) {
+            if (!units[u].built || units[u].seconds <= 0.0) continue;
+            time_srcs[n] = graph->files.names[units[u].id];
+            seconds[n]   = units[u].seconds;
+            colds[n++]   = (unsigned char)units[u].cold;
+        }
+        for (int f = 0; time_srcs && seconds && colds && f < stream->files.count; f++) {
+            StreamedCompile *sc = stream->compiles[f];
+            if (!sc || !sc->unit.built || sc->unit.seconds <= 0.0) continue;
+            time_srcs[n] = sc->unit.src;
+            seconds[n]   = sc->unit.seconds;
+            colds[n++]   = (unsigned char)sc->unit.cold;
+        }
+        hot_times_record(time_srcs, seconds, colds, n);
+        free(time_srcs);
+        free(seconds);
+        free(colds);
+    }
+
+    int nsamples = unit_count + stream->files.count;
+    CompileSample *samples = malloc(sizeof(CompileSample) * (nsamples ? nsamples : 1));
+    if (samples) {
+        int n = 0;
+        for (int u = 0; u < unit_count; u++) {
+            if (!units[u].built || units[u].seconds <= 0.0) continue;
+            samples[n++] = (CompileSample){ graph->files.names[units[u].id], units[u].obj_file, units[u].seconds,
+                                            units[u].cpu_seconds, units[u].peak_rss_kb };
+        }
+        for (int f = 0; f < stream->files.count; f++) {
+            StreamedCompile *sc = stream->compiles[f];
+            if (!sc || !sc->unit.built || sc->unit.seconds <= 0.0) continue;
+            samples[n++] = (CompileSample){ sc->unit.src, sc->unit.obj_file, sc->unit.seconds,
+                                            sc->unit.cpu_seconds, sc->unit.peak_rss_kb };
+        }
+        if (n > 0 && make_dir(".cache") == 0) history_record(samples, n);
+        free(samples);
+    }
+}
 
+//--stats: the hits and misses of the build cache.
+static void count_cache_stats(ActionCache *cache) {
+    ActionCacheStats st;
+    action_cache_flush(cache);
+    action_cache_stats(cache, &st);
+    stats_count(STAT_CACHE_HITS, st.hits);
+    stats_count(STAT_CACHE_MISSES, st.misses);
+    stats_count(STAT_CACHE_STORES, st.stores);
+    stats_count(STAT_REMOTE_HITS, st.remote_hits);
+    if (st.uploads || st.upload_failures) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Remote cache: %d uploaded, %d uploads failed", st.uploads, st.upload_failures);
+        print_info(msg);
+    }
+}
 
-int fortuna_build_project_incremental(const int parallel_build, 
-                                      const int incremental_build_override, 
-                                      const int lib_only, 
-                                      const int run_flag) {
+int build_target_incremental_core(fortuna_toml_t *cfg,
+                                   const char *maketop_cmd,
+                                   const char *compiler,
+                                   TargetPool *pool,
+                                   const fortuna_build_opts_t *opts,
+                                   int incremental_build,
+                                   const int is_c) {
 
+    const char *flags_str = pool->flags_str;
+    const char *obj_dir   = pool->obj_dir;
+    const char *mod_dir   = pool->mod_dir;
+    const char *cache_dir = pool->cache_dir;
+    char **exclude_files  = pool->exclude;
+    const char *pgo_data  = pool->pgo_data[0] ? pool->pgo_data : NULL;
 
     //Set the return code
-    int ret_code = 0;
+    int return_code = 0;
+    char *topo_src  = NULL;
+    char *topo_make = NULL;
+
+    //Allocate the dependency graph and the previous hashes.
+    DepGraph  graph;
+    HashCache prev_hashes;
+    FileTable pending;
+    graph_init(&graph);
+    hash_cache_init(&prev_hashes);
+    file_table_init(&pending);
+
+    //Everything below is released at defer_core.
+    char **sources         = NULL;
+    int src_count          = 0;
+    int *rebuild_list      = NULL;
+    int rebuild_cnt        = 0;
+    CompileJobs jobs       = {0};
+    LinkJobs links         = {0};
+    Scheduler *sched       = NULL;
+    FILE *journal          = NULL;
+    ActionCache *cache     = NULL;
+    char ***module_outputs = NULL;
+    WorkerPool *workers    = NULL;
+    ScanStream stream      = {0};
+    char **why             = NULL;
+    char *batch_prefix     = NULL;
+    double phase_start     = now_seconds();
+    file_table_init(&stream.files);
+
+    //The cache files of this object pool.
+    char hash_path[1024], deps_path[1024], journal_path[1024];
+    snprintf(hash_path, sizeof(hash_path), "%s/%s", cache_dir, hash_cache_file);
+    snprintf(deps_path, sizeof(deps_path), "%s/%s", cache_dir, deps_file);
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", cache_dir, journal_file);
+    char make_cmd[1100];
+    snprintf(make_cmd, sizeof(make_cmd), "%s -m", maketop_cmd);
+
+    //How the compiles are scheduled, see schedule_compiles. The objects of
+    //--pgo are compiled one at a time and locally, each names its profile data.
+    int local_lanes = opts->parallel_build ? cpu_count() : 1;
+    int batch_max   = pgo_data ? 1 : (int)fortuna_toml_get_int(cfg, "build.batch", 1);
+    int two_phase   = !is_c && fortuna_toml_get_bool(cfg, "build.two_phase", 0);
+    char root[1024];
+    if (batch_max > 1) {
+        if (current_dir(root, sizeof(root)) == 0) batch_prefix = format_batch_prefix(compiler, flags_str, mod_dir, root, is_c);
+        if (!batch_prefix) {
+            print_info("Could not prepare the batched compiles, compiling one file at a time");
+            batch_max = 1;
+        }
+    }
+    BuildContext build_ctx = { &graph, NULL, NULL, NULL, obj_dir, mod_dir, 0, NULL, local_lanes, batch_prefix, root,
+                               pool->pgo_use ? pgo_data : NULL, opts->trace };
+
+    //Now we get the exclusion list (if it exists)
+    FileTable exclusion_map;
+    file_table_init(&exclusion_map);
+    if(exclude_files){
+        for(int i = 0; exclude_files[i]; i++){
+            file_table_intern(&exclusion_map, exclude_files[i]);
+        }
+    }
+
+    //A cold build starts compiling while the scanner still runs, see ScanStream.
+    //Batches, two-phase builds and workers plan the whole build up front. A
+    //session that already knows the graph (the daemon, or another object pool
+    //of this build) doesn't scan at all. [build] pipeline = false turns it off.
+    char **worker_hosts = pgo_data ? NULL : fortuna_toml_get_array(cfg, "distributed.workers");
+    int streaming = !incremental_build && !worker_hosts && !opts->dry_run &&
+                    !(opts->session && session_has_scan(opts->session, make_cmd, 1)) &&
+                    batch_max <= 1 && !two_phase &&
+                    fortuna_toml_get_bool(cfg, "build.pipeline", 1) &&
+                    scanner_can_stream(maketop_cmd);
+    free_string_list(worker_hosts);
+    if (streaming) {
+        if (fortuna_toml_get_bool(cfg, "cache.local", 1)) cache = open_build_cache(cfg);
+        build_ctx.cache     = cache;
+        build_ctx.toolchain = toolchain_fingerprint(compiler);
+        sched = sched_create(local_lanes, on_compile_done, &build_ctx);
+        if (sched) sched_set_exec(sched, exec_compile);
+        if (!sched || sched_start(sched) != 0) {
+            return_code = -1;
+            goto defer_core;
+        }
+        stream.sched     = sched;
+        stream.exclude   = &exclusion_map;
+        stream.compiler  = compiler;
+        stream.flags_str = flags_str;
+        stream.source_flags = &pool->source_flags;
+        stream.obj_dir   = obj_dir;
+        stream.mod_dir   = mod_dir;
+        stream.pgo_data  = pgo_data;
+        stream.is_c      = is_c;
+
+        //A full build starts a fresh journal.
+        journal = journal_open(journal_path, 0);
+        stream.journal   = journal;
+
+        char stream_cmd[1100];
+        snprintf(stream_cmd, sizeof(stream_cmd), "%s -s", maketop_cmd);
+        topo_make = scan_stream_run(&stream, stream_cmd);
+        if (!topo_make) {
+            return_code = -1;
+            goto defer_core;
+        }
+        topo_src = dep_list_targets(topo_make);
+        if (opts->session && topo_src) {
+            session_store_scan(opts->session, maketop_cmd, 0, topo_src);
+            session_store_scan(opts->session, make_cmd, 1, topo_make);
+        }
+    } else {
+        //Still need the list of source files to link against.
+        topo_src = scan_sources(opts->session, maketop_cmd, 0);
+    }
+
+    if(!topo_src || collect_sources(topo_src, &exclusion_map, pool, &sources, &src_count) != 0){
+        return_code = -1;
+        goto defer_core;
+    }
+
+    //Objects whose source was deleted, renamed or excluded would otherwise be
+    //linked into the target. Each one is removed on its own; nothing else
+    //about the build changes because of them.
+    //The target still contains them though, so it has to be linked again.
+    int relink = remove_orphan_objects(obj_dir, sources, src_count, streaming || opts->dry_run, opts->dry_run) > 0;
+    if (pool->relink) relink = 1;
+
+    //Scan the dependency graph, unless the stream already did.
+    if (!topo_make) topo_make = scan_sources(opts->session, make_cmd, 1);
+    if(!topo_make){
+        return_code = -1;
+        goto defer_core;
+    }
+    phase_end(opts, "scan", &phase_start);
+
+    //Keep the graph from the last build. Files that disappeared from it
+    //only live on as edges there, so their old dependents are found here.
+    DepGraph prev_graph;
+    graph_init(&prev_graph);
+    if (incremental_build && file_exists(deps_path)) parse_dependency_file(deps_path, &prev_graph);
+
+    //Write the new list to a file and then reload it. A dry run leaves the
+    //one of the last build alone, the next build still compares against it.
+    char scan_path[1100];
+    snprintf(scan_path, sizeof(scan_path), opts->dry_run ? "%s.dry" : "%s", deps_path);
+    FILE* depedency_chain = fopen(scan_path ,"w+");
+    fprintf(depedency_chain,"%s",topo_make);
+    fclose(depedency_chain);
+    free(topo_make);
+    topo_make = NULL;
+
+    //Parse the dependency file first
+    int res = parse_dependency_file(scan_path,&graph);
+    if (opts->dry_run) remove(scan_path);
+    if(!res){
+        print_error("Failed to make hash table of dependency graph\n");
+        graph_free(&prev_graph);
+        return_code = -1;
+        goto defer_core;
+    }
+    phase_end(opts, "parse dependencies", &phase_start);
+    if (opts->session) graph_hash_files_cached(&graph, &opts->session->digests);
+    else               graph_hash_files(&graph);
+    unsigned int toolchain = assign_compile_fingerprints(&graph, compiler, flags_str, &pool->source_flags, obj_dir, mod_dir,
+                                                         pgo_data, pool->pgo_use, is_c);
+    phase_end(opts, "hash", &phase_start);
+
+    //What the last builds committed: hash.dep, plus anything a failed or
+    //interrupted build committed to the journal after it.
+    if (incremental_build) {
+        load_prev_hashes(hash_path,&prev_hashes);
+        if (journal_replay(journal_path, &prev_hashes, &pending)) {
+            print_info("Resuming the previous build from the journal");
+            relink = 1;
+        }
+    }
+
+    if (opts->explain || opts->dry_run) why = calloc(graph.files.count ? graph.files.count : 1, sizeof(char *));
+    rebuild_list = plan_rebuild(&graph, &prev_graph, &prev_hashes, &pending, &exclusion_map, pool, incremental_build,
+                                why, &relink, &rebuild_cnt);
+    graph_free(&prev_graph);
+    if (!rebuild_list) {
+        return_code = -1;
+        goto defer_core;
+    }
+    if (opts->explain && !opts->dry_run) print_compiles(&graph, rebuild_list, rebuild_cnt, why, pool, NULL);
+    phase_end(opts, "mark rebuild", &phase_start);
+
+    //A target that isn't there yet (a new [bin] target, or a deleted one) is
+    //linked even when nothing has to be compiled.
+    int missing_target = 0;
+    for (int t = 0; t < pool->ntargets; t++) {
+        if (!pool->targets[t].needs_program && !target_exists(pool->targets[t].name)) missing_target = 1;
+    }
+    int thin = fortuna_toml_get_bool(cfg, "lib.thin", 0);
+    int archive = pool->lib && opts->lib_only == 0 && library_outdated(pool->lib, cache_dir, thin);
+
+    //Rebuild required if the rebuild list is not empty.
+    //Otherwise, we jump to our memory cleanup.
+    if(rebuild_cnt == 0 && opts->lib_only == 0 && !relink && !missing_target && !archive) {
+        if(!opts->run_flag || opts->dry_run) print_info("Nothing to build");
+        return_code = 0;
+        goto defer_core;
+    }
+
+    //--dry-run stops before anything is written.
+    if (opts->dry_run) {
+        print_dry_run(&graph, rebuild_list, rebuild_cnt, why, pool, opts, sources, src_count, relink, archive,
+                      local_lanes, two_phase, is_c);
+        goto defer_core;
+    }
+
+    //A full build starts a fresh journal, an incremental one adds to it.
+    if (!journal) journal = journal_open(journal_path, incremental_build);
+
+    //The build cache needs to know which module files each source writes.
+    //A streamed build opened it already.
+    if (!streaming && rebuild_cnt > 0 && fortuna_toml_get_bool(cfg, "cache.local", 1)) {
+        cache = open_build_cache(cfg);
+    }
+
+    //Remote workers, see fortuna_worker.h. Each of their slots is one more
+    //scheduler lane on top of the local ones.
+    worker_hosts = rebuild_cnt > 0 && !pgo_data ? fortuna_toml_get_array(cfg, "distributed.workers") : NULL;
+    if (worker_hosts) {
+        workers = worker_pool_open(worker_hosts, compiler);
+        if (!workers) print_info("No usable workers, compiling locally");
+        free_string_list(worker_hosts);
+    }
+
+    //Streamed compiles look them up themselves.
+    if ((cache || workers) && !streaming) {
+        module_outputs = calloc(graph.files.count ? graph.files.count : 1, sizeof(char **));
+        for (int id = 0; module_outputs && id < graph.files.count; id++) {
+            module_outputs[id] = list_module_outputs(graph.files.names[id]);
+        }
+        if (!module_outputs) {
+            action_cache_close(cache);
+            cache = NULL;
+            worker_pool_close(workers);
+            workers = NULL;
+        }
+    }
+
+    //Remote workers get single files, so batching is off with them.
+    //A streamed build has every file queued already, and its compiles running.
+    if (workers) batch_max = 1;
+    build_ctx.journal        = journal;
+    build_ctx.module_outputs = module_outputs;
+    build_ctx.workers        = workers;
+    if (!streaming) {
+        build_ctx.cache     = cache;
+        build_ctx.toolchain = toolchain;
+        sched = sched_create(local_lanes + worker_pool_slots(workers), on_compile_done, &build_ctx);
+        if (sched) sched_set_exec(sched, exec_compile);
+    }
+    if (!sched) {
+        print_error("Memory allocation error in scheduling the build");
+        return_code = -1;
+        goto defer_core;
+    }
+    if (schedule_compiles(sched, &graph, rebuild_list, rebuild_cnt, pool, compiler, &stream, journal,
+                          batch_max, local_lanes, two_phase, is_c, &jobs) != 0) {
+        return_code = -1;
+        goto defer_core;
+    }
+
+    //The links wait on the compiles, the partial link groups go first.
+    if (opts->lib_only == 0 &&
+        (link_plan(sources, src_count, pool->targets, pool->ntargets, is_c) != 0 ||
+         schedule_link_groups(cfg, sched, &graph, pool, compiler, sources, src_count, jobs.job_of_id, &links) != 0 ||
+         schedule_target_links(cfg, sched, &graph, pool, compiler, sources, src_count, jobs.job_of_id, relink, &links) != 0)) {
+        return_code = -1;
+        goto defer_core;
+    }
+
+    //Run the build. On failure the journal keeps every object that finished,
+    //so the next build picks up exactly where this one stopped.
+    phase_end(opts, "plan", &phase_start);
+    int failed_jobs = streaming ? sched_wait(sched) : sched_run(sched);
+    phase_end(opts, "compile and link", &phase_start);
+
+    //Streamed compiles ran before their hashes were known.
+    for (int f = 0; f < stream.files.count; f++) {
+        StreamedCompile *sc = stream.compiles[f];
+        int id = sc ? file_table_find(&graph.files, sc->unit.src) : -1;
+        if (id >= 0 && sc->unit.built) journal_commit(journal, sc->unit.src, &graph.records[id]);
+    }
+
+    if (failed_jobs != 0) {
+        print_error("Build failed.");
+        return_code = -1;
+        goto defer_core;
+    }
+
+    //Check if we are building a library or not. With lib only there is
+    //nothing left to do but the library.
+    if (pool->lib == NULL && opts->lib_only == 1) {
+        print_error("No target lib found in Fortuna.toml");
+        return_code = -1;
+        goto defer_core;
+    }
+    if (pool->lib != NULL && opts->lib_only == 0) {
+        int ar_ret = archive_library(pool, &graph, rebuild_list, rebuild_cnt, sources, src_count, thin,
+                                     !incremental_build, compiler);
+        phase_end(opts, "archive", &phase_start);
+        if (ar_ret != 0) {
+            return_code = -1;
+            goto defer_core;
+        }
+    }
+    print_ok("Built Successfully");
+
+    //The whole build went through, so the hashes of every file in the graph
+    //are committed in one go and the journal is no longer needed.
+    if (save_hashes(hash_path,&graph)) {
+        if (journal) fclose(journal);
+        journal = NULL;
+        remove(journal_path);
+    }
+
+defer_core:
+    //Streamed compiles may still be running when the build gave up early.
+    if (sched) sched_wait(sched);
+    free(batch_prefix);
+    record_compile_times(pool, &graph, &jobs, &stream);
+    if (cache && opts->stats) count_cache_stats(cache);
+    action_cache_close(cache);
+    worker_pool_close(workers);
+    for (int id = 0; module_outputs && id < graph.files.count; id++) free_string_list(module_outputs[id]);
+    free(module_outputs);
+    if (journal) fclose(journal);
+    sched_free(sched);
+    compile_jobs_free(&jobs);
+    link_jobs_free(&links);
+    for (int t = 0; t < pool->ntargets; t++) {
+        free(pool->targets[t].cmd);
+        free(pool->targets[t].sources);
+        pool->targets[t].cmd     = NULL;
+        pool->targets[t].sources = NULL;
+    }
+    free(rebuild_list);
+    for (int i = 0; i < src_count; i++) free(sources[i]);
+    free(sources);
+    free(topo_src);
+    free(topo_make);
+    scan_stream_free(&stream);
+
+    for (int id = 0; why && id < graph.files.count; id++) free(why[id]);
+    free(why);
+    hash_cache_free(&prev_hashes);
+    file_table_free(&pending);
+    graph_free(&graph);
+    file_table_free(&exclusion_map);
+
+    return return_code;
+}
+
+
+
+//fortuna impact <file>: everything compiled again when the file changes, from
+//the dependency graph of the last build of the pool, and how long that takes
+//at the current -j. Nothing is scanned or built.
+static int impact_core(fortuna_toml_t *cfg, const TargetPool *pool, const fortuna_build_opts_t *opts, int is_c) {
+    char deps_path[1024], msg[2400];
+    snprintf(deps_path, sizeof(deps_path), "%s/%s", pool->cache_dir, deps_file);
+    if (!file_exists(deps_path)) {
+        snprintf(msg, sizeof(msg), "No %s yet, build first.", deps_path);
+        print_error(msg);
+        return -1;
+    }
+    DepGraph graph;
+    graph_init(&graph);
+    if (!parse_dependency_file(deps_path, &graph)) {
+        snprintf(msg, sizeof(msg), "Failed to read the dependency graph %s", deps_path);
+        print_error(msg);
+        graph_free(&graph);
+        return -1;
+    }
+
+    //The sources are listed without a leading ./
+    const char *file = opts->impact;
+    if (file[0] == '.' && is_path_sep(file[1])) file += 2;
+    int changed = file_table_find(&graph.files, file);
+    if (changed < 0) {
+        snprintf(msg, sizeof(msg), "%s is not in the dependency graph of the last build (%s).", file, deps_path);
+        print_error(msg);
+        graph_free(&graph);
+        return -1;
+    }
 
-    //Check if we can do an incremental build.
-    int incremental_build = file_exists(hash_cache_file);
+    Bitset dirty;
+    int ret       = 0;
+    char **why    = calloc(graph.files.count, sizeof(char *));
+    int *list     = malloc(sizeof(int) * graph.files.count);
+    double *seconds = NULL;
+    if (!why || !list || bitset_init(&dirty, graph.files.count) != 0) {
+        print_error("Memory allocation error in marking the rebuild set");
+        ret = -1;
+        goto defer_impact;
+    }
+    bitset_set(&dirty, changed);
+    explain(why, changed, "changed", NULL);
+    graph_propagate_dirty(&graph, &dirty);
+    explain_dependents(&graph, &dirty, why);
+    int cnt = graph_collect_in_topo_order(&graph, &dirty, list);
+    bitset_free(&dirty);
+
+    //Excluded files, and the mains of other pools, are never compiled here.
+    int kept = 0, users = 0;
+    for (int k = 0; k < cnt; k++) {
+        int excluded = 0;
+        for (int i = 0; pool->exclude[i] && !excluded; i++) excluded = strcmp(pool->exclude[i], graph.files.names[list[k]]) == 0;
+        if (excluded) continue;
+        users += list[k] != changed;
+        list[kept++] = list[k];
+    }
+    cnt = kept;
+
+    snprintf(msg, sizeof(msg), "%d file%s %s, directly or not", users, users == 1 ? " uses" : "s use", file);
+    print_info(msg);
+    seconds = estimate_compiles(&graph, list, cnt, pool->obj_dir);
+    print_compiles(&graph, list, cnt, why, pool, seconds);
+    print_estimate(&graph, list, cnt, seconds, pool->obj_dir, opts->parallel_build ? cpu_count() : 1,
+                   !is_c && fortuna_toml_get_bool(cfg, "build.two_phase", 0));
+
+defer_impact:
+    free(seconds);
+    for (int id = 0; why && id < graph.files.count; id++) free(why[id]);
+    free(why);
+    free(list);
+    graph_free(&graph);
+    return ret;
+}
+
+//fortuna build --pgo builds twice: instrumented (PGO_GENERATE), then optimized
+//with the profile data of the training runs (PGO_USE). See build_with_pgo.
+enum { PGO_NONE, PGO_GENERATE, PGO_USE };
+
+//A directory of a target pool: dir itself, or dir/<name> for a pool of its
+//own. Returns 0 when it doesn't fit.
+static int pool_dir(char *buf, size_t size, const char *dir, const char *name) {
+    int len = name ? snprintf(buf, size, "%s%c%s", dir, PATH_SEP, name) : snprintf(buf, size, "%s", dir);
+    return len >= 0 && (size_t)len < size;
+}
+
+//Where --pgo keeps its trees and the profile data, per profile.
+static void pgo_root_dir(char *buf, size_t size, const char *profile) {
+    if (profile) snprintf(buf, size, ".cache%c%s%cpgo", PATH_SEP, profile, PATH_SEP);
+    else         snprintf(buf, size, ".cache%cpgo", PATH_SEP);
+}
 
-    //If we allow the override, then we want to rebuild all, so incremental build is disabled.
-    if(incremental_build_override == 0) incremental_build = 0;
+static int build_project_pass(const fortuna_build_opts_t *opts, int pgo_phase) {
+
+
+    //Set the return code
+    int ret_code = 0;
+    double phase_start = now_seconds();
+
+    //[hot] and [[override]], see below.
+    HotSet hot;
+    int use_hot        = 0;
+    char **cold_array  = NULL;
+    int noverrides     = 0;
+    char ***override_files = NULL;
+    char ***override_flags = NULL;
 
     //Load the toml file.
     const char* toml_path = "Fortuna.toml";
@@ -861,6 +3500,7 @@ int fortuna_build_project_incremental(const int parallel_build,
         print_error("Failed to load Fortuna.toml.");
         return -1;
     }
+    phase_end(opts, "load Fortuna.toml", &phase_start);
 
     const char *target = fortuna_toml_get_string(&cfg, "build.target");
     if (!target) {
@@ -889,6 +3529,17 @@ int fortuna_build_project_incremental(const int parallel_build,
     const char *obj_dir = fortuna_toml_get_string(&cfg, "build.obj_dir");
     const char *mod_dir = fortuna_toml_get_string(&cfg, "build.mod_dir");
 
+    //Link time optimization, see lto_flags.
+    const char *lto_setting = fortuna_toml_get_string(&cfg, "build.lto");
+    int lto_mode = LTO_OFF;
+    if (lto_setting && strcmp(lto_setting, "full") == 0) lto_mode = LTO_FULL;
+    else if (lto_setting && strcmp(lto_setting, "auto") == 0) lto_mode = LTO_AUTO;
+    else if (lto_setting && strcmp(lto_setting, "off") != 0) {
+        print_error("[build] lto is one of \"off\", \"full\" or \"auto\".");
+        ret_code = -1;
+        goto defer_build;
+    }
+
     int is_c = 0;
     if(strcasecmp(compiler,"clang") == 0 || 
        strcasecmp(compiler,"gcc")   == 0 ||
@@ -925,94 +3576,138 @@ int fortuna_build_project_incremental(const int parallel_build,
         mod_dir = "";
     }
 
+    //A build profile ([profile.<name>], picked with --profile or [build] profile)
+    //builds with its own flags into .cache/<name>: objects in obj, module files
+    //in mod and its build state next to them. Switching back to a profile only
+    //recompiles what changed since its last build. The scan is the same for all.
+    const char *profile       = opts->profile ? opts->profile : fortuna_toml_get_string(&cfg, "build.profile");
+    const char *build_mod_dir = mod_dir;
+    char cache_root[512]      = ".cache";
+    char profile_obj[600], profile_mod[600];
+    if (profile) {
+        char key_buf[256];
+        int known = 0;
+        char **profiles = fortuna_toml_get_table_keys_list(&cfg, "profile");
+        for (int i = 0; profiles && profiles[i] && !known; i++) known = strcmp(profiles[i], profile) == 0;
+        free_string_list(profiles);
+        if (!known) {
+            char msg[300];
+            snprintf(msg, sizeof(msg), "No [profile.%s] in Fortuna.toml.", profile);
+            print_error(msg);
+            ret_code = -1;
+            goto defer_build;
+        }
+
+        snprintf(key_buf, sizeof(key_buf), "profile.%s.flags", profile);
+        char **profile_flags = fortuna_toml_get_array(&cfg, key_buf);
+        if (profile_flags) {
+            free_string_list(flags_array);
+            free(flags_str);
+            flags_array = profile_flags;
+            flags_str   = join_flags_array(flags_array);
+        }
+
+        snprintf(cache_root, sizeof(cache_root), ".cache%c%s", PATH_SEP, profile);
+        snprintf(profile_obj, sizeof(profile_obj), "%s%cobj", cache_root, PATH_SEP);
+        snprintf(profile_mod, sizeof(profile_mod), "%s%cmod", cache_root, PATH_SEP);
+        if (make_dir(".cache") == -1 || make_dir(cache_root) == -1 || make_dir(profile_obj) == -1 ||
+            (!is_c && make_dir(profile_mod) == -1)) {
+            print_error("Unable to make the profile directories. Check folder permissions.");
+            ret_code = -1;
+            goto defer_build;
+        }
+        obj_dir = profile_obj;
+        if (!is_c) mod_dir = profile_mod;
+    }
+
+    //Each pass of --pgo has its own tree under .cache/pgo (of the profile, if
+    //any), so both stay incremental, and they share the profile data.
+    char pgo_data[600], pgo_obj[700], pgo_mod[700];
+    if (pgo_phase != PGO_NONE) {
+        char pgo_root[480];
+        pgo_root_dir(pgo_root, sizeof(pgo_root), profile);
+        snprintf(pgo_data, sizeof(pgo_data), "%s%cdata", pgo_root, PATH_SEP);
+        snprintf(cache_root, sizeof(cache_root), "%s%c%s", pgo_root, PATH_SEP, pgo_phase == PGO_GENERATE ? "generate" : "use");
+        snprintf(pgo_obj, sizeof(pgo_obj), "%s%cobj", cache_root, PATH_SEP);
+        snprintf(pgo_mod, sizeof(pgo_mod), "%s%cmod", cache_root, PATH_SEP);
+        if (make_dir(".cache") == -1 || make_dir(pgo_root) == -1 ||
+            make_dir(pgo_data) == -1 || make_dir(cache_root) == -1 || make_dir(pgo_obj) == -1 ||
+            (!is_c && make_dir(pgo_mod) == -1)) {
+            print_error("Unable to make the PGO directories. Check folder permissions.");
+            ret_code = -1;
+            goto defer_build;
+        }
+        obj_dir = pgo_obj;
+        if (!is_c) mod_dir = pgo_mod;
+    }
+
+    //With [hot] profile, the sources the program spends little of its time in
+    //are compiled with the cheaper [profile.cold] flags, see fortuna_hot.h.
+    //Their symbols are found in the objects of this build.
+    const char *hot_profile = fortuna_toml_get_string(&cfg, "hot.profile");
+    if (hot_profile) {
+        cold_array = fortuna_toml_get_array(&cfg, "profile.cold.flags");
+        if (!cold_array) {
+            print_error("[hot] profile needs the flags of the cold sources in [profile.cold] flags.");
+            ret_code = -1;
+            goto defer_build;
+        }
+        use_hot = 1;
+        if (hot_set_load(&hot, hot_profile, fortuna_toml_get_double(&cfg, "hot.threshold", 1.0), obj_dir) != 0) {
+            ret_code = -1;
+            goto defer_build;
+        }
+    }
+
+    //Every [[override]] compiles the sources matching its files globs with its
+    //flags, in every pool.
+    noverrides = fortuna_toml_get_table_count(&cfg, "override");
+    if (noverrides > 0) {
+        override_files = calloc(noverrides, sizeof(char **));
+        override_flags = calloc(noverrides, sizeof(char **));
+        if (!override_files || !override_flags) {
+            print_error("Memory allocation error in reading the overrides");
+            ret_code = -1;
+            goto defer_build;
+        }
+    }
+    for (int o = 0; o < noverrides; o++) {
+        override_files[o] = fortuna_toml_get_table_array(&cfg, "override", o, "files");
+        override_flags[o] = fortuna_toml_get_table_array(&cfg, "override", o, "flags");
+        if (!override_files[o] || !override_flags[o]) {
+            print_error("Every [[override]] needs files and flags.");
+            ret_code = -1;
+            goto defer_build;
+        }
+
+        //The sources are listed without a leading ./
+        for (int g = 0; override_files[o][g]; g++) {
+            char *glob = override_files[o][g];
+            if (glob[0] == '.' && is_path_sep(glob[1])) memmove(glob, glob + 2, strlen(glob + 2) + 1);
+        }
+    }
+
+    //The targets in the project directory belong to one profile at a time.
+    //Switching profiles links them again, even when nothing is compiled. The
+    //passes of --pgo count as profiles of their own.
+    char linked_profile[256], link_stamp[256];
+    snprintf(link_stamp, sizeof(link_stamp), "%s%s", profile ? profile : "",
+             pgo_phase == PGO_GENERATE ? "@pgo-generate" : pgo_phase == PGO_USE ? "@pgo-use" : "");
+    read_link_stamp(".cache/profile", linked_profile, sizeof(linked_profile));
+    int profile_switched = strcmp(linked_profile, link_stamp) != 0;
+
+    //Same for the partial link groups, per profile.
+    char layout_path[600], linked_layout[1024], layout[1024];
+    snprintf(layout_path, sizeof(layout_path), "%s/link.layout", cache_root);
+    read_link_stamp(layout_path, linked_layout, sizeof(linked_layout));
+    link_layout(&cfg, layout, sizeof(layout));
+    int layout_changed = strcmp(linked_layout[0] ? linked_layout : "partial=0", layout) != 0;
+
     //Check the directories.
     char **deep_dirs    = fortuna_toml_get_array(&cfg, "search.deep");
     char **shallow_dirs = fortuna_toml_get_array(&cfg, "search.shallow");
 
-    // // Check for multiple targets
-    // char **keys = fortuna_toml_get_table_keys_list(&cfg, "bin");
-    // if (keys) {
-    //     for (int i = 0; keys[i]; i++) {
-    //         char *sub_target_name  = fortuna_toml_resolve_target_name(&cfg, "bin", keys[i]);
-    //         if (!sub_target_name ) continue;
-    //         char key_buf[256];
-
-    //         snprintf(key_buf, sizeof(key_buf), "bin.%s.flags", sub_target_name);
-    //         char **sub_flags_array = fortuna_toml_get_array(&cfg, key_buf);
-    //         char *sub_flags_str = join_flags_array(sub_flags_array);
-
-    //         snprintf(key_buf, sizeof(key_buf), "bin.%s.obj_dir", sub_target_name);
-    //         const char *sub_obj_dir = fortuna_toml_get_string(&cfg, key_buf);
-    //         if (!sub_obj_dir) sub_obj_dir = obj_dir;
-
-    //         snprintf(key_buf, sizeof(key_buf), "bin.%s.mod_dir", sub_target_name);
-    //         const char *sub_mod_dir = fortuna_toml_get_string(&cfg, key_buf);
-    //         if (!sub_mod_dir) sub_mod_dir = mod_dir;
-
-    //         snprintf(key_buf, sizeof(key_buf), "bin.%s.search.deep", sub_target_name);
-    //         char **sub_deep_dirs = fortuna_toml_get_array(&cfg, key_buf);
-
-    //         snprintf(key_buf, sizeof(key_buf), "bin.%s.search.shallow", sub_target_name);
-    //         char **sub_shallow_dirs = fortuna_toml_get_array(&cfg, key_buf);
-
-    //         snprintf(key_buf, sizeof(key_buf), "bin.%s.exclude", sub_target_name);
-    //         char **sub_exclude_files = fortuna_toml_get_array(&cfg, key_buf);
-
-    //             // Build maketopologicf90 command
-    //             char maketop_cmd[1024] = {0};
-    //         #ifdef _WIN32
-    //             strcat(maketop_cmd, "bin\\maketopologicf90.exe");
-    //         #else
-    //             strcat(maketop_cmd, "./bin/maketopologicf90.exe");
-    //         #endif
-    //         if (sub_deep_dirs) {
-    //             strcat(maketop_cmd, " -D ");
-    //             for (int j = 0; sub_deep_dirs[j]; j++) {
-    //                 strcat(maketop_cmd, sub_deep_dirs[j]);
-    //                 if (sub_deep_dirs[j + 1]) strcat(maketop_cmd, ",");
-    //             }
-    //         }
-    //         if (sub_shallow_dirs) {
-    //             strcat(maketop_cmd, " -d ");
-    //             for (int j = 0; sub_shallow_dirs[j]; j++) {
-    //                 strcat(maketop_cmd, sub_shallow_dirs[j]);
-    //                 if (sub_shallow_dirs[j + 1]) strcat(maketop_cmd, ",");
-    //             }
-    //         }
-
-    //         ret_code = build_target_incremental_core(&cfg,
-    //                                                  maketop_cmd,
-    //                                                  compiler,
-    //                                                  sub_flags_str,
-    //                                                  sub_obj_dir,
-    //                                                  sub_mod_dir,
-    //                                                  sub_target_name,
-    //                                                  sub_exclude_files,
-    //                                                  parallel_build,
-    //                                                  incremental_build,
-    //                                                  lib_only,
-    //                                                  run_flag,
-    //                                                  is_c);
-
-    //         //Free the allocations for the arrays
-    //         if (sub_deep_dirs) {
-    //             for (int k = 0; sub_deep_dirs[k]; k++) free(sub_deep_dirs[k]);
-    //             free(sub_deep_dirs);
-    //         }
-    //         if (sub_shallow_dirs) {
-    //             for (int k = 0; sub_shallow_dirs[k]; k++) free(sub_shallow_dirs[k]);
-    //             free(sub_shallow_dirs);
-    //         }
-    //         if(sub_exclude_files){
-    //             for (int k = 0; sub_exclude_files[k]; k++) free(sub_exclude_files[k]);
-    //             free(sub_exclude_files);
-    //         }
-
-    //         if(ret_code < 0) return -1;
-    //     }
-    // }
-
-    // Now build the top-level main target using the same logic:
+    //Build the maketopologicf90 command, one scan for every target.
     char maketop_cmd[1024] = {0};
     #ifdef _WIN32
         strcat(maketop_cmd, "bin\\maketopologicf90.exe");
@@ -1034,34 +3729,228 @@ int fortuna_build_project_incremental(const int parallel_build,
         }
     }
 
+    //The [build] target and the [bin.<name>] targets next to it, each with the
+    //source of its main program. Targets without flags of their own, or with
+    //the same as [build], share its object pool. Any other set of flags gets a
+    //pool of its own, named after its first target: objects in obj_dir/<name>,
+    //module files in mod_dir/<name> and its cache in .cache/<name> (below the
+    //directory of the profile, with one).
     char **exclude_files = fortuna_toml_get_array(&cfg, "exclude.files");
-    ret_code = build_target_incremental_core(&cfg,
-                                             maketop_cmd,
-                                             compiler,
-                                             flags_str,
-                                             obj_dir,
-                                             mod_dir,
-                                             target,
-                                             exclude_files,
-                                             parallel_build,
-                                             incremental_build,
-                                             lib_only,
-                                             run_flag,
-                                             is_c);
+    char **bin_keys      = fortuna_toml_get_table_keys_list(&cfg, "bin");
+    int nbins = 0, nexclude = 0;
+    while (bin_keys && bin_keys[nbins]) nbins++;
+    while (exclude_files && exclude_files[nexclude]) nexclude++;
+
+    TargetPool *pools = calloc(nbins + 1, sizeof(TargetPool));
+    int npools = 0;
+    if (!pools) {
+        print_error("Memory allocation error in reading the targets");
+        ret_code = -1;
+        goto defer_targets;
+    }
+    for (int b = -1; b < nbins; b++) {
+        const char *name = b < 0 ? target : bin_keys[b];
+        const char *main = NULL;
+        char *pool_flags = flags_str;
+        char **bin_flags_array = NULL;
+        if (b >= 0) {
+            char key_buf[256];
+            snprintf(key_buf, sizeof(key_buf), "bin.%s.main", name);
+            main = fortuna_toml_get_string(&cfg, key_buf);
+            if (!main) {
+                char msg[300];
+                snprintf(msg, sizeof(msg), "Missing 'bin.%s.main' in config.", name);
+                print_error(msg);
+                ret_code = -1;
+                goto defer_targets;
+            }
+            snprintf(key_buf, sizeof(key_buf), "bin.%s.flags", name);
+            bin_flags_array = fortuna_toml_get_array(&cfg, key_buf);
+            if (bin_flags_array) {
+                pool_flags = join_flags_array(bin_flags_array);
+                if (!pool_flags) pool_flags = flags_str;
+            }
+        }
+
+        int p = 0;
+        while (p < npools && strcmp(pools[p].flags_key, pool_flags) != 0) p++;
+        if (pool_flags != flags_str && p < npools) free(pool_flags);
+        TargetPool *pool = &pools[p];
+        if (p == npools) {
+            npools++;
+            pool->flags_key = pool_flags;
+            pool->relink    = profile_switched || layout_changed;
+            pool->targets   = calloc(nbins + 1, sizeof(LinkTarget));
+            pool->exclude   = calloc(nexclude + nbins + 1, sizeof(char *));
+            for (int i = 0; pool->exclude && i < nexclude; i++) pool->exclude[i] = exclude_files[i];
+            const char *sub = p == 0 ? NULL : name;
+            if (!pool_dir(pool->obj_dir, sizeof(pool->obj_dir), obj_dir, sub) ||
+                ((p == 0 || !is_c) && !pool_dir(pool->mod_dir, sizeof(pool->mod_dir), mod_dir, sub)) ||
+                !pool_dir(pool->cache_dir, sizeof(pool->cache_dir), cache_root, sub)) {
+                char msg[300];
+                snprintf(msg, sizeof(msg), "The object directories of target %s are too long.", name);
+                print_error(msg);
+                ret_code = -1;
+                goto defer_targets;
+            }
+            if (p == 0) {
+                pool->lib = fortuna_toml_get_string(&cfg, "lib.target");
+            } else {
+                if (make_dir(pool->obj_dir) == -1 || (!is_c && make_dir(pool->mod_dir) == -1) || make_dir(pool->cache_dir) == -1) {
+                    print_error("Unable to make the object directories of a target. Check folder permissions.");
+                    ret_code = -1;
+                    goto defer_targets;
+                }
+            }
+            pool->flags_str = join_flags_retargeted(bin_flags_array ? bin_flags_array : flags_array,
+                                                    build_mod_dir, pool->mod_dir);
+
+            //The cold sources of [hot] in the pools of the build flags.
+            //Targets with flags of their own keep them everywhere.
+            if (use_hot && !bin_flags_array) {
+                pool->cold_flags = join_flags_retargeted(cold_array, build_mod_dir, pool->mod_dir);
+                pool->source_flags.hot  = &hot;
+                pool->source_flags.cold = pool->cold_flags;
+            }
+            if (noverrides > 0) {
+                pool->overrides = calloc(noverrides, sizeof(FlagOverride));
+                for (int o = 0; pool->overrides && o < noverrides; o++) {
+                    pool->overrides[o].files = override_files[o];
+                    pool->overrides[o].flags = join_flags_retargeted(override_flags[o], build_mod_dir, pool->mod_dir);
+                    if (pool->overrides[o].flags) pool->source_flags.noverrides++;
+                }
+                pool->source_flags.overrides = pool->overrides;
+            }
+            if (!pool->targets || !pool->exclude || !pool->flags_str || (pool->source_flags.hot && !pool->cold_flags) ||
+                pool->source_flags.noverrides != noverrides) {
+                print_error("Memory allocation error in reading the targets");
+                free_string_list(bin_flags_array);
+                ret_code = -1;
+                goto defer_targets;
+            }
 
+            //The LTO flag is part of the compile commands, so IR objects are
+            //cached apart from the regular ones. The flags of the --pgo pass
+            //are there at compile and link time alike. Both go for the cold
+            //sources too, their objects are linked with the others.
+            const char *lto_flag = NULL, *pgo_flag = NULL;
+            pool->lto = lto_mode == LTO_FULL || (lto_mode == LTO_AUTO && flags_optimize(pool->flags_str));
+            if (pool->lto) lto_flag = lto_flags(compiler).compile;
+            if (pgo_phase != PGO_NONE) {
+                pgo_flag = pgo_phase == PGO_GENERATE ? "-fprofile-generate"
+                         : "-fprofile-use -fprofile-partial-training -Wno-missing-profile";
+            }
+            if ((lto_flag && append_flag(&pool->flags_str, lto_flag) != 0) ||
+                (pgo_flag && append_flag(&pool->flags_str, pgo_flag) != 0) ||
+                (pool->cold_flags && lto_flag && append_flag(&pool->cold_flags, lto_flag) != 0) ||
+                (pool->cold_flags && pgo_flag && append_flag(&pool->cold_flags, pgo_flag) != 0)) {
+                print_error("Memory allocation error in reading the targets");
+                free_string_list(bin_flags_array);
+                ret_code = -1;
+                goto defer_targets;
+            }
+            for (int o = 0; o < noverrides; o++) {
+                if ((lto_flag && append_flag(&pool->overrides[o].flags, lto_flag) != 0) ||
+                    (pgo_flag && append_flag(&pool->overrides[o].flags, pgo_flag) != 0)) {
+                    print_error("Memory allocation error in reading the targets");
+                    free_string_list(bin_flags_array);
+                    ret_code = -1;
+                    goto defer_targets;
+                }
+            }
+            pool->source_flags.cold = pool->cold_flags;
+
+            if (pgo_phase != PGO_NONE) {
+                pool->pgo_use = pgo_phase == PGO_USE;
+
+                //Objects of other flags have other profiles.
+                if (p == 0) snprintf(pool->pgo_data, sizeof(pool->pgo_data), "%s", pgo_data);
+                else        snprintf(pool->pgo_data, sizeof(pool->pgo_data), "%s%c%s", pgo_data, PATH_SEP, name);
+                if (make_dir(pool->pgo_data) == -1) {
+                    print_error("Unable to make the PGO directories. Check folder permissions.");
+                    free_string_list(bin_flags_array);
+                    ret_code = -1;
+                    goto defer_targets;
+                }
+            }
+        }
+        free_string_list(bin_flags_array);
+        LinkTarget *link = &pool->targets[pool->ntargets++];
+        link->name          = name;
+        link->main          = main;
+        link->needs_program = b < 0 && nbins > 0;
+    }
 
-    if (deep_dirs) {
-        for (int i = 0; deep_dirs[i]; i++) free(deep_dirs[i]);
-        free(deep_dirs);
+    //A pool only compiles the mains of its own targets.
+    for (int p = 0; p < npools; p++) {
+        int n = 0;
+        while (pools[p].exclude[n]) n++;
+        for (int q = 0; q < npools; q++) {
+            for (int t = 0; q != p && t < pools[q].ntargets; t++) {
+                if (pools[q].targets[t].main) pools[p].exclude[n++] = (char *)pools[q].targets[t].main;
+            }
+        }
+        pools[p].exclude[n] = NULL;
     }
-    if (shallow_dirs) {
-        for (int i = 0; shallow_dirs[i]; i++) free(shallow_dirs[i]);
-        free(shallow_dirs);
+
+    //The pools share the scan, through a session when there isn't one already.
+    fortuna_build_opts_t pool_opts = *opts;
+    BuildSession *session = NULL;
+    if (npools > 1 && !opts->session) {
+        session = build_session_create();
+        pool_opts.session = session;
+    }
+
+    phase_end(opts, "config", &phase_start);
+
+    //--lib only needs the first pool.
+    for (int p = 0; p < npools && ret_code == 0; p++) {
+        if (p > 0 && opts->lib_only) break;
+        if (opts->impact) {
+            ret_code = impact_core(&cfg, &pools[p], opts, is_c);
+            continue;
+        }
+
+        //Check if we can do an incremental build. A journal alone is enough,
+        //that is a first build that was interrupted part way.
+        char hash_path[1024], journal_path[1024];
+        snprintf(hash_path, sizeof(hash_path), "%s/%s", pools[p].cache_dir, hash_cache_file);
+        snprintf(journal_path, sizeof(journal_path), "%s/%s", pools[p].cache_dir, journal_file);
+        int incremental_build = file_exists(hash_path) || file_exists(journal_path);
+
+        //If we allow the override, then we want to rebuild all, so incremental build is disabled.
+        if(opts->incremental == 0) incremental_build = 0;
+
+        ret_code = build_target_incremental_core(&cfg,
+                                                 maketop_cmd,
+                                                 compiler,
+                                                 &pools[p],
+                                                 &pool_opts,
+                                                 incremental_build,
+                                                 is_c);
     }
-    if (exclude_files) {
-        for (int i = 0; exclude_files[i]; i++) free(exclude_files[i]);
-        free(exclude_files);
+    build_session_free(session);
+
+    //Remember whose targets are in place now.
+    int linked = ret_code == 0 && !opts->lib_only && !opts->dry_run && !opts->impact;
+    if (linked && profile_switched) write_link_stamp(".cache/profile", link_stamp);
+    if (linked && layout_changed) write_link_stamp(layout_path, layout);
+
+defer_targets:
+    for (int p = 0; pools && p < npools; p++) {
+        if (pools[p].flags_key != flags_str) free(pools[p].flags_key);
+        free(pools[p].flags_str);
+        free(pools[p].cold_flags);
+        for (int o = 0; pools[p].overrides && o < noverrides; o++) free(pools[p].overrides[o].flags);
+        free(pools[p].overrides);
+        free(pools[p].targets);
+        free(pools[p].exclude);
     }
+    free(pools);
+    free_string_list(bin_keys);
+    free_string_list(deep_dirs);
+    free_string_list(shallow_dirs);
+    free_string_list(exclude_files);
 
 defer_build:
     if (flags_array) {
@@ -1069,9 +3958,191 @@ defer_build:
         free(flags_array);
     }
     if (flags_str) free(flags_str);
+    if (use_hot) hot_set_free(&hot);
+    free_string_list(cold_array);
+    for (int o = 0; o < noverrides; o++) {
+        if (override_files) free_string_list(override_files[o]);
+        if (override_flags) free_string_list(override_flags[o]);
+    }
+    free(override_files);
+    free(override_flags);
     fortuna_toml_free(&cfg);
 
     //Check if we passed or failed the build
     return (ret_code < 0) ? -1 : 0;
 }
 
+//Count the .gcda files below dir, and remove them with remove_them. The last
+//training's go before a training, so the counts are the ones of this training
+//and an optimized object only changes where its profile did. The data of the
+//other object pools is in subdirectories.
+static int profile_data_files(const char *dir, int remove_them) {
+    char path[1200];
+    int count = 0;
+#ifdef _WIN32
+    char pattern[1100];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    do {
+        const char *name = fd.cFileName;
+        size_t len = strlen(name);
+        snprintf(path, sizeof(path), "%s\\%s", dir, name);
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0) count += profile_data_files(path, remove_them);
+        } else if (len > 5 && strcmp(name + len - 5, ".gcda") == 0) {
+            if (remove_them) remove(path);
+            count++;
+        }
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *name = entry->d_name;
+        size_t len = strlen(name);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (dir_exists(path)) {
+            count += profile_data_files(path, remove_them);
+        } else if (len > 5 && strcmp(name + len - 5, ".gcda") == 0) {
+            if (remove_them) remove(path);
+            count++;
+        }
+    }
+    closedir(d);
+#endif
+    return count;
+}
+
+//Training commands are command lines like "./app 1 < input", so they run
+//through the shell (cmd on Windows).
+static int exec_training(const SchedJob *job, void *ctx) {
+    (void)ctx;
+    ProcessStats st = {0};
+    print_info(job->cmd);
+#ifdef _WIN32
+    size_t len = strlen(job->cmd) + 8;
+    char *cmd = malloc(len);
+    if (!cmd) return -1;
+    snprintf(cmd, len, "cmd /c %s", job->cmd);
+    int ret = launch_process_stats(cmd, NULL, &st);
+    free(cmd);
+    return ret;
+#else
+    return launch_process_stats(job->cmd, NULL, &st);
+#endif
+}
+
+//fortuna build --pgo. The instrumented targets are built and linked in place,
+//the training commands run ([pgo] training, from the project directory, or
+//else the target with [args] cmd, as fortuna run does), and the targets are
+//built again with the profile data. With -j the training commands run side by
+//side; the runtime merges their counts into the same .gcda files.
+static int build_with_pgo(const fortuna_build_opts_t *opts) {
+    fortuna_toml_t cfg = {0};
+    if (fortuna_toml_load("Fortuna.toml", &cfg) != 0) {
+        print_error("Failed to load Fortuna.toml.");
+        return -1;
+    }
+
+    int ret_code = 0;
+    const char *compiler = fortuna_toml_get_string(&cfg, "build.compiler");
+    if (compiler && (strstr(compiler, "clang") || strstr(compiler, "flang") || strcasecmp(compiler, "nvcc") == 0)) {
+        print_error("--pgo needs gcc or gfortran.");
+        fortuna_toml_free(&cfg);
+        return -1;
+    }
+    if (opts->lib_only) {
+        print_error("--pgo runs the targets, so it doesn't go with --lib.");
+        fortuna_toml_free(&cfg);
+        return -1;
+    }
+
+    char **training = fortuna_toml_get_array(&cfg, "pgo.training");
+    if (!training) {
+        const char *target = fortuna_toml_get_string(&cfg, "build.target");
+        const char *args   = fortuna_toml_get_string(&cfg, "args.cmd");
+        training = calloc(2, sizeof(char *));
+        if (training && target) {
+            size_t len = strlen(target) + (args ? strlen(args) : 0) + 8;
+            training[0] = malloc(len);
+#ifdef _WIN32
+            if (training[0]) snprintf(training[0], len, "%s.exe%s%s", target, args ? " " : "", args ? args : "");
+#else
+            if (training[0]) snprintf(training[0], len, "./%s%s%s", target, args ? " " : "", args ? args : "");
+#endif
+        }
+        if (!training || !training[0]) {
+            print_error("Nothing to train --pgo with, add [pgo] training.");
+            free_string_list(training);
+            fortuna_toml_free(&cfg);
+            return -1;
+        }
+    }
+    int ntraining = 0;
+    while (training[ntraining]) ntraining++;
+
+    char pgo_root[560], pgo_data[600];
+    pgo_root_dir(pgo_root, sizeof(pgo_root), opts->profile ? opts->profile : fortuna_toml_get_string(&cfg, "build.profile"));
+    snprintf(pgo_data, sizeof(pgo_data), "%s%cdata", pgo_root, PATH_SEP);
+
+    print_info("PGO: building the instrumented targets");
+    ret_code = build_project_pass(opts, PGO_GENERATE);
+
+    if (ret_code == 0) {
+        print_info("PGO: training");
+        double train_start = now_seconds();
+        profile_data_files(pgo_data, 1);
+        Scheduler *sched = sched_create(opts->parallel_build && ntraining > 1 ? ntraining : 1, NULL, NULL);
+        if (sched) sched_set_exec(sched, exec_training);
+        for (int i = 0; sched && i < ntraining; i++) {
+            if (sched_add_job(sched, training[i], NULL, 0, NULL) < 0) {
+                sched_free(sched);
+                sched = NULL;
+            }
+        }
+        if (!sched) {
+            print_error("Memory allocation error in scheduling the training");
+            ret_code = -1;
+        } else if (sched_run(sched) != 0) {
+            print_error("A training run failed.");
+            ret_code = -1;
+        } else if (profile_data_files(pgo_data, 0) == 0) {
+            //Optimizing without a profile would only pass for a PGO build.
+            char msg[800];
+            snprintf(msg, sizeof(msg), "The training wrote no profile data to %s, check [pgo] training.", pgo_data);
+            print_error(msg);
+            ret_code = -1;
+        }
+        sched_free(sched);
+        stats_phase("train", now_seconds() - train_start);
+        trace_phase(opts->trace, "train", train_start, now_seconds());
+    }
+
+    if (ret_code == 0) {
+        print_info("PGO: building the optimized targets");
+        ret_code = build_project_pass(opts, PGO_USE);
+    }
+
+    free_string_list(training);
+    fortuna_toml_free(&cfg);
+    return ret_code;
+}
+
+int fortuna_build_project_incremental(const fortuna_build_opts_t *opts) {
+    stats_reset();
+    int ret = opts->pgo ? build_with_pgo(opts) : build_project_pass(opts, PGO_NONE);
+
+    if (opts->stats == STATS_TEXT) {
+        stats_print();
+    } else if (opts->stats == STATS_JSON) {
+        make_dir(".cache");
+        stats_write_json(STATS_FILE);
+    }
+    return ret;
+}
+
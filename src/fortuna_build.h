@@ -1,9 +1,40 @@
 #ifndef FORTUNA_BUILD_H
 #define FORTUNA_BUILD_H
 
-int fortuna_build_project_incremental(const int parallel_build, 
-                                      const int incremental_build_override, 
-                                      const int lib_only, 
-                                      const int run_flag);
+//State a long running process keeps from one build to the next: the file
+//digests and the results of the dependency scan. See fortuna_daemon.h.
+typedef struct BuildSession BuildSession;
+
+//Options of one build, filled in from the command line.
+typedef struct fortuna_build_opts_t {
+    int parallel_build;     // -j
+    int incremental;        // 0 forces a full rebuild (-r, --rebuild)
+    int lib_only;           // --lib
+    int run_flag;           // building for fortuna run
+    int stats;              // --stats, STATS_TEXT or STATS_JSON (fortuna_stats.h)
+    int pgo;                // --pgo
+    int explain;            // --explain, print why each file is compiled
+    int dry_run;            // --dry-run, print the plan and its estimate, build nothing
+    const char *impact;     // fortuna impact <file>, NULL for a build
+    const char *profile;    // --profile, NULL for the one in [build] (if any)
+    BuildSession *session;  // NULL outside the daemon
+    struct Trace *trace;    // --trace, the timeline of the build, see fortuna_trace.h
+} fortuna_build_opts_t;
+
+int fortuna_build_project_incremental(const fortuna_build_opts_t *opts);
+
+BuildSession *build_session_create(void);
+void          build_session_free(BuildSession *session);
+
+//A file was written. Its digest is dropped, and so is the scan when the file's
+//module, use or include lines changed. Returns 0 for a file the session never
+//saw in a build.
+int           build_session_file_changed(BuildSession *session, const char *path);
+
+//Files were added, removed or renamed, or the configuration changed.
+void          build_session_invalidate_scan(BuildSession *session);
+
+//Recursively delete a directory.
+int remove_folder(const char *path);
 
 #endif // FORTUNA_BUILD_H
@@ -0,0 +1,969 @@
+//Winsock has to come before windows.h
+#include "fortuna_net.h"
+#include "fortuna_cache.h"
+#include "fortuna_threads.h"
+#include "fortuna_helper_fn.h"
+#include "fortuna_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#include <sys/utime.h>
+#define PATH_SEP '\\'
+#define cache_getpid() _getpid()
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#define PATH_SEP '/'
+#define cache_getpid() getpid()
+#endif
+
+#define CACHE_PATH_LEN 1024
+
+//Longest name of a file in the cache: the root, "/cas/xx/" and a hash.
+#define CACHE_FILE_LEN (CACHE_PATH_LEN + CACHE_KEY_HEX + 8)
+
+//Upper bound of outputs in one entry, a source rarely defines more than a few modules.
+#define CACHE_MAX_OUTPUTS 256
+
+struct ActionCache {
+    char      root[CACHE_PATH_LEN];
+    long long max_bytes;
+    ActionCacheStats stats;
+    unsigned  tmp_counter;
+    mutex_t   lock;
+
+    //Remote backend, see action_cache_set_remote.
+    int       has_remote;
+    int       remote_down;      // stop talking to it after a connection failure
+    int       upload;
+    net_url_t remote;
+
+    //Keys waiting for the upload thread.
+    char    **upload_queue;
+    int       upload_head;
+    int       upload_tail;
+    int       upload_capacity;
+    int       upload_closing;
+    int       uploader_running;
+    thread_t  uploader;
+    cond_t    upload_cond;
+};
+
+//=============================================================================
+// Keys
+//=============================================================================
+void action_key_init(ActionKey *key) {
+    blake3_hasher_init(&key->hasher);
+    action_key_add_str(key, "fortuna-ac-1");
+}
+
+void action_key_add(ActionKey *key, const void *data, size_t len) {
+    unsigned long long n = (unsigned long long)len;
+    blake3_hasher_update(&key->hasher, &n, sizeof(n));
+    blake3_hasher_update(&key->hasher, data, len);
+}
+
+void action_key_add_str(ActionKey *key, const char *str) {
+    action_key_add(key, str, strlen(str));
+}
+
+int action_key_add_file(ActionKey *key, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        action_key_add_str(key, "<missing>");
+        return -1;
+    }
+
+    //Hash the contents on their own first so the length prefix is known.
+    blake3_hasher file_hasher;
+    blake3_hasher_init(&file_hasher);
+    unsigned char buffer[16384];
+    size_t n;
+    long long total = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        blake3_hasher_update(&file_hasher, buffer, n);
+        total += (long long)n;
+    }
+    fclose(fp);
+    stats_count(STAT_FILES_HASHED, 1);
+    stats_count(STAT_BYTES_HASHED, total);
+
+    uint8_t digest[BLAKE3_OUT_LEN];
+    blake3_hasher_finalize(&file_hasher, digest, BLAKE3_OUT_LEN);
+    action_key_add(key, digest, sizeof(digest));
+    return 0;
+}
+
+static void to_hex(const uint8_t *bytes, size_t len, char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        hex[2 * i]     = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 15];
+    }
+    hex[2 * len] = '\0';
+}
+
+void action_key_final(ActionKey *key, char hex[CACHE_KEY_HEX]) {
+    uint8_t digest[BLAKE3_OUT_LEN];
+    blake3_hasher_finalize(&key->hasher, digest, BLAKE3_OUT_LEN);
+    to_hex(digest, sizeof(digest), hex);
+}
+
+//Content hash of a file as a blob name. Returns -1 if it can't be read.
+static int hash_file_hex(const char *path, char hex[CACHE_KEY_HEX]) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+    unsigned char buffer[16384];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        blake3_hasher_update(&hasher, buffer, n);
+    }
+    fclose(fp);
+    uint8_t digest[BLAKE3_OUT_LEN];
+    blake3_hasher_finalize(&hasher, digest, BLAKE3_OUT_LEN);
+    to_hex(digest, sizeof(digest), hex);
+    return 0;
+}
+
+//=============================================================================
+// Files
+//=============================================================================
+
+static int path_exists(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static void touch(const char *path) {
+    utime(path, NULL);
+}
+
+//Unique temporary name next to path, so concurrent writers never share one.
+static void temp_name(ActionCache *cache, const char *path, char *out, size_t size) {
+    mutex_lock(&cache->lock);
+    unsigned n = cache->tmp_counter++;
+    mutex_unlock(&cache->lock);
+    snprintf(out, size, "%s.%d.%u.tmp", path, (int)cache_getpid(), n);
+}
+
+//Copy src over dest through a temporary file and a rename.
+static int copy_file_atomic(ActionCache *cache, const char *src, const char *dest) {
+    char tmp[CACHE_PATH_LEN + 64];
+    temp_name(cache, dest, tmp, sizeof(tmp));
+
+    FILE *in = fopen(src, "rb");
+    if (!in) return -1;
+    FILE *out = fopen(tmp, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    unsigned char buffer[16384];
+    size_t n;
+    int ok = 1;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) {
+            ok = 0;
+            break;
+        }
+    }
+    if (ferror(in)) ok = 0;
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+
+    if (!ok || replace_file(tmp, dest) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void blob_path(const ActionCache *cache, const char *hash, char *out, size_t size) {
+    snprintf(out, size, "%s%ccas%c%.2s%c%s", cache->root, PATH_SEP, PATH_SEP, hash, PATH_SEP, hash);
+}
+
+static void entry_path(const ActionCache *cache, const char *key, char *out, size_t size) {
+    snprintf(out, size, "%s%cac%c%.2s%c%s", cache->root, PATH_SEP, PATH_SEP, key, PATH_SEP, key);
+}
+
+//Directory part of path, for creating the two character fan-out folders.
+static void parent_dir(const char *path, char *out, size_t size) {
+    snprintf(out, size, "%s", path);
+    char *sep = strrchr(out, PATH_SEP);
+    if (sep) *sep = '\0';
+}
+
+//Store a file as a blob unless that content is already there.
+static int put_blob(ActionCache *cache, const char *src, char hash[CACHE_KEY_HEX]) {
+    if (hash_file_hex(src, hash) != 0) return -1;
+
+    char path[CACHE_FILE_LEN];
+    blob_path(cache, hash, path, sizeof(path));
+    if (path_exists(path)) {
+        touch(path);
+        return 0;
+    }
+
+    char dir[CACHE_FILE_LEN];
+    parent_dir(path, dir, sizeof(dir));
+    if (make_path(dir) != 0) return -1;
+    return copy_file_atomic(cache, src, path);
+}
+
+//Module names come out of the cache, so only plain file names are accepted.
+static int is_plain_name(const char *name) {
+    if (!*name || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return 0;
+    for (const char *p = name; *p; p++) {
+        if (*p == '/' || *p == '\\' || *p == ':') return 0;
+    }
+    return 1;
+}
+
+static int is_hex_hash(const char *s) {
+    size_t len = strlen(s);
+    if (len != CACHE_KEY_HEX - 1) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit((unsigned char)s[i])) return 0;
+    }
+    return 1;
+}
+
+//=============================================================================
+// Cache
+//=============================================================================
+static long long parse_size(const char *text) {
+    if (!text) return CACHE_DEFAULT_MAX_SIZE;
+    char *end = NULL;
+    double value = strtod(text, &end);
+    if (end == text || value <= 0) return CACHE_DEFAULT_MAX_SIZE;
+    while (*end == ' ') end++;
+    switch (toupper((unsigned char)*end)) {
+        case 'K': value *= 1024.0; break;
+        case 'M': value *= 1024.0 * 1024.0; break;
+        case 'G': value *= 1024.0 * 1024.0 * 1024.0; break;
+        default: break;
+    }
+    return (long long)value;
+}
+
+int action_cache_default_dir(char *out, size_t size) {
+    const char *dir = getenv("FORTUNA_CACHE_DIR");
+    if (dir && *dir) {
+        snprintf(out, size, "%s", dir);
+        return 0;
+    }
+#ifdef _WIN32
+    const char *home = getenv("USERPROFILE");
+    if (!home || !*home) return -1;
+    snprintf(out, size, "%s\\.cache\\fortuna", home);
+#else
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) {
+        snprintf(out, size, "%s/fortuna", xdg);
+        return 0;
+    }
+    const char *home = getenv("HOME");
+    if (!home || !*home) return -1;
+    snprintf(out, size, "%s/.cache/fortuna", home);
+#endif
+    return 0;
+}
+
+ActionCache *action_cache_open(const char *dir, const char *max_size) {
+    ActionCache *cache = calloc(1, sizeof(ActionCache));
+    if (!cache) return NULL;
+
+    if (dir) {
+        snprintf(cache->root, sizeof(cache->root), "%s", dir);
+    } else if (action_cache_default_dir(cache->root, sizeof(cache->root)) != 0) {
+        free(cache);
+        return NULL;
+    }
+
+    char sub[CACHE_PATH_LEN + 8];
+    snprintf(sub, sizeof(sub), "%s%cac", cache->root, PATH_SEP);
+    if (make_path(sub) != 0) {
+        free(cache);
+        return NULL;
+    }
+    snprintf(sub, sizeof(sub), "%s%ccas", cache->root, PATH_SEP);
+    if (make_path(sub) != 0) {
+        free(cache);
+        return NULL;
+    }
+
+    cache->max_bytes = parse_size(max_size);
+    mutex_init(&cache->lock);
+    cond_init(&cache->upload_cond);
+    return cache;
+}
+
+void action_cache_close(ActionCache *cache) {
+    if (!cache) return;
+    action_cache_flush(cache);
+    if (cache->stats.stores > 0) action_cache_trim(cache);
+    for (int i = cache->upload_head; i < cache->upload_tail; i++) free(cache->upload_queue[i]);
+    free(cache->upload_queue);
+    cond_destroy(&cache->upload_cond);
+    mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+const char *action_cache_root(const ActionCache *cache) {
+    return cache->root;
+}
+
+void action_cache_stats(ActionCache *cache, ActionCacheStats *stats) {
+    mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    mutex_unlock(&cache->lock);
+}
+
+typedef struct CacheOutput {
+    char kind;                          // 'o' object, 'm' module file
+    char hash[CACHE_KEY_HEX];
+    char name[256];
+} CacheOutput;
+
+//Read an entry. Returns the number of outputs, or -1 if it is missing or damaged.
+static int read_entry(const char *path, CacheOutput *outputs, int max_outputs) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    int count = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0]) continue;
+        if (count == max_outputs) {
+            count = -1;
+            break;
+        }
+
+        CacheOutput *out = &outputs[count];
+        out->name[0] = '\0';
+        char hash[CACHE_KEY_HEX + 1];
+        if (line[0] == 'o' && sscanf(line, "o %65s", hash) == 1) {
+            out->kind = 'o';
+        } else if (line[0] == 'm' && sscanf(line, "m %65s %255s", hash, out->name) == 2 && is_plain_name(out->name)) {
+            out->kind = 'm';
+        } else {
+            count = -1;
+            break;
+        }
+        if (!is_hex_hash(hash)) {
+            count = -1;
+            break;
+        }
+        memcpy(out->hash, hash, CACHE_KEY_HEX);
+        count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+//Restore from the local cache only. Returns 1 on a hit.
+static int fetch_local(ActionCache *cache, const char *key, const char *obj_dest, const char *mod_dir) {
+    char path[CACHE_FILE_LEN];
+    entry_path(cache, key, path, sizeof(path));
+
+    CacheOutput *outputs = malloc(sizeof(CacheOutput) * CACHE_MAX_OUTPUTS);
+    if (!outputs) return 0;
+
+    int count = read_entry(path, outputs, CACHE_MAX_OUTPUTS);
+    int has_obj = 0;
+    for (int i = 0; i < count; i++) has_obj |= outputs[i].kind == 'o';
+    if (count <= 0 || !has_obj) {
+        free(outputs);
+        return 0;
+    }
+
+    //Every blob has to be there before anything is copied out, a trim may
+    //have removed some of them.
+    char blob[CACHE_FILE_LEN];
+    for (int i = 0; i < count; i++) {
+        blob_path(cache, outputs[i].hash, blob, sizeof(blob));
+        if (!path_exists(blob)) {
+            free(outputs);
+            return 0;
+        }
+    }
+
+    char dest[CACHE_PATH_LEN];
+    char current[CACHE_KEY_HEX];
+    for (int i = 0; i < count; i++) {
+        blob_path(cache, outputs[i].hash, blob, sizeof(blob));
+        if (outputs[i].kind == 'o') {
+            snprintf(dest, sizeof(dest), "%s", obj_dest);
+        } else {
+            snprintf(dest, sizeof(dest), "%s%c%s", mod_dir, PATH_SEP, outputs[i].name);
+
+            //Like gfortran, leave module files alone when nothing changed.
+            if (hash_file_hex(dest, current) == 0 && strcmp(current, outputs[i].hash) == 0) {
+                touch(blob);
+                continue;
+            }
+        }
+        if (copy_file_atomic(cache, blob, dest) != 0) {
+            free(outputs);
+            return 0;
+        }
+        touch(blob);
+    }
+    touch(path);
+    free(outputs);
+    return 1;
+}
+
+static int fetch_remote(ActionCache *cache, const char *key);
+
+int action_cache_fetch(ActionCache *cache, const char *key, const char *obj_dest, const char *mod_dir) {
+    int hit = fetch_local(cache, key, obj_dest, mod_dir);
+    int remote_hit = 0;
+    if (!hit && fetch_remote(cache, key)) {
+        hit = fetch_local(cache, key, obj_dest, mod_dir);
+        remote_hit = hit;
+    }
+
+    mutex_lock(&cache->lock);
+    if (hit) cache->stats.hits++;
+    else     cache->stats.misses++;
+    if (remote_hit) cache->stats.remote_hits++;
+    mutex_unlock(&cache->lock);
+    return hit;
+}
+
+static void queue_upload(ActionCache *cache, const char *key);
+
+int action_cache_store(ActionCache *cache, const char *key, const char *obj_src,
+                       const char *mod_dir, char **mod_names) {
+    char path[CACHE_FILE_LEN];
+    entry_path(cache, key, path, sizeof(path));
+
+    //Write the entry to a temporary file while the blobs go in.
+    char tmp[CACHE_FILE_LEN + 64];
+    char dir[CACHE_FILE_LEN];
+    parent_dir(path, dir, sizeof(dir));
+    if (make_path(dir) != 0) return -1;
+    temp_name(cache, path, tmp, sizeof(tmp));
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return -1;
+
+    char hash[CACHE_KEY_HEX];
+    int ok = put_blob(cache, obj_src, hash) == 0;
+    if (ok) fprintf(fp, "o %s\n", hash);
+
+    char mod_file[CACHE_PATH_LEN];
+    for (int i = 0; ok && mod_names && mod_names[i]; i++) {
+        if (!is_plain_name(mod_names[i])) continue;
+        snprintf(mod_file, sizeof(mod_file), "%s%c%s", mod_dir, PATH_SEP, mod_names[i]);
+        if (!path_exists(mod_file)) continue;
+        ok = put_blob(cache, mod_file, hash) == 0;
+        if (ok) fprintf(fp, "m %s %s\n", hash, mod_names[i]);
+    }
+
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || replace_file(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+
+    mutex_lock(&cache->lock);
+    cache->stats.stores++;
+    mutex_unlock(&cache->lock);
+
+    if (cache->has_remote && cache->upload) queue_upload(cache, key);
+    return 0;
+}
+
+//=============================================================================
+// Trimming
+//=============================================================================
+typedef struct CacheFile {
+    char      *path;
+    long long  size;
+    time_t     mtime;
+} CacheFile;
+
+typedef struct CacheFileList {
+    CacheFile *files;
+    int        count;
+    int        capacity;
+    long long  total;
+} CacheFileList;
+
+static void file_list_add(CacheFileList *list, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG) return;
+    if (list->count == list->capacity) {
+        int new_cap = list->capacity ? list->capacity * 2 : 1024;
+        CacheFile *tmp = realloc(list->files, sizeof(CacheFile) * new_cap);
+        if (!tmp) return;
+        list->files = tmp;
+        list->capacity = new_cap;
+    }
+    list->files[list->count].path  = strdup(path);
+    list->files[list->count].size  = (long long)st.st_size;
+    list->files[list->count].mtime = st.st_mtime;
+    list->total += (long long)st.st_size;
+    list->count++;
+}
+
+//Calls fn for every entry in dir, except . and ..
+static void for_each_in_dir(const char *dir, void (*fn)(const char *path, void *arg), void *arg) {
+    char path[CACHE_PATH_LEN];
+#ifdef _WIN32
+    WIN32_FIND_DATA fd;
+    char search_path[MAX_PATH];
+    snprintf(search_path, MAX_PATH, "%s\\*", dir);
+    HANDLE hFind = FindFirstFile(search_path, &fd);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0) continue;
+        snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, fd.cFileName);
+        fn(path, arg);
+    } while (FindNextFile(hFind, &fd));
+    FindClose(hFind);
+#else
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        snprintf(path, sizeof(path), "%s%c%s", dir, PATH_SEP, entry->d_name);
+        fn(path, arg);
+    }
+    closedir(d);
+#endif
+}
+
+static void collect_file(const char *path, void *arg) {
+    file_list_add((CacheFileList *)arg, path);
+}
+
+static void collect_fanout(const char *path, void *arg) {
+    for_each_in_dir(path, collect_file, arg);
+}
+
+static int compare_mtime(const void *a, const void *b) {
+    const CacheFile *fa = (const CacheFile *)a;
+    const CacheFile *fb = (const CacheFile *)b;
+    if (fa->mtime != fb->mtime) return fa->mtime < fb->mtime ? -1 : 1;
+    return 0;
+}
+
+void action_cache_trim(ActionCache *cache) {
+    CacheFileList list = {0};
+    char sub[CACHE_PATH_LEN + 8];
+    snprintf(sub, sizeof(sub), "%s%cac", cache->root, PATH_SEP);
+    for_each_in_dir(sub, collect_fanout, &list);
+    snprintf(sub, sizeof(sub), "%s%ccas", cache->root, PATH_SEP);
+    for_each_in_dir(sub, collect_fanout, &list);
+
+    if (list.total > cache->max_bytes) {
+
+        //Go a bit below the limit so the next few builds don't trim again.
+        long long target = cache->max_bytes - cache->max_bytes / 10;
+        qsort(list.files, list.count, sizeof(CacheFile), compare_mtime);
+        int removed = 0;
+        for (int i = 0; i < list.count && list.total > target; i++) {
+            if (remove(list.files[i].path) == 0) {
+                list.total -= list.files[i].size;
+                removed++;
+            }
+        }
+
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Trimmed %d files from the build cache (%.1f MB left)",
+                 removed, (double)list.total / (1024.0 * 1024.0));
+        print_info(msg);
+    }
+
+    for (int i = 0; i < list.count; i++) free(list.files[i].path);
+    free(list.files);
+}
+
+//=============================================================================
+// Remote backend
+//=============================================================================
+int action_cache_set_remote(ActionCache *cache, const char *url, int upload) {
+    if (net_parse_url(url, &cache->remote) != 0) return -1;
+    if (net_init() != 0) return -1;
+    cache->has_remote = 1;
+    cache->upload     = upload;
+    return 0;
+}
+
+static int remote_usable(ActionCache *cache) {
+    mutex_lock(&cache->lock);
+    int usable = cache->has_remote && !cache->remote_down;
+    mutex_unlock(&cache->lock);
+    return usable;
+}
+
+//A server that can't be reached is given up on for the rest of the build,
+//instead of paying a connection timeout on every compile.
+static void remote_failed(ActionCache *cache) {
+    mutex_lock(&cache->lock);
+    if (!cache->remote_down) {
+        cache->remote_down = 1;
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Remote cache at %s:%d unreachable, continuing without it",
+                 cache->remote.host, cache->remote.port);
+        print_info(msg);
+    }
+    mutex_unlock(&cache->lock);
+}
+
+//Download path to a temporary file next to dest. A blob is checked against its
+//hash before it is renamed into place. Returns 1 when dest was written.
+static int remote_get(ActionCache *cache, const char *path, const char *dest, const char *expected_hash) {
+    char dir[CACHE_FILE_LEN];
+    parent_dir(dest, dir, sizeof(dir));
+    if (make_path(dir) != 0) return 0;
+
+    char tmp[CACHE_FILE_LEN + 64];
+    temp_name(cache, dest, tmp, sizeof(tmp));
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return 0;
+    int status = http_request(&cache->remote, "GET", path, NULL, 0, fp);
+    if (fclose(fp) != 0) status = -2;
+    if (status == -1) remote_failed(cache);
+
+    int ok = status == 200;
+    char hash[CACHE_KEY_HEX];
+    if (ok && expected_hash) ok = hash_file_hex(tmp, hash) == 0 && strcmp(hash, expected_hash) == 0;
+    if (ok && replace_file(tmp, dest) == 0) return 1;
+    remove(tmp);
+    return 0;
+}
+
+//Pull an entry and the blobs it is missing into the local cache. Runs on the
+//scheduler workers, so every compile that misses locally fetches in parallel.
+static int fetch_remote(ActionCache *cache, const char *key) {
+    if (!remote_usable(cache)) return 0;
+
+    //The entry is only renamed into place once all its blobs are here.
+    char path[CACHE_FILE_LEN];
+    char tmp_entry[CACHE_FILE_LEN + 64];
+    char url_path[256];
+    entry_path(cache, key, path, sizeof(path));
+    temp_name(cache, path, tmp_entry, sizeof(tmp_entry));
+    snprintf(url_path, sizeof(url_path), "/ac/%s", key);
+    if (!remote_get(cache, url_path, tmp_entry, NULL)) return 0;
+
+    CacheOutput *outputs = malloc(sizeof(CacheOutput) * CACHE_MAX_OUTPUTS);
+    int count = outputs ? read_entry(tmp_entry, outputs, CACHE_MAX_OUTPUTS) : -1;
+    int ok = count > 0;
+
+    char blob[CACHE_FILE_LEN];
+    for (int i = 0; ok && i < count; i++) {
+        blob_path(cache, outputs[i].hash, blob, sizeof(blob));
+        if (path_exists(blob)) continue;
+        snprintf(url_path, sizeof(url_path), "/cas/%s", outputs[i].hash);
+        ok = remote_get(cache, url_path, blob, outputs[i].hash);
+    }
+    free(outputs);
+
+    if (ok && replace_file(tmp_entry, path) == 0) return 1;
+    remove(tmp_entry);
+    return 0;
+}
+
+//PUT a file unless the server already has it (checked with HEAD for blobs).
+static int remote_put(ActionCache *cache, const char *path, const char *file, int check_first) {
+    if (check_first) {
+        int status = http_request(&cache->remote, "HEAD", path, NULL, 0, NULL);
+        if (status == 200) return 0;
+        if (status < 0) {
+            remote_failed(cache);
+            return -1;
+        }
+    }
+
+    struct stat st;
+    if (stat(file, &st) != 0) return -1;
+    FILE *fp = fopen(file, "rb");
+    if (!fp) return -1;
+    int status = http_request(&cache->remote, "PUT", path, fp, (long long)st.st_size, NULL);
+    fclose(fp);
+    if (status < 0) remote_failed(cache);
+    return (status == 200 || status == 201 || status == 204) ? 0 : -1;
+}
+
+//Blobs go up before the entry that points at them.
+static int upload_entry(ActionCache *cache, const char *key) {
+    char path[CACHE_FILE_LEN];
+    entry_path(cache, key, path, sizeof(path));
+    CacheOutput *outputs = malloc(sizeof(CacheOutput) * CACHE_MAX_OUTPUTS);
+    int count = outputs ? read_entry(path, outputs, CACHE_MAX_OUTPUTS) : -1;
+    int ok = count > 0;
+
+    char blob[CACHE_FILE_LEN];
+    char url_path[256];
+    for (int i = 0; ok && i < count; i++) {
+        blob_path(cache, outputs[i].hash, blob, sizeof(blob));
+        snprintf(url_path, sizeof(url_path), "/cas/%s", outputs[i].hash);
+        ok = remote_put(cache, url_path, blob, 1) == 0;
+    }
+    free(outputs);
+
+    snprintf(url_path, sizeof(url_path), "/ac/%s", key);
+    return (ok && remote_put(cache, url_path, path, 0) == 0) ? 0 : -1;
+}
+
+//Uploads run on their own thread so a compile never waits on the network.
+static void uploader_main(void *arg) {
+    ActionCache *cache = (ActionCache *)arg;
+    mutex_lock(&cache->lock);
+    for (;;) {
+        while (cache->upload_head == cache->upload_tail && !cache->upload_closing) {
+            cond_wait(&cache->upload_cond, &cache->lock);
+        }
+        if (cache->upload_head == cache->upload_tail) break;
+
+        char *key = cache->upload_queue[cache->upload_head++];
+        int usable = !cache->remote_down;
+        mutex_unlock(&cache->lock);
+
+        int ok = usable && upload_entry(cache, key) == 0;
+        free(key);
+
+        mutex_lock(&cache->lock);
+        if (ok) cache->stats.uploads++;
+        else    cache->stats.upload_failures++;
+    }
+    mutex_unlock(&cache->lock);
+}
+
+static void queue_upload(ActionCache *cache, const char *key) {
+    mutex_lock(&cache->lock);
+    if (cache->upload_closing || cache->remote_down) {
+        mutex_unlock(&cache->lock);
+        return;
+    }
+    if (cache->upload_tail == cache->upload_capacity) {
+        int new_cap = cache->upload_capacity ? cache->upload_capacity * 2 : 64;
+        char **tmp = realloc(cache->upload_queue, sizeof(char *) * new_cap);
+        if (!tmp) {
+            mutex_unlock(&cache->lock);
+            return;
+        }
+        cache->upload_queue    = tmp;
+        cache->upload_capacity = new_cap;
+    }
+    cache->upload_queue[cache->upload_tail++] = strdup(key);
+    if (!cache->uploader_running && thread_create(&cache->uploader, uploader_main, cache) == 0) {
+        cache->uploader_running = 1;
+    }
+    cond_broadcast(&cache->upload_cond);
+    mutex_unlock(&cache->lock);
+}
+
+void action_cache_flush(ActionCache *cache) {
+    mutex_lock(&cache->lock);
+    cache->upload_closing = 1;
+    cond_broadcast(&cache->upload_cond);
+    int running = cache->uploader_running;
+    cache->uploader_running = 0;
+    mutex_unlock(&cache->lock);
+    if (running) thread_join(cache->uploader);
+}
+
+//=============================================================================
+// Stand-in server
+//=============================================================================
+
+//Largest body the server accepts.
+#define CACHE_SERVER_MAX_BODY (2LL * 1024 * 1024 * 1024)
+
+//Trim the server store after this many uploads.
+#define CACHE_SERVER_TRIM_EVERY 256
+
+typedef struct ServeConnection {
+    ActionCache  *store;
+    net_socket_t  sock;
+} ServeConnection;
+
+//Map "/ac/<key>" and "/cas/<hash>" onto the store. Returns 'a', 'c' or 0.
+static char serve_resolve(ActionCache *store, const char *url_path, char *file, size_t size, char *name) {
+    char kind = 0;
+    const char *hash = NULL;
+    if (strncmp(url_path, "/ac/", 4) == 0) {
+        kind = 'a';
+        hash = url_path + 4;
+    } else if (strncmp(url_path, "/cas/", 5) == 0) {
+        kind = 'c';
+        hash = url_path + 5;
+    }
+    if (!kind || !is_hex_hash(hash)) return 0;
+
+    snprintf(name, CACHE_KEY_HEX, "%s", hash);
+    for (char *p = name; *p; p++) *p = (char)tolower((unsigned char)*p);
+    if (kind == 'a') entry_path(store, name, file, size);
+    else             blob_path(store, name, file, size);
+    return kind;
+}
+
+static int serve_put(ActionCache *store, net_socket_t sock, http_request_t *req, char kind,
+                     const char *file, const char *name) {
+    if (req->content_length < 0) return 400;
+    if (req->content_length > CACHE_SERVER_MAX_BODY) return 413;
+
+    char dir[CACHE_FILE_LEN];
+    char tmp[CACHE_FILE_LEN + 64];
+    parent_dir(file, dir, sizeof(dir));
+    if (make_path(dir) != 0) return 500;
+    temp_name(store, file, tmp, sizeof(tmp));
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return 500;
+    int ok = http_read_body(sock, req, fp, req->content_length) == 0;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) {
+        remove(tmp);
+        return 400;
+    }
+
+    //Blobs must match their name and entries must parse, so a bad client
+    //can't poison the cache for everyone else.
+    int status = 200;
+    if (kind == 'c') {
+        char hash[CACHE_KEY_HEX];
+        if (hash_file_hex(tmp, hash) != 0 || strcmp(hash, name) != 0) status = 400;
+    } else {
+        CacheOutput *outputs = malloc(sizeof(CacheOutput) * CACHE_MAX_OUTPUTS);
+        if (!outputs || read_entry(tmp, outputs, CACHE_MAX_OUTPUTS) <= 0) status = 400;
+        free(outputs);
+    }
+    if (status == 200 && replace_file(tmp, file) != 0) status = 500;
+    if (status != 200) {
+        remove(tmp);
+        return status;
+    }
+
+    mutex_lock(&store->lock);
+    int trim = (++store->stats.stores % CACHE_SERVER_TRIM_EVERY) == 0;
+    mutex_unlock(&store->lock);
+    if (trim) action_cache_trim(store);
+    return 200;
+}
+
+static void serve_connection(void *arg) {
+    ServeConnection *conn = (ServeConnection *)arg;
+    ActionCache *store = conn->store;
+    net_socket_t sock  = conn->sock;
+    free(conn);
+
+    http_request_t req;
+    if (http_read_request(sock, &req) != 0) {
+        net_close(sock);
+        return;
+    }
+
+    char file[CACHE_FILE_LEN];
+    char name[CACHE_KEY_HEX];
+    char kind = serve_resolve(store, req.path, file, sizeof(file), name);
+    int is_get  = strcmp(req.method, "GET") == 0;
+    int is_head = strcmp(req.method, "HEAD") == 0;
+    int status;
+
+    if (!kind) {
+        status = 404;
+        http_send_response(sock, status, NULL, 0);
+    } else if (is_get || is_head) {
+        struct stat st;
+        FILE *fp = (stat(file, &st) == 0) ? fopen(file, "rb") : NULL;
+        if (fp) {
+            touch(file);
+            status = 200;
+            http_send_response(sock, status, is_get ? fp : NULL, (long long)st.st_size);
+            fclose(fp);
+        } else {
+            status = 404;
+            http_send_response(sock, status, NULL, 0);
+        }
+        mutex_lock(&store->lock);
+        if (status == 200) store->stats.hits++;
+        else               store->stats.misses++;
+        mutex_unlock(&store->lock);
+    } else if (strcmp(req.method, "PUT") == 0) {
+        status = serve_put(store, sock, &req, kind, file, name);
+        http_send_response(sock, status, NULL, 0);
+    } else {
+        status = 405;
+        http_send_response(sock, status, NULL, 0);
+    }
+
+    char msg[1200];
+    snprintf(msg, sizeof(msg), "%s %s %d", req.method, req.path, status);
+    print_info(msg);
+    fflush(stdout);
+    net_close(sock);
+}
+
+int action_cache_serve(const char *dir, int port, int local_only) {
+    if (net_init() != 0) {
+        print_error("Failed to initialize sockets");
+        return -1;
+    }
+
+    ActionCache *store = action_cache_open(dir, NULL);
+    if (!store) {
+        print_error("Failed to create the cache server directory");
+        return -1;
+    }
+
+    net_socket_t listener = net_listen(port, local_only);
+    if (listener == NET_INVALID_SOCKET) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Failed to listen on port %d", port);
+        print_error(msg);
+        action_cache_close(store);
+        return -1;
+    }
+
+    char msg[CACHE_PATH_LEN + 128];
+    snprintf(msg, sizeof(msg), "Serving the build cache in %s on http://%s:%d",
+             store->root, local_only ? "127.0.0.1" : "0.0.0.0", port);
+    print_ok(msg);
+    fflush(stdout);
+
+    //One thread per connection. Every request is a single short transfer.
+    for (;;) {
+        net_socket_t sock = net_accept(listener);
+        if (sock == NET_INVALID_SOCKET) continue;
+        ServeConnection *conn = malloc(sizeof(ServeConnection));
+        if (!conn) {
+            net_close(sock);
+            continue;
+        }
+        conn->store = store;
+        conn->sock  = sock;
+        thread_t thread;
+        if (thread_create(&thread, serve_connection, conn) != 0) {
+            net_close(sock);
+            free(conn);
+            continue;
+        }
+        thread_detach(thread);
+    }
+
+    //Not reached, the server runs until it is killed.
+    net_close(listener);
+    action_cache_close(store);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef FORTUNA_CACHE_H
+#define FORTUNA_CACHE_H
+
+#include "blake3.h"
+
+//Content addressed action cache shared by every project of the user. An action
+//is one compile, keyed by everything that can change its outputs. The outputs
+//(the object and the .mod/.smod files it wrote) are stored once by content:
+//
+//  <root>/ac/<xx>/<key>    one line per output: "o <blob>" or "m <blob> <name>"
+//  <root>/cas/<xx>/<blob>  file contents, named by their BLAKE3 hash
+//
+//Entries are written after their blobs and every file is written to a temporary
+//name and renamed, so concurrent builds can share a cache. A hit refreshes the
+//mtime of everything it touched, and trimming removes the least recently used
+//files first until the cache is back under its size limit.
+//
+//A remote backend speaks plain HTTP with the same layout, in the spirit of
+//bazel-remote: GET/HEAD/PUT on /ac/<key> and /cas/<blob>. A local miss is looked
+//up remotely and pulled into the local cache, and new entries are uploaded in
+//the background. `fortuna cache-serve` is a small server for it.
+
+#define CACHE_KEY_HEX (BLAKE3_OUT_LEN * 2 + 1)
+
+//Default size limit when [cache] max_size is not set.
+#define CACHE_DEFAULT_MAX_SIZE (5LL * 1024 * 1024 * 1024)
+
+typedef struct ActionCache ActionCache;
+
+typedef struct ActionCacheStats {
+    int hits;               // restored, locally or from the remote
+    int misses;
+    int stores;
+    int remote_hits;        // hits that had to be fetched from the remote
+    int uploads;
+    int upload_failures;
+} ActionCacheStats;
+
+//Incremental key builder. Every part is length prefixed so adjacent parts
+//can't run into each other.
+typedef struct ActionKey {
+    blake3_hasher hasher;
+} ActionKey;
+
+void action_key_init(ActionKey *key);
+void action_key_add(ActionKey *key, const void *data, size_t len);
+void action_key_add_str(ActionKey *key, const char *str);
+
+//Adds the contents of a file. Returns -1 (and adds a marker) if it can't be read.
+int  action_key_add_file(ActionKey *key, const char *path);
+void action_key_final(ActionKey *key, char hex[CACHE_KEY_HEX]);
+
+//Default location: $FORTUNA_CACHE_DIR, then $XDG_CACHE_HOME/fortuna, then
+//~/.cache/fortuna (%USERPROFILE%\.cache\fortuna on Windows).
+int  action_cache_default_dir(char *out, size_t size);
+
+//Open the cache in dir, or in the default location when dir is NULL. max_size
+//is a byte count with an optional K, M or G suffix. Returns NULL if the
+//directory can't be created.
+ActionCache *action_cache_open(const char *dir, const char *max_size);
+
+//Add a remote backend ("http://host:port/prefix"). New entries are only
+//uploaded when upload is set. Returns -1 for a URL that can't be used.
+int  action_cache_set_remote(ActionCache *cache, const char *url, int upload);
+
+//Wait for the background uploads to finish.
+void action_cache_flush(ActionCache *cache);
+
+//Flush, trim the cache if anything was stored and release it.
+void action_cache_close(ActionCache *cache);
+
+const char *action_cache_root(const ActionCache *cache);
+
+//Restore the outputs of an action: the object to obj_dest and every module
+//file into mod_dir. Module files that already hold the same contents are left
+//untouched. Returns 1 on a hit, 0 on a miss.
+int  action_cache_fetch(ActionCache *cache, const char *key, const char *obj_dest, const char *mod_dir);
+
+//Store the outputs of an action. mod_names is a NULL terminated list of files
+//in mod_dir, missing ones are skipped. Returns 0 on success.
+int  action_cache_store(ActionCache *cache, const char *key, const char *obj_src,
+                        const char *mod_dir, char **mod_names);
+
+//Remove the least recently used files until the cache is under its limit.
+void action_cache_trim(ActionCache *cache);
+
+void action_cache_stats(ActionCache *cache, ActionCacheStats *stats);
+
+//Serve a cache directory over HTTP until killed, on loopback only when
+//local_only is set. Uploaded blobs are checked against their hash.
+int  action_cache_serve(const char *dir, int port, int local_only);
+
+#endif // FORTUNA_CACHE_H
@@ -133,6 +133,15 @@ void cli_args_free(cli_args_t *args) {
     hashmap_free(&args->args_map);
 }
 
+//Words followed by a free-form value that is not checked against the dictionary.
+static int takes_value(const char *arg) {
+    static const char *with_value[] = {"new", "--bin", "--port", "--dir", "--jobs", "--latency", "--profile", "report", "--trace", "--threshold", "impact", NULL};
+    for (int i = 0; with_value[i]; i++) {
+        if (strcmp(arg, with_value[i]) == 0) return 1;
+    }
+    return 0;
+}
+
 int cli_args_parse(cli_args_t *args, int argc, char **argv) {
     if (!args || !argv) return -1;
 
@@ -140,9 +149,12 @@ int cli_args_parse(cli_args_t *args, int argc, char **argv) {
     TrieNode *root = alloc_node();
     loadDictionary(root); 
 
-    //Check if the next item is a name for the --bin flag. No suggestion needed.
+    //Check if the next item is a value (a name, a port, a path). No suggestion needed.
     int bin_check = 0;
 
+    //Position of the next word. --flag=value is two words, the same as --flag value.
+    int idx = 1;
+
     //Loop over the cli arguments
     for (int i = 1; i < argc; i++) {
         size_t arg_len = strnlen(argv[i], MAX_ARG_LEN + 1);
@@ -153,14 +165,23 @@ int cli_args_parse(cli_args_t *args, int argc, char **argv) {
             return -1;
         }
 
-        //Special case for after --bin for a specifc name and after new
-        if(strcmp(argv[i],"--bin") == 0 || strcmp(argv[i],"new") == 0) bin_check = 1;
+        char word[MAX_ARG_LEN + 1];
+        snprintf(word, sizeof(word), "%s", argv[i]);
+        char *value = strncmp(word, "--", 2) == 0 ? strchr(word, '=') : NULL;
+        if (value) *value++ = '\0';
 
         //Suggest a closest word if there is a mismatch with the options. 
-        if(!bin_check) suggest_closest_word_fuzzy(root,argv[i]);
+        if(!bin_check) suggest_closest_word_fuzzy(root,word);
+
+        //Special case for after --bin for a specifc name and after new,
+        //and the flags that take a value. Only the value itself is skipped.
+        bin_check = !value && takes_value(word);
 
         //If we failed to input the argument, return error. 
-        if (hashmap_put(&args->args_map, argv[i], i) != 0) {
+        if (hashmap_put(&args->args_map, word, idx++) != 0) {
+            return -1;
+        }
+        if (value && hashmap_put(&args->args_map, value, idx++) != 0) {
             return -1;
         }
     }
@@ -0,0 +1,658 @@
+#include "fortuna_daemon.h"
+#include "fortuna_toml.h"
+#include "fortuna_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#endif
+
+//=============================================================================
+// Client
+//=============================================================================
+#ifndef _WIN32
+static int daemon_connect(void) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DAEMON_SOCKET);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+//Send the request line with our stdout and stderr attached.
+static int send_request(int sock, const char *line) {
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    union {
+        struct cmsghdr align;
+        char           buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = (void *)line;
+    iov.iov_len  = strlen(line);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SCM_RIGHTS;
+    cm->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    return sendmsg(sock, &msg, 0) == (ssize_t)iov.iov_len ? 0 : -1;
+}
+#endif
+
+int fortuna_daemon_build(const fortuna_build_opts_t *opts, int *result) {
+#ifdef _WIN32
+    (void)opts;
+    (void)result;
+    return -1;
+#else
+    struct stat st;
+    if (stat(DAEMON_SOCKET, &st) != 0) return -1;
+    int sock = daemon_connect();
+    if (sock < 0) return -1;
+
+    char line[384];
+    snprintf(line, sizeof(line), "build %d %d %d %d %d %s\n", opts->parallel_build, opts->incremental,
+             opts->lib_only, opts->run_flag, opts->stats, opts->profile ? opts->profile : "-");
+    fflush(stdout);
+    fflush(stderr);
+    if (send_request(sock, line) != 0) {
+        close(sock);
+        return -1;
+    }
+
+    //The build prints to our terminal, all that comes back is its result.
+    char reply[64];
+    size_t used = 0;
+    while (used + 1 < sizeof(reply)) {
+        ssize_t n = read(sock, reply + used, sizeof(reply) - 1 - used);
+        if (n <= 0) break;
+        used += (size_t)n;
+        if (memchr(reply, '\n', used)) break;
+    }
+    reply[used] = '\0';
+    close(sock);
+
+    if (sscanf(reply, "exit %d", result) != 1) {
+        print_info("The build daemon went away, building without it");
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+//=============================================================================
+// Daemon
+//=============================================================================
+#ifndef __linux__
+int fortuna_daemon_serve(void) {
+    print_error("fortuna daemon needs inotify and is only available on Linux");
+    return -1;
+}
+
+int fortuna_watch(const fortuna_build_opts_t *opts, int run) {
+    (void)opts;
+    (void)run;
+    print_error("fortuna watch needs inotify and is only available on Linux");
+    return -1;
+}
+#else
+
+//Quiet time after the last change before a watch rebuilds.
+#define WATCH_DEBOUNCE_MS   150
+
+//How long a running target gets to exit after SIGTERM.
+#define WATCH_KILL_GRACE_MS 1000
+
+#define SOURCE_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF)
+#define OUTPUT_MASK (IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF)
+#define ROOT_MASK   (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+typedef enum {
+    WATCH_SOURCE,       // a search directory, or below a deep one
+    WATCH_OUTPUT,       // obj_dir and mod_dir, only deletions matter
+    WATCH_ROOT          // the project directory, for Fortuna.toml and the target
+} WatchKind;
+
+typedef struct Watch {
+    int        wd;
+    WatchKind  kind;
+    int        deep;
+    char      *path;
+} Watch;
+
+typedef struct Daemon {
+    int           inotify_fd;
+    Watch        *watches;
+    int           nwatches;
+    int           capacity;
+    BuildSession *session;
+    char          target[512];
+    char          obj_dir[512];
+    char          mod_dir[512];
+    char          run_args[1024];   // [args] cmd, for fortuna watch --run
+    int           clean;            // the last build succeeded and nothing changed since
+    int           clean_lib_only;   // ... and it was a --lib build
+    char          clean_profile[256]; // ... of this --profile, "" without one
+    int           config_changed;
+} Daemon;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void on_stop_signal(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+//The scanner picks up every file with one of these in its name.
+static int is_scanned_name(const char *name) {
+    return strstr(name, ".f") || strstr(name, ".F") || strstr(name, ".c");
+}
+
+static Watch *find_watch(Daemon *d, int wd) {
+    for (int i = 0; i < d->nwatches; i++) {
+        if (d->watches[i].wd == wd) return &d->watches[i];
+    }
+    return NULL;
+}
+
+static void add_watch(Daemon *d, const char *path, WatchKind kind, int deep) {
+    uint32_t mask = kind == WATCH_SOURCE ? SOURCE_MASK : kind == WATCH_OUTPUT ? OUTPUT_MASK : ROOT_MASK;
+    int wd = inotify_add_watch(d->inotify_fd, path, mask);
+    if (wd < 0 || find_watch(d, wd)) return;
+
+    if (d->nwatches == d->capacity) {
+        int cap = d->capacity ? d->capacity * 2 : 64;
+        Watch *tmp = realloc(d->watches, sizeof(Watch) * cap);
+        if (!tmp) return;
+        d->watches  = tmp;
+        d->capacity = cap;
+    }
+    Watch *w = &d->watches[d->nwatches++];
+    w->wd   = wd;
+    w->kind = kind;
+    w->deep = deep;
+    w->path = strdup(path);
+
+    //inotify is not recursive, so deep search directories get a watch per
+    //subdirectory. New ones are added as they appear.
+    if (!deep) return;
+    DIR *dir = opendir(path);
+    if (!dir) return;
+    struct dirent *entry;
+    char sub[1024];
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(sub, sizeof(sub), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (stat(sub, &st) == 0 && S_ISDIR(st.st_mode)) add_watch(d, sub, kind, 1);
+    }
+    closedir(dir);
+}
+
+static void remove_watch(Daemon *d, Watch *w) {
+    free(w->path);
+    *w = d->watches[--d->nwatches];
+}
+
+static void free_string_array(char **list) {
+    if (!list) return;
+    for (int i = 0; list[i]; i++) free(list[i]);
+    free(list);
+}
+
+//(Re)read Fortuna.toml and watch everything a build reads. Starts over with
+//a fresh session, since anything may have changed while nobody was looking.
+static int daemon_watch_project(Daemon *d) {
+    if (d->inotify_fd >= 0) close(d->inotify_fd);
+    for (int i = 0; i < d->nwatches; i++) free(d->watches[i].path);
+    d->nwatches = 0;
+    build_session_free(d->session);
+    d->session = build_session_create();
+    d->clean   = 0;
+
+    d->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (d->inotify_fd < 0 || !d->session) return -1;
+
+    fortuna_toml_t cfg = {0};
+    if (fortuna_toml_load("Fortuna.toml", &cfg) != 0) {
+        print_error("Failed to load Fortuna.toml.");
+        return -1;
+    }
+    const char *target  = fortuna_toml_get_string(&cfg, "build.target");
+    const char *obj_dir = fortuna_toml_get_string(&cfg, "build.obj_dir");
+    const char *mod_dir = fortuna_toml_get_string(&cfg, "build.mod_dir");
+    snprintf(d->target, sizeof(d->target), "%s", target ? target : "");
+    snprintf(d->obj_dir, sizeof(d->obj_dir), "%s", obj_dir ? obj_dir : "obj");
+    snprintf(d->mod_dir, sizeof(d->mod_dir), "%s", mod_dir ? mod_dir : "mod");
+    const char *run_args = fortuna_toml_get_string(&cfg, "args.cmd");
+    snprintf(d->run_args, sizeof(d->run_args), "%s", run_args ? run_args : "");
+
+    add_watch(d, ".", WATCH_ROOT, 0);
+    char **deep_dirs    = fortuna_toml_get_array(&cfg, "search.deep");
+    char **shallow_dirs = fortuna_toml_get_array(&cfg, "search.shallow");
+    for (int i = 0; deep_dirs && deep_dirs[i]; i++) add_watch(d, deep_dirs[i], WATCH_SOURCE, 1);
+    for (int i = 0; shallow_dirs && shallow_dirs[i]; i++) add_watch(d, shallow_dirs[i], WATCH_SOURCE, 0);
+    add_watch(d, d->obj_dir, WATCH_OUTPUT, 0);
+    add_watch(d, d->mod_dir, WATCH_OUTPUT, 0);
+    free_string_array(deep_dirs);
+    free_string_array(shallow_dirs);
+    fortuna_toml_free(&cfg);
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Watching %d directories", d->nwatches);
+    print_info(msg);
+    return 0;
+}
+
+//Events read after a build come with during_build set. The build's own
+//output is ignored then, and the scan is dropped since it may predate the change.
+static void handle_event(Daemon *d, const struct inotify_event *ev, int during_build) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        d->config_changed = 1;
+        d->clean = 0;
+        return;
+    }
+    Watch *w = find_watch(d, ev->wd);
+    if (!w) return;
+    if (ev->mask & IN_IGNORED) {
+        remove_watch(d, w);
+        return;
+    }
+
+    if (w->kind == WATCH_ROOT) {
+        if (!ev->len) return;
+        if (strcmp(ev->name, "Fortuna.toml") == 0) {
+            d->config_changed = 1;
+            d->clean = 0;
+        } else if (!during_build && strcmp(ev->name, d->target) == 0 && (ev->mask & (IN_DELETE | IN_MOVED_FROM))) {
+            d->clean = 0;
+        }
+        return;
+    }
+    if (w->kind == WATCH_OUTPUT) {
+        if (!during_build) d->clean = 0;
+        return;
+    }
+
+    if (ev->mask & IN_DELETE_SELF) {
+        build_session_invalidate_scan(d->session);
+        d->clean = 0;
+        return;
+    }
+    if (!ev->len) return;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", w->path, ev->name);
+    if (ev->mask & IN_ISDIR) {
+        if (w->deep && (ev->mask & (IN_CREATE | IN_MOVED_TO))) add_watch(d, path, WATCH_SOURCE, 1);
+        build_session_invalidate_scan(d->session);
+        d->clean = 0;
+        return;
+    }
+
+    //Editor swap files and the like don't matter, neither to the scanner nor
+    //to any build so far.
+    int scanned = is_scanned_name(ev->name);
+    int known   = build_session_file_changed(d->session, path);
+    if (!known && !scanned) return;
+    d->clean = 0;
+    if (during_build || (scanned && (!known || (ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))))) {
+        build_session_invalidate_scan(d->session);
+    }
+}
+
+static void drain_events(Daemon *d, int during_build) {
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(d->inotify_fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (char *p = buf; p < buf + n; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            handle_event(d, ev, during_build);
+        }
+    }
+}
+
+//Read the request line and the descriptors that came with it.
+static int read_request(int sock, char *line, size_t size, int fds[2]) {
+    union {
+        struct cmsghdr align;
+        char           buf[CMSG_SPACE(sizeof(int) * 2)];
+    } control;
+
+    struct iovec iov;
+    iov.iov_base = line;
+    iov.iov_len  = size - 1;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    fds[0] = fds[1] = -1;
+    ssize_t n = recvmsg(sock, &msg, 0);
+    if (n <= 0) return -1;
+    line[n] = '\0';
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int received[2] = { -1, -1 };
+        memcpy(received, CMSG_DATA(cm), sizeof(int) * (count > 2 ? 2 : count));
+        fds[0] = received[0];
+        fds[1] = received[1];
+    }
+    return 0;
+}
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+//Run a build on the session. d->clean says afterwards whether it succeeded
+//with nothing changing underneath it.
+static int session_build(Daemon *d, fortuna_build_opts_t *opts) {
+    opts->session = d->session;
+    d->clean = 1;
+    int result = fortuna_build_project_incremental(opts);
+    fflush(stdout);
+    fflush(stderr);
+
+    drain_events(d, 1);
+    if (result != 0) d->clean = 0;
+    d->clean_lib_only = opts->lib_only;
+    snprintf(d->clean_profile, sizeof(d->clean_profile), "%s", opts->profile ? opts->profile : "");
+
+    //The build may have created them.
+    add_watch(d, d->obj_dir, WATCH_OUTPUT, 0);
+    add_watch(d, d->mod_dir, WATCH_OUTPUT, 0);
+    return result;
+}
+
+static void daemon_free(Daemon *d) {
+    if (d->inotify_fd >= 0) close(d->inotify_fd);
+    for (int i = 0; i < d->nwatches; i++) free(d->watches[i].path);
+    free(d->watches);
+    build_session_free(d->session);
+}
+
+static void serve_request(Daemon *d, int client) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char line[384];
+    char profile[256] = "-";
+    int fds[2];
+    fortuna_build_opts_t opts = {0};
+    if (read_request(client, line, sizeof(line), fds) != 0 ||
+        sscanf(line, "build %d %d %d %d %d %255s", &opts.parallel_build, &opts.incremental,
+               &opts.lib_only, &opts.run_flag, &opts.stats, profile) < 5) {
+        if (fds[0] >= 0) close(fds[0]);
+        if (fds[1] >= 0) close(fds[1]);
+        return;
+    }
+    if (strcmp(profile, "-") != 0) opts.profile = profile;
+
+    //Catch up on everything that happened since the last request.
+    drain_events(d, 0);
+    if (d->config_changed) {
+        d->config_changed = 0;
+        print_info("Fortuna.toml changed, starting over");
+        daemon_watch_project(d);
+    }
+
+    //The build prints to the client's terminal.
+    fflush(stdout);
+    fflush(stderr);
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+    if (fds[0] >= 0) dup2(fds[0], STDOUT_FILENO);
+    if (fds[1] >= 0) dup2(fds[1], STDERR_FILENO);
+
+    struct stat st;
+    int noop = d->clean && opts.incremental && (opts.lib_only || !d->clean_lib_only) &&
+               strcmp(d->clean_profile, opts.profile ? opts.profile : "") == 0 &&
+               (opts.lib_only || !d->target[0] || stat(d->target, &st) == 0);
+    int result = 0;
+    if (noop) {
+        if (!opts.run_flag) print_info("Nothing to build");
+    } else {
+        result = session_build(d, &opts);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
+
+    char reply[32];
+    int n = snprintf(reply, sizeof(reply), "exit %d\n", result);
+    if (write(client, reply, (size_t)n) != n) print_info("Client went away before the build finished");
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%s in %.2f ms", noop ? "No-op build" : result == 0 ? "Build finished" : "Build failed",
+             elapsed_ms(&start));
+    print_info(msg);
+}
+
+int fortuna_daemon_serve(void) {
+    Daemon d;
+    memset(&d, 0, sizeof(d));
+    d.inotify_fd = -1;
+
+    if (make_path(".cache") != 0) {
+        print_error("Failed to create .cache");
+        return -1;
+    }
+
+    //A socket nobody answers on is left over from a daemon that was killed.
+    int probe = daemon_connect();
+    if (probe >= 0) {
+        close(probe);
+        print_error("A daemon is already running for this project");
+        return -1;
+    }
+    unlink(DAEMON_SOCKET);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DAEMON_SOCKET);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+        print_error("Failed to create the daemon socket");
+        if (listener >= 0) close(listener);
+        return -1;
+    }
+
+    if (daemon_watch_project(&d) != 0) {
+        close(listener);
+        unlink(DAEMON_SOCKET);
+        return -1;
+    }
+
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    //Builds print in order with the compilers they launch.
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    print_ok("Daemon listening on " DAEMON_SOCKET);
+    while (!daemon_stop) {
+        struct pollfd pfd[2] = {
+            { listener, POLLIN, 0 },
+            { d.inotify_fd, POLLIN, 0 },
+        };
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfd[1].revents & POLLIN) drain_events(&d, 0);
+        if (pfd[0].revents & POLLIN) {
+            int client = accept(listener, NULL, NULL);
+            if (client < 0) continue;
+            serve_request(&d, client);
+            close(client);
+        }
+    }
+
+    print_info("Daemon stopped");
+    close(listener);
+    unlink(DAEMON_SOCKET);
+    daemon_free(&d);
+    return 0;
+}
+
+//=============================================================================
+// Watch
+//=============================================================================
+
+//Start the target with [args] cmd, without waiting for it.
+static pid_t launch_target(Daemon *d) {
+    char cmd[2048];
+    snprintf(cmd, sizeof(cmd), "exec ./%s %s", d->target, d->run_args);
+    print_info(cmd + 5);
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0) print_error("Failed to start the target");
+    return pid;
+}
+
+//Report a target that exited on its own.
+static void reap_target(pid_t *child) {
+    int status;
+    if (*child <= 0 || waitpid(*child, &status, WNOHANG) != *child) return;
+    char msg[128];
+    if (WIFEXITED(status)) snprintf(msg, sizeof(msg), "Target exited with code %d", WEXITSTATUS(status));
+    else snprintf(msg, sizeof(msg), "Target killed by signal %d", WTERMSIG(status));
+    print_info(msg);
+    *child = -1;
+}
+
+//Stop a target that is still running: SIGTERM, then SIGKILL after a grace period.
+static void stop_target(pid_t *child) {
+    if (*child <= 0) return;
+    kill(*child, SIGTERM);
+    for (int i = 0; i < WATCH_KILL_GRACE_MS / 10; i++) {
+        if (waitpid(*child, NULL, WNOHANG) == *child) {
+            *child = -1;
+            return;
+        }
+        sleep_ms(10);
+    }
+    kill(*child, SIGKILL);
+    waitpid(*child, NULL, 0);
+    *child = -1;
+}
+
+int fortuna_watch(const fortuna_build_opts_t *base, int run) {
+    Daemon d;
+    memset(&d, 0, sizeof(d));
+    d.inotify_fd = -1;
+    if (daemon_watch_project(&d) != 0) {
+        daemon_free(&d);
+        return -1;
+    }
+
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    fortuna_build_opts_t opts = *base;
+    pid_t child = -1;
+    if (session_build(&d, &opts) == 0 && run) child = launch_target(&d);
+    print_info("Watching for changes, Ctrl-C to stop");
+
+    //A save often comes as a burst of events (write, rename, several files),
+    //so the rebuild waits until things have been quiet for a moment.
+    int pending = 0;
+    struct timespec last_change;
+    while (!daemon_stop) {
+        int timeout = -1;
+        if (pending) {
+            timeout = WATCH_DEBOUNCE_MS - (int)elapsed_ms(&last_change);
+            if (timeout < 0) timeout = 0;
+        } else if (child > 0) {
+            timeout = 200;
+        }
+
+        struct pollfd pfd = { d.inotify_fd, POLLIN, 0 };
+        int n = poll(&pfd, 1, timeout);
+        if (n < 0 && errno != EINTR) break;
+        reap_target(&child);
+
+        if (n > 0) {
+            d.clean = 1;
+            drain_events(&d, 0);
+            if (!d.clean) {
+                pending = 1;
+                clock_gettime(CLOCK_MONOTONIC, &last_change);
+            }
+            continue;
+        }
+        if (!pending || elapsed_ms(&last_change) < WATCH_DEBOUNCE_MS) continue;
+
+        pending = 0;
+        if (d.config_changed) {
+            d.config_changed = 0;
+            print_info("Fortuna.toml changed, starting over");
+            if (daemon_watch_project(&d) != 0) break;
+        }
+        stop_target(&child);
+        print_info("Change detected, rebuilding");
+        if (session_build(&d, &opts) == 0 && run) child = launch_target(&d);
+    }
+
+    stop_target(&child);
+    daemon_free(&d);
+    return 0;
+}
+#endif
@@ -0,0 +1,36 @@
+#ifndef FORTUNA_DAEMON_H
+#define FORTUNA_DAEMON_H
+
+#include "fortuna_build.h"
+
+//Persistent build daemon, one per project. `fortuna daemon` keeps a build
+//session (file digests and scan results, see BuildSession) in memory, watches
+//the search directories and Fortuna.toml with inotify, and runs the builds the
+//CLI asks for over a Unix domain socket in .cache. The client passes its
+//stdout and stderr along with the request, so the build prints straight to the
+//user's terminal.
+//
+//When nothing it watches changed since the last successful build, a request is
+//answered without touching the disk. Otherwise only the files it saw change are
+//hashed again, and the scanner only runs again when files were added or
+//removed, or their module, use or include lines changed.
+//
+//`fortuna watch` uses the same machinery in the foreground.
+//
+//Linux only (inotify). Elsewhere the CLI simply builds on its own.
+
+#define DAEMON_SOCKET ".cache/daemon.sock"
+
+//Run the daemon for the project in the current directory until killed.
+int fortuna_daemon_serve(void);
+
+//Build, then rebuild whenever a source changes (after a short quiet period,
+//so a burst of saves is one build). With run the target is started with
+//[args] cmd after every successful build, and stopped before the next one.
+int fortuna_watch(const fortuna_build_opts_t *opts, int run);
+
+//Hand a build to the daemon of this project. Returns 0 and sets result to
+//the build's return code when it ran there, -1 when there is no daemon.
+int fortuna_daemon_build(const fortuna_build_opts_t *opts, int *result);
+
+#endif // FORTUNA_DAEMON_H
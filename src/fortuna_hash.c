@@ -1,11 +1,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "fortuna_hash.h"
+#include "fortuna_stats.h"
 #include "blake3.h"
 
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define PATH_LIST_SEP ';'
+#else
+#define PATH_LIST_SEP ':'
+#endif
+
 #define MAX_LINE 1024
-#define HASH_TABLE_SIZE 1024
+
+//Environment variables that change what the compiler produces without
+//showing up on the command line. 
+static const char *toolchain_env_vars[] = {
+    "CPATH",
+    "C_INCLUDE_PATH",
+    "CPLUS_INCLUDE_PATH",
+    "LIBRARY_PATH",
+    "COMPILER_PATH",
+    "GCC_EXEC_PREFIX",
+    "GFORTRAN_CONVERT_UNIT",
+    "SOURCE_DATE_EPOCH",
+    "NVCC_PREPEND_FLAGS",
+    "NVCC_APPEND_FLAGS",
+    NULL
+};
 
 //Use blake3 for hashing the file
 INLINE unsigned int hash_file_blake3(const char *filename) {
@@ -19,11 +44,15 @@ INLINE unsigned int hash_file_blake3(const char *filename) {
 
     unsigned char buffer[4096];
     size_t bytes_read;
+    long long total = 0;
     while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
         blake3_hasher_update(&hasher, buffer, bytes_read);
+        total += (long long)bytes_read;
     }
 
     fclose(file);
+    stats_count(STAT_FILES_HASHED, 1);
+    stats_count(STAT_BYTES_HASHED, total);
 
     uint8_t hash[BLAKE3_OUT_LEN];
     blake3_hasher_finalize(&hasher, hash, BLAKE3_OUT_LEN);
@@ -38,99 +67,300 @@ INLINE unsigned int hash_file_blake3(const char *filename) {
     return reduced_hash;
 }
 
-// Simple hash function for strings (djb2)
+// Reduce a finalized blake3 hasher to 32-bits like the file hashes.
+static unsigned int blake3_finalize_reduced(blake3_hasher *hasher) {
+    uint8_t hash[BLAKE3_OUT_LEN];
+    blake3_hasher_finalize(hasher, hash, BLAKE3_OUT_LEN);
+    return ((unsigned int)hash[0] << 24) |
+           ((unsigned int)hash[1] << 16) |
+           ((unsigned int)hash[2] << 8)  |
+           ((unsigned int)hash[3]);
+}
+
+//Find the compiler binary the shell would run. Returns 1 and fills the
+//path and stat buffer if found. 
+static int resolve_compiler_path(const char *compiler, char *path, size_t size, struct stat *st) {
+    if (strchr(compiler, '/') || strchr(compiler, '\\')) {
+        snprintf(path, size, "%s", compiler);
+        return stat(path, st) == 0;
+    }
+
+    const char *env_path = getenv("PATH");
+    if (!env_path) return 0;
+
+    const char *p = env_path;
+    while (*p) {
+        const char *end = strchr(p, PATH_LIST_SEP);
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len > 0) {
+#ifdef _WIN32
+            snprintf(path, size, "%.*s\\%s.exe", (int)len, p, compiler);
+            if (stat(path, st) == 0) return 1;
+#endif
+            snprintf(path, size, "%.*s/%s", (int)len, p, compiler);
+            if (stat(path, st) == 0 && (st->st_mode & S_IFMT) == S_IFREG) return 1;
+        }
+        if (!end) break;
+        p = end + 1;
+    }
+    return 0;
+}
+
+//Fingerprint the toolchain. Stat'ing the binary is cheap, so we use the
+//path, size and mtime when we can find it, and fall back to hashing the
+//--version output otherwise. An upgraded compiler changes the fingerprint
+//and so every object it built is stale. 
+unsigned int toolchain_fingerprint(const char *compiler) {
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+
+    char path[1024];
+    struct stat st;
+    if (resolve_compiler_path(compiler, path, sizeof(path), &st)) {
+        char identity[1200];
+        int n = snprintf(identity, sizeof(identity), "%s|%lld|%lld", path,
+                         (long long)st.st_size, (long long)st.st_mtime);
+        blake3_hasher_update(&hasher, identity, (size_t)n);
+    } else {
+        char cmd[1100];
+        snprintf(cmd, sizeof(cmd), "%s --version", compiler);
+        blake3_hasher_update(&hasher, compiler, strlen(compiler));
+        FILE *pipe = popen(cmd, "r");
+        if (pipe) {
+            char chunk[512];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), pipe)) > 0) {
+                blake3_hasher_update(&hasher, chunk, n);
+            }
+            pclose(pipe);
+        }
+    }
+
+    for (int i = 0; toolchain_env_vars[i]; i++) {
+        const char *val = getenv(toolchain_env_vars[i]);
+        if (!val) continue;
+        blake3_hasher_update(&hasher, toolchain_env_vars[i], strlen(toolchain_env_vars[i]));
+        blake3_hasher_update(&hasher, "=", 1);
+        blake3_hasher_update(&hasher, val, strlen(val));
+        blake3_hasher_update(&hasher, "\n", 1);
+    }
+
+    return blake3_finalize_reduced(&hasher);
+}
+
+//Fingerprint of one object: the exact compile command plus the toolchain. 
+//Never 0 so a missing value in an old cache can't match.
+unsigned int compile_fingerprint(unsigned int toolchain, const char *compile_cmd) {
+    blake3_hasher hasher;
+    blake3_hasher_init(&hasher);
+    blake3_hasher_update(&hasher, &toolchain, sizeof(toolchain));
+    blake3_hasher_update(&hasher, compile_cmd, strlen(compile_cmd));
+    unsigned int fp = blake3_finalize_reduced(&hasher);
+    return fp ? fp : 1;
+}
+
+// FNV-1a over the filename. The full 32 bits are kept so the probe loop can
+// reject most mismatches without a strcmp.
 INLINE unsigned int str_hash(const char *str) {
-    unsigned int hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-    return hash & (HASH_TABLE_SIZE-1); //Assumes hash table size is a power of 2. 
-}
-
-// Create new dependent node
-DependentNode *new_dependent_node(const char *dependent) {
-    DependentNode *node = malloc(sizeof(DependentNode));
-    if (!node) {
-        print_error("malloc failed in hashmap creating new node");
+    unsigned int hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)(*str++);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//Every allocation failure in here is fatal, like the rest of the build. 
+static void *xrealloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        print_error("malloc failed in the dependency graph");
         exit(EXIT_FAILURE);
     }
-    node->dependent = strdup(dependent);
-    node->next = NULL;
-    return node;
+    return p;
 }
 
-// Create new file node with file hash
-FileNode *new_file_node(const char *filename) {
-    FileNode *node = malloc(sizeof(FileNode));
-    if (!node) {
-        print_error("malloc failed in hashmap creating new node");
+//Read a full line of any length into *buf, growing it as needed.
+//Returns 0 at end of file. 
+static int read_full_line(FILE *fp, char **buf, size_t *cap) {
+    size_t len = 0;
+    if (*cap == 0) {
+        *cap = MAX_LINE;
+        *buf = xrealloc(NULL, *cap);
+    }
+    while (fgets(*buf + len, (int)(*cap - len), fp)) {
+        len += strlen(*buf + len);
+        if (len > 0 && (*buf)[len - 1] == '\n') return 1;
+        if (len + 1 < *cap) return 1; // last line without a newline
+        *cap *= 2;
+        *buf = xrealloc(*buf, *cap);
+    }
+    return len > 0;
+}
+
+//=============================================================================
+// File table
+//=============================================================================
+void file_table_init(FileTable *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+void file_table_free(FileTable *table) {
+    for (int i = 0; i < table->count; i++) free(table->names[i]);
+    free(table->names);
+    free(table->name_hash);
+    free(table->slots);
+    file_table_init(table);
+}
+
+//Double the slot array and re-insert every id.
+static void file_table_grow_slots(FileTable *table) {
+    int new_cap = table->slot_capacity ? table->slot_capacity * 2 : FILE_TABLE_INITIAL_SLOTS;
+    int *slots  = calloc((size_t)new_cap, sizeof(int));
+    if (!slots) {
+        print_error("malloc failed in the dependency graph");
         exit(EXIT_FAILURE);
     }
-    node->filename = strdup(filename);
-    node->file_hash = hash_file_blake3(filename);
-    node->dependents = NULL;
-    node->next = NULL;
-    return node;
+
+    unsigned int mask = (unsigned int)new_cap - 1;
+    for (int id = 0; id < table->count; id++) {
+        unsigned int i = table->name_hash[id] & mask;
+        while (slots[i]) i = (i + 1) & mask;
+        slots[i] = id + 1;
+    }
+
+    free(table->slots);
+    table->slots         = slots;
+    table->slot_capacity = new_cap;
 }
 
-// Find file node in hashtable by filename
-FileNode *find_file_node(const char *filename, FileNode *hash_table[]) {
-    unsigned int index = str_hash(filename);
-    FileNode *curr = hash_table[index];
-    while (curr) {
-        if (strcmp(curr->filename, filename) == 0) {
-            return curr;
+// Find the id for a filename, or -1 if it was never interned
+int file_table_find(const FileTable *table, const char *filename) {
+    if (table->slot_capacity == 0) return -1;
+
+    unsigned int hash = str_hash(filename);
+    unsigned int mask = (unsigned int)table->slot_capacity - 1;
+    unsigned int i    = hash & mask;
+    while (table->slots[i]) {
+        int id = table->slots[i] - 1;
+        if (table->name_hash[id] == hash && strcmp(table->names[id], filename) == 0) {
+            return id;
         }
-        curr = curr->next;
+        i = (i + 1) & mask;
     }
-    return NULL;
+    return -1;
 }
 
-// Get or create file node in hashtable
-FileNode *get_or_create_file_node(const char *filename, FileNode *hash_table[]) {
-    FileNode *node = find_file_node(filename, hash_table);
-    if (node) return node;
+// Get or create the id for a filename
+int file_table_intern(FileTable *table, const char *filename) {
+    int id = file_table_find(table, filename);
+    if (id >= 0) return id;
+
+    //Keep the load factor under 70% so the probe sequences stay short.
+    if ((long long)(table->count + 1) * 10 > (long long)table->slot_capacity * 7) {
+        file_table_grow_slots(table);
+    }
+
+    if (table->count == table->capacity) {
+        table->capacity  = table->capacity ? table->capacity * 2 : FILE_TABLE_INITIAL_SLOTS;
+        table->names     = xrealloc(table->names, sizeof(char *) * table->capacity);
+        table->name_hash = xrealloc(table->name_hash, sizeof(unsigned int) * table->capacity);
+    }
 
-    node = new_file_node(filename);
-    unsigned int index = str_hash(filename);
-    node->next = hash_table[index];
-    hash_table[index] = node;
-    return node;
+    unsigned int hash = str_hash(filename);
+    id = table->count++;
+    table->names[id]     = strdup(filename);
+    table->name_hash[id] = hash;
+
+    unsigned int mask = (unsigned int)table->slot_capacity - 1;
+    unsigned int i    = hash & mask;
+    while (table->slots[i]) i = (i + 1) & mask;
+    table->slots[i] = id + 1;
+    return id;
 }
 
-// Add dependent to file's dependents list if not already present
-void add_dependent(FileNode *file, const char *dependent) {
-    DependentNode *curr = file->dependents;
-    while (curr) {
-        if (strcmp(curr->dependent, dependent) == 0) {
-            return; // already added
-        }
-        curr = curr->next;
+//=============================================================================
+// Bitsets
+//=============================================================================
+int bitset_init(Bitset *set, int nbits) {
+    size_t nwords = (size_t)(nbits + 63) / 64;
+    set->words = calloc(nwords ? nwords : 1, sizeof(uint64_t));
+    set->nbits = nbits;
+    return set->words ? 0 : -1;
+}
+
+void bitset_free(Bitset *set) {
+    free(set->words);
+    set->words = NULL;
+    set->nbits = 0;
+}
+
+//=============================================================================
+// Dependency graph
+//=============================================================================
+static void id_list_push(IdList *list, int id) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 4;
+        list->ids      = xrealloc(list->ids, sizeof(int) * list->capacity);
     }
-    DependentNode *newnode = new_dependent_node(dependent);
-    newnode->next = file->dependents;
-    file->dependents = newnode;
+    list->ids[list->count++] = id;
 }
 
-//Simple check if a node is in the hashmap already. 
-int node_is_in_the_hashmap(const char *filename, FileNode *hash_table[]){
-    FileNode *node = find_file_node(filename, hash_table);
-    return !(node == NULL);
+void graph_init(DepGraph *graph) {
+    memset(graph, 0, sizeof(*graph));
+    file_table_init(&graph->files);
 }
 
-//Insert node
-void insert_node(const char *filename, FileNode *hash_table[]) {
-    FileNode *node = find_file_node(filename, hash_table);
-    if (node) return;
-    node = new_file_node(filename);
-    unsigned int index = str_hash(filename);
-    node->next = hash_table[index];
-    hash_table[index] = node;
-    return;
+void graph_free(DepGraph *graph) {
+    for (int i = 0; i < graph->files.count; i++) {
+        free(graph->dependents[i].ids);
+        free(graph->dependencies[i].ids);
+    }
+    free(graph->records);
+    free(graph->dependents);
+    free(graph->dependencies);
+    free(graph->topo);
+    file_table_free(&graph->files);
+    graph_init(graph);
 }
 
-// Parse a dependency line, update hashtable with dependents
-void parse_line(char *line, FileNode *hash_table[]) {
+// Get or create the id for a file, growing the per-id arrays alongside the table
+int graph_intern(DepGraph *graph, const char *filename) {
+    int id = file_table_intern(&graph->files, filename);
+    if (id >= graph->capacity) {
+        int new_cap = graph->files.capacity;
+        graph->records      = xrealloc(graph->records, sizeof(FileRecord) * new_cap);
+        graph->dependents   = xrealloc(graph->dependents, sizeof(IdList) * new_cap);
+        graph->dependencies = xrealloc(graph->dependencies, sizeof(IdList) * new_cap);
+        memset(graph->records + graph->capacity, 0, sizeof(FileRecord) * (new_cap - graph->capacity));
+        memset(graph->dependents + graph->capacity, 0, sizeof(IdList) * (new_cap - graph->capacity));
+        memset(graph->dependencies + graph->capacity, 0, sizeof(IdList) * (new_cap - graph->capacity));
+        graph->capacity = new_cap;
+    }
+
+    //Any new node invalidates the cached order.
+    if (graph->topo && id == graph->files.count - 1) {
+        free(graph->topo);
+        graph->topo = NULL;
+    }
+    return id;
+}
+
+// dependency -> dependent. Duplicate edges are dropped.
+void graph_add_edge(DepGraph *graph, int dependency, int dependent) {
+    IdList *deps = &graph->dependencies[dependent];
+    for (int i = 0; i < deps->count; i++) {
+        if (deps->ids[i] == dependency) return;
+    }
+    id_list_push(deps, dependency);
+    id_list_push(&graph->dependents[dependency], dependent);
+
+    free(graph->topo);
+    graph->topo = NULL;
+}
+
+// Parse a dependency line "target: dep dep ..." into the graph
+void parse_line(char *line, DepGraph *graph) {
     char *colon = strchr(line, ':');
     if (!colon) return;
 
@@ -147,301 +377,320 @@ void parse_line(char *line, FileNode *hash_table[]) {
     }
 
     // Ensure target is in the graph
-    FileNode *target_node = get_or_create_file_node(target, hash_table);
-    if(target_node == NULL){
-        print_error("Unable to insert node into hash table when parsing the hash.dep file");
-        exit(1);
-    }
+    int target_id = graph_intern(graph, target);
 
     // Parse dependencies and add edges
-    char *dep = strtok(deps, " \t");
+    char *dep = strtok(deps, " \t\r");
     while (dep) {
-        FileNode *dep_node = get_or_create_file_node(dep, hash_table);
-        add_dependent(dep_node, target);  // dep_node -> target
-        dep = strtok(NULL, " \t");
+        int dep_id = graph_intern(graph, dep);
+        graph_add_edge(graph, dep_id, target_id);
+        dep = strtok(NULL, " \t\r");
     }
 }
 
-int parse_dependency_file(const char *filename, FileNode *hash_table[]) {
-    // Initialize table to NULLs
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        hash_table[i] = NULL;
-    }
-
+int parse_dependency_file(const char *filename, DepGraph *graph) {
     FILE *fp = fopen(filename, "r");
     if (!fp) {
         print_error("Error opening dependency file");
         return 0;
     }
 
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\n")] = 0; // strip newline
+    char *line = NULL;
+    size_t cap = 0;
+    while (read_full_line(fp, &line, &cap)) {
+        line[strcspn(line, "\r\n")] = 0; // strip newline
         if (strlen(line) == 0) continue;
-        parse_line(line, hash_table);
+        parse_line(line, graph);
     }
 
+    free(line);
     fclose(fp);
     return 1;
 }
 
-void print_hashtable(FileNode *hash_table[]) {
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        FileNode *node = hash_table[i];
-        while (node) {
-            printf("[TABLE] %s -> hash: %u\n", node->filename, node->file_hash);
-            DependentNode *d = node->dependents;
-            while (d) {
-                printf("    depends on -> %s\n", d->dependent);
-                d = d->next;
-            }
-            node = node->next;
-        }
+// Content hash of every file in the graph
+void graph_hash_files(DepGraph *graph) {
+    for (int id = 0; id < graph->files.count; id++) {
+        graph->records[id].file_hash = hash_file_blake3(graph->files.names[id]);
     }
 }
 
-// Free all allocated memory
-void free_all(FileNode *hash_table[]) {
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        FileNode *curr = hash_table[i];
-        while (curr) {
-            free(curr->filename);
-            DependentNode *d = curr->dependents;
-            while (d) {
-                DependentNode *tmp = d;
-                free(d->dependent);
-                d = d->next;
-                free(tmp);
+//FNV-1a over the lines that decide the dependency graph: module, submodule,
+//program, use and include statements. Edits anywhere else leave it unchanged.
+static unsigned int scan_signature(const char *filename) {
+    static const char *keywords[] = {"use", "module", "submodule", "program", "include", "#include", NULL};
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return 0;
+
+    unsigned int hash = 2166136261u;
+    char *line = NULL;
+    size_t cap = 0;
+    while (read_full_line(fp, &line, &cap)) {
+        const char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        for (int k = 0; keywords[k]; k++) {
+            size_t len = strlen(keywords[k]);
+            if (strncasecmp(p, keywords[k], len) != 0) continue;
+            if (p[len] && p[len] != ' ' && p[len] != '\t' && p[len] != ',' && p[len] != '"' && p[len] != '\'' && p[len] != '<') continue;
+            for (const char *c = p; *c && *c != '\n' && *c != '\r'; c++) {
+                hash ^= (unsigned char)*c;
+                hash *= 16777619u;
             }
-            FileNode *tmp = curr;
-            curr = curr->next;
-            free(tmp);
+            hash ^= '\n';
+            hash *= 16777619u;
+            break;
         }
-        hash_table[i] = NULL;
     }
+    free(line);
+    fclose(fp);
+    return hash;
 }
 
-int load_hash_table(const char* dependency_list, FileNode *hash_table[]) {
-    FILE *fp = fopen(dependency_list, "r");
-    if (!fp) return -1;
+void digest_cache_init(DigestCache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    file_table_init(&cache->files);
+}
 
-    // Initialize
-    for (int i = 0; i < HASH_TABLE_SIZE; i++)
-        hash_table[i] = NULL;
+void digest_cache_free(DigestCache *cache) {
+    free(cache->file_hash);
+    free(cache->scan_sig);
+    free(cache->valid);
+    file_table_free(&cache->files);
+    digest_cache_init(cache);
+}
 
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), fp)) {
-        line[strcspn(line, "\n")] = 0;
-        if (strlen(line) == 0) continue;
-        parse_line(line, hash_table);
+void graph_hash_files_cached(DepGraph *graph, DigestCache *cache) {
+    for (int id = 0; id < graph->files.count; id++) {
+        const char *name = graph->files.names[id];
+        int slot = file_table_intern(&cache->files, name);
+        if (slot >= cache->capacity) {
+            int old = cache->capacity;
+            cache->capacity  = cache->files.capacity;
+            cache->file_hash = xrealloc(cache->file_hash, sizeof(unsigned int) * cache->capacity);
+            cache->scan_sig  = xrealloc(cache->scan_sig, sizeof(unsigned int) * cache->capacity);
+            cache->valid     = xrealloc(cache->valid, cache->capacity);
+            memset(cache->valid + old, 0, cache->capacity - old);
+        }
+        if (!cache->valid[slot]) {
+            cache->file_hash[slot] = hash_file_blake3(name);
+            cache->scan_sig[slot]  = scan_signature(name);
+            cache->valid[slot]     = 1;
+        }
+        graph->records[id].file_hash = cache->file_hash[slot];
     }
-    fclose(fp);
-    return 0;
 }
 
-int save_hashes(const char *filename, FileNode *hash_table[]) {
-    FILE *fp = fopen(filename, "w");
-    if (!fp) {
-        print_error("Failed to open file for saving hashes");
-        return 0;
-    }
+int digest_cache_invalidate(DigestCache *cache, const char *filename) {
+    int slot = file_table_find(&cache->files, filename);
+    if (slot < 0) return -1;
+    cache->valid[slot] = 0;
+    return scan_signature(filename) != cache->scan_sig[slot];
+}
 
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        FileNode *curr = hash_table[i];
-        while (curr) {
-            fprintf(fp, "%s %u\n", curr->filename, curr->file_hash);
-            curr = curr->next;
+void print_graph(const DepGraph *graph) {
+    for (int id = 0; id < graph->files.count; id++) {
+        printf("[TABLE] %s -> hash: %u\n", graph->files.names[id], graph->records[id].file_hash);
+        const IdList *d = &graph->dependencies[id];
+        for (int i = 0; i < d->count; i++) {
+            printf("    depends on -> %s\n", graph->files.names[d->ids[i]]);
         }
     }
-
-    fclose(fp);
-    return 1;
 }
 
-void load_prev_hashes(const char *filename, HashEntry *prev_hash_table[]) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        // No cache file yet so we just return.
-        return;
-    }
+const int *graph_topo_order(DepGraph *graph) {
+    if (graph->topo) return graph->topo;
 
-    char fname[512];
-    unsigned int hash;
+    int n = graph->files.count;
+    int *order     = xrealloc(NULL, sizeof(int) * (n ? n : 1));
+    int *in_degree = xrealloc(NULL, sizeof(int) * (n ? n : 1));
 
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) prev_hash_table[i] = NULL;
+    int back = 0;
+    for (int id = 0; id < n; id++) {
+        in_degree[id] = graph->dependencies[id].count;
+        if (in_degree[id] == 0) order[back++] = id;
+    }
 
-    while (fscanf(fp, "%511s %u", fname, &hash) == 2) {
-        HashEntry *entry = malloc(sizeof(HashEntry));
-        entry->filename  = strdup(fname);
-        entry->file_hash = hash;
+    //The order array doubles as the queue.
+    for (int front = 0; front < back; front++) {
+        const IdList *d = &graph->dependents[order[front]];
+        for (int i = 0; i < d->count; i++) {
+            if (--in_degree[d->ids[i]] == 0) order[back++] = d->ids[i];
+        }
+    }
 
-        unsigned int idx = str_hash(fname);
-        entry->next = prev_hash_table[idx];
-        prev_hash_table[idx] = entry;
+    //A cycle leaves nodes with edges remaining. Keep them so nothing is lost,
+    //the compiler will complain about the missing module instead.
+    if (back < n) {
+        for (int id = 0; id < n; id++) {
+            if (in_degree[id] > 0) order[back++] = id;
+        }
     }
 
-    fclose(fp);
+    free(in_degree);
+    graph->topo = order;
+    return order;
 }
 
-int file_is_unchanged(const char *filename, unsigned int current_hash, HashEntry *prev_hash_table[]) {
-    unsigned int idx = str_hash(filename);
-    HashEntry *entry = prev_hash_table[idx];
-    while (entry) {
-        if (strcmp(entry->filename, filename) == 0) {
-            return entry->file_hash == current_hash;
-        }
-        entry = entry->next;
+void graph_propagate_dirty(DepGraph *graph, Bitset *dirty) {
+    const int *order = graph_topo_order(graph);
+    for (int k = 0; k < graph->files.count; k++) {
+        int u = order[k];
+        if (!bitset_test(dirty, u)) continue;
+        const IdList *d = &graph->dependents[u];
+        for (int i = 0; i < d->count; i++) bitset_set(dirty, d->ids[i]);
     }
-    return 0;
 }
 
-void prune_unchanged_files(FileNode *hash_table[], HashEntry *prev_hash_table[]) {
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        FileNode **pprev = &hash_table[i];
-        FileNode *curr = hash_table[i];
-
-        while (curr) {
-            if (file_is_unchanged(curr->filename, curr->file_hash, prev_hash_table)) {
-                // Remove the node
-                *pprev = curr->next;
-
-                // Free memory
-                free(curr->filename);
-                DependentNode *d = curr->dependents;
-                while (d) {
-                    DependentNode *tmp = d;
-                    free(d->dependent);
-                    d = d->next;
-                    free(tmp);
-                }
-
-                FileNode *tmp = curr;
-                curr = curr->next;
-                free(tmp);
-            } else {
-                pprev = &curr->next;
-                curr = curr->next;
-            }
-        }
+int graph_collect_in_topo_order(DepGraph *graph, const Bitset *set, int *out) {
+    const int *order = graph_topo_order(graph);
+    int n = 0;
+    for (int k = 0; k < graph->files.count; k++) {
+        if (bitset_test(set, order[k])) out[n++] = order[k];
     }
+    return n;
 }
 
-void prune_obsolete_cached_entries(HashEntry *prev_hash_table[], FileNode *hash_table[]) {
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        HashEntry **pprev = &prev_hash_table[i];
-        HashEntry *curr = prev_hash_table[i];
+//=============================================================================
+// Hash cache
+//=============================================================================
+void hash_cache_init(HashCache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    file_table_init(&cache->files);
+}
 
-        while (curr) {
-            // Check if this filename is in the current dependency graph
-            if (!find_file_node(curr->filename, hash_table)) {
-                *pprev = curr->next;
+void hash_cache_free(HashCache *cache) {
+    free(cache->records);
+    file_table_free(&cache->files);
+    hash_cache_init(cache);
+}
 
-                free(curr->filename);
-                free(curr);
-                curr = *pprev;
-            } else {
-                pprev = &curr->next;
-                curr = curr->next;
-            }
-        }
+static void hash_cache_put(HashCache *cache, const char *filename, unsigned int file_hash, unsigned int fingerprint) {
+    int id = file_table_intern(&cache->files, filename);
+    if (id >= cache->capacity) {
+        cache->capacity = cache->files.capacity;
+        cache->records  = xrealloc(cache->records, sizeof(FileRecord) * cache->capacity);
     }
+    cache->records[id].file_hash   = file_hash;
+    cache->records[id].fingerprint = fingerprint;
 }
 
-void free_prev_hash_table(HashEntry *prev_hash_table[]) {
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        HashEntry *curr = prev_hash_table[i];
-        while (curr) {
-            HashEntry *tmp = curr;
-            free(curr->filename);
-            curr = curr->next;
-            free(tmp);
-        }
-        prev_hash_table[i] = NULL;
-    }
+const FileRecord *hash_cache_lookup(const HashCache *cache, const char *filename) {
+    int id = file_table_find(&cache->files, filename);
+    return (id < 0) ? NULL : &cache->records[id];
 }
 
-DependentNode* get_dependents_if_changed(const char *filename, FileNode *hash_table[], HashEntry *prev_hash_table[]) {
-    FileNode *curr = find_file_node(filename, hash_table);
-    if (!curr) return NULL;  // Not in current graph
+//Written to a temporary file and renamed over the old cache, so a crash
+//mid-write can never leave a truncated hash.dep behind.
+int save_hashes(const char *filename, const DepGraph *graph) {
+    char tmp_name[1024];
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename);
 
-    unsigned int current_hash = curr->file_hash;
+    FILE *fp = fopen(tmp_name, "w");
+    if (!fp) {
+        print_error("Failed to open file for saving hashes");
+        return 0;
+    }
 
-    // Look up in old hash table
-    unsigned int idx = str_hash(filename);
-    HashEntry *entry = prev_hash_table[idx];
-    while (entry) {
-        if (strcmp(entry->filename, filename) == 0) {
-            if (entry->file_hash != current_hash) {
-                return curr->dependents;  // File changed
-            } else {
-                return NULL;  // File unchanged
-            }
-        }
-        entry = entry->next;
+    for (int id = 0; id < graph->files.count; id++) {
+        fprintf(fp, "%s %u %u\n", graph->files.names[id],
+                graph->records[id].file_hash, graph->records[id].fingerprint);
     }
 
-    // If not found in previous table, it's new -> mark as changed
-    return curr->dependents;
+    if (fclose(fp) != 0 || replace_file(tmp_name, filename) != 0) {
+        print_error("Failed to save hashes");
+        remove(tmp_name);
+        return 0;
+    }
+    return 1;
 }
 
+void load_prev_hashes(const char *filename, HashCache *cache) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        // No cache file yet so we just return.
+        return;
+    }
 
-// Check if we need to reprocess
-bool is_in_rebuild_list(const char *filename, FileNode *rebuild_list) {
-    FileNode *curr = rebuild_list;
-    while (curr) {
-        if (strcmp(curr->filename, filename) == 0) return true;
-        curr = curr->next;
+    char line[MAX_LINE];
+    char fname[512];
+    unsigned int hash;
+    unsigned int fingerprint;
+
+    //Caches written before fingerprints existed only have two columns. Those
+    //entries get a fingerprint of 0 which never matches, so they rebuild once.
+    while (fgets(line, sizeof(line), fp)) {
+        fingerprint = 0;
+        if (sscanf(line, "%511s %u %u", fname, &hash, &fingerprint) < 2) continue;
+        hash_cache_put(cache, fname, hash, fingerprint);
     }
-    return false;
+
+    fclose(fp);
 }
 
-// Add file to rebuild list
-void append_to_rebuild_list(FileNode **rebuild_list, const char *filename) {
-    if (is_in_rebuild_list(filename, *rebuild_list)) return;
+int file_is_unchanged(const DepGraph *graph, int id, const HashCache *cache) {
+    const FileRecord *prev = hash_cache_lookup(cache, graph->files.names[id]);
+    if (!prev) return 0; // new file
+    return prev->file_hash   == graph->records[id].file_hash &&
+           prev->fingerprint == graph->records[id].fingerprint;
+}
 
-    //Otherwise, add to the end. Note, the list is topologically sorted
-    //So we want to add them in order. 
-    FileNode *node = new_file_node(filename);
-    if (*rebuild_list == NULL) {
-        *rebuild_list = node;
-    } else {
-        FileNode *curr = *rebuild_list;
-        while (curr->next != NULL) {
-            curr = curr->next;
-        }
-        curr->next = node;
-    }
+//=============================================================================
+// Build journal
+//=============================================================================
+FILE *journal_open(const char *filename, int append) {
+    FILE *fp = fopen(filename, append ? "a" : "w");
+    if (!fp) print_error("Failed to open the build journal");
+    return fp;
 }
 
-// Recursive marking + hash table pruning
-void mark_dependents_for_rebuild(const char *filename, FileNode *hash_table[], FileNode **rebuild_list, int *rebuild_cnt) {
-    unsigned int idx = str_hash(filename);
-    FileNode **pprev = &hash_table[idx];
-    FileNode *node   = hash_table[idx];
-    while (node) {
+void journal_mark_dirty(FILE *journal, const char *filename) {
+    if (!journal) return;
+    fprintf(journal, "D %s\n", filename);
+    fflush(journal);
+}
 
-        if (strcmp(node->filename, filename) == 0) {
-            FileNode *next_bucket = node->next; // save continuation
-            append_to_rebuild_list(rebuild_list, node->filename);
+void journal_commit(FILE *journal, const char *filename, const FileRecord *record) {
+    if (!journal) return;
+    fprintf(journal, "C %s %u %u\n", filename, record->file_hash, record->fingerprint);
+    fflush(journal);
+}
+
+int journal_replay(const char *filename, HashCache *cache, FileTable *pending) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return 0;
 
-            //Increment the number of elements in the rebuild list. 
-            (*rebuild_cnt)++; 
+    //Planned is a flag per id of the seen table, since a
+    //later "C" clears an earlier "D" and a later build can mark it again.
+    char *planned = NULL;
+    int planned_cap = 0;
 
-            // Mark dependents recursively
-            DependentNode *d = node->dependents;
-            while (d) {
-                if (!is_in_rebuild_list(d->dependent, *rebuild_list)) {
-                    mark_dependents_for_rebuild(d->dependent, hash_table, rebuild_list, rebuild_cnt);
-                }
-                d = d->next;
-            }
+    FileTable seen;
+    file_table_init(&seen);
 
-            // unlink from hash bucket (note we saved next_bucket)
-            *pprev = next_bucket;   // skip this node in the chain
-            node   = next_bucket;   // continue traversal
-        } else {
-            pprev = &node->next;
-            node = node->next;
+    char line[MAX_LINE];
+    char fname[512];
+    unsigned int hash, fingerprint;
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == 'D' && sscanf(line + 1, "%511s", fname) == 1) {
+            int id = file_table_intern(&seen, fname);
+            if (id >= planned_cap) {
+                planned_cap = seen.capacity;
+                planned = xrealloc(planned, planned_cap);
+            }
+            planned[id] = 1;
+        } else if (line[0] == 'C' && sscanf(line + 1, "%511s %u %u", fname, &hash, &fingerprint) == 3) {
+            hash_cache_put(cache, fname, hash, fingerprint);
+            int id = file_table_find(&seen, fname);
+            if (id >= 0) planned[id] = 0;
         }
+        //Anything else is a torn last line from a crash and is ignored.
     }
-}
\ No newline at end of file
+    fclose(fp);
+
+    for (int id = 0; id < seen.count; id++) {
+        if (planned[id]) file_table_intern(pending, seen.names[id]);
+    }
+    free(planned);
+    file_table_free(&seen);
+    return 1;
+}
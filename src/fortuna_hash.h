@@ -3,78 +3,150 @@
 
 #include "fortuna_helper_fn.h"
 #include <stdbool.h>
-
-#define HASH_TABLE_SIZE 1024
-
-typedef struct DependentNode {
-    char *dependent;
-    struct DependentNode *next;
-} DependentNode;
-
-typedef struct FileNode {
-    char *filename;
-    unsigned int file_hash;
-    DependentNode *dependents;
-    struct FileNode *next;
-    int marked;
-} FileNode;
-
-typedef struct HashEntry {
-    char *filename;
+#include <stdint.h>
+
+//Initial number of slots in the open addressing file table. Must be a power of 2.
+#define FILE_TABLE_INITIAL_SLOTS 1024
+
+//Interned file table. Every filename gets a dense integer id (0..count-1) on
+//first sight, and all the graph bookkeeping is done on ids from there on.
+//Lookups are open addressing with linear probing on the full 32-bit hash,
+//and the slot array doubles before it reaches 70% load.
+typedef struct FileTable {
+    char         **names;       // id -> filename (owned)
+    unsigned int  *name_hash;   // id -> full hash of the filename
+    int           *slots;       // id + 1, or 0 for an empty slot
+    int            count;
+    int            capacity;    // capacity of names/name_hash
+    int            slot_capacity;
+} FileTable;
+
+//Growable list of file ids.
+typedef struct IdList {
+    int *ids;
+    int  count;
+    int  capacity;
+} IdList;
+
+//What the incremental cache knows about a file.
+typedef struct FileRecord {
     unsigned int file_hash;
-    struct HashEntry *next;
-} HashEntry;
+    unsigned int fingerprint;   // compile argv + toolchain identity
+} FileRecord;
+
+//Dependency graph over interned ids with integer adjacency in both directions.
+typedef struct DepGraph {
+    FileTable   files;
+    FileRecord *records;        // id -> current hashes
+    IdList     *dependents;     // id -> files that use it
+    IdList     *dependencies;   // id -> files it uses
+    int        *topo;           // cached topological order (NULL until asked for)
+    int         capacity;
+} DepGraph;
+
+//Hashes from the previous build, as loaded from .cache/hash.dep
+typedef struct HashCache {
+    FileTable   files;
+    FileRecord *records;
+    int         capacity;
+} HashCache;
+
+//Digests kept from one build to the next by a long running process (fortuna
+//daemon). An entry stays valid until the file is reported as changed.
+typedef struct DigestCache {
+    FileTable      files;
+    unsigned int  *file_hash;
+    unsigned int  *scan_sig;    // hash of the lines the dependency scanner reads
+    unsigned char *valid;
+    int            capacity;
+} DigestCache;
+
+//Fixed size bitset over file ids.
+typedef struct Bitset {
+    uint64_t *words;
+    int       nbits;
+} Bitset;
 
 // Hash functions
 INLINE unsigned int hash_file_blake3(const char *filename);
-INLINE unsigned int str_hash(const char *str);
-
-// Node creation
-DependentNode *new_dependent_node(const char *dependent);
-FileNode *new_file_node(const char *filename);
-
-// Hashtable access
-FileNode *find_file_node(const char *filename, FileNode *hash_table[]);
-FileNode *get_or_create_file_node(const char *filename, FileNode *hash_table[]);
-
-// Dependency management
-void add_dependent(FileNode *file, const char *dependent);
-void parse_line(char *line, FileNode *hash_table[]);
-int parse_dependency_file(const char *filename, FileNode *hash_table[]);
 
-// Hashtable operations
-void print_hashtable(FileNode *hash_table[]);
-void free_all(FileNode *hash_table[]);
+// Compile fingerprints. The toolchain fingerprint covers the resolved compiler
+// binary (path, size, mtime) and the environment variables that change its output.
+// The compile fingerprint combines it with the exact compile command of one object.
+unsigned int toolchain_fingerprint(const char *compiler);
+unsigned int compile_fingerprint(unsigned int toolchain, const char *compile_cmd);
+
+// File table
+void file_table_init(FileTable *table);
+void file_table_free(FileTable *table);
+int  file_table_find(const FileTable *table, const char *filename);
+int  file_table_intern(FileTable *table, const char *filename);
+
+// Bitsets
+int  bitset_init(Bitset *set, int nbits);
+void bitset_free(Bitset *set);
+
+INLINE void bitset_set(Bitset *set, int bit) {
+    set->words[bit >> 6] |= (uint64_t)1 << (bit & 63);
+}
+
+INLINE int bitset_test(const Bitset *set, int bit) {
+    return (int)((set->words[bit >> 6] >> (bit & 63)) & 1);
+}
+
+// Dependency graph
+void graph_init(DepGraph *graph);
+void graph_free(DepGraph *graph);
+int  graph_intern(DepGraph *graph, const char *filename);
+void graph_add_edge(DepGraph *graph, int dependency, int dependent);
+void parse_line(char *line, DepGraph *graph);
+int  parse_dependency_file(const char *filename, DepGraph *graph);
+void graph_hash_files(DepGraph *graph);
+
+//Same as graph_hash_files, but only files without a valid digest are read.
+void graph_hash_files_cached(DepGraph *graph, DigestCache *cache);
+void print_graph(const DepGraph *graph);
+
+//Topological order of every id (dependencies first). Computed once with
+//Kahn's algorithm and cached on the graph. Ids caught in a cycle go last.
+const int *graph_topo_order(DepGraph *graph);
+
+//Spread the dirty bits to every transitive dependent. Iterative, one pass
+//over the topological order, so deep graphs can't blow the stack.
+void graph_propagate_dirty(DepGraph *graph, Bitset *dirty);
+
+//Write the ids that are set in topological order to out. Returns the count.
+int graph_collect_in_topo_order(DepGraph *graph, const Bitset *set, int *out);
 
 // Loading and saving hashes
-int load_hash_table(const char* dependency_list, FileNode *hash_table[]);
-int save_hashes(const char *filename, FileNode *hash_table[]);
-
-// Previous hash table management
-void load_prev_hashes(const char *filename, HashEntry *prev_hash_table[]);
-int file_is_unchanged(const char *filename, unsigned int current_hash, HashEntry *prev_hash_table[]);
-void prune_unchanged_files(FileNode *hash_table[], HashEntry *prev_hash_table[]);
-void prune_obsolete_cached_entries(HashEntry *prev_hash_table[], FileNode *hash_table[]);
-void free_prev_hash_table(HashEntry *prev_hash_table[]);
-
-// Dependency checking
-DependentNode* get_dependents_if_changed(const char *filename, FileNode *hash_table[], HashEntry *prev_hash_table[]);
-
-//Rebuild check
-// Check if a file is already marked for rebuild
-bool is_in_rebuild_list(const char *filename, FileNode *rebuild_list);
-
-// Add file to the rebuild list if not already present
-void append_to_rebuild_list(FileNode **rebuild_list, const char *filename);
-
-// Recursively mark a file and its dependents for rebuild,
-// removing visited nodes from the hash_table
-void mark_dependents_for_rebuild(const char *filename, FileNode *hash_table[], FileNode **rebuild_list, int *rebuild_cnt);
-
-//Generic function to insert node
-void insert_node(const char *filename, FileNode *hash_table[]);
-
-//Generic function to check node. 
-int node_is_in_the_hashmap(const char *filename, FileNode *hash_table[]);
-
-#endif // FORTUNA_HASH_H
\ No newline at end of file
+void hash_cache_init(HashCache *cache);
+void hash_cache_free(HashCache *cache);
+void load_prev_hashes(const char *filename, HashCache *cache);
+int  save_hashes(const char *filename, const DepGraph *graph);
+const FileRecord *hash_cache_lookup(const HashCache *cache, const char *filename);
+
+//True when the file and its compile fingerprint match the previous build.
+int file_is_unchanged(const DepGraph *graph, int id, const HashCache *cache);
+
+// Digest cache
+void digest_cache_init(DigestCache *cache);
+void digest_cache_free(DigestCache *cache);
+
+//Forget the digest of a file that changed. Returns 1 when the lines the
+//scanner reads (module, use, include, ...) changed as well, 0 when they did
+//not, and -1 for a file the cache has never hashed.
+int  digest_cache_invalidate(DigestCache *cache, const char *filename);
+
+// Build journal. hash.dep is only rewritten once a whole build succeeded. In
+// between, the journal records which files a build planned to compile ("D file")
+// and each object that finished ("C file hash fingerprint"), flushed line by line.
+// Replaying it after a failed or interrupted build lands exactly where it stopped.
+FILE *journal_open(const char *filename, int append);
+void  journal_mark_dirty(FILE *journal, const char *filename);
+void  journal_commit(FILE *journal, const char *filename, const FileRecord *record);
+
+//Apply a journal on top of the loaded hashes. Files that were planned but never
+//committed are interned into pending. Returns 1 if a journal was found.
+int   journal_replay(const char *filename, HashCache *cache, FileTable *pending);
+
+#endif // FORTUNA_HASH_H
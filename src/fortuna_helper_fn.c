@@ -18,12 +18,18 @@ void print_test(const char *msg) {
 
 #if defined(_WIN32)
 #include <windows.h>
+#include <psapi.h>
 
 // Windows version using CreateProcessA
 int launch_process(const char *exe, const char *args) {
-    // Combine exe + args into a single command line string
-    char cmdline[4096];
-    snprintf(cmdline, sizeof(cmdline), "%s %s", exe, args ? args : "");
+    // Combine exe + args into a single command line string, as long as it is
+    size_t len = strlen(exe) + (args ? strlen(args) : 0) + 2;
+    char *cmdline = malloc(len);
+    if (!cmdline) {
+        print_error("Memory allocation error in starting a process");
+        return -1;
+    }
+    snprintf(cmdline, len, "%s %s", exe, args ? args : "");
 
     STARTUPINFOA si = {0};
     PROCESS_INFORMATION pi = {0};
@@ -39,6 +45,7 @@ int launch_process(const char *exe, const char *args) {
         NULL,             // Current directory (inherit)
         &si, &pi
     );
+    free(cmdline);
 
     if (!success) {
         char msg[512];
@@ -57,9 +64,57 @@ int launch_process(const char *exe, const char *args) {
     return (int)exit_code;
 }
 
+// Same as above, then the CPU time and peak working set of the process.
+int launch_process_stats(const char *cmd, const char *dir, ProcessStats *stats) {
+    //CreateProcessA may write to the command line, so it gets a copy.
+    char *cmdline = strdup(cmd);
+    if (!cmdline) {
+        print_error("Memory allocation error in starting a process");
+        return -1;
+    }
+
+    STARTUPINFOA si = {0};
+    PROCESS_INFORMATION pi = {0};
+    si.cb = sizeof(si);
+    BOOL success = CreateProcessA(NULL, cmdline, NULL, NULL, FALSE, 0, NULL, dir, &si, &pi);
+    free(cmdline);
+    if (!success) {
+        char msg[512];
+        snprintf(msg,sizeof(msg),"CreateProcess failed (error %lu)\n", GetLastError());
+        print_error(msg);
+        return -1;
+    }
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD exit_code = 0;
+    GetExitCodeProcess(pi.hProcess, &exit_code);
+
+    FILETIME created, exited, kernel, user;
+    if (GetProcessTimes(pi.hProcess, &created, &exited, &kernel, &user)) {
+        ULARGE_INTEGER k, u;
+        k.LowPart  = kernel.dwLowDateTime;
+        k.HighPart = kernel.dwHighDateTime;
+        u.LowPart  = user.dwLowDateTime;
+        u.HighPart = user.dwHighDateTime;
+        stats->cpu_seconds = (double)(k.QuadPart + u.QuadPart) * 1e-7;
+    }
+    PROCESS_MEMORY_COUNTERS mem;
+    if (GetProcessMemoryInfo(pi.hProcess, &mem, sizeof(mem))) stats->peak_rss_kb = (long)(mem.PeakWorkingSetSize / 1024);
+
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    return (int)exit_code;
+}
+
+// rename() refuses to overwrite on Windows, MoveFileEx does it atomically.
+int replace_file(const char *from, const char *to) {
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+}
+
 #else
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 
 // POSIX version using fork + execve
 INLINE int launch_process(const char *exe, const char *args) {
@@ -94,4 +149,87 @@ INLINE int launch_process(const char *exe, const char *args) {
         return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
     }
 }
-#endif
\ No newline at end of file
+
+// Through the shell, so the command line is split like system() would. The
+// rusage of wait4 has the CPU time and peak RSS of the child alone.
+int launch_process_stats(const char *cmd, const char *dir, ProcessStats *stats) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        print_error("fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        if (dir && chdir(dir) != 0) _exit(127);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) return -1;
+    stats->cpu_seconds = (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+                         (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#ifdef __APPLE__
+    stats->peak_rss_kb = (long)(usage.ru_maxrss / 1024);
+#else
+    stats->peak_rss_kb = (long)usage.ru_maxrss;
+#endif
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// rename() replaces the target atomically on POSIX.
+int replace_file(const char *from, const char *to) {
+    return rename(from, to);
+}
+#endif
+
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define make_one_dir(path) _mkdir(path)
+#else
+#include <time.h>
+#define make_one_dir(path) mkdir(path, 0755)
+#endif
+
+int make_path(const char *path) {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", path);
+    size_t len = strlen(buf);
+    for (size_t i = 1; i <= len; i++) {
+        if (buf[i] != '/' && buf[i] != '\\' && buf[i] != '\0') continue;
+        char c = buf[i];
+        buf[i] = '\0';
+
+        //Skip drive letters like "C:"
+        if (!(i == 2 && buf[1] == ':')) {
+            if (make_one_dir(buf) != 0 && errno != EEXIST) return -1;
+        }
+        buf[i] = c;
+    }
+    return 0;
+}
+
+void sleep_ms(int ms) {
+    if (ms <= 0) return;
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+double now_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
@@ -24,4 +24,27 @@ void print_error(const char *msg);
 void print_test(const char *msg);
 int launch_process(const char *exe, const char *args);
 
+//What a finished process cost: user plus system CPU time, and its peak
+//resident set size.
+typedef struct ProcessStats {
+    double cpu_seconds;
+    long   peak_rss_kb;
+} ProcessStats;
+
+//Run a command line and wait for it, like launch_process, and fill in stats.
+//dir is the working directory of the process, NULL for the current one.
+//Returns the exit code, or -1 when it couldn't be started.
+int launch_process_stats(const char *cmd, const char *dir, ProcessStats *stats);
+
+//Atomically move from over to, replacing to if it exists. Returns 0 on success.
+int replace_file(const char *from, const char *to);
+
+//Create a directory and any missing parents (mkdir -p). Returns 0 on success.
+int make_path(const char *path);
+
+void sleep_ms(int ms);
+
+//Monotonic clock in seconds, for timing.
+double now_seconds(void);
+
 #endif
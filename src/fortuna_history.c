@@ -0,0 +1,329 @@
+#include "fortuna_history.h"
+#include "fortuna_hash.h"
+#include "fortuna_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define HISTORY_HEADER "fortuna-times 1"
+
+//Compiles shorter than this apart are noise, never a regression.
+#define HISTORY_NOISE_SECONDS 0.1
+
+//Rows of the report tables.
+#define REPORT_SLOWEST 20
+
+//All compiles of one object, oldest first.
+typedef struct Series {
+    char   *src;
+    double *wall;
+    double *cpu;
+    long   *rss;
+    int     count;
+    int     capacity;
+} Series;
+
+typedef struct History {
+    FileTable objs;      // object, or source for the report -> series
+    Series   *series;
+    int       capacity;
+} History;
+
+static void history_free(History *h) {
+    for (int i = 0; i < h->objs.count && i < h->capacity; i++) {
+        free(h->series[i].src);
+        free(h->series[i].wall);
+        free(h->series[i].cpu);
+        free(h->series[i].rss);
+    }
+    free(h->series);
+    file_table_free(&h->objs);
+}
+
+static int series_add(Series *s, double wall, double cpu, long rss) {
+    if (s->count == s->capacity) {
+        int cap = s->capacity ? 2 * s->capacity : 8;
+        double *w = realloc(s->wall, sizeof(double) * cap);
+        if (w) s->wall = w;
+        double *c = realloc(s->cpu, sizeof(double) * cap);
+        if (c) s->cpu = c;
+        long *r = realloc(s->rss, sizeof(long) * cap);
+        if (r) s->rss = r;
+        if (!w || !c || !r) return -1;
+        s->capacity = cap;
+    }
+    s->wall[s->count] = wall;
+    s->cpu[s->count]  = cpu;
+    s->rss[s->count]  = rss;
+    s->count++;
+    return 0;
+}
+
+//Whether obj is in the object tree under dir.
+static int in_tree(const char *obj, const char *dir) {
+    size_t len = strlen(dir);
+    while (len > 0 && (dir[len - 1] == '/' || dir[len - 1] == '\\')) len--;
+    return strncmp(obj, dir, len) == 0 && (obj[len] == '/' || obj[len] == '\\');
+}
+
+//A series per object. With a tree, only the objects under it, and a series per
+//source, so the objects of one source in several pools share it. Returns the
+//number of builds that compiled something of it, or -1 without a history.
+static int history_load(History *h, const char *tree) {
+    file_table_init(&h->objs);
+    h->series   = NULL;
+    h->capacity = 0;
+
+    FILE *f = fopen(HISTORY_FILE, "r");
+    if (!f) return -1;
+    char line[2200], obj[1024], src[1024];
+    double wall, cpu;
+    long rss;
+    int builds = 0, counted = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == 'b') {
+            counted = 0;
+            continue;
+        }
+        if (sscanf(line, "%lf %lf %ld %1023s %1023s", &wall, &cpu, &rss, obj, src) != 5) continue;
+        if (tree && !in_tree(obj, tree)) continue;
+        if (!counted) builds++;
+        counted = 1;
+        int id = file_table_intern(&h->objs, tree ? src : obj);
+        if (id < 0) break;
+        if (id >= h->capacity) {
+            int cap = h->objs.capacity;
+            Series *grown = realloc(h->series, sizeof(Series) * cap);
+            if (!grown) break;
+            memset(grown + h->capacity, 0, sizeof(Series) * (cap - h->capacity));
+            h->series   = grown;
+            h->capacity = cap;
+        }
+        Series *s = &h->series[id];
+        if (!s->src) s->src = strdup(src);
+        if (series_add(s, wall * 1e-3, cpu * 1e-3, rss) != 0) break;
+    }
+    fclose(f);
+    return builds;
+}
+
+//Keep the last HISTORY_KEEP_BUILDS builds once the file got too big.
+static void history_trim(void) {
+    struct stat st;
+    if (stat(HISTORY_FILE, &st) != 0 || st.st_size <= HISTORY_MAX_BYTES) return;
+
+    FILE *f = fopen(HISTORY_FILE, "r");
+    if (!f) return;
+    char line[2200];
+    int builds = 0;
+    while (fgets(line, sizeof(line), f)) builds += line[0] == 'b';
+    rewind(f);
+
+    FILE *out = fopen(HISTORY_FILE ".tmp", "w");
+    if (!out) {
+        fclose(f);
+        return;
+    }
+    fprintf(out, "%s\n", HISTORY_HEADER);
+    int skip = builds - HISTORY_KEEP_BUILDS, seen = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == 'b') seen++;
+        if (seen > skip && seen > 0) fputs(line, out);
+    }
+    fclose(f);
+    fclose(out);
+    replace_file(HISTORY_FILE ".tmp", HISTORY_FILE);
+}
+
+void history_record(const CompileSample *samples, int n) {
+    if (n == 0) return;
+    struct stat st;
+    int fresh = stat(HISTORY_FILE, &st) != 0 || st.st_size == 0;
+    FILE *f = fopen(HISTORY_FILE, "a");
+    if (!f) return;
+    if (fresh) fprintf(f, "%s\n", HISTORY_HEADER);
+    fprintf(f, "b %lld\n", (long long)time(NULL));
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%.0f %.0f %ld %s %s\n", samples[i].seconds * 1e3, samples[i].cpu_seconds * 1e3,
+                samples[i].peak_rss_kb, samples[i].obj, samples[i].src);
+    }
+    fclose(f);
+    history_trim();
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+//Median of at most HISTORY_WINDOW times, -1 without any.
+static double median(const double *values, int n) {
+    if (n <= 0) return -1.0;
+    double window[HISTORY_WINDOW];
+    memcpy(window, values, sizeof(double) * n);
+    qsort(window, n, sizeof(double), compare_doubles);
+    return (n % 2) ? window[n / 2] : 0.5 * (window[n / 2 - 1] + window[n / 2]);
+}
+
+//Median of the HISTORY_WINDOW compiles before the last one.
+static double rolling_median(const Series *s) {
+    int end   = s->count - 1;
+    int start = end > HISTORY_WINDOW ? end - HISTORY_WINDOW : 0;
+    return median(s->wall + start, end - start);
+}
+
+int history_estimate(char **objs, int n, double *seconds) {
+    History h;
+    history_load(&h, NULL);
+    int known = 0;
+    for (int i = 0; i < n; i++) {
+        int id = file_table_find(&h.objs, objs[i]);
+        seconds[i] = -1.0;
+        if (id < 0 || id >= h.capacity) continue;
+
+        const Series *s = &h.series[id];
+        int start  = s->count > HISTORY_WINDOW ? s->count - HISTORY_WINDOW : 0;
+        seconds[i] = median(s->wall + start, s->count - start);
+        if (seconds[i] >= 0.0) known++;
+    }
+    history_free(&h);
+    return known;
+}
+
+typedef struct TimeRow {
+    const Series *s;
+    double        last;
+    double        median;
+} TimeRow;
+
+static int compare_last(const void *a, const void *b) {
+    const TimeRow *x = (const TimeRow *)a, *y = (const TimeRow *)b;
+    return (x->last < y->last) - (x->last > y->last);
+}
+
+//Largest slowdown against the median first.
+static int compare_regression(const void *a, const void *b) {
+    const TimeRow *x = (const TimeRow *)a, *y = (const TimeRow *)b;
+    double dx = x->last / x->median, dy = y->last / y->median;
+    return (dx < dy) - (dx > dy);
+}
+
+typedef struct DirRow {
+    const char *dir;
+    int         files;
+    double      total;
+} DirRow;
+
+static int compare_total(const void *a, const void *b) {
+    const DirRow *x = (const DirRow *)a, *y = (const DirRow *)b;
+    return (x->total < y->total) - (x->total > y->total);
+}
+
+//Directory part of a source path, "." for none.
+static void source_dir(const char *src, char *out, size_t size) {
+    const char *slash = strrchr(src, '/');
+    const char *back  = strrchr(src, '\\');
+    if (back && (!slash || back > slash)) slash = back;
+    if (!slash) {
+        snprintf(out, size, ".");
+        return;
+    }
+    snprintf(out, size, "%.*s", (int)(slash - src), src);
+}
+
+int fortuna_report_compile_times(const char *obj_dir, double threshold) {
+    History h;
+    int builds = history_load(&h, obj_dir);
+    if (builds < 0 || h.objs.count == 0) {
+        char msg[1200];
+        snprintf(msg, sizeof(msg), "No compiles into %s in " HISTORY_FILE " yet, build first.", obj_dir);
+        print_error(msg);
+        history_free(&h);
+        return -1;
+    }
+
+    int n = h.objs.count < h.capacity ? h.objs.count : h.capacity;
+    TimeRow *rows = calloc(n, sizeof(TimeRow));
+    DirRow  *dirs = calloc(n, sizeof(DirRow));
+    FileTable dir_names;
+    file_table_init(&dir_names);
+    if (!rows || !dirs) {
+        free(rows);
+        free(dirs);
+        history_free(&h);
+        return -1;
+    }
+
+    //The last compile of every source that is still there, and its
+    //directory's share.
+    double total = 0.0;
+    int ndirs = 0, nrows = 0;
+    for (int i = 0; i < n; i++) {
+        const Series *s = &h.series[i];
+        struct stat st;
+        if (s->count == 0 || stat(s->src, &st) != 0) continue;
+        TimeRow *row = &rows[nrows++];
+        row->s      = s;
+        row->last   = s->wall[s->count - 1];
+        row->median = rolling_median(s);
+        total += row->last;
+
+        char dir[1024];
+        source_dir(s->src, dir, sizeof(dir));
+        int d = file_table_intern(&dir_names, dir);
+        if (d < 0) continue;
+        if (d == ndirs) dirs[ndirs++].dir = dir_names.names[d];
+        dirs[d].total += row->last;
+        dirs[d].files++;
+    }
+    n = nrows;
+
+    printf("Slowest files of their last build into %s (%d builds in " HISTORY_FILE ")\n", obj_dir, builds);
+    printf("%-36s %9s %9s %9s %9s %7s\n", "source", "last s", "median s", "cpu s", "peak MB", "builds");
+    qsort(rows, n, sizeof(TimeRow), compare_last);
+    for (int i = 0; i < n && i < REPORT_SLOWEST; i++) {
+        const Series *s = rows[i].s;
+        char median[32] = "-";
+        if (rows[i].median >= 0.0) snprintf(median, sizeof(median), "%.2f", rows[i].median);
+        printf("%-36s %9.2f %9s %9.2f %9.1f %7d\n", s->src, rows[i].last, median, s->cpu[s->count - 1],
+               s->rss[s->count - 1] / 1024.0, s->count);
+    }
+
+    //Slower than threshold percent over the rolling median, and by more than noise.
+    int nreg = 0;
+    for (int i = 0; i < n; i++) {
+        if (rows[i].median <= 0.0) continue;
+        if (rows[i].last <= rows[i].median * (1.0 + threshold / 100.0)) continue;
+        if (rows[i].last - rows[i].median < HISTORY_NOISE_SECONDS) continue;
+        rows[nreg++] = rows[i];
+    }
+    qsort(rows, nreg, sizeof(TimeRow), compare_regression);
+    printf("\nRegressions, more than %.0f%% over the median of the last %d compiles\n", threshold, HISTORY_WINDOW);
+    if (nreg == 0) printf("none\n");
+    else printf("%-36s %9s %9s %9s\n", "source", "median s", "last s", "change");
+    for (int i = 0; i < nreg; i++) {
+        printf("%-36s %9.2f %9.2f %8.0f%%\n", rows[i].s->src, rows[i].median, rows[i].last,
+               100.0 * (rows[i].last / rows[i].median - 1.0));
+    }
+
+    qsort(dirs, ndirs, sizeof(DirRow), compare_total);
+    printf("\nCompile time by directory, last build of every file\n");
+    printf("%-36s %7s %9s %7s\n", "directory", "files", "total s", "%");
+    for (int d = 0; d < ndirs; d++) {
+        printf("%-36s %7d %9.2f %7.1f\n", dirs[d].dir, dirs[d].files, dirs[d].total,
+               total > 0.0 ? 100.0 * dirs[d].total / total : 0.0);
+    }
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), "%d files, %.1f s of compile time, %d regressed", n, total, nreg);
+    print_info(msg);
+
+    free(rows);
+    free(dirs);
+    file_table_free(&dir_names);
+    history_free(&h);
+    return 0;
+}
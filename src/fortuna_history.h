@@ -0,0 +1,43 @@
+#ifndef FORTUNA_HISTORY_H
+#define FORTUNA_HISTORY_H
+
+//Compile time history. Every build appends what each of its compiles cost to
+//.cache/compile.history: a "b <unix time>" line for the build (one per object
+//pool), then one "wall_ms cpu_ms peak_rss_kb object source" line per object
+//that was compiled. Objects restored from a cache cost nothing and aren't in
+//it. Once the file grows past HISTORY_MAX_BYTES it is cut back to the last
+//HISTORY_KEEP_BUILDS builds.
+//
+//fortuna report compile-times reads back the compiles into one object tree, a
+//row per source that is still there: the slowest files of their last build,
+//the files whose last compile is more than a threshold slower than the median
+//of their compiles before it, and the compile time per directory.
+
+#define HISTORY_FILE        ".cache/compile.history"
+#define HISTORY_MAX_BYTES   (1 << 20)
+#define HISTORY_KEEP_BUILDS 30
+#define HISTORY_WINDOW      5      // compiles the rolling median looks at
+#define HISTORY_THRESHOLD   25.0   // percent slower than the median, the default
+
+//What one compile cost. cpu_seconds and peak_rss_kb are 0 when it ran on a
+//remote worker.
+typedef struct CompileSample {
+    const char *src;
+    const char *obj;
+    double      seconds;
+    double      cpu_seconds;
+    long        peak_rss_kb;
+} CompileSample;
+
+//Append the compiles of a build, .cache has to be there.
+void history_record(const CompileSample *samples, int n);
+
+//Expected compile time of each object, the median of its last HISTORY_WINDOW
+//compiles, or -1 for one without any. Returns how many have one.
+int  history_estimate(char **objs, int n, double *seconds);
+
+//fortuna report compile-times on the objects under obj_dir, the object tree of
+//a profile. threshold is in percent.
+int  fortuna_report_compile_times(const char *obj_dir, double threshold);
+
+#endif // FORTUNA_HISTORY_H
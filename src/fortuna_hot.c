@@ -0,0 +1,464 @@
+#include "fortuna_hot.h"
+#include "fortuna_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define popen _popen
+#define pclose _pclose
+#define PATH_SEP '\\'
+#else
+#include <dirent.h>
+#define PATH_SEP '/'
+#endif
+
+#define HOT_LIST_HEADER "fortuna-hot 1"
+#define HOT_NM_RSP      ".cache/hot.nm.rsp"
+
+//Growable per-name values, on top of a file table.
+typedef struct NameValues {
+    FileTable names;
+    double   *values;
+    double   *values2;
+    int       capacity;
+} NameValues;
+
+static void name_values_init(NameValues *nv) {
+    file_table_init(&nv->names);
+    nv->values   = NULL;
+    nv->values2  = NULL;
+    nv->capacity = 0;
+}
+
+static void name_values_free(NameValues *nv) {
+    file_table_free(&nv->names);
+    free(nv->values);
+    free(nv->values2);
+}
+
+//Id of name, with both values at init when it is new. -1 on allocation failure.
+static int name_values_intern(NameValues *nv, const char *name, double init) {
+    int before = nv->names.count;
+    int id = file_table_intern(&nv->names, name);
+    if (id < 0) return -1;
+    if (id >= nv->capacity) {
+        int new_cap = nv->capacity ? nv->capacity * 2 : 256;
+        double *values  = realloc(nv->values, sizeof(double) * new_cap);
+        if (values) nv->values = values;
+        double *values2 = realloc(nv->values2, sizeof(double) * new_cap);
+        if (values2) nv->values2 = values2;
+        if (!values || !values2) return -1;
+        nv->capacity = new_cap;
+    }
+    if (id >= before) {
+        nv->values[id]  = init;
+        nv->values2[id] = init;
+    }
+    return id;
+}
+
+//Symbols as both tools print them: compilers add suffixes like .cold, .part.0
+//or .constprop.0 to the pieces of a function, and those belong to it.
+static void symbol_base(char *sym) {
+    char *dot = strchr(sym, '.');
+    if (dot && dot != sym) *dot = '\0';
+}
+
+//Name of an object or source without directories and extension.
+static void path_stem(const char *path, char *out, size_t size) {
+    const char *name = path;
+    for (const char *c = path; *c; c++) {
+        if (*c == '/' || *c == '\\') name = c + 1;
+    }
+    const char *dot = strrchr(name, '.');
+    size_t len = dot ? (size_t)(dot - name) : strlen(name);
+    snprintf(out, size, "%.*s", (int)len, name);
+}
+
+//Percent of the time per symbol. A gprof flat profile line starts with the
+//percent ("45.00  0.09  0.09  100  0.00  0.00  name"), perf with one or two
+//("45.00%  prog  prog  [.] name", the self time last). The name is at the end.
+static int parse_time_profile(const char *path, NameValues *symbols) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') continue;
+        char *tokens[64];
+        int ntok = 0;
+        for (char *tok = strtok(line, " \t\r\n"); tok && ntok < 64; tok = strtok(NULL, " \t\r\n")) tokens[ntok++] = tok;
+        if (ntok < 2) continue;
+
+        char *end;
+        double percent = strtod(tokens[0], &end);
+        if (end == tokens[0] || (*end && *end != '%')) continue;
+        if (*end == '%') {
+            for (int i = 1; i < ntok - 1; i++) {
+                double next = strtod(tokens[i], &end);
+                if (end == tokens[i] || *end != '%') break;
+                percent = next;
+            }
+        }
+
+        //gprof can put the index of the call graph after the name.
+        int last = ntok - 1;
+        if (tokens[last][0] == '[' && last > 1) last--;
+        char *sym = tokens[last];
+        if (!isalpha((unsigned char)sym[0]) && sym[0] != '_') continue;
+        symbol_base(sym);
+        int id = name_values_intern(symbols, sym, 0.0);
+        if (id < 0) {
+            fclose(f);
+            return -1;
+        }
+        symbols->values[id] += percent;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int push_object(char ***objs, int *n, int *cap, const char *dir, const char *name) {
+    size_t len = strlen(name);
+    if (len < 3 || strcmp(name + len - 2, ".o") != 0) return 0;
+    if (*n == *cap) {
+        int new_cap = *cap ? *cap * 2 : 256;
+        char **grown = realloc(*objs, sizeof(char *) * new_cap);
+        if (!grown) return -1;
+        *objs = grown;
+        *cap  = new_cap;
+    }
+    size_t size = strlen(dir) + len + 2;
+    char *path = malloc(size);
+    if (!path) return -1;
+    snprintf(path, size, "%s%c%s", dir, PATH_SEP, name);
+    (*objs)[(*n)++] = path;
+    return 0;
+}
+
+//Every object directly in dir.
+static int list_objects(const char *dir, char ***out) {
+    char **objs = NULL;
+    int n = 0, cap = 0;
+#ifdef _WIN32
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*.o", dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h != INVALID_HANDLE_VALUE) {
+        do {
+            if (push_object(&objs, &n, &cap, dir, fd.cFileName) != 0) break;
+        } while (FindNextFileA(h, &fd));
+        FindClose(h);
+    }
+#else
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while (d && (entry = readdir(d)) != NULL) {
+        if (push_object(&objs, &n, &cap, dir, entry->d_name) != 0) break;
+    }
+    if (d) closedir(d);
+#endif
+    *out = objs;
+    return n;
+}
+
+//Which object defines every function of the objects in obj_dir, from one nm
+//run over all of them. Returns the number of objects, or -1 when nm failed.
+static int map_symbols(const char *obj_dir, NameValues *symbols, FileTable *objects, int **object_of) {
+    char **objs = NULL;
+    int nobjs = list_objects(obj_dir, &objs);
+    if (nobjs == 0) {
+        free(objs);
+        return 0;
+    }
+
+    //One object per line of a response file, there may be thousands.
+    FILE *rsp = fopen(HOT_NM_RSP, "w");
+    for (int i = 0; i < nobjs; i++) {
+        if (rsp) fprintf(rsp, "%s\n", objs[i]);
+        free(objs[i]);
+    }
+    free(objs);
+    if (!rsp) return -1;
+    fclose(rsp);
+
+    FILE *pipe = popen("nm -A --defined-only @" HOT_NM_RSP, "r");
+    if (!pipe) return -1;
+
+    //"obj/m1.o:0000000000000000 T __m1_MOD_f", functions only.
+    char line[4096], stem[512];
+    int cap = 0;
+    while (fgets(line, sizeof(line), pipe)) {
+        char *colon = strstr(line, ".o:");
+        if (!colon) continue;
+        colon[2] = '\0';
+        path_stem(line, stem, sizeof(stem));
+
+        char *tokens[8];
+        int ntok = 0;
+        for (char *tok = strtok(colon + 3, " \t\r\n"); tok && ntok < 8; tok = strtok(NULL, " \t\r\n")) tokens[ntok++] = tok;
+        if (ntok < 2 || !strchr("TtWw", tokens[ntok - 2][0]) || tokens[ntok - 2][1]) continue;
+
+        char *sym = tokens[ntok - 1];
+        symbol_base(sym);
+        int obj = file_table_intern(objects, stem);
+        int id  = name_values_intern(symbols, sym, 0.0);
+        if (obj < 0 || id < 0) break;
+        if (id >= cap) {
+            int new_cap = symbols->capacity;
+            int *grown = realloc(*object_of, sizeof(int) * new_cap);
+            if (!grown) break;
+            for (int i = cap; i < new_cap; i++) grown[i] = -1;
+            *object_of = grown;
+            cap = new_cap;
+        }
+
+        //A static function can be in several objects, the first one keeps it.
+        if ((*object_of)[id] < 0) (*object_of)[id] = obj;
+    }
+    int status = pclose(pipe);
+    remove(HOT_NM_RSP);
+    return status == 0 ? objects->count : -1;
+}
+
+//Redo .cache/hot.list from the profile.
+static int import_profile(const char *profile, double threshold, const char *obj_dir) {
+    NameValues symbols;
+    name_values_init(&symbols);
+    if (parse_time_profile(profile, &symbols) != 0) {
+        name_values_free(&symbols);
+        return -1;
+    }
+    int profiled = symbols.names.count;
+
+    FileTable objects;
+    file_table_init(&objects);
+    int *object_of = NULL;
+    int nobjs = map_symbols(obj_dir, &symbols, &objects, &object_of);
+    if (nobjs <= 0) {
+        if (nobjs < 0) print_error("nm failed on the objects, the [hot] profile is not applied");
+        else print_info("No objects to place the [hot] profile in yet, everything is hot until the next build");
+        name_values_free(&symbols);
+        file_table_free(&objects);
+        free(object_of);
+        return 0;
+    }
+
+    double *percent = calloc(nobjs, sizeof(double));
+    double placed = 0.0, total = 0.0;
+    for (int id = 0; percent && id < profiled; id++) {
+        total += symbols.values[id];
+        if (!object_of || object_of[id] < 0) continue;
+        percent[object_of[id]] += symbols.values[id];
+        placed += symbols.values[id];
+    }
+
+    int hot = 0;
+    make_path(".cache");
+    FILE *f = percent ? fopen(HOT_LIST ".tmp", "w") : NULL;
+    if (f) {
+        fprintf(f, "%s %g\n", HOT_LIST_HEADER, threshold);
+        for (int o = 0; o < nobjs; o++) {
+            int is_hot = percent[o] >= threshold;
+            hot += is_hot;
+            fprintf(f, "%s %.2f %s\n", is_hot ? "hot" : "cold", percent[o], objects.names[o]);
+        }
+        fclose(f);
+        replace_file(HOT_LIST ".tmp", HOT_LIST);
+
+        char msg[1200];
+        snprintf(msg, sizeof(msg), "Imported the profile %s: %d hot and %d cold sources, %.1f%% of %.1f%% of the time placed",
+                 profile, hot, nobjs - hot, placed, total);
+        print_info(msg);
+    }
+    name_values_free(&symbols);
+    file_table_free(&objects);
+    free(object_of);
+    free(percent);
+    return f ? 0 : -1;
+}
+
+static long long file_mtime(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_mtime : -1;
+}
+
+int hot_set_load(HotSet *set, const char *profile, double threshold, const char *obj_dir) {
+    file_table_init(&set->cold);
+    long long profile_time = file_mtime(profile);
+    if (profile_time < 0) {
+        char msg[1100];
+        snprintf(msg, sizeof(msg), "Can't read the [hot] profile %s.", profile);
+        print_error(msg);
+        return -1;
+    }
+
+    //The list is current when it is newer than the profile and has its threshold.
+    char line[1024], expected[64];
+    snprintf(expected, sizeof(expected), "%s %g\n", HOT_LIST_HEADER, threshold);
+    FILE *f = file_mtime(HOT_LIST) >= profile_time ? fopen(HOT_LIST, "r") : NULL;
+    if (!f || !fgets(line, sizeof(line), f) || strcmp(line, expected) != 0) {
+        if (f) fclose(f);
+        if (import_profile(profile, threshold, obj_dir) != 0) {
+            char msg[1100];
+            snprintf(msg, sizeof(msg), "Failed to import the [hot] profile %s.", profile);
+            print_error(msg);
+            return -1;
+        }
+        f = fopen(HOT_LIST, "r");
+        if (f && !fgets(line, sizeof(line), f)) line[0] = '\0';
+    }
+
+    char name[1024], cls[8];
+    double percent;
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%7s %lf %1023s", cls, &percent, name) == 3 && strcmp(cls, "cold") == 0) {
+            file_table_intern(&set->cold, name);
+        }
+    }
+    if (f) fclose(f);
+    return 0;
+}
+
+void hot_set_free(HotSet *set) {
+    file_table_free(&set->cold);
+}
+
+int hot_set_is_cold(const HotSet *set, const char *name) {
+    return file_table_find(&set->cold, name) >= 0;
+}
+
+//.cache/hot.times: "hot_seconds cold_seconds source", -1 for not measured yet.
+static void load_hot_times(NameValues *times) {
+    FILE *f = fopen(HOT_TIMES, "r");
+    char line[1200], src[1024];
+    double hot, cold;
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lf %lf %1023s", &hot, &cold, src) != 3) continue;
+        int id = name_values_intern(times, src, -1.0);
+        if (id < 0) break;
+        times->values[id]  = hot;
+        times->values2[id] = cold;
+    }
+    if (f) fclose(f);
+}
+
+void hot_times_record(char **srcs, const double *seconds, const unsigned char *cold, int n) {
+    if (n == 0) return;
+    NameValues times;
+    name_values_init(&times);
+    load_hot_times(&times);
+    for (int i = 0; i < n; i++) {
+        int id = name_values_intern(&times, srcs[i], -1.0);
+        if (id < 0) break;
+        if (cold[i]) times.values2[id] = seconds[i];
+        else         times.values[id]  = seconds[i];
+    }
+
+    FILE *f = fopen(HOT_TIMES ".tmp", "w");
+    for (int id = 0; f && id < times.names.count; id++) {
+        fprintf(f, "%.3f %.3f %s\n", times.values[id], times.values2[id], times.names.names[id]);
+    }
+    if (f) {
+        fclose(f);
+        replace_file(HOT_TIMES ".tmp", HOT_TIMES);
+    }
+    name_values_free(&times);
+}
+
+typedef struct HotRow {
+    const char *src;
+    const char *cls;
+    double      percent;
+    double      hot;
+    double      cold;
+    double      saved;
+    int         has_saved; // cold, and compiled both ways
+} HotRow;
+
+//Most saved first, then the cold sources without both times, then the rest.
+static int compare_saved(const void *a, const void *b) {
+    const HotRow *x = (const HotRow *)a, *y = (const HotRow *)b;
+    if (x->has_saved != y->has_saved) return y->has_saved - x->has_saved;
+    if (x->saved != y->saved) return (x->saved < y->saved) - (x->saved > y->saved);
+    return strcmp(x->cls, y->cls);
+}
+
+int fortuna_report_hot(void) {
+    FILE *f = fopen(HOT_LIST, "r");
+    if (!f) {
+        print_error("No " HOT_LIST " yet, set [hot] profile and build first.");
+        return -1;
+    }
+    NameValues classes;
+    name_values_init(&classes);
+    char line[1200], name[1024], cls[8];
+    double percent;
+    if (!fgets(line, sizeof(line), f)) line[0] = '\0';
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%7s %lf %1023s", cls, &percent, name) != 3) continue;
+        int id = name_values_intern(&classes, name, 0.0);
+        if (id < 0) break;
+        classes.values[id]  = percent;
+        classes.values2[id] = strcmp(cls, "cold") == 0;
+    }
+    fclose(f);
+
+    NameValues times;
+    name_values_init(&times);
+    load_hot_times(&times);
+    HotRow *rows = calloc(times.names.count ? times.names.count : 1, sizeof(HotRow));
+    if (!rows) {
+        name_values_free(&classes);
+        name_values_free(&times);
+        return -1;
+    }
+
+    //Seconds saved: the last compile with the build flags against the last cold one.
+    double total_hot = 0.0, total_saved = 0.0;
+    int ncold = 0;
+    for (int id = 0; id < times.names.count; id++) {
+        HotRow *row = &rows[id];
+        char stem[512];
+        path_stem(times.names.names[id], stem, sizeof(stem));
+        int c = file_table_find(&classes.names, stem);
+        row->src     = times.names.names[id];
+        row->percent = c >= 0 ? classes.values[c] : 0.0;
+        row->cls     = c < 0 ? "new" : classes.values2[c] ? "cold" : "hot";
+        row->hot     = times.values[id];
+        row->cold    = times.values2[id];
+        if (c >= 0 && classes.values2[c]) {
+            ncold++;
+            if (row->hot >= 0.0 && row->cold >= 0.0) {
+                row->saved     = row->hot - row->cold;
+                row->has_saved = 1;
+                total_saved   += row->saved;
+            }
+        }
+        if (row->hot >= 0.0) total_hot += row->hot;
+    }
+    qsort(rows, times.names.count, sizeof(HotRow), compare_saved);
+
+    printf("%-48s %7s %5s %9s %9s %9s\n", "source", "time %", "class", "hot s", "cold s", "saved s");
+    for (int i = 0; i < times.names.count; i++) {
+        const HotRow *row = &rows[i];
+        char hot[32] = "-", cold[32] = "-", saved[32] = "-";
+        if (row->hot >= 0.0)   snprintf(hot, sizeof(hot), "%.2f", row->hot);
+        if (row->cold >= 0.0)  snprintf(cold, sizeof(cold), "%.2f", row->cold);
+        if (row->has_saved)    snprintf(saved, sizeof(saved), "%.2f", row->saved);
+        printf("%-48s %7.2f %5s %9s %9s %9s\n", row->src, row->percent, row->cls, hot, cold, saved);
+    }
+    char msg[256];
+    snprintf(msg, sizeof(msg), "%d cold sources, %.1f s of %.1f s of compile time saved", ncold, total_saved, total_hot);
+    print_info(msg);
+
+    free(rows);
+    name_values_free(&classes);
+    name_values_free(&times);
+    return 0;
+}
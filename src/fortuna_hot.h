@@ -0,0 +1,45 @@
+#ifndef FORTUNA_HOT_H
+#define FORTUNA_HOT_H
+
+#include "fortuna_hash.h"
+
+//Hot and cold sources. A profile of the program, named by [hot] profile, says
+//where its run time goes: the flat profile of gprof (gprof -b -p) or the output
+//of perf report --stdio. Its symbols are looked up in the objects of the last
+//build with nm, and every source whose symbols take less than [hot] threshold
+//percent of the time (1 by default) is cold. Cold sources are compiled with
+//[profile.cold] flags instead of the flags of the build, which is most of the
+//compile time of a project that only spends its run time in a few modules.
+//
+//The classification is kept in .cache/hot.list, one "hot|cold percent name"
+//line per object (its name without .o), and only redone when the profile is
+//newer than it or the threshold changed. Sources it doesn't know (no object at
+//the time, or new since) stay hot.
+//
+//Every compile of a build with [hot] records its time in .cache/hot.times, per
+//source and class, for `fortuna report hot`.
+
+#define HOT_LIST  ".cache/hot.list"
+#define HOT_TIMES ".cache/hot.times"
+
+typedef struct HotSet {
+    FileTable cold;     // object names (no .o) of the cold sources
+} HotSet;
+
+//Load the classification, importing the profile again when it changed. obj_dir
+//holds the objects the symbols are looked up in. Returns 0, or -1 when the
+//profile can't be read.
+int  hot_set_load(HotSet *set, const char *profile, double threshold, const char *obj_dir);
+void hot_set_free(HotSet *set);
+
+//Whether the source of this object (its name without .o) is cold.
+int  hot_set_is_cold(const HotSet *set, const char *name);
+
+//Add the compile times of a build: seconds of the source srcs[i], compiled
+//with the cold flags when cold[i].
+void hot_times_record(char **srcs, const double *seconds, const unsigned char *cold, int n);
+
+//fortuna report hot: the classification and the compile time saved per source.
+int  fortuna_report_hot(void);
+
+#endif // FORTUNA_HOT_H
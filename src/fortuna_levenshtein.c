@@ -18,7 +18,7 @@ typedef struct TrieNode {
 
 
 //Arena allocated Trie. This reduces overhead as much as possible.
-#define MAX_NODES 256
+#define MAX_NODES 1024
 static TrieNode arena[MAX_NODES];
 static int arena_idx = 0;
 
@@ -41,7 +41,7 @@ static inline int char_index(char c) {
 //Allocated a new Trie node in the arena. No real allocation, but sets the memory up.
 TrieNode* alloc_node(void) {
     if (arena_idx >= MAX_NODES) {
-        print_error("Arena Allocated Trie is too large. Must be less than 256 words");
+        print_error("Arena Allocated Trie is too large. Must be less than 1024 nodes");
         exit(1);
     }
     TrieNode* node = &arena[arena_idx++];
@@ -165,8 +165,27 @@ static const char* dictionary[MAX_WORDS] = {"new",
                                             "--rebuild",
                                             "clean",
                                             "-r",
-                                            "-j"};
-static const int dictSize = 9;
+                                            "-j",
+                                            "--stats",
+                                            "cache-serve",
+                                            "--port",
+                                            "--dir",
+                                            "--public",
+                                            "worker",
+                                            "--jobs",
+                                            "--latency",
+                                            "daemon",
+                                            "watch",
+                                            "--run",
+                                            "--profile",
+                                            "--pgo",
+                                            "report",
+                                            "--explain",
+                                            "--trace",
+                                            "--threshold",
+                                            "impact",
+                                            "--dry-run"};
+static const int dictSize = 28;
 
 void loadDictionary(TrieNode *root) {
     for(int i = 0; i < dictSize; i++) {
@@ -0,0 +1,295 @@
+#include "fortuna_net.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#endif
+
+int net_init(void) {
+#ifdef _WIN32
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0 ? 0 : -1;
+#else
+    //A peer that goes away mid-send must not kill the build.
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+#endif
+}
+
+void net_set_timeout(net_socket_t sock, int seconds) {
+#ifdef _WIN32
+    DWORD ms = (DWORD)seconds * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&ms, sizeof(ms));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&ms, sizeof(ms));
+#else
+    struct timeval tv = { seconds, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+static void set_timeouts(net_socket_t sock) {
+    net_set_timeout(sock, NET_TIMEOUT_SECONDS);
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+}
+
+void net_close(net_socket_t sock) {
+    if (sock == NET_INVALID_SOCKET) return;
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+net_socket_t net_connect(const char *host, int port) {
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, port_str, &hints, &res) != 0) return NET_INVALID_SOCKET;
+
+    net_socket_t sock = NET_INVALID_SOCKET;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock == NET_INVALID_SOCKET) continue;
+        if (connect(sock, ai->ai_addr, (int)ai->ai_addrlen) == 0) break;
+        net_close(sock);
+        sock = NET_INVALID_SOCKET;
+    }
+    freeaddrinfo(res);
+
+    if (sock != NET_INVALID_SOCKET) set_timeouts(sock);
+    return sock;
+}
+
+net_socket_t net_listen(int port, int local_only) {
+    net_socket_t sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == NET_INVALID_SOCKET) return NET_INVALID_SOCKET;
+
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(local_only ? INADDR_LOOPBACK : INADDR_ANY);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, 64) != 0) {
+        net_close(sock);
+        return NET_INVALID_SOCKET;
+    }
+    return sock;
+}
+
+net_socket_t net_accept(net_socket_t listener) {
+    net_socket_t sock = accept(listener, NULL, NULL);
+    if (sock != NET_INVALID_SOCKET) set_timeouts(sock);
+    return sock;
+}
+
+int net_send_all(net_socket_t sock, const void *data, size_t len) {
+    const char *p = (const char *)data;
+    while (len > 0) {
+        int n = send(sock, p, (int)(len > 65536 ? 65536 : len), 0);
+        if (n <= 0) return -1;
+        p   += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int net_recv(net_socket_t sock, void *data, size_t len) {
+    int n = recv(sock, (char *)data, (int)len, 0);
+    return n < 0 ? -1 : n;
+}
+
+int net_parse_url(const char *url, net_url_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->port = 80;
+    if (strncmp(url, "http://", 7) != 0) return -1;
+    const char *p = url + 7;
+
+    size_t host_len = strcspn(p, ":/");
+    if (host_len == 0 || host_len >= sizeof(out->host)) return -1;
+    memcpy(out->host, p, host_len);
+    out->host[host_len] = '\0';
+    p += host_len;
+
+    if (*p == ':') {
+        out->port = atoi(p + 1);
+        if (out->port <= 0 || out->port > 65535) return -1;
+        p += 1 + strspn(p + 1, "0123456789");
+    }
+
+    snprintf(out->prefix, sizeof(out->prefix), "%s", p);
+    size_t len = strlen(out->prefix);
+    while (len > 0 && out->prefix[len - 1] == '/') out->prefix[--len] = '\0';
+    return 0;
+}
+
+//Read the status line and headers. Leftover bytes (start of the body) are
+//returned in buf[0..*extra).
+static int read_headers(net_socket_t sock, char *buf, size_t size, size_t *header_len, size_t *extra) {
+    size_t used = 0;
+    while (used + 1 < size) {
+        int n = net_recv(sock, buf + used, size - 1 - used);
+        if (n <= 0) return -1;
+        used += (size_t)n;
+        buf[used] = '\0';
+        char *end = strstr(buf, "\r\n\r\n");
+        if (end) {
+            *header_len = (size_t)(end - buf) + 4;
+            *extra = used - *header_len;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static long long header_content_length(const char *headers) {
+    const char *p = headers;
+    while ((p = strchr(p, '\n')) != NULL) {
+        p++;
+        if (strncasecmp(p, "Content-Length:", 15) == 0) return atoll(p + 15);
+    }
+    return -1;
+}
+
+//Copy len bytes (or everything until close when len < 0) from the socket to out.
+static int copy_from_socket(net_socket_t sock, FILE *out, long long len) {
+    char chunk[16384];
+    while (len != 0) {
+        size_t want = sizeof(chunk);
+        if (len > 0 && (long long)want > len) want = (size_t)len;
+        int n = net_recv(sock, chunk, want);
+        if (n < 0) return -1;
+        if (n == 0) return len < 0 ? 0 : -1;
+        if (out && fwrite(chunk, 1, (size_t)n, out) != (size_t)n) return -1;
+        if (len > 0) len -= n;
+    }
+    return 0;
+}
+
+static int copy_to_socket(net_socket_t sock, FILE *in, long long len) {
+    char chunk[16384];
+    while (len > 0) {
+        size_t want = (long long)sizeof(chunk) > len ? (size_t)len : sizeof(chunk);
+        size_t n = fread(chunk, 1, want, in);
+        if (n == 0) return -1;
+        if (net_send_all(sock, chunk, n) != 0) return -1;
+        len -= (long long)n;
+    }
+    return 0;
+}
+
+int http_request(const net_url_t *url, const char *method, const char *path,
+                 FILE *body_in, long long body_len, FILE *body_out) {
+    net_socket_t sock = net_connect(url->host, url->port);
+    if (sock == NET_INVALID_SOCKET) return -1;
+
+    char head[2048];
+    int n = snprintf(head, sizeof(head),
+                     "%s %s%s HTTP/1.1\r\n"
+                     "Host: %s:%d\r\n"
+                     "Content-Length: %lld\r\n"
+                     "Connection: close\r\n\r\n",
+                     method, url->prefix, path, url->host, url->port,
+                     body_in ? body_len : 0LL);
+    if (n <= 0 || n >= (int)sizeof(head) || net_send_all(sock, head, (size_t)n) != 0 ||
+        (body_in && copy_to_socket(sock, body_in, body_len) != 0)) {
+        net_close(sock);
+        return -1;
+    }
+
+    char buf[8192];
+    size_t header_len, extra;
+    if (read_headers(sock, buf, sizeof(buf), &header_len, &extra) != 0) {
+        net_close(sock);
+        return -1;
+    }
+
+    int status = -1;
+    if (sscanf(buf, "HTTP/%*d.%*d %d", &status) != 1) {
+        net_close(sock);
+        return -1;
+    }
+
+    //HEAD responses carry a length but no body.
+    long long length = strcmp(method, "HEAD") == 0 ? 0 : header_content_length(buf);
+    if (extra > 0 && length != 0) {
+        size_t take = (length >= 0 && (long long)extra > length) ? (size_t)length : extra;
+        if (body_out && fwrite(buf + header_len, 1, take, body_out) != take) status = -1;
+        if (length > 0) length -= (long long)take;
+    }
+    if (status >= 0 && copy_from_socket(sock, body_out, length) != 0) status = -1;
+
+    net_close(sock);
+    return status;
+}
+
+int http_read_request(net_socket_t sock, http_request_t *req) {
+    char buf[8192];
+    size_t header_len, extra;
+    memset(req, 0, sizeof(*req));
+    if (read_headers(sock, buf, sizeof(buf), &header_len, &extra) != 0) return -1;
+    if (sscanf(buf, "%15s %1023s HTTP/", req->method, req->path) != 2) return -1;
+
+    req->content_length = header_content_length(buf);
+    if (extra > sizeof(req->pending)) return -1;
+    memcpy(req->pending, buf + header_len, extra);
+    req->pending_len = extra;
+    return 0;
+}
+
+int http_read_body(net_socket_t sock, http_request_t *req, FILE *out, long long len) {
+    size_t take = req->pending_len > (size_t)len ? (size_t)len : req->pending_len;
+    if (take > 0 && out && fwrite(req->pending, 1, take, out) != take) return -1;
+    req->pending_len = 0;
+    return copy_from_socket(sock, out, len - (long long)take);
+}
+
+static const char *status_text(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        default:  return "Internal Server Error";
+    }
+}
+
+int http_send_response(net_socket_t sock, int status, FILE *body_in, long long body_len) {
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\n"
+                     "Content-Length: %lld\r\n"
+                     "Connection: close\r\n\r\n",
+                     status, status_text(status), body_len);
+    if (net_send_all(sock, head, (size_t)n) != 0) return -1;
+    if (body_in) return copy_to_socket(sock, body_in, body_len);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef FORTUNA_NET_H
+#define FORTUNA_NET_H
+
+#include <stdio.h>
+
+//Thin portability layer over Winsock and BSD sockets, and just enough HTTP/1.1
+//for the remote build cache: one request per connection, Content-Length bodies.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET net_socket_t;
+#define NET_INVALID_SOCKET INVALID_SOCKET
+#else
+typedef int net_socket_t;
+#define NET_INVALID_SOCKET (-1)
+#endif
+
+//Send/receive timeout on every socket, in seconds.
+#define NET_TIMEOUT_SECONDS 30
+
+//Call once before any other function (WSAStartup on Windows).
+int  net_init(void);
+
+//Connect to host:port. Returns NET_INVALID_SOCKET on failure.
+net_socket_t net_connect(const char *host, int port);
+
+//Listen on port on all interfaces (or only on loopback when local_only is set).
+net_socket_t net_listen(int port, int local_only);
+net_socket_t net_accept(net_socket_t listener);
+void net_close(net_socket_t sock);
+
+//Change the send/receive timeout of a socket, e.g. while waiting on a compile.
+void net_set_timeout(net_socket_t sock, int seconds);
+
+int  net_send_all(net_socket_t sock, const void *data, size_t len);
+
+//Receive up to len bytes. Returns the count, 0 on close, -1 on error.
+int  net_recv(net_socket_t sock, void *data, size_t len);
+
+//Parsed "http://host:port/prefix". The port defaults to 80.
+typedef struct net_url_t {
+    char host[256];
+    int  port;
+    char prefix[512];   // without a trailing slash, may be empty
+} net_url_t;
+
+int  net_parse_url(const char *url, net_url_t *out);
+
+//Issue one HTTP request. The body is streamed from body_in when given, and
+//the response body is written to body_out when given. Returns the HTTP status,
+//or -1 when the server could not be reached or the response was malformed.
+int  http_request(const net_url_t *url, const char *method, const char *path,
+                  FILE *body_in, long long body_len, FILE *body_out);
+
+//Server side. Reads the request line and headers of one request.
+typedef struct http_request_t {
+    char      method[16];
+    char      path[1024];
+    long long content_length;   // -1 when there was none
+    char      pending[4096];    // body bytes that arrived with the headers
+    size_t    pending_len;
+} http_request_t;
+
+int  http_read_request(net_socket_t sock, http_request_t *req);
+
+//Read exactly len body bytes of a request into out.
+int  http_read_body(net_socket_t sock, http_request_t *req, FILE *out, long long len);
+
+//Send a response. body_in may be NULL for an empty body.
+int  http_send_response(net_socket_t sock, int status, FILE *body_in, long long body_len);
+
+#endif // FORTUNA_NET_H
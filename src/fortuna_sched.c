@@ -0,0 +1,278 @@
+#include "fortuna_sched.h"
+#include "fortuna_threads.h"
+#include "fortuna_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+typedef struct SchedWorker {
+    struct Scheduler *sched;
+    int lane;
+} SchedWorker;
+
+struct Scheduler {
+    SchedJob *jobs;
+    int       njobs;
+    int       capacity;
+
+    //FIFO of ready job ids. Every job enters it at most once.
+    int      *ready;
+    int       ready_head;
+    int       ready_tail;
+
+    int       running;
+    int       completed;    // done, failed or skipped
+    int       failed;
+    int       sealed;       // no more jobs will be added
+    int       stopping;     // a job failed, start nothing new
+
+    sched_done_fn on_done;
+    sched_exec_fn exec;
+    void         *ctx;
+
+    mutex_t       lock;
+    cond_t        cond;
+    thread_t     *threads;
+    SchedWorker  *workers;
+    int           nworkers;
+    int           started;
+};
+
+int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+Scheduler *sched_create(int nworkers, sched_done_fn on_done, void *ctx) {
+    Scheduler *sched = calloc(1, sizeof(Scheduler));
+    if (!sched) return NULL;
+    sched->nworkers = nworkers > 0 ? nworkers : 1;
+    sched->on_done  = on_done;
+    sched->ctx      = ctx;
+    mutex_init(&sched->lock);
+    cond_init(&sched->cond);
+    return sched;
+}
+
+void sched_set_exec(Scheduler *sched, sched_exec_fn exec) {
+    sched->exec = exec;
+}
+
+void sched_free(Scheduler *sched) {
+    if (!sched) return;
+    for (int i = 0; i < sched->njobs; i++) {
+        free(sched->jobs[i].cmd);
+        free(sched->jobs[i].dependents);
+    }
+    free(sched->jobs);
+    free(sched->ready);
+    free(sched->threads);
+    free(sched->workers);
+    mutex_destroy(&sched->lock);
+    cond_destroy(&sched->cond);
+    free(sched);
+}
+
+static int sched_push_dependent(SchedJob *job, int dependent) {
+    if (job->dependents_count == job->dependents_capacity) {
+        int new_cap = job->dependents_capacity ? job->dependents_capacity * 2 : 4;
+        int *tmp = realloc(job->dependents, sizeof(int) * new_cap);
+        if (!tmp) return -1;
+        job->dependents = tmp;
+        job->dependents_capacity = new_cap;
+    }
+    job->dependents[job->dependents_count++] = dependent;
+    return 0;
+}
+
+//Mark every transitive dependent of a failed job as skipped. Each job is
+//pushed at most once (when it leaves JOB_PENDING) so njobs slots is enough.
+static void sched_skip_dependents(Scheduler *sched, int failed_id) {
+    int *stack = malloc(sizeof(int) * (sched->njobs ? sched->njobs : 1));
+    if (!stack) return;
+    int top = 0;
+    stack[top++] = failed_id;
+    while (top > 0) {
+        SchedJob *job = &sched->jobs[stack[--top]];
+        for (int i = 0; i < job->dependents_count; i++) {
+            SchedJob *dep = &sched->jobs[job->dependents[i]];
+            if (dep->state != JOB_PENDING) continue;
+            dep->state = JOB_SKIPPED;
+            sched->completed++;
+            stack[top++] = dep->id;
+        }
+    }
+    free(stack);
+}
+
+int sched_add_job(Scheduler *sched, const char *cmd, const int *deps, int ndeps, void *user) {
+    mutex_lock(&sched->lock);
+
+    if (sched->njobs == sched->capacity) {
+        int new_cap = sched->capacity ? sched->capacity * 2 : 64;
+        SchedJob *jobs = realloc(sched->jobs, sizeof(SchedJob) * new_cap);
+        int *ready     = realloc(sched->ready, sizeof(int) * new_cap);
+        if (jobs) sched->jobs = jobs;
+        if (ready) sched->ready = ready;
+        if (!jobs || !ready) {
+            mutex_unlock(&sched->lock);
+            print_error("Memory allocation error in the job scheduler");
+            return -1;
+        }
+        sched->capacity = new_cap;
+    }
+
+    int id = sched->njobs++;
+    SchedJob *job = &sched->jobs[id];
+    memset(job, 0, sizeof(*job));
+    job->id     = id;
+    job->cmd    = strdup(cmd);
+    job->user   = user;
+    job->worker = -1;
+
+    int skip = 0;
+    for (int i = 0; i < ndeps; i++) {
+        if (deps[i] < 0 || deps[i] >= id) continue;
+        SchedJob *dep = &sched->jobs[deps[i]];
+        if (dep->state == JOB_DONE) continue;
+        if (dep->state == JOB_FAILED || dep->state == JOB_SKIPPED) {
+            skip = 1;
+            continue;
+        }
+        if (sched_push_dependent(dep, id) != 0) {
+            mutex_unlock(&sched->lock);
+            print_error("Memory allocation error in the job scheduler");
+            return -1;
+        }
+        job->pending_deps++;
+    }
+
+    if (skip) {
+        job->state = JOB_SKIPPED;
+        sched->completed++;
+    } else if (job->pending_deps == 0) {
+        sched->ready[sched->ready_tail++] = id;
+    }
+
+    cond_broadcast(&sched->cond);
+    mutex_unlock(&sched->lock);
+    return id;
+}
+
+static void sched_worker(void *arg) {
+    SchedWorker *worker = (SchedWorker *)arg;
+    Scheduler *sched = worker->sched;
+
+    mutex_lock(&sched->lock);
+    for (;;) {
+        while (!sched->stopping &&
+               sched->ready_head == sched->ready_tail &&
+               !(sched->sealed && sched->completed == sched->njobs)) {
+            cond_wait(&sched->cond, &sched->lock);
+        }
+        if (sched->stopping || sched->ready_head == sched->ready_tail) break;
+
+        int id = sched->ready[sched->ready_head++];
+        SchedJob *job = &sched->jobs[id];
+        job->state  = JOB_RUNNING;
+        job->worker = worker->lane;
+        sched->running++;
+        //The job array can move while jobs are added, so the worker runs off a copy.
+        SchedJob snapshot = *job;
+        mutex_unlock(&sched->lock);
+
+        int ret;
+        if (sched->exec) {
+            ret = sched->exec(&snapshot, sched->ctx);
+        } else {
+            print_info(snapshot.cmd);
+            ret = launch_process(snapshot.cmd, NULL);
+        }
+
+        mutex_lock(&sched->lock);
+        job = &sched->jobs[id];
+        job->exit_code = ret;
+        job->state     = (ret == 0) ? JOB_DONE : JOB_FAILED;
+        if (sched->on_done && sched->on_done(job, sched->ctx) != 0) job->state = JOB_FAILED;
+
+        sched->running--;
+        sched->completed++;
+        if (job->state == JOB_DONE) {
+            for (int i = 0; i < job->dependents_count; i++) {
+                SchedJob *dep = &sched->jobs[job->dependents[i]];
+                if (--dep->pending_deps == 0 && dep->state == JOB_PENDING) {
+                    sched->ready[sched->ready_tail++] = dep->id;
+                }
+            }
+        } else {
+            sched->failed++;
+            sched->stopping = 1;
+            sched_skip_dependents(sched, id);
+        }
+        cond_broadcast(&sched->cond);
+    }
+    mutex_unlock(&sched->lock);
+}
+
+int sched_start(Scheduler *sched) {
+    sched->threads = malloc(sizeof(thread_t) * sched->nworkers);
+    sched->workers = malloc(sizeof(SchedWorker) * sched->nworkers);
+    if (!sched->threads || !sched->workers) {
+        print_error("Memory allocation error in the job scheduler");
+        return -1;
+    }
+    for (int i = 0; i < sched->nworkers; i++) {
+        sched->workers[i].sched = sched;
+        sched->workers[i].lane  = i;
+        if (thread_create(&sched->threads[i], sched_worker, &sched->workers[i]) != 0) {
+            print_error("Failed to create thread");
+            mutex_lock(&sched->lock);
+            sched->stopping = 1;
+            sched->failed++;
+            cond_broadcast(&sched->cond);
+            mutex_unlock(&sched->lock);
+            for (int j = 0; j < i; j++) thread_join(sched->threads[j]);
+            sched->started = 0;
+            return -1;
+        }
+        sched->started++;
+    }
+    return 0;
+}
+
+int sched_wait(Scheduler *sched) {
+    mutex_lock(&sched->lock);
+    sched->sealed = 1;
+    cond_broadcast(&sched->cond);
+    mutex_unlock(&sched->lock);
+
+    for (int i = 0; i < sched->started; i++) thread_join(sched->threads[i]);
+    sched->started = 0;
+    return sched->failed;
+}
+
+int sched_run(Scheduler *sched) {
+    if (sched_start(sched) != 0) return sched->failed ? sched->failed : 1;
+    return sched_wait(sched);
+}
+
+int sched_count(Scheduler *sched, JobState state) {
+    int n = 0;
+    mutex_lock(&sched->lock);
+    for (int i = 0; i < sched->njobs; i++) {
+        if (sched->jobs[i].state == state) n++;
+    }
+    mutex_unlock(&sched->lock);
+    return n;
+}
@@ -0,0 +1,65 @@
+#ifndef FORTUNA_SCHED_H
+#define FORTUNA_SCHED_H
+
+//Dependency aware job scheduler. Jobs are shell commands with a list of jobs
+//that must succeed before they can start. A fixed pool of worker threads pulls
+//ready jobs off a FIFO queue, so at most nworkers processes run at once and a
+//job never starts before the jobs it depends on (e.g. the module it uses).
+//After the first failure no new jobs are started; running ones finish.
+
+typedef enum {
+    JOB_PENDING = 0,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED,
+    JOB_SKIPPED
+} JobState;
+
+typedef struct SchedJob {
+    int       id;
+    char     *cmd;
+    void     *user;          // caller data, untouched by the scheduler
+    JobState  state;
+    int       exit_code;
+    int       worker;        // lane the job ran on, -1 if it never ran
+    int       pending_deps;
+    int      *dependents;
+    int       dependents_count;
+    int       dependents_capacity;
+} SchedJob;
+
+typedef struct Scheduler Scheduler;
+
+//Called once per finished job with the scheduler lock held and before any
+//dependent is released. Returning nonzero turns a success into a failure.
+typedef int (*sched_done_fn)(SchedJob *job, void *ctx);
+
+//Runs a job on a worker without the lock held, in place of printing and
+//launching its command. job is a snapshot, only cmd, user and worker (the
+//lane it runs on) are meaningful.
+//Returns the exit code.
+typedef int (*sched_exec_fn)(const SchedJob *job, void *ctx);
+
+Scheduler *sched_create(int nworkers, sched_done_fn on_done, void *ctx);
+void       sched_free(Scheduler *sched);
+
+//Replace the default of printing and launching job commands. Set before sched_start.
+void       sched_set_exec(Scheduler *sched, sched_exec_fn exec);
+
+//Add a job. Dependencies are ids returned by earlier calls. Jobs may be
+//added before or after sched_start. Returns the job id or -1.
+int  sched_add_job(Scheduler *sched, const char *cmd, const int *deps, int ndeps, void *user);
+
+//Start the workers, declare that no more jobs will come, and wait for
+//everything to finish. Returns the number of failed jobs.
+int  sched_start(Scheduler *sched);
+int  sched_wait(Scheduler *sched);
+int  sched_run(Scheduler *sched);
+
+//Number of jobs in each state after sched_wait.
+int  sched_count(Scheduler *sched, JobState state);
+
+//Number of logical CPUs, at least 1.
+int  cpu_count(void);
+
+#endif // FORTUNA_SCHED_H
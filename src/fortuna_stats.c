@@ -0,0 +1,142 @@
+#include "fortuna_stats.h"
+#include "fortuna_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#define stats_atomic_add(p, n) InterlockedExchangeAdd64((volatile LONG64 *)(p), (LONG64)(n))
+#else
+#include <sys/resource.h>
+#define stats_atomic_add(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#endif
+
+#define STATS_MAX_PHASES 16
+
+typedef enum { UNIT_COUNT, UNIT_BYTES, UNIT_US } StatUnit;
+
+//Name in the table and in the JSON, per counter.
+static const struct {
+    const char *name;
+    const char *key;
+    StatUnit    unit;
+} counter_info[STAT_COUNT] = {
+    { "files stat'd",        "files_stated",       UNIT_COUNT },
+    { "files hashed",        "files_hashed",       UNIT_COUNT },
+    { "bytes hashed",        "bytes_hashed",       UNIT_BYTES },
+    { "scanner runs",        "scanner_runs",       UNIT_COUNT },
+    { "time in the scanner", "scanner_seconds",    UNIT_US    },
+    { "processes started",   "processes",          UNIT_COUNT },
+    { "compile jobs",        "compile_seconds",    UNIT_US    },
+    { "link jobs",           "link_seconds",       UNIT_US    },
+    { "build cache hits",    "cache_hits",         UNIT_COUNT },
+    { "build cache misses",  "cache_misses",       UNIT_COUNT },
+    { "build cache stores",  "cache_stores",       UNIT_COUNT },
+    { "remote cache hits",   "remote_cache_hits",  UNIT_COUNT },
+};
+
+static long long counters[STAT_COUNT];
+static struct {
+    const char *name;   // a string literal of the caller
+    double      seconds;
+} phases[STATS_MAX_PHASES];
+static int nphases;
+
+void stats_reset(void) {
+    memset(counters, 0, sizeof(counters));
+    nphases = 0;
+}
+
+void stats_count(StatCounter counter, long long n) {
+    stats_atomic_add(&counters[counter], n);
+}
+
+void stats_phase(const char *name, double seconds) {
+    int i = 0;
+    while (i < nphases && strcmp(phases[i].name, name) != 0) i++;
+    if (i == nphases) {
+        if (nphases == STATS_MAX_PHASES) return;
+        phases[nphases].name    = name;
+        phases[nphases].seconds = 0.0;
+        nphases++;
+    }
+    phases[i].seconds += seconds;
+}
+
+//Peak resident set of fortuna itself, in kB.
+static long self_peak_rss_kb(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS mem;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem))) return 0;
+    return (long)(mem.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (long)(usage.ru_maxrss / 1024);
+#else
+    return (long)usage.ru_maxrss;
+#endif
+#endif
+}
+
+void stats_print(void) {
+    double total = 0.0;
+    for (int i = 0; i < nphases; i++) total += phases[i].seconds;
+
+    printf("%-28s %12s %7s\n", "phase", "ms", "%");
+    for (int i = 0; i < nphases; i++) {
+        printf("%-28s %12.2f %7.1f\n", phases[i].name, phases[i].seconds * 1e3,
+               total > 0.0 ? 100.0 * phases[i].seconds / total : 0.0);
+    }
+    printf("%-28s %12.2f\n\n", "total", total * 1e3);
+
+    printf("%-28s %12s\n", "counter", "value");
+    for (int c = 0; c < STAT_COUNT; c++) {
+        char value[64];
+        if (counter_info[c].unit == UNIT_US)         snprintf(value, sizeof(value), "%.2f ms", (double)counters[c] * 1e-3);
+        else if (counter_info[c].unit == UNIT_BYTES) snprintf(value, sizeof(value), "%.1f kB", (double)counters[c] / 1024.0);
+        else                                         snprintf(value, sizeof(value), "%lld", counters[c]);
+        printf("%-28s %12s\n", counter_info[c].name, value);
+    }
+    printf("%-28s %9ld kB\n", "fortuna peak RSS", self_peak_rss_kb());
+
+    long long lookups = counters[STAT_CACHE_HITS] + counters[STAT_CACHE_MISSES];
+    if (lookups > 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Build cache: %.1f%% hit rate", 100.0 * counters[STAT_CACHE_HITS] / lookups);
+        print_info(msg);
+    }
+}
+
+int stats_write_json(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        char msg[1200];
+        snprintf(msg, sizeof(msg), "Failed to write the build stats %s", path);
+        print_error(msg);
+        return -1;
+    }
+
+    //Phase names are fortuna's own, nothing to escape.
+    fprintf(f, "{\n  \"phases\": [\n");
+    for (int i = 0; i < nphases; i++) {
+        fprintf(f, "    {\"name\": \"%s\", \"seconds\": %.6f}%s\n", phases[i].name, phases[i].seconds,
+                i + 1 < nphases ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"counters\": {\n");
+    for (int c = 0; c < STAT_COUNT; c++) {
+        if (counter_info[c].unit == UNIT_US) fprintf(f, "    \"%s\": %.6f,\n", counter_info[c].key, (double)counters[c] * 1e-6);
+        else                                 fprintf(f, "    \"%s\": %lld,\n", counter_info[c].key, counters[c]);
+    }
+    fprintf(f, "    \"peak_rss_kb\": %ld\n  }\n}\n", self_peak_rss_kb());
+    fclose(f);
+
+    char msg[1200];
+    snprintf(msg, sizeof(msg), "Wrote the build stats to %s", path);
+    print_info(msg);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef FORTUNA_STATS_H
+#define FORTUNA_STATS_H
+
+//Where the time of a build goes inside fortuna itself, for fortuna build
+//--stats. The phases of the build are timed on the thread that runs it, and
+//the counters below are bumped from anywhere, the scheduler lanes included.
+//With a slow build that does nothing, the phases say whether it is fortuna's
+//own work (parsing, hashing, marking) or the filesystem and the scanner.
+//
+//--stats prints them after the build, --stats=json writes them to
+//.cache/stats.json instead.
+
+#define STATS_FILE ".cache/stats.json"
+
+//What fortuna_build_opts_t stats asks for.
+enum { STATS_OFF = 0, STATS_TEXT, STATS_JSON };
+
+typedef enum {
+    STAT_FILES_STATED,   // existence checks of sources, objects, modules and targets
+    STAT_FILES_HASHED,   // sources hashed for the incremental build and cache keys
+    STAT_BYTES_HASHED,
+    STAT_SCANS,          // runs of the dependency scanner
+    STAT_SCAN_US,        // time in the scanner, part of the scan phase
+    STAT_PROCESSES,      // compilers, linkers, ar and scanners started
+    STAT_COMPILE_US,     // compile jobs, summed over the lanes
+    STAT_LINK_US,        // link jobs, summed over the lanes
+    STAT_CACHE_HITS,
+    STAT_CACHE_MISSES,
+    STAT_CACHE_STORES,
+    STAT_REMOTE_HITS,
+    STAT_COUNT
+} StatCounter;
+
+//Start over, at the beginning of a build.
+void stats_reset(void);
+
+void stats_count(StatCounter counter, long long n);
+
+//Add seconds to a phase. Phases keep the order they first came in, and one that
+//comes again (the next object pool) adds up.
+void stats_phase(const char *name, double seconds);
+
+void stats_print(void);
+
+//Returns 0, or -1 when the file can't be written.
+int  stats_write_json(const char *path);
+
+#endif // FORTUNA_STATS_H
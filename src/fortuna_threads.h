@@ -5,16 +5,31 @@
 #ifdef _WIN32
 #include <windows.h>
 typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
 #else
 #include <pthread.h>
 typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
 #endif
 
 typedef void (*thread_func_t)(void *);
 
 // Cross-platform thread start wrapper declaration
-static int thread_create(thread_t *thread, thread_func_t func, void *arg);
-static int thread_join(thread_t thread);
+static inline int thread_create(thread_t *thread, thread_func_t func, void *arg);
+static inline int thread_join(thread_t thread);
+static inline void thread_detach(thread_t thread);
+
+// Cross-platform mutex and condition variable wrappers
+static inline void mutex_init(mutex_t *m);
+static inline void mutex_destroy(mutex_t *m);
+static inline void mutex_lock(mutex_t *m);
+static inline void mutex_unlock(mutex_t *m);
+static inline void cond_init(cond_t *c);
+static inline void cond_destroy(cond_t *c);
+static inline void cond_wait(cond_t *c, mutex_t *m);
+static inline void cond_broadcast(cond_t *c);
 
 #ifdef _WIN32
 
@@ -23,14 +38,14 @@ typedef struct {
     void *arg;
 } thread_start_t;
 
-static DWORD WINAPI thread_start(LPVOID param) {
+static inline DWORD WINAPI thread_start(LPVOID param) {
     thread_start_t *start = (thread_start_t *)param;
     start->func(start->arg);
     free(start);
     return 0;
 }
 
-static int thread_create(thread_t *thread, thread_func_t func, void *arg) {
+static inline int thread_create(thread_t *thread, thread_func_t func, void *arg) {
     thread_start_t *start = (thread_start_t*)malloc(sizeof(thread_start_t));
     if (!start) {
         fprintf(stderr, "Failed to allocate memory for thread start data\n");
@@ -49,15 +64,27 @@ static int thread_create(thread_t *thread, thread_func_t func, void *arg) {
     return 0;
 }
 
-static int thread_join(thread_t thread) {
+static inline int thread_join(thread_t thread) {
     WaitForSingleObject(thread, INFINITE);
     CloseHandle(thread);
     return 0;
 }
 
+static inline void thread_detach(thread_t thread) { CloseHandle(thread); }
+
+static inline void mutex_init(mutex_t *m)    { InitializeCriticalSection(m); }
+static inline void mutex_destroy(mutex_t *m) { DeleteCriticalSection(m); }
+static inline void mutex_lock(mutex_t *m)    { EnterCriticalSection(m); }
+static inline void mutex_unlock(mutex_t *m)  { LeaveCriticalSection(m); }
+
+static inline void cond_init(cond_t *c)      { InitializeConditionVariable(c); }
+static inline void cond_destroy(cond_t *c)   { (void)c; }
+static inline void cond_wait(cond_t *c, mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static inline void cond_broadcast(cond_t *c) { WakeAllConditionVariable(c); }
+
 #else // POSIX pthreads
 
-static void *thread_start(void *arg) {
+static inline void *thread_start(void *arg) {
     void **data = (void **)arg;
     thread_func_t func = (thread_func_t)data[0];
     void *func_arg = data[1];
@@ -66,7 +93,7 @@ static void *thread_start(void *arg) {
     return NULL;
 }
 
-static int thread_create(thread_t *thread, thread_func_t func, void *arg) {
+static inline int thread_create(thread_t *thread, thread_func_t func, void *arg) {
     void **data = malloc(2 * sizeof(void *));
     if (!data) {
         fprintf(stderr, "Failed to allocate memory for thread start data\n");
@@ -85,8 +112,20 @@ static int thread_create(thread_t *thread, thread_func_t func, void *arg) {
     return 0;
 }
 
-static int thread_join(thread_t thread) {
+static inline int thread_join(thread_t thread) {
     return pthread_join(thread, NULL);
 }
 
+static inline void thread_detach(thread_t thread) { pthread_detach(thread); }
+
+static inline void mutex_init(mutex_t *m)    { pthread_mutex_init(m, NULL); }
+static inline void mutex_destroy(mutex_t *m) { pthread_mutex_destroy(m); }
+static inline void mutex_lock(mutex_t *m)    { pthread_mutex_lock(m); }
+static inline void mutex_unlock(mutex_t *m)  { pthread_mutex_unlock(m); }
+
+static inline void cond_init(cond_t *c)      { pthread_cond_init(c, NULL); }
+static inline void cond_destroy(cond_t *c)   { pthread_cond_destroy(c); }
+static inline void cond_wait(cond_t *c, mutex_t *m) { pthread_cond_wait(c, m); }
+static inline void cond_broadcast(cond_t *c) { pthread_cond_broadcast(c); }
+
 #endif
@@ -71,6 +71,25 @@ static toml_table_t* fortuna_toml_traverse_table(toml_table_t *table, const char
     return cur;
 }
 
+// Copy of a toml array of strings, NULL-terminated.
+static char **string_list(toml_array_t *arr) {
+    int n = toml_array_nelem(arr);
+    char **result = malloc((n + 1) * sizeof(char *));
+    if (!result) return NULL;
+
+    for (int i = 0; i < n; i++) {
+        toml_datum_t val = toml_string_at(arr, i);
+        if (!val.ok) {
+            for (int j = 0; j < i; j++) free(result[j]);
+            free(result);
+            return NULL;
+        }
+        result[i] = val.u.s;
+    }
+    result[n] = NULL;
+    return result;
+}
+
 // Get string array from key path like "search.shallow"
 char **fortuna_toml_get_array(fortuna_toml_t *cfg, const char *key_path) {
     if (!cfg || !cfg->table || !key_path) return NULL;
@@ -87,22 +106,31 @@ char **fortuna_toml_get_array(fortuna_toml_t *cfg, const char *key_path) {
 
     toml_array_t *arr = toml_array_in(tbl, array_key);
     if (!arr) return NULL;
+    return string_list(arr);
+}
 
-    int n = toml_array_nelem(arr);
-    char **result = malloc((n + 1) * sizeof(char *));
-    if (!result) return NULL;
+// Number of tables in an array of tables like [[override]]
+int fortuna_toml_get_table_count(fortuna_toml_t *cfg, const char *key_path) {
+    if (!cfg || !cfg->table || !key_path) return 0;
 
-    for (int i = 0; i < n; i++) {
-        toml_datum_t val = toml_string_at(arr, i);
-        if (!val.ok) {
-            for (int j = 0; j < i; j++) free(result[j]);
-            free(result);
-            return NULL;
-        }
-        result[i] = strdup(val.u.s);
-    }
-    result[n] = NULL;
-    return result;
+    const char *last_dot = strrchr(key_path, '.');
+    toml_table_t *tbl = fortuna_toml_traverse_table(cfg->table, key_path);
+    toml_array_t *arr = tbl ? toml_array_in(tbl, last_dot ? last_dot + 1 : key_path) : NULL;
+    if (!arr || toml_array_kind(arr) != 't') return 0;
+    return toml_array_nelem(arr);
+}
+
+// Get string array key of the index-th table of an array of tables
+char **fortuna_toml_get_table_array(fortuna_toml_t *cfg, const char *key_path, int index, const char *key) {
+    if (!cfg || !cfg->table || !key_path || !key) return NULL;
+
+    const char *last_dot = strrchr(key_path, '.');
+    toml_table_t *tbl = fortuna_toml_traverse_table(cfg->table, key_path);
+    toml_array_t *arr = tbl ? toml_array_in(tbl, last_dot ? last_dot + 1 : key_path) : NULL;
+    toml_table_t *item = arr ? toml_table_at(arr, index) : NULL;
+    toml_array_t *values = item ? toml_array_in(item, key) : NULL;
+    if (!values) return NULL;
+    return string_list(values);
 }
 
 // Get string value from key path like "build.target"
@@ -124,12 +152,75 @@ const char *fortuna_toml_get_string(fortuna_toml_t *cfg, const char *key_path) {
     return NULL;
 }
 
+// Get boolean value from key path like "cache.local"
+int fortuna_toml_get_bool(fortuna_toml_t *cfg, const char *key_path, int fallback) {
+    if (!cfg || !cfg->table || !key_path) return fallback;
+
+    char key_copy[256];
+    strncpy(key_copy, key_path, sizeof(key_copy));
+    key_copy[sizeof(key_copy)-1] = '\0';
+
+    char *last_dot = strrchr(key_copy, '.');
+    const char *key_name = last_dot ? last_dot + 1 : key_copy;
+
+    toml_table_t *tbl = fortuna_toml_traverse_table(cfg->table, key_path);
+    if (!tbl) return fallback;
+
+    toml_datum_t val = toml_bool_in(tbl, key_name);
+    if (val.ok) return val.u.b;
+    return fallback;
+}
+
+// Get integer value from key path like "build.batch"
+long long fortuna_toml_get_int(fortuna_toml_t *cfg, const char *key_path, long long fallback) {
+    if (!cfg || !cfg->table || !key_path) return fallback;
+
+    char key_copy[256];
+    strncpy(key_copy, key_path, sizeof(key_copy));
+    key_copy[sizeof(key_copy)-1] = '\0';
+
+    char *last_dot = strrchr(key_copy, '.');
+    const char *key_name = last_dot ? last_dot + 1 : key_copy;
+
+    toml_table_t *tbl = fortuna_toml_traverse_table(cfg->table, key_path);
+    if (!tbl) return fallback;
+
+    toml_datum_t val = toml_int_in(tbl, key_name);
+    if (val.ok) return val.u.i;
+    return fallback;
+}
+
+//Integers count as well, "threshold = 1" is a number like any other.
+double fortuna_toml_get_double(fortuna_toml_t *cfg, const char *key_path, double fallback) {
+    if (!cfg || !cfg->table || !key_path) return fallback;
+
+    char key_copy[256];
+    strncpy(key_copy, key_path, sizeof(key_copy));
+    key_copy[sizeof(key_copy)-1] = '\0';
+
+    char *last_dot = strrchr(key_copy, '.');
+    const char *key_name = last_dot ? last_dot + 1 : key_copy;
+
+    toml_table_t *tbl = fortuna_toml_traverse_table(cfg->table, key_path);
+    if (!tbl) return fallback;
+
+    toml_datum_t val = toml_double_in(tbl, key_name);
+    if (val.ok) return val.u.d;
+    val = toml_int_in(tbl, key_name);
+    if (val.ok) return (double)val.u.i;
+    return fallback;
+}
+
 // Returns list of keys under table_path (e.g. keys under "bin")
 char **fortuna_toml_get_table_keys_list(fortuna_toml_t *cfg, const char *table_path) {
-    toml_table_t *tab = toml_table_in(cfg->table, table_path);
+    //Dotted paths ("link.group") name a subtable.
+    const char *last    = strrchr(table_path, '.');
+    toml_table_t *outer = fortuna_toml_traverse_table(cfg->table, table_path);
+    toml_table_t *tab   = outer ? toml_table_in(outer, last ? last + 1 : table_path) : NULL;
     if (!tab) return NULL;
 
-    int n = toml_table_nkval(tab);
+    //Values, arrays and subtables ([bin.<name>]) alike.
+    int n = toml_table_nkval(tab) + toml_table_narr(tab) + toml_table_ntab(tab);
     if (n == 0) return NULL;
 
     char **keys = calloc(n + 1, sizeof(char *));
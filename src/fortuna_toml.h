@@ -14,9 +14,24 @@ void fortuna_toml_free(fortuna_toml_t *cfg);
 //Returns a NULL-terminated array of strings (caller must free all)
 char **fortuna_toml_get_array(fortuna_toml_t *cfg, const char *key_path);
 
+//Number of tables in the array of tables ([[name]]) at key_path, 0 if none
+int fortuna_toml_get_table_count(fortuna_toml_t *cfg, const char *key_path);
+
+//Returns the array of strings key of the index-th table at key_path (caller must free all)
+char **fortuna_toml_get_table_array(fortuna_toml_t *cfg, const char *key_path, int index, const char *key);
+
 //Get a string from key_path, or NULL if not found (do NOT free)
 const char *fortuna_toml_get_string(fortuna_toml_t *cfg, const char *key_path);
 
+//Get a boolean from key_path, or fallback if not found
+int fortuna_toml_get_bool(fortuna_toml_t *cfg, const char *key_path, int fallback);
+
+//Get an integer from key_path, or fallback if not found
+long long fortuna_toml_get_int(fortuna_toml_t *cfg, const char *key_path, long long fallback);
+
+//Get a number from key_path, or fallback if not found
+double fortuna_toml_get_double(fortuna_toml_t *cfg, const char *key_path, double fallback);
+
 //Get a matrix of strings from a toml file
 char ***extract_string_matrix(toml_table_t* cfg, const char* key, int* rows, int* cols);
 
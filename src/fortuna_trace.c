@@ -0,0 +1,165 @@
+#include "fortuna_trace.h"
+#include "fortuna_threads.h"
+#include "fortuna_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Row of the phases. Lane n of the scheduler is row n + 1.
+#define TRACE_PHASE_ROW 0
+
+struct Trace {
+    char   *path;
+    double  start;       // now_seconds() at trace_open, time 0 of the file
+    char  **events;      // one JSON object each, in the order they came
+    int     count;
+    int     capacity;
+    char   *named;       // per row, whether its name went out
+    int     nnamed;
+    mutex_t lock;
+};
+
+//s as the inside of a JSON string.
+static void json_escape(char *out, size_t size, const char *s) {
+    size_t n = 0;
+    for (; s && *s && n + 7 < size; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out[n++] = '\\';
+            out[n++] = (char)c;
+        } else if (c < 0x20) {
+            n += (size_t)snprintf(out + n, size - n, "\\u%04x", c);
+        } else {
+            out[n++] = (char)c;
+        }
+    }
+    out[n] = '\0';
+}
+
+//Microseconds since the start of the trace.
+static long long trace_us(const Trace *trace, double t) {
+    double us = (t - trace->start) * 1e6;
+    return us > 0.0 ? (long long)us : 0;
+}
+
+//Takes the event, called with the lock held.
+static void trace_add(Trace *trace, char *event) {
+    if (!event) return;
+    if (trace->count == trace->capacity) {
+        int cap = trace->capacity ? 2 * trace->capacity : 256;
+        char **grown = realloc(trace->events, sizeof(char *) * cap);
+        if (!grown) {
+            free(event);
+            return;
+        }
+        trace->events   = grown;
+        trace->capacity = cap;
+    }
+    trace->events[trace->count++] = event;
+}
+
+//The name of a row, the first time something lands on it.
+static void trace_name_row(Trace *trace, int row) {
+    if (row >= trace->nnamed) {
+        int n = row + 16;
+        char *grown = realloc(trace->named, n);
+        if (!grown) return;
+        memset(grown + trace->nnamed, 0, n - trace->nnamed);
+        trace->named  = grown;
+        trace->nnamed = n;
+    }
+    if (trace->named[row]) return;
+    trace->named[row] = 1;
+
+    char name[64], *event = malloc(160);
+    if (row == TRACE_PHASE_ROW) snprintf(name, sizeof(name), "build");
+    else                        snprintf(name, sizeof(name), "lane %d", row - 1);
+    if (event) {
+        snprintf(event, 160, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                 row, name);
+    }
+    trace_add(trace, event);
+}
+
+Trace *trace_open(const char *path) {
+    Trace *trace = calloc(1, sizeof(Trace));
+    if (!trace) return NULL;
+    trace->path  = strdup(path);
+    trace->start = now_seconds();
+    if (!trace->path) {
+        free(trace);
+        return NULL;
+    }
+    mutex_init(&trace->lock);
+
+    char *event = malloc(128);
+    if (event) snprintf(event, 128, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"fortuna\"}}");
+    trace_add(trace, event);
+    return trace;
+}
+
+void trace_phase(Trace *trace, const char *name, double start, double end) {
+    if (!trace) return;
+    char esc[256];
+    json_escape(esc, sizeof(esc), name);
+    char *event = malloc(512);
+    if (event) {
+        snprintf(event, 512, "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                 esc, TRACE_PHASE_ROW, trace_us(trace, start), trace_us(trace, end) - trace_us(trace, start));
+    }
+    mutex_lock(&trace->lock);
+    trace_name_row(trace, TRACE_PHASE_ROW);
+    trace_add(trace, event);
+    mutex_unlock(&trace->lock);
+}
+
+void trace_job(Trace *trace, int lane, const TraceJob *job, double start, double end) {
+    if (!trace) return;
+    char name[1100], file[4200], worker[300];
+    json_escape(name, sizeof(name), job->name);
+    json_escape(file, sizeof(file), job->file);
+    json_escape(worker, sizeof(worker), job->worker);
+
+    size_t size = strlen(name) + strlen(file) + strlen(worker) + 512;
+    char *event = malloc(size);
+    if (event) {
+        int n = snprintf(event, size,
+                         "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,"
+                         "\"args\":{\"file\":\"%s\",\"exit_code\":%d,\"peak_rss_kb\":%ld,\"cpu_ms\":%.1f,\"cached\":%d",
+                         name, job->kind, lane + 1, trace_us(trace, start), trace_us(trace, end) - trace_us(trace, start),
+                         file, job->exit_code, job->peak_rss_kb, job->cpu_seconds * 1e3, job->cached);
+        if (job->worker) n += snprintf(event + n, size - n, ",\"worker\":\"%s\"", worker);
+        snprintf(event + n, size - n, "}}");
+    }
+    mutex_lock(&trace->lock);
+    trace_name_row(trace, lane + 1);
+    trace_add(trace, event);
+    mutex_unlock(&trace->lock);
+}
+
+int trace_close(Trace *trace) {
+    if (!trace) return 0;
+    int ret = 0;
+    FILE *f = fopen(trace->path, "w");
+    if (f) {
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (int i = 0; i < trace->count; i++) fprintf(f, "%s%s\n", trace->events[i], i + 1 < trace->count ? "," : "");
+        fprintf(f, "]}\n");
+        if (fclose(f) != 0) ret = -1;
+    } else {
+        ret = -1;
+    }
+    char msg[1200];
+    snprintf(msg, sizeof(msg), ret == 0 ? "Wrote the build trace to %s" : "Failed to write the trace %s", trace->path);
+    if (ret == 0) print_info(msg);
+    else          print_error(msg);
+
+    for (int i = 0; i < trace->count; i++) free(trace->events[i]);
+    free(trace->events);
+    free(trace->named);
+    free(trace->path);
+    mutex_destroy(&trace->lock);
+    free(trace);
+    return ret;
+}
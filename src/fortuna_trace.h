@@ -0,0 +1,36 @@
+#ifndef FORTUNA_TRACE_H
+#define FORTUNA_TRACE_H
+
+//Timeline of a build, for fortuna build --trace=<file>. The file is in the
+//trace event format of Chrome (chrome://tracing) and Perfetto (ui.perfetto.dev).
+//The phases of the build (config, scan, hash, plan, run, archive) are spans on
+//the first row, and every scheduler job is a span on the row of the lane that
+//ran it: a compile, a batch, an interface pass or a link. Idle lanes, a module
+//chain compiling one file at a time and the slow files all show up at a glance.
+//
+//Spans may come from any thread. Times are now_seconds() values.
+
+typedef struct Trace Trace;
+
+//The args of a job span.
+typedef struct TraceJob {
+    const char *name;        // what the row shows: the source, or the target of a link
+    const char *kind;        // compile, batch, interface or link
+    const char *file;        // every file of the job
+    int         exit_code;
+    double      cpu_seconds; // 0 when nothing ran here (cache, remote worker)
+    long        peak_rss_kb;
+    int         cached;      // files of the job restored from the build cache
+    const char *worker;      // remote worker that ran it, NULL for a local lane
+} TraceJob;
+
+//Start a trace, written to path by trace_close. NULL when out of memory.
+Trace *trace_open(const char *path);
+
+//Write the trace and free it. Returns 0, or -1 when the file can't be written.
+int    trace_close(Trace *trace);
+
+void   trace_phase(Trace *trace, const char *name, double start, double end);
+void   trace_job(Trace *trace, int lane, const TraceJob *job, double start, double end);
+
+#endif // FORTUNA_TRACE_H
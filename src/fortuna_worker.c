@@ -0,0 +1,726 @@
+//Winsock has to come before windows.h
+#include "fortuna_net.h"
+#include "fortuna_worker.h"
+#include "fortuna_build.h"
+#include "fortuna_threads.h"
+#include "fortuna_helper_fn.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#define popen _popen
+#define pclose _pclose
+#define PATH_SEP '\\'
+#define worker_getpid() _getpid()
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#define PATH_SEP '/'
+#define worker_getpid() getpid()
+#endif
+
+#define WORKER_PATH_LEN 1024
+
+//Largest single file either side accepts.
+#define WORKER_MAX_FILE (512LL * 1024 * 1024)
+
+//How long a client waits for a worker to finish a compile, in seconds.
+#define WORKER_JOB_TIMEOUT 900
+
+//=============================================================================
+// Records
+//=============================================================================
+typedef struct RecordStream {
+    net_socket_t sock;
+    char         buf[16384];
+    size_t       pos;
+    size_t       len;
+} RecordStream;
+
+static void stream_init(RecordStream *rs, net_socket_t sock) {
+    rs->sock = sock;
+    rs->pos  = 0;
+    rs->len  = 0;
+}
+
+static int stream_fill(RecordStream *rs) {
+    if (rs->pos < rs->len) return 0;
+    int n = net_recv(rs->sock, rs->buf, sizeof(rs->buf));
+    if (n <= 0) return -1;
+    rs->pos = 0;
+    rs->len = (size_t)n;
+    return 0;
+}
+
+//Read the next "<tag> <size> <name>" header. The name is optional.
+static int read_header(RecordStream *rs, char *tag, size_t tag_size, long long *size, char *name, size_t name_size) {
+    char line[WORKER_PATH_LEN + 64];
+    size_t used = 0;
+    for (;;) {
+        if (stream_fill(rs) != 0) return -1;
+        char c = rs->buf[rs->pos++];
+        if (c == '\n') break;
+        if (used + 1 >= sizeof(line)) return -1;
+        line[used++] = c;
+    }
+    line[used] = '\0';
+
+    char *sp1 = strchr(line, ' ');
+    if (!sp1) return -1;
+    *sp1 = '\0';
+    if ((size_t)snprintf(tag, tag_size, "%s", line) >= tag_size) return -1;
+
+    char *end = NULL;
+    *size = strtoll(sp1 + 1, &end, 10);
+    if (end == sp1 + 1 || *size < 0 || *size > WORKER_MAX_FILE) return -1;
+    snprintf(name, name_size, "%s", (*end == ' ') ? end + 1 : "");
+    return 0;
+}
+
+//Copy size payload bytes to out (NULL skips them).
+static int read_payload(RecordStream *rs, FILE *out, long long size) {
+    while (size > 0) {
+        if (stream_fill(rs) != 0) return -1;
+        size_t take = rs->len - rs->pos;
+        if ((long long)take > size) take = (size_t)size;
+        if (out && fwrite(rs->buf + rs->pos, 1, take, out) != take) return -1;
+        rs->pos += take;
+        size    -= (long long)take;
+    }
+    return 0;
+}
+
+//Read a small payload into a new string.
+static char *read_payload_string(RecordStream *rs, long long size) {
+    if (size > 1024 * 1024) return NULL;
+    char *s = malloc((size_t)size + 1);
+    if (!s) return NULL;
+    for (long long i = 0; i < size; i++) {
+        if (stream_fill(rs) != 0) {
+            free(s);
+            return NULL;
+        }
+        s[i] = rs->buf[rs->pos++];
+    }
+    s[size] = '\0';
+    return s;
+}
+
+static int send_record(net_socket_t sock, const char *tag, const char *name, const void *data, long long size) {
+    char head[WORKER_PATH_LEN + 64];
+    int n = snprintf(head, sizeof(head), "%s %lld %s\n", tag, size, name ? name : "");
+    if (n <= 0 || n >= (int)sizeof(head)) return -1;
+    if (net_send_all(sock, head, (size_t)n) != 0) return -1;
+    return size > 0 ? net_send_all(sock, data, (size_t)size) : 0;
+}
+
+static int send_record_file(net_socket_t sock, const char *tag, const char *name, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || (long long)st.st_size > WORKER_MAX_FILE) return -1;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+
+    char head[WORKER_PATH_LEN + 64];
+    int n = snprintf(head, sizeof(head), "%s %lld %s\n", tag, (long long)st.st_size, name);
+    int ok = n > 0 && n < (int)sizeof(head) && net_send_all(sock, head, (size_t)n) == 0;
+
+    char chunk[16384];
+    long long left = (long long)st.st_size;
+    while (ok && left > 0) {
+        size_t got = fread(chunk, 1, sizeof(chunk), fp);
+        if (got == 0) ok = 0;
+        else ok = net_send_all(sock, chunk, got) == 0;
+        left -= (long long)got;
+    }
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+//Receive a payload into path through a temporary file.
+static int receive_file(RecordStream *rs, const char *path, long long size) {
+    char tmp[WORKER_PATH_LEN + 32];
+    snprintf(tmp, sizeof(tmp), "%s.recv.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        read_payload(rs, NULL, size);
+        return -1;
+    }
+    int ok = read_payload(rs, fp, size) == 0;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || replace_file(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+//First line of "<compiler> --version", which is what decides whether a worker
+//produces the same objects. Only plain compiler names are run.
+static int compiler_version(const char *compiler, char *out, size_t size) {
+    out[0] = '\0';
+    for (const char *p = compiler; *p; p++) {
+        if (!isalnum((unsigned char)*p) && !strchr("._+-/\\:", *p)) return -1;
+    }
+    char cmd[WORKER_PATH_LEN];
+    snprintf(cmd, sizeof(cmd), "%s --version", compiler);
+    FILE *pipe = popen(cmd, "r");
+    if (!pipe) return -1;
+    if (fgets(out, (int)size, pipe)) out[strcspn(out, "\r\n")] = '\0';
+    while (fgetc(pipe) != EOF) {}
+    pclose(pipe);
+    return out[0] ? 0 : -1;
+}
+
+//=============================================================================
+// Client
+//=============================================================================
+typedef struct WorkerHost {
+    char name[300];
+    char host[256];
+    int  port;
+    int  slots;
+    int  down;
+} WorkerHost;
+
+struct WorkerPool {
+    WorkerHost *hosts;
+    int         nhosts;
+    int        *slot_host;     // slot -> index into hosts
+    int         nslots;
+    mutex_t     lock;
+};
+
+static int split_host_port(const char *spec, char *host, size_t host_size, int *port) {
+    const char *colon = strrchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+    if (len == 0 || len >= host_size) return -1;
+    memcpy(host, spec, len);
+    host[len] = '\0';
+    *port = colon ? atoi(colon + 1) : WORKER_DEFAULT_PORT;
+    return (*port > 0 && *port < 65536) ? 0 : -1;
+}
+
+//Ask a worker for its slot count and compiler version.
+static int probe_worker(WorkerHost *w, const char *compiler, char *version, size_t version_size) {
+    net_socket_t sock = net_connect(w->host, w->port);
+    if (sock == NET_INVALID_SOCKET) return -1;
+
+    int ok = send_record(sock, "info", compiler, NULL, 0) == 0 &&
+             send_record(sock, "end", NULL, NULL, 0) == 0;
+
+    RecordStream *rs = malloc(sizeof(RecordStream));
+    char tag[32], name[WORKER_PATH_LEN];
+    long long size;
+    if (!rs) ok = 0;
+    else stream_init(rs, sock);
+    version[0] = '\0';
+    while (ok) {
+        if (read_header(rs, tag, sizeof(tag), &size, name, sizeof(name)) != 0) {
+            ok = 0;
+            break;
+        }
+        if (strcmp(tag, "end") == 0) break;
+        if (strcmp(tag, "slots") == 0) {
+            w->slots = atoi(name);
+        } else if (strcmp(tag, "version") == 0) {
+            if ((size_t)snprintf(version, version_size, "%s", name) >= version_size) ok = 0;
+        }
+        if (read_payload(rs, NULL, size) != 0) ok = 0;
+    }
+    free(rs);
+    net_close(sock);
+    return ok ? 0 : -1;
+}
+
+WorkerPool *worker_pool_open(char **hosts, const char *compiler) {
+    if (!hosts || !hosts[0] || net_init() != 0) return NULL;
+
+    char local_version[512];
+    if (compiler_version(compiler, local_version, sizeof(local_version)) != 0) {
+        print_error("Could not determine the local compiler version, distributed compilation disabled");
+        return NULL;
+    }
+
+    WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+    int count = 0;
+    while (hosts[count]) count++;
+    if (!pool || !(pool->hosts = calloc(count, sizeof(WorkerHost)))) {
+        free(pool);
+        return NULL;
+    }
+
+    char msg[1200];
+    char version[512];
+    for (int i = 0; i < count; i++) {
+        WorkerHost *w = &pool->hosts[pool->nhosts];
+        snprintf(w->name, sizeof(w->name), "%s", hosts[i]);
+        if (split_host_port(hosts[i], w->host, sizeof(w->host), &w->port) != 0) {
+            snprintf(msg, sizeof(msg), "Ignoring worker \"%s\", expected host:port", hosts[i]);
+            print_error(msg);
+            continue;
+        }
+        if (probe_worker(w, compiler, version, sizeof(version)) != 0 || w->slots <= 0) {
+            snprintf(msg, sizeof(msg), "Worker %s unreachable, skipping it", w->name);
+            print_info(msg);
+            continue;
+        }
+        if (strcmp(version, local_version) != 0) {
+            snprintf(msg, sizeof(msg), "Worker %s has a different compiler (%s), skipping it", w->name, version);
+            print_info(msg);
+            continue;
+        }
+        pool->nhosts++;
+        pool->nslots += w->slots;
+    }
+
+    if (pool->nslots == 0) {
+        free(pool->hosts);
+        free(pool);
+        return NULL;
+    }
+
+    pool->slot_host = malloc(sizeof(int) * pool->nslots);
+    if (!pool->slot_host) {
+        free(pool->hosts);
+        free(pool);
+        return NULL;
+    }
+
+    //Interleave the hosts so the first lanes to pick up work spread over all of them.
+    int slot = 0;
+    for (int round = 0; slot < pool->nslots; round++) {
+        for (int h = 0; h < pool->nhosts; h++) {
+            if (round < pool->hosts[h].slots) pool->slot_host[slot++] = h;
+        }
+    }
+
+    snprintf(msg, sizeof(msg), "Distributing compiles over %d remote slots on %d workers", pool->nslots, pool->nhosts);
+    print_info(msg);
+    mutex_init(&pool->lock);
+    return pool;
+}
+
+void worker_pool_close(WorkerPool *pool) {
+    if (!pool) return;
+    mutex_destroy(&pool->lock);
+    free(pool->slot_host);
+    free(pool->hosts);
+    free(pool);
+}
+
+int worker_pool_slots(const WorkerPool *pool) {
+    return pool ? pool->nslots : 0;
+}
+
+const char *worker_pool_slot_name(const WorkerPool *pool, int slot) {
+    return pool->hosts[pool->slot_host[slot]].name;
+}
+
+static void worker_down(WorkerPool *pool, WorkerHost *w) {
+    mutex_lock(&pool->lock);
+    if (!w->down) {
+        w->down = 1;
+        char msg[512];
+        snprintf(msg, sizeof(msg), "Worker %s stopped responding, compiling its jobs locally", w->name);
+        print_info(msg);
+    }
+    mutex_unlock(&pool->lock);
+}
+
+static int send_job(net_socket_t sock, const RemoteJob *job) {
+    if (send_record(sock, "job", NULL, NULL, 0) != 0) return -1;
+    if (send_record(sock, "out", job->obj_remote, NULL, 0) != 0) return -1;
+    if (send_record(sock, "moddir", job->mod_dir, NULL, 0) != 0) return -1;
+    for (int i = 0; job->dirs && job->dirs[i]; i++) {
+        if (send_record(sock, "dir", job->dirs[i], NULL, 0) != 0) return -1;
+    }
+    for (int i = 0; job->files && job->files[i]; i++) {
+        if (send_record_file(sock, "file", job->files[i], job->files[i]) != 0) return -1;
+    }
+    if (send_record(sock, "cmd", NULL, job->cmd, (long long)strlen(job->cmd)) != 0) return -1;
+    return send_record(sock, "end", NULL, NULL, 0);
+}
+
+int worker_pool_compile(WorkerPool *pool, int slot, const RemoteJob *job, int *exit_code) {
+    if (!pool || slot < 0 || slot >= pool->nslots) return -1;
+    WorkerHost *w = &pool->hosts[pool->slot_host[slot]];
+    mutex_lock(&pool->lock);
+    int down = w->down;
+    mutex_unlock(&pool->lock);
+    if (down) return -1;
+
+    net_socket_t sock = net_connect(w->host, w->port);
+    if (sock == NET_INVALID_SOCKET) {
+        worker_down(pool, w);
+        return -1;
+    }
+
+    RecordStream *rs = malloc(sizeof(RecordStream));
+    int ok = rs && send_job(sock, job) == 0;
+    if (rs) stream_init(rs, sock);
+
+    //The reply only starts once the compile is done.
+    net_set_timeout(sock, WORKER_JOB_TIMEOUT);
+
+    char tag[32], name[WORKER_PATH_LEN], path[WORKER_PATH_LEN * 2];
+    long long size;
+    int status = -1;
+    while (ok) {
+        if (read_header(rs, tag, sizeof(tag), &size, name, sizeof(name)) != 0) {
+            ok = 0;
+            break;
+        }
+        if (strcmp(tag, "end") == 0) break;
+
+        if (strcmp(tag, "status") == 0) {
+            status = atoi(name);
+            ok = read_payload(rs, NULL, size) == 0;
+        } else if (strcmp(tag, "log") == 0) {
+            ok = read_payload(rs, stdout, size) == 0;
+            fflush(stdout);
+        } else if (strcmp(tag, "obj") == 0) {
+            ok = receive_file(rs, job->obj_out, size) == 0;
+        } else if (strcmp(tag, "mod") == 0 && !strpbrk(name, "/\\:") && strcmp(name, "..") != 0) {
+            snprintf(path, sizeof(path), "%s%c%s", job->mod_dir, PATH_SEP, name);
+            ok = receive_file(rs, path, size) == 0;
+        } else {
+            ok = read_payload(rs, NULL, size) == 0;
+        }
+    }
+    free(rs);
+    net_close(sock);
+
+    if (!ok || status < 0) {
+        worker_down(pool, w);
+        return -1;
+    }
+    *exit_code = status;
+    return 0;
+}
+
+//=============================================================================
+// Worker daemon
+//=============================================================================
+typedef struct WorkerServer {
+    int      slots;
+    int      busy;
+    int      latency_ms;
+    unsigned counter;
+    char     scratch[WORKER_PATH_LEN];
+    mutex_t  lock;
+    cond_t   cond;
+} WorkerServer;
+
+typedef struct WorkerConnection {
+    WorkerServer *server;
+    net_socket_t  sock;
+} WorkerConnection;
+
+//Paths come from the network, so only plain relative ones are accepted.
+static int is_safe_relative(const char *path) {
+    if (!*path || path[0] == '/' || path[0] == '\\' || strchr(path, ':')) return 0;
+    const char *p = path;
+    while (*p) {
+        size_t len = strcspn(p, "/\\");
+        if (len == 2 && p[0] == '.' && p[1] == '.') return 0;
+        p += len;
+        if (*p) p++;
+    }
+    return 1;
+}
+
+static void parent_of(const char *path, char *out, size_t size) {
+    snprintf(out, size, "%s", path);
+    char *a = strrchr(out, '/');
+    char *b = strrchr(out, '\\');
+    char *sep = a > b ? a : b;
+    if (sep) *sep = '\0';
+    else out[0] = '\0';
+}
+
+static void slot_acquire(WorkerServer *server) {
+    mutex_lock(&server->lock);
+    while (server->busy >= server->slots) cond_wait(&server->cond, &server->lock);
+    server->busy++;
+    mutex_unlock(&server->lock);
+}
+
+static void slot_release(WorkerServer *server) {
+    mutex_lock(&server->lock);
+    server->busy--;
+    cond_broadcast(&server->cond);
+    mutex_unlock(&server->lock);
+}
+
+//Run cmd inside dir and collect everything it prints. Returns the exit code.
+static int run_in_dir(const char *dir, const char *cmd, char **log, size_t *log_len) {
+    size_t len = strlen(dir) + strlen(cmd) + 64;
+    char *full = malloc(len);
+    if (!full) return -1;
+#ifdef _WIN32
+    snprintf(full, len, "cd /d \"%s\" && %s 2>&1", dir, cmd);
+#else
+    snprintf(full, len, "cd '%s' && %s 2>&1", dir, cmd);
+#endif
+
+    *log = NULL;
+    *log_len = 0;
+    FILE *pipe = popen(full, "r");
+    free(full);
+    if (!pipe) return -1;
+
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), pipe)) > 0) {
+        char *tmp = realloc(*log, *log_len + n);
+        if (!tmp) break;
+        *log = tmp;
+        memcpy(*log + *log_len, chunk, n);
+        *log_len += n;
+    }
+    int status = pclose(pipe);
+#ifdef _WIN32
+    return status;
+#else
+    return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+//Send back every module file the compile wrote, i.e. everything in the
+//module directory that was not shipped as an input.
+static void send_new_modules(net_socket_t sock, const char *mod_path, char **inputs, int ninputs) {
+    char path[WORKER_PATH_LEN * 3];
+#ifdef _WIN32
+    WIN32_FIND_DATA fd;
+    char search_path[MAX_PATH];
+    snprintf(search_path, MAX_PATH, "%s\\*", mod_path);
+    HANDLE hFind = FindFirstFile(search_path, &fd);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        const char *name = fd.cFileName;
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+#else
+    DIR *d = opendir(mod_path);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.') continue;
+#endif
+        int shipped = 0;
+        for (int i = 0; i < ninputs && !shipped; i++) shipped = strcmp(inputs[i], name) == 0;
+        if (!shipped) {
+            snprintf(path, sizeof(path), "%s%c%s", mod_path, PATH_SEP, name);
+            send_record_file(sock, "mod", name, path);
+        }
+#ifdef _WIN32
+    } while (FindNextFile(hFind, &fd));
+    FindClose(hFind);
+#else
+    }
+    closedir(d);
+#endif
+}
+
+static void handle_info(WorkerServer *server, net_socket_t sock, const char *compiler) {
+    char version[512];
+    char slots[32];
+    compiler_version(compiler, version, sizeof(version));
+    snprintf(slots, sizeof(slots), "%d", server->slots);
+    send_record(sock, "slots", slots, NULL, 0);
+    send_record(sock, "version", version, NULL, 0);
+    send_record(sock, "end", NULL, NULL, 0);
+}
+
+static void handle_job(WorkerServer *server, net_socket_t sock, RecordStream *rs) {
+    mutex_lock(&server->lock);
+    unsigned id = server->counter++;
+    mutex_unlock(&server->lock);
+
+    char sandbox[WORKER_PATH_LEN];
+    int len = snprintf(sandbox, sizeof(sandbox), "%s%cjob-%d-%u", server->scratch, PATH_SEP, (int)worker_getpid(), id);
+    if (len < 0 || (size_t)len >= sizeof(sandbox) || make_path(sandbox) != 0) return;
+
+    char tag[32], name[WORKER_PATH_LEN], path[WORKER_PATH_LEN * 2], dir[WORKER_PATH_LEN * 2];
+    char out_name[WORKER_PATH_LEN] = "";
+    char mod_dir[WORKER_PATH_LEN] = "";
+    char *cmd = NULL;
+    char **mod_inputs = NULL;
+    int nmod_inputs = 0;
+    long long size;
+    int ok = 1;
+
+    while (ok) {
+        if (read_header(rs, tag, sizeof(tag), &size, name, sizeof(name)) != 0) {
+            ok = 0;
+            break;
+        }
+        if (strcmp(tag, "end") == 0) break;
+
+        if (strcmp(tag, "dir") == 0) {
+            ok = is_safe_relative(name) && read_payload(rs, NULL, size) == 0;
+            snprintf(path, sizeof(path), "%s%c%s", sandbox, PATH_SEP, name);
+            if (ok) ok = make_path(path) == 0;
+        } else if (strcmp(tag, "file") == 0) {
+            ok = is_safe_relative(name);
+            snprintf(path, sizeof(path), "%s%c%s", sandbox, PATH_SEP, name);
+            parent_of(path, dir, sizeof(dir));
+            if (ok && dir[0]) ok = make_path(dir) == 0;
+            if (ok) ok = receive_file(rs, path, size) == 0;
+
+            //Remember shipped module files so they are not sent back.
+            size_t mod_len = strlen(mod_dir);
+            if (ok && mod_len && strncmp(name, mod_dir, mod_len) == 0 && (name[mod_len] == '/' || name[mod_len] == '\\')) {
+                char **tmp = realloc(mod_inputs, sizeof(char *) * (nmod_inputs + 1));
+                if (tmp) {
+                    mod_inputs = tmp;
+                    mod_inputs[nmod_inputs++] = strdup(name + mod_len + 1);
+                }
+            }
+        } else if (strcmp(tag, "out") == 0) {
+            ok = is_safe_relative(name) && read_payload(rs, NULL, size) == 0;
+            snprintf(out_name, sizeof(out_name), "%s", name);
+        } else if (strcmp(tag, "moddir") == 0) {
+            ok = (!name[0] || is_safe_relative(name)) && read_payload(rs, NULL, size) == 0;
+            snprintf(mod_dir, sizeof(mod_dir), "%s", name);
+        } else if (strcmp(tag, "cmd") == 0) {
+            free(cmd);
+            cmd = read_payload_string(rs, size);
+            ok = cmd != NULL;
+        } else {
+            ok = read_payload(rs, NULL, size) == 0;
+        }
+    }
+
+    if (ok && cmd && out_name[0]) {
+        sleep_ms(server->latency_ms);
+
+        slot_acquire(server);
+        char *log = NULL;
+        size_t log_len = 0;
+        int code = run_in_dir(sandbox, cmd, &log, &log_len);
+        slot_release(server);
+
+        char code_str[32];
+        snprintf(code_str, sizeof(code_str), "%d", code);
+        send_record(sock, "status", code_str, NULL, 0);
+        if (log_len) send_record(sock, "log", NULL, log, (long long)log_len);
+        free(log);
+
+        if (code == 0) {
+            snprintf(path, sizeof(path), "%s%c%s", sandbox, PATH_SEP, out_name);
+            send_record_file(sock, "obj", out_name, path);
+            if (mod_dir[0]) {
+                snprintf(path, sizeof(path), "%s%c%s", sandbox, PATH_SEP, mod_dir);
+                send_new_modules(sock, path, mod_inputs, nmod_inputs);
+            }
+        }
+        send_record(sock, "end", NULL, NULL, 0);
+
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Job %u finished with exit code %d", id, code);
+        print_info(msg);
+        fflush(stdout);
+    }
+
+    free(cmd);
+    for (int i = 0; i < nmod_inputs; i++) free(mod_inputs[i]);
+    free(mod_inputs);
+    remove_folder(sandbox);
+}
+
+static void worker_connection(void *arg) {
+    WorkerConnection *conn = (WorkerConnection *)arg;
+    WorkerServer *server = conn->server;
+    net_socket_t sock    = conn->sock;
+    free(conn);
+
+    RecordStream *rs = malloc(sizeof(RecordStream));
+    char tag[32], name[WORKER_PATH_LEN];
+    long long size;
+    if (rs) {
+        stream_init(rs, sock);
+        if (read_header(rs, tag, sizeof(tag), &size, name, sizeof(name)) == 0 &&
+            read_payload(rs, NULL, size) == 0) {
+            if (strcmp(tag, "info") == 0) handle_info(server, sock, name);
+            else if (strcmp(tag, "job") == 0) handle_job(server, sock, rs);
+        }
+        free(rs);
+    }
+    net_close(sock);
+}
+
+static void scratch_root(char *out, size_t size) {
+#ifdef _WIN32
+    char tmp[MAX_PATH];
+    DWORD n = GetTempPathA(MAX_PATH, tmp);
+    if (n == 0 || n > MAX_PATH) snprintf(tmp, sizeof(tmp), ".");
+    snprintf(out, size, "%sfortuna-worker-%d", tmp, (int)worker_getpid());
+#else
+    const char *tmp = getenv("TMPDIR");
+    snprintf(out, size, "%s/fortuna-worker-%d", (tmp && *tmp) ? tmp : "/tmp", (int)worker_getpid());
+#endif
+}
+
+int fortuna_worker_serve(int port, int slots, int latency_ms, int local_only) {
+    if (net_init() != 0) {
+        print_error("Failed to initialize sockets");
+        return -1;
+    }
+
+    WorkerServer server;
+    memset(&server, 0, sizeof(server));
+    server.slots      = slots > 0 ? slots : 1;
+    server.latency_ms = latency_ms;
+    scratch_root(server.scratch, sizeof(server.scratch));
+    if (make_path(server.scratch) != 0) {
+        print_error("Failed to create the worker scratch directory");
+        return -1;
+    }
+    mutex_init(&server.lock);
+    cond_init(&server.cond);
+
+    net_socket_t listener = net_listen(port, local_only);
+    if (listener == NET_INVALID_SOCKET) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Failed to listen on port %d", port);
+        print_error(msg);
+        return -1;
+    }
+
+    char msg[WORKER_PATH_LEN + 128];
+    snprintf(msg, sizeof(msg), "Worker listening on %s:%d with %d slots (%d ms simulated latency)",
+             local_only ? "127.0.0.1" : "0.0.0.0", port, server.slots, latency_ms);
+    print_ok(msg);
+    fflush(stdout);
+
+    for (;;) {
+        net_socket_t sock = net_accept(listener);
+        if (sock == NET_INVALID_SOCKET) continue;
+        WorkerConnection *conn = malloc(sizeof(WorkerConnection));
+        if (!conn) {
+            net_close(sock);
+            continue;
+        }
+        conn->server = &server;
+        conn->sock   = sock;
+        thread_t thread;
+        if (thread_create(&thread, worker_connection, conn) != 0) {
+            net_close(sock);
+            free(conn);
+            continue;
+        }
+        thread_detach(thread);
+    }
+
+    //Not reached, the worker runs until it is killed.
+    net_close(listener);
+    return 0;
+}
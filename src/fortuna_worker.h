@@ -0,0 +1,52 @@
+#ifndef FORTUNA_WORKER_H
+#define FORTUNA_WORKER_H
+
+//Distributed compilation. `fortuna worker` runs on a build host and executes
+//compile jobs shipped to it over TCP: the command, the source and every input
+//it reads (the .mod files of the modules it uses and any included files), all
+//at their paths relative to the project root. The job runs in a scratch
+//directory laid out like the project, and the object and any module files it
+//wrote are sent back.
+//
+//Each job is one connection carrying a stream of records, a header line
+//"<tag> <size> <name>\n" followed by size bytes:
+//
+//  client: job, out, moddir, dir*, file*, cmd, end   worker: status, log, obj, mod*, end
+//  client: info <compiler>, end                      worker: slots, version, end
+//
+//Workers are only used when they report the same compiler version as the
+//local one. Anything that fails remotely is compiled locally instead.
+
+#define WORKER_DEFAULT_PORT 9000
+
+typedef struct WorkerPool WorkerPool;
+
+typedef struct RemoteJob {
+    const char *cmd;          // compile command, relative paths only
+    const char *obj_out;      // local path for the object the command writes
+    const char *obj_remote;   // path of the object in the command
+    const char *mod_dir;      // "" when there are no module files
+    char      **dirs;         // directories the command expects to exist
+    char      **files;        // files to ship, NULL terminated, the source first
+} RemoteJob;
+
+//Probe every "host:port" and keep the ones that answer with a matching
+//compiler. Returns NULL when none are usable.
+WorkerPool *worker_pool_open(char **hosts, const char *compiler);
+void        worker_pool_close(WorkerPool *pool);
+
+//Total number of remote slots, each one an extra scheduler lane.
+int         worker_pool_slots(const WorkerPool *pool);
+
+//Name ("host:port") of the worker behind a slot.
+const char *worker_pool_slot_name(const WorkerPool *pool, int slot);
+
+//Run a job on the worker behind slot. Returns 0 and sets exit_code when the
+//job ran remotely, -1 when it could not (the caller compiles locally).
+int         worker_pool_compile(WorkerPool *pool, int slot, const RemoteJob *job, int *exit_code);
+
+//Run the worker daemon until killed. latency_ms is added to every job to
+//simulate a slow network.
+int         fortuna_worker_serve(int port, int slots, int latency_ms, int local_only);
+
+#endif // FORTUNA_WORKER_H